@@ -0,0 +1,308 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           dictperf.c
+ *  Description:    Dictionary benchmarks: write latency for sharded
+ *                  vs. unsharded dictionaries while the tables are
+ *                  growing, and miss-heavy lookups with and without
+ *                  the negative-lookup filter.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <testhat.h>
+#include <hatrack.h>
+#include <stdio.h>
+
+/* Every thread starts writing new keys into an empty dictionary at
+ * the same time, so the tables have to migrate over and over while
+ * we're measuring. We time every single put, and report the latency
+ * distribution, since the whole point of sharding is to take the
+ * edge off the writes that get stuck helping with a migration; that
+ * shows up in the tail, not in the average.
+ *
+ * The second test fills a dictionary up front, and then has every
+ * thread do lookups where most of the keys aren't there, which is
+ * the case the negative-lookup filter is for. We run it with the
+ * filter off and on, at a few different table sizes, and report
+ * throughput.
+ *
+ * Pass the number of threads on the command line, if you want
+ * something other than 64.
+ */
+
+// clang-format off
+static const uint64_t ops_per_thread  = 1 << 15;
+static const uint64_t gets_per_thread = 1 << 20;
+static const uint64_t miss_pct        = 90;
+static       gate_t  *gate;
+
+pthread_t threads[HATRACK_THREADS_MAX];
+
+static uint32_t shard_params[] = {0, 2, 4, 6, 8};
+static uint32_t size_params[]  = {12, 16, 20};
+
+typedef struct {
+    hatrack_dict_t *dict;
+    uint64_t        start_key;
+    uint64_t       *latencies;
+    uint64_t        num_keys;
+} thread_info_t;
+
+static inline uint64_t
+ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(uint64_t *)a;
+    uint64_t y = *(uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void *
+worker_thread(void *arg)
+{
+    thread_info_t *info;
+    uint64_t       i;
+    uint64_t       start;
+
+    mmm_register_thread();
+
+    info = (thread_info_t *)arg;
+
+    gate_thread_ready(gate);
+
+    for (i = 0; i < ops_per_thread; i++) {
+	start = ns_now();
+	hatrack_dict_put(info->dict, (void *)(info->start_key + i), (void *)i);
+	info->latencies[i] = ns_now() - start;
+    }
+
+    gate_thread_done(gate);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Keys 1 through num_keys are in the table. For misses, we look up
+ * keys past the end of that range. The random numbers come from a
+ * simple per-thread xorshift, so we're not measuring the RNG.
+ */
+void *
+lookup_thread(void *arg)
+{
+    thread_info_t *info;
+    uint64_t       i;
+    uint64_t       x;
+    uint64_t       key;
+    bool           found;
+
+    mmm_register_thread();
+
+    info = (thread_info_t *)arg;
+    x    = info->start_key * 0x9e3779b97f4a7c15ULL + 1;
+
+    gate_thread_ready(gate);
+
+    for (i = 0; i < gets_per_thread; i++) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	key = (x >> 8) % info->num_keys + 1;
+
+	if ((x & 0xff) % 100 < miss_pct) {
+	    key += info->num_keys;
+	}
+
+	hatrack_dict_get(info->dict, (void *)key, &found);
+    }
+
+    gate_thread_done(gate);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static double
+run_lookup_test(uint32_t size_bits, bool filter, uint64_t num_threads)
+{
+    hatrack_dict_t *dict;
+    thread_info_t  *info;
+    uint64_t        num_keys;
+    uint64_t        i;
+    double          elapsed;
+
+    num_keys = (1ULL << size_bits) / 2;
+    info     = (thread_info_t *)malloc(sizeof(thread_info_t) * num_threads);
+    dict     = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    hatrack_dict_set_miss_filter(dict, filter);
+
+    for (i = 1; i <= num_keys; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    gate_init(gate, gate->max_threads);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].dict      = dict;
+	info[i].start_key = i + 1;
+	info[i].num_keys  = num_keys;
+
+	pthread_create(&threads[i], NULL, lookup_thread, &info[i]);
+    }
+
+    gate_open(gate, num_threads);
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    elapsed = gate_close(gate);
+
+    hatrack_dict_delete(dict);
+    free(info);
+
+    return ((gets_per_thread * num_threads) / elapsed) / 1000000;
+}
+
+static void
+run_test(uint32_t shard_bits, uint64_t num_threads)
+{
+    hatrack_dict_t *dict;
+    thread_info_t  *info;
+    uint64_t       *latencies;
+    uint64_t        total;
+    uint64_t        i;
+    double          elapsed;
+
+    total     = ops_per_thread * num_threads;
+    latencies = (uint64_t *)malloc(sizeof(uint64_t) * total);
+    info      = (thread_info_t *)malloc(sizeof(thread_info_t) * num_threads);
+    dict      = hatrack_dict_new_sharded(HATRACK_DICT_KEY_TYPE_INT,
+					 shard_bits);
+
+    gate_init(gate, gate->max_threads);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].dict      = dict;
+	info[i].start_key = i * ops_per_thread + 1;
+	info[i].latencies = latencies + i * ops_per_thread;
+
+	pthread_create(&threads[i], NULL, worker_thread, &info[i]);
+    }
+
+    gate_open(gate, num_threads);
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    elapsed = gate_close(gate);
+
+    if (hatrack_dict_len(dict) != total) {
+	fprintf(stderr, "Error: expected %lu items, got %lu\n",
+		total, hatrack_dict_len(dict));
+	abort();
+    }
+
+    qsort(latencies, total, sizeof(uint64_t), latency_cmp);
+
+    printf("%-9u %-9lu %-9.3f %-9lu %-9lu %-9lu %-9lu %-9lu\n",
+	   1U << shard_bits,
+	   num_threads,
+	   (total / elapsed) / 1000000,
+	   latencies[total / 2],
+	   latencies[(total * 99) / 100],
+	   latencies[(total * 999) / 1000],
+	   latencies[(total * 9999) / 10000],
+	   latencies[total - 1]);
+
+    hatrack_dict_delete(dict);
+    free(info);
+    free(latencies);
+
+    return;
+}
+
+static const char HDR[]
+    = "Shards    Threads   MOps/sec  p50 ns    p99 ns    p99.9 ns  "
+      "p99.99 ns max ns\n";
+
+static const char LOOKUP_HDR[]
+    = "\nLookups (%lu%% misses)\n"
+      "Size      Threads   Off MOps  On MOps   Speedup\n";
+
+static const char LINE[]
+    = "------------------------------------------------------------"
+      "----------------\n";
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t num_threads;
+    uint64_t i;
+    double   off;
+    double   on;
+
+    num_threads = 64;
+
+    if (argc > 1) {
+	num_threads = strtoul(argv[1], NULL, 10);
+    }
+
+    if (!num_threads || num_threads >= HATRACK_THREADS_MAX) {
+	fprintf(stderr, "Invalid number of threads.\n");
+	return 1;
+    }
+
+    gate = gate_new();
+
+    printf(HDR);
+    printf(LINE);
+
+    for (i = 0; i < sizeof(shard_params) / sizeof(uint32_t); i++) {
+	run_test(shard_params[i], num_threads);
+    }
+
+    printf(LOOKUP_HDR, miss_pct);
+    printf(LINE);
+
+    for (i = 0; i < sizeof(size_params) / sizeof(uint32_t); i++) {
+	off = run_lookup_test(size_params[i], false, num_threads);
+	on  = run_lookup_test(size_params[i], true, num_threads);
+
+	printf("2^%-7u %-9lu %-9.3f %-9.3f %-.2fx\n",
+	       size_params[i],
+	       num_threads,
+	       off,
+	       on,
+	       on / off);
+    }
+
+    gate_delete(gate);
+
+    return 0;
+}
@@ -9,18 +9,32 @@ typedef struct {
     char     msg[112];
 } log_msg_t;
 
+/* Odd threads copy a message in; even threads write theirs straight
+ * into the ring.
+ */
 void *
 log_thread(void *item)
 {
-    log_msg_t log;
-    uint64_t  id;
+    log_msg_t  log;
+    log_msg_t *slot;
+    uint64_t   id;
 
     strcpy(log.msg, "This is a log message!");
     log.tid = (uint64_t)item;
 
     for (id = 0; id < 512; id++) {
-        log.mid = id;
-        logring_enqueue(ring, &log, sizeof(log));
+        if (log.tid & 1) {
+            log.mid = id;
+            logring_enqueue(ring, &log, sizeof(log));
+            continue;
+        }
+
+        slot      = (log_msg_t *)logring_reserve(ring, sizeof(log_msg_t));
+        slot->tid = log.tid;
+        slot->mid = id;
+
+        snprintf(slot->msg, sizeof(slot->msg), "In-place message #%lu", id);
+        logring_commit(ring, slot, sizeof(log_msg_t));
     }
 
     return NULL;
@@ -36,7 +50,15 @@ output_logs(void)
 
     view = logring_view(ring, false);
 
-    while (logring_dequeue(ring, &log, &len)) {
+    // Read half of the messages in place, and copy out the rest.
+    while ((msg = (log_msg_t *)logring_dequeue_inplace(ring, &len))) {
+        printf("tid=%lu; mid=%lu; msg=%s\n", msg->tid, msg->mid, msg->msg);
+        logring_release(ring, msg);
+
+        if (!logring_dequeue(ring, &log, &len)) {
+            break;
+        }
+
         printf("tid=%lu; mid=%lu; msg=%s\n", log.tid, log.mid, log.msg);
     }
 
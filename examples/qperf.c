@@ -81,6 +81,39 @@ q64_int_dequeue(q64_t *self, bool *found)
     return res >> 32;
 }
 
+/* skipq is a priority queue, so it takes a priority along with each
+ * item. We use the value as its own priority; with ENQUEUE_INDEX
+ * off, that's always 1, which is the worst case for contention at
+ * the front of the queue.
+ */
+skipq_t *
+skipq_new_proxy(uint64_t ignore)
+{
+    if (!(ignore ^ ignore))
+        return skipq_new();
+    return NULL;
+}
+
+skipq_t *
+skipq_relaxed_new_proxy(uint64_t ignore)
+{
+    if (!(ignore ^ ignore))
+        return skipq_new_relaxed(0);
+    return NULL;
+}
+
+void
+skipq_int_insert(skipq_t *self, uint64_t n)
+{
+    skipq_insert(self, n, (void *)n);
+}
+
+uint64_t
+skipq_int_dequeue(skipq_t *self, bool *found)
+{
+    return (uint64_t)skipq_dequeue_min(self, NULL, found);
+}
+
 // clang-format off
 static queue_impl_t algorithms[] = {
 #ifdef HATRACK_TEST_LLSTACK    
@@ -125,11 +158,96 @@ static queue_impl_t algorithms[] = {
 	.del          = (del_func)hq_delete,
 	.can_prealloc = true
     },
+    {
+	.name         = "skipq",
+	.new          = (new_func)skipq_new_proxy,
+	.enqueue      = (enqueue_func)skipq_int_insert,
+	.dequeue      = (dequeue_func)skipq_int_dequeue,
+	.del          = (del_func)skipq_delete,
+	.can_prealloc = false
+    },
+    {
+	.name         = "skipq-r",
+	.new          = (new_func)skipq_relaxed_new_proxy,
+	.enqueue      = (enqueue_func)skipq_int_insert,
+	.dequeue      = (dequeue_func)skipq_int_dequeue,
+	.del          = (del_func)skipq_delete,
+	.can_prealloc = false
+    },
     {
         0,
     },
 };
 
+/* The workload above has every thread both enqueuing and dequeuing,
+ * which the single-consumer queues can't handle. So we also run a
+ * pipeline workload: some number of producer threads feeding a single
+ * consumer thread, which is the case hq_spsc and hq_mpsc are built
+ * for. hq_spsc only gets run with a single producer.
+ */
+typedef struct {
+    char        *name;
+    new_func     new;
+    enqueue_func enqueue;
+    dequeue_func dequeue;
+    del_func     del;
+    bool         single_producer;
+} pipe_impl_t;
+
+typedef struct {
+    pipe_impl_t *impl;
+    uint64_t     num_producers;
+    uint64_t     num_ops;
+    double       elapsed;
+} pipe_info_t;
+
+typedef struct {
+    pipe_impl_t *impl;
+    void        *object;
+    uint64_t     num_items;
+    bool         consumer;
+} pipe_thread_info_t;
+
+static pipe_impl_t pipe_algorithms[] = {
+    {
+	.name            = "q64",
+	.new             = (new_func)q64_new_proxy,
+	.enqueue         = (enqueue_func)q64_int_enqueue,
+	.dequeue         = (dequeue_func)q64_int_dequeue,
+	.del             = (del_func)q64_delete,
+	.single_producer = false
+    },
+    {
+	.name            = "hq",
+	.new             = (new_func)hq_new_size,
+	.enqueue         = (enqueue_func)hq_enqueue,
+	.dequeue         = (dequeue_func)hq_dequeue,
+	.del             = (del_func)hq_delete,
+	.single_producer = false
+    },
+    {
+	.name            = "hq_mpsc",
+	.new             = (new_func)hq_mpsc_new_size,
+	.enqueue         = (enqueue_func)hq_mpsc_enqueue,
+	.dequeue         = (dequeue_func)hq_mpsc_dequeue,
+	.del             = (del_func)hq_mpsc_delete,
+	.single_producer = false
+    },
+    {
+	.name            = "hq_spsc",
+	.new             = (new_func)hq_spsc_new_size,
+	.enqueue         = (enqueue_func)hq_spsc_enqueue,
+	.dequeue         = (dequeue_func)hq_spsc_dequeue,
+	.del             = (del_func)hq_spsc_delete,
+	.single_producer = true
+    },
+    {
+        0,
+    },
+};
+
+static uint64_t pipe_producers[] = {1, 2, 4, 8, 0};
+
 typedef struct {
     queue_impl_t *impl;
     void         *object;
@@ -259,6 +377,95 @@ test_queue(test_info_t *test_info)
     return err;
 }
 
+void *
+pipe_thread(void *info)
+{
+    pipe_thread_info_t *pinfo;
+    enqueue_func        enqueue;
+    dequeue_func        dequeue;
+    void               *queue;
+    uint64_t            i;
+    bool                found;
+
+    mmm_register_thread();
+
+    pinfo   = (pipe_thread_info_t *)info;
+    enqueue = pinfo->impl->enqueue;
+    dequeue = pinfo->impl->dequeue;
+    queue   = pinfo->object;
+
+    gate_thread_ready(gate);
+
+    if (pinfo->consumer) {
+	for (i = 0; i < pinfo->num_items;) {
+	    (*dequeue)(queue, &found);
+	    if (found) {
+		i++;
+	    }
+	}
+    }
+    else {
+	for (i = 1; i <= pinfo->num_items; i++) {
+	    (*enqueue)(queue, i);
+	}
+    }
+
+    gate_thread_done(gate);
+    mmm_clean_up_before_exit();
+    free(pinfo);
+
+    return NULL;
+}
+
+void
+test_pipe(pipe_info_t *test_info)
+{
+    uint64_t            i;
+    uint64_t            per_producer;
+    pipe_thread_info_t *pinfo;
+    void               *queue;
+
+    fprintf(stdout,
+            "%8s, # producers = %2lu, 1 consumer -> ",
+            test_info->impl->name,
+            test_info->num_producers);
+    fflush(stdout);
+
+    gate_init(gate, gate->max_threads);
+
+    queue              = (*test_info->impl->new)(0);
+    per_producer       = (target_ops >> 2) / test_info->num_producers;
+    test_info->num_ops = per_producer * test_info->num_producers;
+
+    for (i = 0; i <= test_info->num_producers; i++) {
+	pinfo            = (pipe_thread_info_t *)
+	                   malloc(sizeof(pipe_thread_info_t));
+	pinfo->impl      = test_info->impl;
+	pinfo->object    = queue;
+	pinfo->consumer  = (i == test_info->num_producers);
+	pinfo->num_items = pinfo->consumer ? test_info->num_ops : per_producer;
+
+	pthread_create(&threads[i], NULL, pipe_thread, (void *)pinfo);
+    }
+
+    gate_open(gate, test_info->num_producers + 1);
+
+    for (i = 0; i <= test_info->num_producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    test_info->elapsed = gate_close(gate);
+
+    fprintf(stdout, "%.3f sec\n", test_info->elapsed);
+
+    (*test_info->impl->del)(queue);
+
+    return;
+}
+
+static const char PIPE_HDR[]
+    = "\nAlgorithm  | Producers | MOps/sec\n";
+
 static const char HDR[]
     = "\nAlgorithm  | Prealloc? | # Threads | Op Batch  | MOps/sec\n";
 
@@ -284,16 +491,39 @@ format_results(test_info_t *tests, int num_tests, int row_size)
     }
 }
 
+/* The optional argument picks the backoff strategy (see backoff.h)
+ * that every queue uses after losing a race. The larger thread
+ * counts are well past the number of cores on most machines, which
+ * is exactly where the choice matters, so it's worth running this
+ * once per strategy and comparing.
+ */
 int
-main(void)
+main(int argc, char *argv[])
 {
-    int          num_algos;
-    int          num_params;
-    int          num_tests;
-    int          n;
-    int          row_size;
-    int          i, j;
-    test_info_t *tests;
+    int               num_algos;
+    int               num_params;
+    int               num_tests;
+    int               n;
+    int               row_size;
+    int               i, j;
+    test_info_t      *tests;
+    hatrack_backoff_t backoff;
+
+    if (argc > 2) {
+	fprintf(stderr, "Usage: %s [none|pause|spin|yield|sleep]\n", argv[0]);
+	return 1;
+    }
+
+    if (argc == 2) {
+	if (!hatrack_backoff_from_name(&backoff, argv[1])) {
+	    fprintf(stderr, "Unknown backoff strategy: %s\n", argv[1]);
+	    return 1;
+	}
+	hatrack_backoff_set_default(&backoff);
+    }
+
+    printf("Backoff strategy: %s\n",
+	   hatrack_backoff_name(&hatrack_backoff_default));
 
     gate = gate_new();
 	
@@ -345,6 +575,31 @@ main(void)
     printf(LINE);
 
     format_results(tests, n, row_size);
+
+    pipe_info_t pipes[sizeof(pipe_producers) / sizeof(uint64_t)
+		      * sizeof(pipe_algorithms) / sizeof(pipe_impl_t)];
+
+    n = 0;
+
+    for (i = 0; pipe_producers[i]; i++) {
+	for (j = 0; pipe_algorithms[j].name; j++) {
+	    if (pipe_algorithms[j].single_producer && pipe_producers[i] > 1) {
+		continue;
+	    }
+	    pipes[n].impl          = &pipe_algorithms[j];
+	    pipes[n].num_producers = pipe_producers[i];
+	    test_pipe(&pipes[n++]);
+	}
+    }
+
+    printf(PIPE_HDR);
+    printf(LINE);
+
+    for (i = 0; i < n; i++) {
+        printf("%-13s", pipes[i].impl->name);
+        printf("%-12lu", pipes[i].num_producers);
+        printf("%-.4f\n", (pipes[i].num_ops / pipes[i].elapsed) / 1000000);
+    }
     
     return 0;
 }
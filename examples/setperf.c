@@ -0,0 +1,160 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           setperf.c
+ *  Description:    Scaling benchmark for the parallel set algebra
+ *                  operations.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+#include <stdio.h>
+
+/* Builds two sets that overlap by half, then times each of the four
+ * set algebra operations with 1, 2, 4, ... threads, up to the number
+ * given on the command line (the default is 16), and reports the time
+ * and the speedup over one thread.
+ *
+ * The second argument, if given, is the number of items in each set,
+ * as a power of two. The default is 2^20.
+ */
+
+// clang-format off
+static char *op_names[] = {"difference", "union", "intersection",
+			   "disjunction"};
+
+static inline uint64_t
+ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double
+run_op(uint32_t op, hatrack_set_t *s1, hatrack_set_t *s2, uint32_t threads)
+{
+    hatrack_set_t *result;
+    uint64_t       start;
+    uint64_t       elapsed;
+
+    start = ns_now();
+
+    switch (op) {
+    case 0:
+	result = hatrack_set_difference_parallel(s1, s2, threads);
+	break;
+    case 1:
+	result = hatrack_set_union_parallel(s1, s2, threads);
+	break;
+    case 2:
+	result = hatrack_set_intersection_parallel(s1, s2, threads);
+	break;
+    default:
+	result = hatrack_set_disjunction_parallel(s1, s2, threads);
+	break;
+    }
+
+    elapsed = ns_now() - start;
+
+    hatrack_set_delete(result);
+
+    return elapsed / 1000000.0;
+}
+
+static const char HDR[]
+    = "Operation     Threads   ms         Speedup\n";
+
+static const char LINE[]
+    = "------------------------------------------\n";
+
+int
+main(int argc, char *argv[])
+{
+    hatrack_set_t *s1;
+    hatrack_set_t *s2;
+    uint64_t       max_threads;
+    uint64_t       size_log;
+    uint64_t       num_items;
+    uint64_t       i;
+    uint32_t       op;
+    uint32_t       threads;
+    double         base;
+    double         ms;
+
+    max_threads = 16;
+    size_log    = 20;
+
+    if (argc > 1) {
+	max_threads = strtoul(argv[1], NULL, 10);
+    }
+
+    if (argc > 2) {
+	size_log = strtoul(argv[2], NULL, 10);
+    }
+
+    if (!max_threads || max_threads >= HATRACK_THREADS_MAX) {
+	fprintf(stderr, "Invalid number of threads.\n");
+	return 1;
+    }
+
+    if (size_log < 4 || size_log > 30) {
+	fprintf(stderr, "Invalid set size.\n");
+	return 1;
+    }
+
+    mmm_register_thread();
+
+    num_items = 1ULL << size_log;
+    s1        = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+    s2        = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    for (i = 1; i <= num_items; i++) {
+	hatrack_set_put(s1, (void *)i);
+	hatrack_set_put(s2, (void *)(i + num_items / 2));
+    }
+
+    printf("Two sets of 2^%lu items each, overlapping by half.\n\n", size_log);
+    printf(HDR);
+    printf(LINE);
+
+    for (op = 0; op < sizeof(op_names) / sizeof(char *); op++) {
+	base = 0;
+
+	for (threads = 1; threads <= max_threads; threads <<= 1) {
+	    ms = run_op(op, s1, s2, threads);
+
+	    if (threads == 1) {
+		base = ms;
+	    }
+
+	    printf("%-13s %-9u %-10.1f %.2fx\n",
+		   op_names[op],
+		   threads,
+		   ms,
+		   base / ms);
+	}
+    }
+
+    hatrack_set_delete(s1);
+    hatrack_set_delete(s2);
+
+    mmm_clean_up_before_exit();
+
+    return 0;
+}
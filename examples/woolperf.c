@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           woolperf.c
+ *  Description:    Benchmarks woolhat's record pooling, under an
+ *                  update-heavy workload.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+#include <stdio.h>
+
+/* Runs the same workload twice, once with mmm's record pool turned
+ * off (so every write mallocs a record, and every reclaimed record
+ * gets freed), and once with it on.
+ *
+ * The workload is a table of 2^16 keys, where the writer threads
+ * (the first argument; the default is 4) overwrite random keys as
+ * fast as they can, while one more thread does gets, and times each
+ * one. For each run, we report the write throughput, how many of the
+ * writes had to call malloc() for their record, and the median and
+ * tail get latencies.
+ *
+ * The second argument, if given, is the number of writes per writer,
+ * in millions. The default is 2.
+ */
+
+// clang-format off
+#define WOOLPERF_KEYS_LOG   16
+#define WOOLPERF_KEYS       (1 << WOOLPERF_KEYS_LOG)
+#define WOOLPERF_SAMPLES    (1 << 20)
+
+typedef struct {
+    woolhat_t        *table;
+    hatrack_hash_t   *hashes;
+    uint64_t          id;
+    uint64_t          num_writes;
+    uint64_t          hits;
+    uint64_t          misses;
+} woolperf_info_t;
+
+static _Atomic uint64_t num_writers_done;
+static uint64_t         latencies[WOOLPERF_SAMPLES];
+
+static inline uint64_t
+ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *
+writer_thread(void *arg)
+{
+    woolperf_info_t *info;
+    uint64_t         rng;
+    uint64_t         i;
+
+    info = (woolperf_info_t *)arg;
+    rng  = info->id * 0x9e3779b97f4a7c15ULL + 1;
+
+    mmm_register_thread();
+
+    for (i = 0; i < info->num_writes; i++) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	woolhat_put(info->table,
+		    info->hashes[rng & (WOOLPERF_KEYS - 1)],
+		    (void *)i,
+		    NULL);
+    }
+
+    mmm_pool_counts(&info->hits, &info->misses);
+    atomic_fetch_add(&num_writers_done, 1);
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(uint64_t *)a;
+    uint64_t y = *(uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+run_one(char *name, uint64_t num_writers, uint64_t num_writes)
+{
+    woolhat_t       *table;
+    hatrack_hash_t  *hashes;
+    woolperf_info_t *info;
+    pthread_t       *threads;
+    uint64_t         start;
+    uint64_t         elapsed;
+    uint64_t         num_samples;
+    uint64_t         hits;
+    uint64_t         misses;
+    uint64_t         t;
+    uint64_t         i;
+
+    table   = woolhat_new_size(WOOLPERF_KEYS_LOG + 1);
+    hashes  = (hatrack_hash_t *)malloc(sizeof(hatrack_hash_t) * WOOLPERF_KEYS);
+    info    = (woolperf_info_t *)malloc(sizeof(woolperf_info_t) * num_writers);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_writers);
+    hits    = 0;
+    misses  = 0;
+
+    for (i = 0; i < WOOLPERF_KEYS; i++) {
+	hashes[i] = hash_int(i);
+	woolhat_put(table, hashes[i], (void *)i, NULL);
+    }
+
+    atomic_store(&num_writers_done, 0);
+
+    start = ns_now();
+
+    for (i = 0; i < num_writers; i++) {
+	info[i].table      = table;
+	info[i].hashes     = hashes;
+	info[i].id         = i;
+	info[i].num_writes = num_writes;
+
+	pthread_create(&threads[i], NULL, writer_thread, &info[i]);
+    }
+
+    num_samples = 0;
+    i           = 0;
+
+    while (atomic_load(&num_writers_done) != num_writers) {
+	t = ns_now();
+	woolhat_get(table, hashes[i++ & (WOOLPERF_KEYS - 1)], NULL);
+	latencies[num_samples++ & (WOOLPERF_SAMPLES - 1)] = ns_now() - t;
+    }
+
+    for (i = 0; i < num_writers; i++) {
+	pthread_join(threads[i], NULL);
+	hits   += info[i].hits;
+	misses += info[i].misses;
+    }
+
+    elapsed = ns_now() - start;
+
+    if (num_samples > WOOLPERF_SAMPLES) {
+	num_samples = WOOLPERF_SAMPLES;
+    }
+
+    qsort(latencies, num_samples, sizeof(uint64_t), cmp_u64);
+
+    printf("%-10s %-12.2f %-12.1f %-9lu %-9lu %-9lu\n",
+	   name,
+	   (num_writers * num_writes) / (elapsed / 1000.0),
+	   (misses * 100.0) / (hits + misses),
+	   num_samples ? latencies[num_samples / 2] : 0,
+	   num_samples ? latencies[(num_samples * 99) / 100] : 0,
+	   num_samples ? latencies[(num_samples * 999) / 1000] : 0);
+
+    woolhat_delete(table);
+    free(hashes);
+    free(info);
+    free(threads);
+
+    return;
+}
+
+static const char HDR[]
+    = "Pooling    Mwrites/sec  malloc'd pct get p50   get p99   get p999 (ns)\n";
+
+static const char LINE[]
+    = "----------------------------------------------------------------------\n";
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t num_writers;
+    uint64_t num_writes;
+    uint64_t limit;
+
+    num_writers = 4;
+    num_writes  = 2;
+
+    if (argc > 1) {
+	num_writers = strtoul(argv[1], NULL, 10);
+    }
+
+    if (argc > 2) {
+	num_writes = strtoul(argv[2], NULL, 10);
+    }
+
+    if (!num_writers || num_writers >= HATRACK_THREADS_MAX - 1) {
+	fprintf(stderr, "Invalid number of threads.\n");
+	return 1;
+    }
+
+    if (!num_writes) {
+	fprintf(stderr, "Invalid number of writes.\n");
+	return 1;
+    }
+
+    num_writes *= 1000000;
+
+    mmm_register_thread();
+
+    printf("%lu writer(s), %lu writes each, over 2^%u keys.\n\n",
+	   num_writers,
+	   num_writes,
+	   WOOLPERF_KEYS_LOG);
+    printf(HDR);
+    printf(LINE);
+
+    limit          = mmm_pool_limit;
+    mmm_pool_limit = 0;
+
+    run_one("off", num_writers, num_writes);
+
+    mmm_pool_limit = limit;
+
+    run_one("on", num_writers, num_writes);
+
+    mmm_clean_up_before_exit();
+
+    return 0;
+}
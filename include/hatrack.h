@@ -27,8 +27,18 @@
 // Currently pulls in Crown.
 #include <hatrack/dict.h>
 
-// Currently pulls in Woolhat.
+// Currently pulls in Woolhat (and the bitset).
 #include <hatrack/set.h>
+
+// The lock-free ordered map (a skiplist).
+#include <hatrack/omap.h>
+
+// Integer-to-integer maps, with no per-operation allocation.
+#include <hatrack/u64map.h>
+
+// The insertion-ordered compact table.
+#include <hatrack/cloche.h>
+
 #include <hatrack/flexarray.h>
 
 #ifdef HATRACK_COMPILE_ALL_ALGORITHMS
@@ -51,6 +61,11 @@
 #include <hatrack/q64.h>
 #include <hatrack/hq.h>
 #include <hatrack/capq.h>
+#include <hatrack/hq_spsc.h>
+#include <hatrack/hq_mpsc.h>
+#include <hatrack/skipq.h>
+#include <hatrack/wsdeque.h>
+#include <hatrack/pool.h>
 #include <hatrack/helpmanager.h>
 #include <hatrack/llstack.h>
 #include <hatrack/stack.h>
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           backend.h
+ *  Description:    Selectable hash table backends for the high-level
+ *                  dictionary and set interfaces.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_BACKEND_H__
+#define __HATRACK_BACKEND_H__
+
+#include <hatrack/hatvtable.h>
+#include <hatrack/stats.h>
+
+/* By default, hatrack_dict sits on top of crown, and hatrack_set
+ * sits on top of woolhat. Those are good general-purpose choices, but
+ * we've got plenty of other tables with different tradeoffs. For
+ * instance, hihat does better on write-heavy workloads, and tophat
+ * is great for tables that are usually only touched by one thread.
+ *
+ * So the high-level interfaces can be handed any of the following
+ * backends at creation time, and they'll do all their work (hashing
+ * keys, running hooks, producing views) on top of the table's
+ * public API, via the same vtables tophat and our test harness use.
+ *
+ * Note that the 'extra' tables are only available when the library
+ * was compiled with HATRACK_COMPILE_ALL_ALGORITHMS; asking for one
+ * that isn't compiled in will abort().  Also note that tiara isn't
+ * on the list, since it only keeps 64 bits of hash value, which
+ * isn't enough to identify arbitrary keys.
+ *
+ * Cloche is always compiled in. Its views come back in insertion
+ * order without any sorting, so it's the one to pick if you call
+ * hatrack_dict_items_sort() (and friends) a lot.
+ *
+ * HATRACK_BACKEND_DEFAULT gets whichever of crown / woolhat is the
+ * native choice for the interface in question; asking for the native
+ * table by name is the same thing, and uses the same fast path.
+ */
+typedef enum {
+    HATRACK_BACKEND_DEFAULT,
+    HATRACK_BACKEND_CROWN,
+    HATRACK_BACKEND_WOOLHAT,
+    HATRACK_BACKEND_WITCHHAT,
+    HATRACK_BACKEND_HIHAT,
+    HATRACK_BACKEND_TOPHAT_FAST,
+    HATRACK_BACKEND_TOPHAT_CONSISTENT,
+    HATRACK_BACKEND_CLOCHE,
+    HATRACK_BACKEND_NUM
+} hatrack_backend_t;
+
+/* 'stats' is NULL for tables that don't have a *_stats() call; the
+ * dict and set just report the item count for those.
+ */
+typedef void (*hatrack_stats_func)(void *, hatrack_stats_t *);
+
+// clang-format off
+typedef struct {
+    char               *name;
+    hatrack_vtable_t   *vtable;
+    uint64_t            size;
+    hatrack_stats_func  stats;
+} hatrack_backend_info_t;
+
+hatrack_backend_info_t *hatrack_backend_get_info(hatrack_backend_t);
+void                   *hatrack_backend_new     (hatrack_backend_info_t *);
+
+#endif
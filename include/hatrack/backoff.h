@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           backoff.h
+ *  Description:    Pluggable backoff for CAS retry loops.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * Most of the retry loops in this library go right back around when a
+ * CAS fails. That's the right call when there are fewer threads than
+ * cores, since whoever beat us is done, and we're likely to win the
+ * next time. But once the machine is oversubscribed, the thread we
+ * keep losing to may well be one that got descheduled half way
+ * through its operation, and hammering on the same cache line just
+ * slows everyone down, including the thread we're waiting on.
+ *
+ * What works best depends on the workload, and on the machine, so
+ * instead of hardcoding a policy in each data structure (as hatring
+ * and hihat-a used to, with their own nanosleep() loops), the retry
+ * loops call hatrack_backoff(), and the strategy is picked by a
+ * hatrack_backoff_t:
+ *
+ * HATRACK_BACKOFF_NONE   Retry right away (the old behavior for most
+ *                        of the library).
+ *
+ * HATRACK_BACKOFF_PAUSE  Issue a single pause instruction (yield, on
+ *                        ARM). This takes the pressure off the memory
+ *                        system, and off a hyperthread sibling, for a
+ *                        few dozen cycles. This is the default.
+ *
+ * HATRACK_BACKOFF_SPIN   Exponential backoff with pause instructions,
+ *                        starting at 'min' of them, and doubling after
+ *                        each failure, up to 'max'.
+ *
+ * HATRACK_BACKOFF_YIELD  Call sched_yield(), which gives a descheduled
+ *                        thread a chance to run, if there's one on our
+ *                        core.
+ *
+ * HATRACK_BACKOFF_SLEEP  Exponential backoff with nanosleep(), starting
+ *                        at 'min' nanoseconds, and doubling up to
+ *                        'max'.
+ *
+ * hq, capq, hatring and hatstack each carry their own hatrack_backoff_t,
+ * which starts out as a copy of hatrack_backoff_default, and can be
+ * changed with the structure's *_set_backoff() call. The hash tables
+ * are far too numerous (and too often instantiated through the
+ * vtable-based interfaces) for that to be worth it, so they all use
+ * hatrack_backoff_default directly. The one exception is the change
+ * feed's stripe locks (see changelog.h), which always yield.
+ *
+ * Either way, the configuration should be set up before other threads
+ * start using the object; we don't synchronize on it.
+ *
+ * In a retry loop, the usage is:
+ *
+ *   hatrack_backoff_state_t backoff;
+ *
+ *   hatrack_backoff_start(&backoff, &self->backoff);
+ *
+ *   while (!CAS(...)) {
+ *       ...
+ *       hatrack_backoff(&backoff);
+ *   }
+ *
+ * We only ever back off after a failure, so uncontended operations
+ * pay for nothing but the two stores in hatrack_backoff_start().
+ */
+
+#ifndef __HATRACK_BACKOFF_H__
+#define __HATRACK_BACKOFF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hatrack/hatrack_config.h>
+
+typedef enum {
+    HATRACK_BACKOFF_NONE,
+    HATRACK_BACKOFF_PAUSE,
+    HATRACK_BACKOFF_SPIN,
+    HATRACK_BACKOFF_YIELD,
+    HATRACK_BACKOFF_SLEEP
+} hatrack_backoff_kind_t;
+
+// clang-format off
+/* 'min' and 'max' are in pause instructions for HATRACK_BACKOFF_SPIN,
+ * and in nanoseconds for HATRACK_BACKOFF_SLEEP. The other strategies
+ * ignore them.
+ */
+typedef struct {
+    hatrack_backoff_kind_t kind;
+    uint32_t               min;
+    uint32_t               max;
+} hatrack_backoff_t;
+
+typedef struct {
+    const hatrack_backoff_t *config;
+    uint32_t                 delay;
+} hatrack_backoff_state_t;
+
+extern hatrack_backoff_t hatrack_backoff_default;
+
+void        hatrack_backoff_init       (hatrack_backoff_t *,
+					hatrack_backoff_kind_t);
+void        hatrack_backoff_set_default(const hatrack_backoff_t *);
+bool        hatrack_backoff_from_name  (hatrack_backoff_t *, const char *);
+const char *hatrack_backoff_name       (const hatrack_backoff_t *);
+void        hatrack_backoff_slow       (hatrack_backoff_state_t *);
+
+static inline void
+hatrack_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+
+    return;
+}
+
+static inline void
+hatrack_backoff_start(hatrack_backoff_state_t *state,
+		      const hatrack_backoff_t *config)
+{
+    state->config = config;
+    state->delay  = config->min;
+
+    return;
+}
+
+/* The strategies that don't involve a system call get handled
+ * inline; the rest go through hatrack_backoff_slow(), since a
+ * function call is nothing next to a trip into the kernel.
+ */
+static inline void
+hatrack_backoff(hatrack_backoff_state_t *state)
+{
+    uint32_t i;
+
+    switch (state->config->kind) {
+    case HATRACK_BACKOFF_NONE:
+	return;
+    case HATRACK_BACKOFF_PAUSE:
+	hatrack_pause();
+	return;
+    case HATRACK_BACKOFF_SPIN:
+	for (i = 0; i < state->delay; i++) {
+	    hatrack_pause();
+	}
+
+	if (state->delay < state->config->max) {
+	    state->delay <<= 1;
+
+	    if (state->delay > state->config->max) {
+		state->delay = state->config->max;
+	    }
+	}
+	return;
+    default:
+	hatrack_backoff_slow(state);
+	return;
+    }
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           bitset.h
+ *  Description:    A lock-free dense bitmap set, for sets of integers
+ *                  from a bounded range.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_BITSET_H__
+#define __HATRACK_BITSET_H__
+
+#include <hatrack/hatrack_common.h>
+
+/* When the items in a set are integers from a range that's known up
+ * front (IDs from 0 to 2^24, say), a hash table is a very expensive
+ * way to store them. A woolhat-based set spends around 100 bytes per
+ * item, between the bucket and the mmm-allocated record, and its set
+ * algebra has to sort both sides first.
+ *
+ * A bitmap spends one bit per possible item, whether it's in the set
+ * or not, which is the better deal whenever the set holds more than
+ * about 1 in 800 of the possible items. Adding and removing an item
+ * is a single atomic OR or AND on the word holding its bit, and the
+ * set algebra is a single pass over the words.
+ *
+ * The tricky part is getting a consistent view of the whole set,
+ * since no single atomic operation covers all the words. For that,
+ * each word has a version number, which a write that actually
+ * changes a bit bumps once before it touches the word, and once
+ * after; so the version is odd while a write is in progress. A reader
+ * adds up the versions as it copies the words, and then adds them up
+ * again. If every version was even the first time around, and the
+ * sums match, no word changed while we were copying, so the copy is
+ * exactly the set as of the end of the first pass. Since writers only
+ * ever touch the version of the word they're writing, they don't
+ * contend with each other any more than they would on the words
+ * themselves.
+ *
+ * That can fail if writes keep landing while we copy, so we only try
+ * HATRACK_RETRY_THRESHOLD times. After that, we fall back on freezing
+ * the set: the reader posts a hatrack_bitset_freeze_t, and then copies
+ * each word into it. Writers that see the freeze posted help with
+ * the copying before they make their own change, so nothing they do
+ * ends up in the copy. Once every word has been copied, the copy is
+ * exactly the set as of that moment (writes that were already in
+ * flight when the freeze got posted overlapped with the read, so it
+ * doesn't matter which side of it they land on). Nobody ever waits on
+ * anybody else, and once a freeze is posted, it's done after a
+ * bounded number of steps, however busy the writers are. The cost is
+ * that while it's posted, writers have to help copy the whole set.
+ *
+ * Writes never touch the versions or the freeze when they don't
+ * change the set (adding an item that's already there is just a
+ * load).
+ *
+ * All the set algebra operations work on those consistent snapshots,
+ * taken of both sets at once, so the result reflects both sets at a
+ * single moment in time.
+ *
+ * The range of a bitset is fixed when it's created. Adding an item
+ * that's not less than num_bits aborts; looking one up, or removing
+ * one, just fails. Sets with different ranges can be combined; the
+ * result gets the larger range.
+ *
+ * hatrack_set_new_bitset() gives you this same thing behind the
+ * hatrack_set API, for sets of HATRACK_DICT_KEY_TYPE_INT items.
+ */
+
+// clang-format off
+typedef struct hatrack_bitset_freeze_st hatrack_bitset_freeze_t;
+
+typedef struct {
+    uint64_t                           num_bits;
+    uint64_t                           num_words;
+    _Atomic uint64_t                  *words;
+    _Atomic uint64_t                  *versions;
+    _Atomic(hatrack_bitset_freeze_t *) freeze;
+} hatrack_bitset_t;
+
+hatrack_bitset_t *hatrack_bitset_new          (uint64_t);
+void              hatrack_bitset_init         (hatrack_bitset_t *, uint64_t);
+void              hatrack_bitset_cleanup      (hatrack_bitset_t *);
+void              hatrack_bitset_delete       (hatrack_bitset_t *);
+bool              hatrack_bitset_contains     (hatrack_bitset_t *, uint64_t);
+bool              hatrack_bitset_add          (hatrack_bitset_t *, uint64_t);
+bool              hatrack_bitset_remove       (hatrack_bitset_t *, uint64_t);
+uint64_t          hatrack_bitset_len          (hatrack_bitset_t *);
+uint64_t          hatrack_bitset_range        (hatrack_bitset_t *);
+uint64_t         *hatrack_bitset_items        (hatrack_bitset_t *, uint64_t *);
+bool              hatrack_bitset_is_eq        (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+bool              hatrack_bitset_is_superset  (hatrack_bitset_t *,
+					       hatrack_bitset_t *, bool);
+bool              hatrack_bitset_is_subset    (hatrack_bitset_t *,
+					       hatrack_bitset_t *, bool);
+bool              hatrack_bitset_is_disjoint  (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+hatrack_bitset_t *hatrack_bitset_difference   (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+hatrack_bitset_t *hatrack_bitset_union        (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+hatrack_bitset_t *hatrack_bitset_intersection (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+hatrack_bitset_t *hatrack_bitset_disjunction  (hatrack_bitset_t *,
+					       hatrack_bitset_t *);
+
+#endif
@@ -52,6 +52,9 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/parking.h>
+#include <hatrack/backoff.h>
+#include <hatrack/mmm.h>
 
 
 // clang-format off
@@ -75,10 +78,16 @@ struct capq_store_t {
     capq_cell_t             cells[];
 };
 
+/* As with hq, 'store_cache' holds on to retired stores for reuse, and
+ * 'backoff' is what we do when we lose a race for a cell.
+ */
 typedef struct {
     alignas(8)
     _Atomic (capq_store_t *)store;
     _Atomic int64_t         len;
+    hatrack_parking_t       parking;
+    mmm_cache_t            *store_cache;
+    hatrack_backoff_t       backoff;
 } capq_t;
 
 enum {
@@ -92,21 +101,30 @@ enum {
 };
 
 static inline int64_t
-capq_len(hq_t *self)
+capq_len(capq_t *self)
 {
     return atomic_read(&self->len);
 }
 
-capq_t    *capq_new        (void);
-capq_t    *capq_new_size   (uint64_t);
-void       capq_init       (capq_t *);
-void       capq_init_size  (capq_t *, uint64_t);
-void       capq_cleanup    (capq_t *);
-void       capq_delete     (capq_t *);
-uint64_t   capq_enqueue    (capq_t *, void *);
-capq_top_t capq_top        (capq_t *, bool *);
-bool       capq_cap        (capq_t *, uint64_t);
-void      *capq_dequeue    (capq_t *, bool *);
+static inline void
+capq_set_backoff(capq_t *self, const hatrack_backoff_t *config)
+{
+    self->backoff = *config;
+
+    return;
+}
+
+capq_t    *capq_new         (void);
+capq_t    *capq_new_size    (uint64_t);
+void       capq_init        (capq_t *);
+void       capq_init_size   (capq_t *, uint64_t);
+void       capq_cleanup     (capq_t *);
+void       capq_delete      (capq_t *);
+uint64_t   capq_enqueue     (capq_t *, void *);
+capq_top_t capq_top         (capq_t *, bool *);
+bool       capq_cap         (capq_t *, uint64_t);
+void      *capq_dequeue     (capq_t *, bool *);
+void      *capq_dequeue_wait(capq_t *, bool *, int64_t);
 
 static inline uint64_t
 capq_set_enqueued(uint64_t ix)
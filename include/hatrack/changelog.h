@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           changelog.h
+ *  Description:    A lock-free change feed, used by hatrack_dict and
+ *                  hatrack_set to answer "what changed since epoch E?"
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_CHANGELOG_H__
+#define __HATRACK_CHANGELOG_H__
+
+#include <hatrack/hatrack_common.h>
+
+/* For replication and cache invalidation, people want to know what
+ * changed in a table since some point in time, without pulling a
+ * full view of the table and diffing it.
+ *
+ * The table itself can't answer that question cheaply; our
+ * algorithms don't keep deletion records around (woolhat's history
+ * only lives until the next migration), and finding changes by epoch
+ * would mean scanning every bucket.
+ *
+ * So, when asked to, the high-level dict and set keep a log of
+ * changes on the side. It's a singly linked list of mmm-allocated
+ * records, newest first, pushed with a single CAS on the head. Each
+ * record gets an epoch one higher than the record it was pushed on
+ * top of, which means epochs always strictly decrease as you walk the
+ * list. Therefore, asking for changes since epoch E walks only the
+ * records newer than E, and stops; the cost is proportional to the
+ * number of changes, not to the size of the table.
+ *
+ * Note that these epochs are specific to the log, not the global mmm
+ * epoch. We can't use the mmm epoch, because two threads could get
+ * epochs in one order and push in the other, in which case a reader
+ * who saw only the later push would skip the earlier epoch forever.
+ * Tying the epoch to the position in the list avoids that.
+ *
+ * Pushing onto the log can't happen in the same atomic step as the
+ * write to the table, though. If two threads wrote the same key at
+ * the same time, they could apply their writes in one order and push
+ * in the other, and anyone replaying the log would end up with the
+ * wrong value (or a key that should be gone). Our tables order the
+ * writes to a key in too many different ways for the log to recover
+ * the order after the fact; a delete, in particular, leaves nothing
+ * behind for the next insert to find.
+ *
+ * So, while the feed is on, writes to the same key take turns: the
+ * dict and set call hatrack_changelog_lock() with the key's hash
+ * before writing to the table, and hatrack_changelog_unlock() once
+ * the change is in the log. The locks are striped by hash value
+ * (HATRACK_CHANGELOG_STRIPES of them), so writes to different keys
+ * almost never wait on each other. Still, this means that, with the
+ * feed on, a writer that stalls while holding a stripe holds up
+ * other writers to that stripe; the feed trades away lock freedom
+ * on writes for a log that replays to exactly the table's state.
+ * Reads never lock. Since the thread we're waiting on is most likely
+ * one that got descheduled, waiting writers back off with
+ * sched_yield() (HATRACK_BACKOFF_YIELD; see backoff.h), not by
+ * spinning.
+ *
+ * The log also has to keep what it points to alive. If the table has
+ * a free handler, a value that gets overwritten or removed gets
+ * handed to the free handler once mmm is done with the table's
+ * record, but the log still points at it. So the log takes its own
+ * reference to each key and value it records, through the table's
+ * return hooks, and gives it back through the free handler when the
+ * record gets trimmed away (or the log gets deleted). The free
+ * handler gets NULL in place of the table for those, since the table
+ * may be long gone by then. hatrack_changelog_since() runs the return
+ * hooks on everything it returns, the same as a view does, so the
+ * caller owns a reference to each of those.
+ *
+ * That only works if the table has return hooks to take references
+ * with; without them, there's no way to keep a logged value from
+ * being freed, so the dict and set abort if you turn on the feed with
+ * a free handler and no return hook for values (for the set, the
+ * return hook).
+ *
+ * The log grows until you trim it. Trimming drops everything at or
+ * below a given epoch (except the newest record, which we always
+ * keep so that epochs keep increasing). If somebody asks for changes
+ * since an epoch that has been trimmed away, they can't get a
+ * complete answer, so we give them HATRACK_CHANGES_TRIMMED as the
+ * high-water mark, and they should resync from a full view.
+ */
+
+enum {
+    HATRACK_CHANGE_INSERT,
+    HATRACK_CHANGE_UPDATE,
+    HATRACK_CHANGE_DELETE
+};
+
+enum64(hatrack_changes_flag_t,
+       HATRACK_CHANGES_TRIMMED = 0xffffffffffffffff);
+
+typedef struct {
+    void    *key;
+    void    *value;
+    uint64_t epoch;
+    uint32_t kind;
+} hatrack_change_t;
+
+typedef struct hatrack_change_record_st hatrack_change_record_t;
+
+/* free_handler is whatever the log's free handler was when the
+ * change was recorded; the record hands its key and value back to it
+ * when it's freed. If 'items' is true, the handler gets a
+ * hatrack_dict_item_t holding both; otherwise, it gets the key by
+ * itself (that's what the set's free handler expects).
+ */
+struct hatrack_change_record_st {
+    _Atomic(hatrack_change_record_t *) next;
+    hatrack_change_t                   change;
+    hatrack_mem_hook_t                 free_handler;
+    bool                               items;
+};
+
+typedef struct {
+    alignas(HATRACK_CACHE_LINE_SIZE) _Atomic bool locked;
+} hatrack_changelog_stripe_t;
+
+// clang-format off
+typedef struct {
+    _Atomic(hatrack_change_record_t *) head;
+    _Atomic uint64_t                   trimmed_epoch;
+    _Atomic bool                       trimming;
+    bool                               items;
+    void                              *owner;
+    hatrack_mem_hook_t                 key_return_hook;
+    hatrack_mem_hook_t                 val_return_hook;
+    hatrack_mem_hook_t                 free_handler;
+    hatrack_backoff_t                  backoff;
+    hatrack_changelog_stripe_t         stripes[HATRACK_CHANGELOG_STRIPES];
+} hatrack_changelog_t;
+
+hatrack_changelog_t *hatrack_changelog_new    (void);
+void                 hatrack_changelog_init   (hatrack_changelog_t *);
+void                 hatrack_changelog_cleanup(hatrack_changelog_t *);
+void                 hatrack_changelog_delete (hatrack_changelog_t *);
+void                 hatrack_changelog_set_hooks(hatrack_changelog_t *,
+						 void *, hatrack_mem_hook_t,
+						 hatrack_mem_hook_t,
+						 hatrack_mem_hook_t, bool);
+void                 hatrack_changelog_lock   (hatrack_changelog_t *,
+					       hatrack_hash_t);
+void                 hatrack_changelog_unlock (hatrack_changelog_t *,
+					       hatrack_hash_t);
+void                 hatrack_changelog_record (hatrack_changelog_t *,
+					       uint32_t, void *, void *);
+hatrack_change_t    *hatrack_changelog_since  (hatrack_changelog_t *,
+					       uint64_t, uint64_t *,
+					       uint64_t *);
+uint64_t             hatrack_changelog_epoch  (hatrack_changelog_t *);
+void                 hatrack_changelog_trim   (hatrack_changelog_t *,
+					       uint64_t);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           cloche.h
+ *  Description:    Compact, Lock-free, Ordered hash table with
+ *                  Cheap Hashed Entries.
+ *
+ *                  A lock-free table that keeps its items in a dense,
+ *                  append-only array, in insertion order, so that
+ *                  views come out ordered without sorting.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __CLOCHE_H__
+#define __CLOCHE_H__
+
+#include <hatrack/hatrack_common.h>
+
+/* All of our other tables that can produce ordered views do so by
+ * stamping each item with an epoch, and then, when asked for a
+ * sorted view, they collect up the buckets and run qsort() over
+ * them. For hatrack_dict_items_sort() and friends, that's an
+ * O(n log n) sort on every single call, even if nothing has changed.
+ *
+ * Cloche takes the approach of Python's "compact" dict: the items
+ * live in an append-only array of entries, in the order they were
+ * inserted. The hash table proper is just an index, an array of
+ * 32-bit slots, each of which holds the position of an entry (plus
+ * one, so that 0 can mean 'empty'). We do our linear probing in the
+ * index, and then look at the entry to check the hash value.
+ *
+ * That gets us two things:
+ *
+ * 1) Views are a single, in-order walk over the entries array. The
+ *    'sort' parameter to cloche_view() is there for vtable
+ *    compatibility, but the result is already in insertion order, so
+ *    we never sort.
+ *
+ * 2) The table is smaller. Since we never let the table get more than
+ *    75% full anyway, the entries array only needs to be 3/4 the size
+ *    of the index. Per index slot, that's 4 bytes for the slot, plus
+ *    24 bytes of entry, for 28 bytes total, instead of the 48 bytes
+ *    per bucket crown uses (32 bytes of hash value and record, plus
+ *    the neighbor map, padded out for alignment).
+ *
+ * The ordering semantics are Python's too: overwriting an item
+ * that's in the table keeps its original position, but if you
+ * remove an item and then add it back, it goes to the end.
+ *
+ * The lock-free bits work like they do in hihat. The record in
+ * each entry is updated with a single 128-bit compare-and-swap, and
+ * migrations are cooperative: writers that notice a migration is
+ * needed mark every entry in the old store as MOVING, and then
+ * help copy entries. Since entries get copied in order, and every
+ * helper can compute where each live entry is going (it's the
+ * number of live entries before it), the new store's entries stay
+ * dense and in order, and deleted entries disappear.
+ *
+ * As with hihat, views are not consistent when there are concurrent
+ * writers.
+ */
+
+/* cloche_record_t
+ *
+ * The item is the item passed to the hash table, and the info field
+ * holds the status bits below. An entry whose info field is zero has
+ * been reserved by a writer, but nothing has been written to it yet.
+ *
+ * CLOCHE_F_USED means the entry holds a live item.
+ *
+ * CLOCHE_F_DELETED means the item was removed. Entries that are
+ * deleted are never reused; if the same key is added back, it gets a
+ * new entry at the end of the array, and the index slot gets pointed
+ * at the new entry.
+ *
+ * CLOCHE_F_MOVING and CLOCHE_F_MOVED have the same meanings as in
+ * hihat.
+ */
+typedef struct {
+    void    *item;
+    uint64_t info;
+} cloche_record_t;
+
+// clang-format off
+enum64(cloche_flag_t,
+       CLOCHE_F_MOVING  = 0x8000000000000000,
+       CLOCHE_F_MOVED   = 0x4000000000000000,
+       CLOCHE_F_USED    = 0x2000000000000000,
+       CLOCHE_F_DELETED = 0x1000000000000000);
+
+/* cloche_entry_t
+ *
+ * As with hihat, the hash value never changes once it's written, so it
+ * can live in a separate atomic variable from the record.
+ */
+typedef struct {
+    _Atomic hatrack_hash_t  hv;
+    _Atomic cloche_record_t record;
+} cloche_entry_t;
+
+typedef struct cloche_store_st cloche_store_t;
+
+/* cloche_store_t
+ *
+ * last_slot  -- The array index of the last slot in the index, as
+ *               with our other tables.
+ *
+ * capacity   -- The number of entries in the entries array, which is
+ *               75% of the number of index slots. When a writer
+ *               needs an entry past the end of the array, it's time
+ *               to migrate.
+ *
+ * next_entry -- The next entry to hand out. Writers that need a new
+ *               entry atomically add one to this. Note that it can
+ *               end up larger than capacity, since writers that
+ *               overshoot don't get to use their entry.
+ *
+ * store_next -- The store we're migrating to, if any, as in hihat.
+ *
+ * entries    -- A pointer to the entries array, which lives in the
+ *               same allocation as the store, right after the index.
+ *
+ * index      -- The index slots. 0 is empty; otherwise, it's one more
+ *               than the position of the entry holding the item that
+ *               hashes here.
+ */
+struct cloche_store_st {
+    alignas(8)
+    uint64_t                  last_slot;
+    uint64_t                  capacity;
+    _Atomic uint64_t          next_entry;
+    _Atomic(cloche_store_t *) store_next;
+    cloche_entry_t           *entries;
+    alignas(16)
+    _Atomic uint32_t          index[];
+};
+
+typedef struct {
+    alignas(8)
+    _Atomic(cloche_store_t *) store_current;
+    _Atomic uint64_t          item_count;
+} cloche_t;
+
+cloche_t       *cloche_new      (void);
+cloche_t       *cloche_new_size (char);
+void            cloche_init     (cloche_t *);
+void            cloche_init_size(cloche_t *, char);
+void            cloche_cleanup  (cloche_t *);
+void            cloche_delete   (cloche_t *);
+void           *cloche_get      (cloche_t *, hatrack_hash_t, bool *);
+void           *cloche_put      (cloche_t *, hatrack_hash_t, void *, bool *);
+void           *cloche_replace  (cloche_t *, hatrack_hash_t, void *, bool *);
+bool            cloche_add      (cloche_t *, hatrack_hash_t, void *);
+void           *cloche_remove   (cloche_t *, hatrack_hash_t, bool *);
+uint64_t        cloche_len      (cloche_t *);
+hatrack_view_t *cloche_view     (cloche_t *, uint64_t *, bool);
+
+#endif
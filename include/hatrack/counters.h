@@ -15,7 +15,8 @@
  *
  *  Name:           counters.h
  *  Description:    In-memory counters for performance monitoring,
- *                  when HATRACK_COUNTERS is on.
+ *                  on unless HATRACK_NO_COUNTERS is defined (see
+ *                  hatrack_config.h).
  *
  *                  When these are off, no counter-related code will
  *                  be generated. For instance, hatomic.h has
@@ -24,26 +25,25 @@
  *                  HATRACK_COUNTERS is not defined, it just compiles
  *                  down to atomic_compare_exchange_strong().
  *
- *                  When they're on, we still do what we can to
- *                  minimize the performance impact, while keeping
- *                  them atomic, using sequentially consistent updates
- *                  (via atomic_fetch_add()), and keeping them in
- *                  statically allocated memory (though, it would be
- *                  better to keep them in dynamic memory, if it's in
- *                  the same cache line as what we're operating on at
- *                  the time).
+ *                  When they're on, every thread increments its own
+ *                  private, cache-line aligned block of counters,
+ *                  with plain (relaxed) loads and stores; since no
+ *                  other thread ever writes to the block, there's no
+ *                  need for a locked instruction, and no cache line
+ *                  ping-pong. Reading the counters walks every
+ *                  thread's block and adds them up, which is slower,
+ *                  but happens rarely.
  *
- *                  Right now, I'm primarily using these to monitor
- *                  CAS success and fail rates, in lock free
- *                  algorithms. And they do add about 80% overhead,
- *                  since I'm putting these counters in critical
- *                  sections and creating a lot of unnecessary cache
- *                  misses.
- *
- *                  Still, even when monitoring every single CAS and
- *                  more, while performance degrades, almost every
- *                  program under the sun could tolerate keeping these
- *                  on all the time.
+ *                  Originally, these were global atomic arrays, and
+ *                  added about 80% overhead when monitoring every
+ *                  CAS, mainly from contention on the counters
+ *                  themselves. With per-thread blocks, the cost is a
+ *                  thread-local load, a branch and an increment,
+ *                  which didn't show up above the noise in the perf
+ *                  harness (see hatrack_config.h for the numbers).
+ *                  So they're on by default, and you can scrape them
+ *                  with hatrack_counters_export(), which can write
+ *                  Prometheus text format or JSON.
  *
  *
  *  Author:         John Viega, john@zork.org
@@ -56,15 +56,18 @@
 #include <hatrack/hatrack_config.h>
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdalign.h>
 #include <stdatomic.h>
 
-#ifdef HATRACK_COUNTERS
-extern _Atomic uint64_t hatrack_counters[];
-extern char            *hatrack_counter_names[];
+typedef enum {
+    HATRACK_COUNTERS_PROMETHEUS,
+    HATRACK_COUNTERS_JSON
+} hatrack_counters_format_t;
 
-extern _Atomic uint64_t hatrack_yn_counters[][2];
-extern char            *hatrack_yn_counter_names[];
+#ifdef HATRACK_COUNTERS
+extern char *hatrack_counter_names[];
+extern char *hatrack_yn_counter_names[];
 
 enum64(hatrack_counter_names_enum,
     HATRACK_CTR_MALLOCS,
@@ -166,10 +169,61 @@ enum64(hatrack_yn_counter_names_enum,
     HATRACK_YN_COUNTERS_NUM
 );
 
+/* Each thread's counters. Blocks are never freed; when a thread
+ * exits (via mmm_clean_up_before_exit()), it marks its block as not
+ * in use, and the next new thread picks it up and keeps counting
+ * where it left off. So nothing gets lost, and the number of blocks
+ * never exceeds the most threads we've had running at once.
+ */
+typedef struct hatrack_ctr_block_st hatrack_ctr_block_t;
+
+struct hatrack_ctr_block_st {
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic uint64_t     counters[HATRACK_COUNTERS_NUM];
+    _Atomic uint64_t     yn_counters[HATRACK_YN_COUNTERS_NUM][2];
+    hatrack_ctr_block_t *next;
+    _Atomic bool         in_use;
+};
+
+extern __thread hatrack_ctr_block_t *hatrack_my_counters;
+
+hatrack_ctr_block_t *hatrack_counters_attach(void);
+void                 hatrack_counters_detach(void);
+void                 hatrack_counters_read  (uint64_t *, uint64_t (*)[2]);
+int                  hatrack_counters_export(int, hatrack_counters_format_t);
+void                 counters_output_delta  (void);
+void                 counters_output_alltime(void);
+
+static inline hatrack_ctr_block_t *
+hatrack_ctr_block(void)
+{
+    if (!hatrack_my_counters) {
+	return hatrack_counters_attach();
+    }
+
+    return hatrack_my_counters;
+}
+
+// Only the owning thread ever writes, so a relaxed load / store is
+// enough; readers might just see a slightly stale value.
+static inline void
+hatrack_ctr_bump(_Atomic uint64_t *slot)
+{
+    atomic_store_explicit(slot,
+			  atomic_load_explicit(slot, memory_order_relaxed) + 1,
+			  memory_order_relaxed);
+}
+
+static inline void
+hatrack_ctr_inc(uint64_t id)
+{
+    hatrack_ctr_bump(&hatrack_ctr_block()->counters[id]);
+}
+
 static inline _Bool
 hatrack_yn_ctr_t(uint64_t id)
 {
-    atomic_fetch_add(&hatrack_yn_counters[id][0], 1);
+    hatrack_ctr_bump(&hatrack_ctr_block()->yn_counters[id][0]);
 
     return 1;
 }
@@ -177,15 +231,12 @@ hatrack_yn_ctr_t(uint64_t id)
 static inline _Bool
 hatrack_yn_ctr_f(uint64_t id)
 {
-    atomic_fetch_add(&hatrack_yn_counters[id][1], 1);
+    hatrack_ctr_bump(&hatrack_ctr_block()->yn_counters[id][1]);
 
     return 0;
 }
 
-void counters_output_delta(void);
-void counters_output_alltime(void);
-
-#define HATRACK_CTR_ON(id) atomic_fetch_add(&hatrack_counters[id], 1)
+#define HATRACK_CTR_ON(id) hatrack_ctr_inc(id)
 #define HATRACK_CTR_OFF(id)
 #define HATRACK_YN_ON(x, id)  ((x) ? hatrack_yn_ctr_t(id) : hatrack_yn_ctr_f(id))
 #define HATRACK_YN_OFF(x, id) (x)
@@ -203,6 +254,13 @@ void counters_output_alltime(void);
 #define HATRACK_YN_OFF_NORET(x, id)
 #define counters_output_delta()
 #define counters_output_alltime()
+#define hatrack_counters_detach()
+
+/* There's nothing to export when the counters are compiled out, but
+ * a scraper that calls this should find out, instead of getting an
+ * empty success; this always fails with ENOTSUP.
+ */
+int hatrack_counters_export(int, hatrack_counters_format_t);
 
 #endif /* defined(HATRACK_COUNTERS) */
 
@@ -28,6 +28,7 @@
 #define __CROWN_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/stats.h>
 
 #ifdef HATRACK_32_BIT_HOP_TABLE
 
@@ -63,16 +64,63 @@ typedef struct {
     _Atomic hatrack_hash_t hv;
     _Atomic crown_record_t record;
     
-#ifdef HATRACK_32_BIT_HOP_TABLE
-    _Atomic uint32_t       neighbor_map;
-#else
-    _Atomic uint64_t       neighbor_map;
-#endif
+    _Atomic hop_t          neighbor_map;
 } crown_bucket_t;
 
 typedef struct crown_store_st crown_store_t;
 
+/* Stores can optionally carry a negative-lookup filter (a blocked
+ * Bloom filter; see crown_filter_add() in crown.c). When 'filter' is
+ * NULL, there isn't one. Otherwise, it points to (filter_mask + 1)
+ * cache-line sized blocks, which live in the same allocation as the
+ * store itself.
+ */
+#define CROWN_FILTER_BLOCK_WORDS     8
+#define CROWN_FILTER_BITS_PER_BUCKET 8 // Must be a power of two.
+
 // clang-format off
+#ifdef HATRACK_CROWN_SOA
+/* In the structure-of-arrays layout (see HATRACK_CROWN_SOA in
+ * hatrack_config.h), we don't use crown_bucket_t at all. Instead, the
+ * three arrays live in the same allocation as the store, after the
+ * header, each starting on a cache line boundary; crown_store_new()
+ * sets up the pointers.
+ */
+struct crown_store_st {
+    alignas(8)
+    uint64_t                  last_slot;
+    uint64_t                  threshold;
+    _Atomic uint64_t          used_count;    
+    _Atomic(crown_store_t *)  store_next;
+    _Atomic bool              claimed;
+    _Atomic uint64_t         *filter;
+    uint64_t                  filter_mask;
+    _Atomic hatrack_hash_t   *hashes;
+    _Atomic hop_t            *neighbor_maps;
+    _Atomic crown_record_t   *records;
+    alignas(16)
+    char                      arrays[];
+};
+
+static inline _Atomic hatrack_hash_t *
+crown_hv_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->hashes[ix];
+}
+
+static inline _Atomic crown_record_t *
+crown_record_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->records[ix];
+}
+
+static inline _Atomic hop_t *
+crown_map_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->neighbor_maps[ix];
+}
+
+#else
 struct crown_store_st {
     alignas(8)
     uint64_t                 last_slot;
@@ -80,17 +128,40 @@ struct crown_store_st {
     _Atomic uint64_t         used_count;    
     _Atomic(crown_store_t *) store_next;
     _Atomic bool             claimed;
+    _Atomic uint64_t        *filter;
+    uint64_t                 filter_mask;
     alignas(16)
     crown_bucket_t           buckets[];
 };
 
+static inline _Atomic hatrack_hash_t *
+crown_hv_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->buckets[ix].hv;
+}
+
+static inline _Atomic crown_record_t *
+crown_record_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->buckets[ix].record;
+}
+
+static inline _Atomic hop_t *
+crown_map_at(crown_store_t *store, uint64_t ix)
+{
+    return &store->buckets[ix].neighbor_map;
+}
+#endif
+
 typedef struct {
     alignas(8)
-    _Atomic(crown_store_t *) store_current;
-    _Atomic uint64_t         item_count;
-    _Atomic uint64_t         help_needed;
-            uint64_t         next_epoch;
-
+    _Atomic(crown_store_t *)     store_current;
+    _Atomic uint64_t             item_count;
+    _Atomic uint64_t             help_needed;
+            uint64_t             next_epoch;
+            bool                 use_filter;
+    _Atomic uint64_t             migrations;
+    _Atomic(hatrack_retired_t *) retired;
 } crown_t;
 
 
@@ -109,13 +180,15 @@ uint64_t        crown_len        (crown_t *);
 hatrack_view_t *crown_view       (crown_t *, uint64_t *, bool);
 hatrack_view_t *crown_view_fast  (crown_t *, uint64_t *, bool);
 hatrack_view_t *crown_view_slow  (crown_t *, uint64_t *, bool);
+void            crown_set_filter (crown_t *, bool);
+void            crown_stats      (crown_t *, hatrack_stats_t *);
 
 /* These need to be non-static because tophat and hatrack_dict both
  * need them, so that they can call in without a second call to
  * MMM. But, they should be considered "friend" functions, and not
  * part of the public API.
  */
-crown_store_t    *crown_store_new    (uint64_t);
+crown_store_t    *crown_store_new    (uint64_t, bool);
 void             *crown_store_get    (crown_store_t *, hatrack_hash_t, bool *);
 void             *crown_store_put    (crown_store_t *, crown_t *,
 				      hatrack_hash_t, void *, bool *, uint64_t);
@@ -125,5 +198,9 @@ bool              crown_store_add    (crown_store_t *, crown_t *,
 				      hatrack_hash_t, void *, uint64_t);
 void             *crown_store_remove (crown_store_t *, crown_t *,
 				      hatrack_hash_t, bool *, uint64_t);
+void              crown_stats_raw    (crown_t *, hatrack_stats_t *);
+crown_store_t    *crown_store_claim  (crown_t *);
+void              crown_store_release(crown_t *, crown_store_t *);
+hatrack_view_t   *crown_store_view   (crown_store_t *, uint64_t *, bool);
 
 #endif
@@ -23,6 +23,8 @@
 #define __HATRACK_DICT_H__
 
 #include <hatrack/crown.h>
+#include <hatrack/backend.h>
+#include <hatrack/changelog.h>
 
 enum
 {
@@ -63,22 +65,62 @@ typedef union {
     hatrack_hash_func_t   custom_hash;
 } hatrack_hash_info_t;
 
+/* Each shard of a sharded dictionary gets its own cache line, so
+ * that threads working on different shards don't fight over each
+ * other's item counts and store pointers.
+ */
+typedef struct {
+    alignas(64) crown_t table;
+} hatrack_dict_shard_t;
+
+/* A consistent view of a sharded dictionary needs every shard frozen
+ * before anyone writes to any of them again; this holds the frozen
+ * store for each shard while that's going on. See
+ * hatrack_dict_sharded_view() in dict.c.
+ */
+typedef struct {
+    uint64_t                 num_shards;
+    _Atomic(crown_store_t *) stores[];
+} hatrack_dict_freeze_t;
+
+/* When backend_vtable is NULL, we're using crown_instance directly,
+ * via the crown_store_* calls. Otherwise, backend_table holds some
+ * other table, which we access through its public API.
+ *
+ * If shard_bits is non-zero, crown_instance goes unused, and keys
+ * are instead spread across (1 << shard_bits) crown tables in
+ * 'shards', based on the top bits of their hash value; see
+ * hatrack_dict_init_sharded() in dict.c.
+ */
 struct hatrack_dict_st {
-    crown_t               crown_instance;
-    hatrack_hash_info_t   hash_info;
-    hatrack_mem_hook_t    free_handler;
-    hatrack_mem_hook_t    key_return_hook;
-    hatrack_mem_hook_t    val_return_hook;    
-    uint32_t              key_type;
-    bool                  slow_views;
-    bool                  sorted_views;    
+    crown_t                          crown_instance;
+    hatrack_vtable_t                *backend_vtable;
+    void                            *backend_table;
+    hatrack_backend_t                backend;
+    hatrack_dict_shard_t            *shards;
+    uint32_t                         shard_bits;
+    _Atomic(hatrack_dict_freeze_t *) freeze;
+    hatrack_hash_info_t              hash_info;
+    hatrack_mem_hook_t               free_handler;
+    hatrack_mem_hook_t               key_return_hook;
+    hatrack_mem_hook_t               val_return_hook;
+    hatrack_changelog_t             *change_log;
+    uint32_t                         key_type;
+    bool                             slow_views;
+    bool                             sorted_views;
 };
 
 // clang-format off
-hatrack_dict_t *hatrack_dict_new    (uint32_t);
-void            hatrack_dict_init   (hatrack_dict_t *, uint32_t);
-void            hatrack_dict_cleanup(hatrack_dict_t *);
-void            hatrack_dict_delete (hatrack_dict_t *);
+hatrack_dict_t *hatrack_dict_new             (uint32_t);
+hatrack_dict_t *hatrack_dict_new_with_backend(uint32_t, hatrack_backend_t);
+void            hatrack_dict_init            (hatrack_dict_t *, uint32_t);
+void            hatrack_dict_init_with_backend(hatrack_dict_t *, uint32_t,
+					       hatrack_backend_t);
+hatrack_dict_t *hatrack_dict_new_sharded     (uint32_t, uint32_t);
+void            hatrack_dict_init_sharded    (hatrack_dict_t *, uint32_t,
+					      uint32_t);
+void            hatrack_dict_cleanup         (hatrack_dict_t *);
+void            hatrack_dict_delete          (hatrack_dict_t *);
 
 void hatrack_dict_set_hash_offset     (hatrack_dict_t *, int32_t);
 void hatrack_dict_set_cache_offset    (hatrack_dict_t *, int32_t);
@@ -90,6 +132,8 @@ void hatrack_dict_set_consistent_views(hatrack_dict_t *, bool);
 void hatrack_dict_set_sorted_views    (hatrack_dict_t *, bool);
 bool hatrack_dict_get_consistent_views(hatrack_dict_t *);
 bool hatrack_dict_get_sorted_views    (hatrack_dict_t *);
+void hatrack_dict_set_change_feed     (hatrack_dict_t *, bool);
+void hatrack_dict_set_miss_filter     (hatrack_dict_t *, bool);
 
 void *hatrack_dict_get    (hatrack_dict_t *, void *, bool *);
 void  hatrack_dict_put    (hatrack_dict_t *, void *, void *);
@@ -97,6 +141,9 @@ bool  hatrack_dict_replace(hatrack_dict_t *, void *, void *);
 bool  hatrack_dict_add    (hatrack_dict_t *, void *, void *);
 bool  hatrack_dict_remove (hatrack_dict_t *, void *);
 
+uint64_t hatrack_dict_len  (hatrack_dict_t *);
+void     hatrack_dict_stats(hatrack_dict_t *, hatrack_stats_t *);
+
 hatrack_dict_key_t   *hatrack_dict_keys         (hatrack_dict_t *, uint64_t *);
 hatrack_dict_value_t *hatrack_dict_values       (hatrack_dict_t *, uint64_t *);
 hatrack_dict_item_t  *hatrack_dict_items        (hatrack_dict_t *, uint64_t *);
@@ -107,4 +154,9 @@ hatrack_dict_key_t   *hatrack_dict_keys_nosort  (hatrack_dict_t *, uint64_t *);
 hatrack_dict_value_t *hatrack_dict_values_nosort(hatrack_dict_t *, uint64_t *);
 hatrack_dict_item_t  *hatrack_dict_items_nosort (hatrack_dict_t *, uint64_t *);
 
+hatrack_change_t *hatrack_dict_changes_since(hatrack_dict_t *, uint64_t,
+					     uint64_t *, uint64_t *);
+uint64_t          hatrack_dict_changes_epoch(hatrack_dict_t *);
+void              hatrack_dict_changes_trim (hatrack_dict_t *, uint64_t);
+
 #endif
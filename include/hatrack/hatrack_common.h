@@ -24,6 +24,7 @@
 #define __HATRACK_COMMON_H__
 
 #include <hatrack/mmm.h>
+#include <hatrack/backoff.h>
 
 /* hatrack_hash_t
  *
@@ -317,6 +317,33 @@
 
 #define HATRACK_RETIRE_FREQ (1 << HATRACK_RETIRE_FREQ_LOG)
 
+/* HATRACK_MMM_POOL_LIMIT
+ *
+ * The most records each thread keeps on its free list for each mmm
+ * pool (see mmm_alloc_pooled() in mmm.h), instead of freeing them.
+ * This is just the default; it can be changed at runtime via the
+ * global mmm_pool_limit. Setting it to 0 turns pooling off, which
+ * makes mmm_alloc_pooled() behave just like mmm_alloc().
+ *
+ * With woolhat records at 72 bytes apiece (including the mmm header),
+ * the default caps the free lists at about 300K per thread.
+ */
+#ifndef HATRACK_MMM_POOL_LIMIT
+#define HATRACK_MMM_POOL_LIMIT 4096
+#endif
+
+/* HATRACK_MMM_CACHE_SLOTS
+ *
+ * How many retired stores each store cache holds onto for reuse (see
+ * mmm_cache_alloc_committed() in mmm.h). Queues that grow by
+ * doubling want a few sizes at once, and segmented queues want a few
+ * segments of the same size in flight, but beyond a handful, we're
+ * mostly just holding memory hostage.
+ */
+#ifndef HATRACK_MMM_CACHE_SLOTS
+#define HATRACK_MMM_CACHE_SLOTS 4
+#endif
+
 /* HIHATa_MIGRATE_SLEEP_TIME_NS
  *
  * The hihat-a variant of the hihat algorithm has late migraters do
@@ -354,7 +381,7 @@
 #define HATRACK_RETRY_THRESHOLD 7
 #endif
 
-/* HATRACK_COUNTERS
+/* HATRACK_COUNTERS / HATRACK_NO_COUNTERS
  *
  * This controls whether the event counters get compiled in or not,
  * which we have used to help better understand the performance
@@ -362,11 +389,25 @@
  * as well as hatomic.h, that has a macro wrapping our
  * compare-and-swap operation.
  *
- * If this variable is off, there is no performance penalty
- * whatsoever.
- *
- */
-// #define HATRACK_COUNTERS
+ * The counters are on unless you define HATRACK_NO_COUNTERS. Each
+ * thread counts into its own block, so there's no contention on the
+ * counters themselves. With the perf harness in tests/ (2M ops over
+ * 100K keys, every table, median of five interleaved runs, on one
+ * core), turning them on moved throughput by anywhere from -20% to
+ * +36% per table, in both directions, which is the run-to-run noise
+ * on that box; the mean was +6.7% for the default read-heavy mix,
+ * and -1.9% for a 50% read / 25% put / 25% remove mix. We haven't
+ * measured a many-core box; if you care about the last few percent
+ * there, measure with and without.
+ *
+ * Use hatrack_counters_export() to get the numbers out. With
+ * HATRACK_NO_COUNTERS, hatrack_counters_export() still exists, but
+ * always fails with ENOTSUP, so that a scraper can't mistake a build
+ * without counters for one where nothing happened.
+ */
+#if !defined(HATRACK_COUNTERS) && !defined(HATRACK_NO_COUNTERS)
+#define HATRACK_COUNTERS
+#endif
 
 /* HATRACK_MMMALLOC_CTRS
  *
@@ -490,6 +531,84 @@
  */
 // #define TOPHAT_USE_LOCKING_ALGORITHMS
 
+/* HATRACK_TOPHAT_CONTENTION_THRESHOLD
+ * HATRACK_TOPHAT_CONTENTION_WINDOW
+ * HATRACK_TOPHAT_QUIET_PERIOD_MS
+ *
+ * Tophat used to migrate to the multi-threaded table the first time
+ * a writer failed to grab the mutex on the first try, and then stay
+ * there forever. But one collision doesn't mean the table is going to
+ * be hammered by multiple writers. It might just be a single helper
+ * thread touching it once at startup, after which we'd pay for the
+ * multi-threaded table for the rest of the run.
+ *
+ * Now, we count how many writes had to wait on the mutex, and only
+ * migrate when that count gets to HATRACK_TOPHAT_CONTENTION_THRESHOLD
+ * within a window of HATRACK_TOPHAT_CONTENTION_WINDOW writes.
+ *
+ * And once we're multi-threaded, if we only see one thread writing
+ * for HATRACK_TOPHAT_QUIET_PERIOD_MS milliseconds, we migrate back to
+ * the single-threaded table. A value of 0 means we never go back.
+ *
+ * The threshold and the quiet period can also be changed per-table,
+ * at runtime; see tophat.h.
+ */
+#ifndef HATRACK_TOPHAT_CONTENTION_THRESHOLD
+#define HATRACK_TOPHAT_CONTENTION_THRESHOLD 8
+#endif
+
+#ifndef HATRACK_TOPHAT_CONTENTION_WINDOW
+#define HATRACK_TOPHAT_CONTENTION_WINDOW 1024
+#endif
+
+#ifndef HATRACK_TOPHAT_QUIET_PERIOD_MS
+#define HATRACK_TOPHAT_QUIET_PERIOD_MS 1000
+#endif
+
+/* HATRACK_QUEUE_WAIT_SPINS
+ *
+ * hq_dequeue_wait() and capq_dequeue_wait() retry this many times
+ * before they go to sleep on a futex (see parking.h). Going to sleep
+ * and getting woken back up costs a couple of system calls, so if
+ * items show up quickly, spinning briefly is cheaper. Set it to 0 to
+ * go straight to sleep.
+ */
+#ifndef HATRACK_QUEUE_WAIT_SPINS
+#define HATRACK_QUEUE_WAIT_SPINS 128
+#endif
+
+/* HATRACK_BACKOFF_DEFAULT
+ *
+ * The strategy retry loops use when a CAS fails, unless it's been
+ * changed at runtime (see backoff.h). The other four values here are
+ * the bounds the exponential strategies start out with: pause
+ * instructions for HATRACK_BACKOFF_SPIN, and nanoseconds for
+ * HATRACK_BACKOFF_SLEEP.
+ *
+ * The sleep range starts at about the cost of the nanosleep() call
+ * itself, and stops at a millisecond, past which we'd rather just
+ * keep retrying than add any more latency.
+ */
+#ifndef HATRACK_BACKOFF_DEFAULT
+#define HATRACK_BACKOFF_DEFAULT HATRACK_BACKOFF_PAUSE
+#endif
+
+#ifndef HATRACK_BACKOFF_SPIN_MIN
+#define HATRACK_BACKOFF_SPIN_MIN 4
+#endif
+
+#ifndef HATRACK_BACKOFF_SPIN_MAX
+#define HATRACK_BACKOFF_SPIN_MAX 1024
+#endif
+
+#ifndef HATRACK_BACKOFF_SLEEP_MIN_NS
+#define HATRACK_BACKOFF_SLEEP_MIN_NS 100
+#endif
+
+#ifndef HATRACK_BACKOFF_SLEEP_MAX_NS
+#define HATRACK_BACKOFF_SLEEP_MAX_NS 1000000
+#endif
+
 /* HATRACK_SEED_SIZE
  *
  * How many bytes to seed our random number generator with??
@@ -560,6 +679,101 @@
 
 // #define HATRACK_COMPILE_ALL_ALGORITHMS
 
+/* HATRACK_DICT_BACKEND
+ * HATRACK_SET_BACKEND
+ *
+ * The backend hash table that hatrack_dict_new() and
+ * hatrack_set_new() use when nobody asks for a specific one (you can
+ * always pick a backend per-object, via the *_new_with_backend()
+ * calls). These are hatrack_backend_t values, from backend.h.
+ *
+ * Crown is the native table for dictionaries, and woolhat is the
+ * native table for sets, and those get a slightly faster path than
+ * the other backends. If you pick something other than those, you
+ * will need HATRACK_COMPILE_ALL_ALGORITHMS too.
+ */
+#ifndef HATRACK_DICT_BACKEND
+#define HATRACK_DICT_BACKEND HATRACK_BACKEND_CROWN
+#endif
+
+#ifndef HATRACK_SET_BACKEND
+#define HATRACK_SET_BACKEND HATRACK_BACKEND_WOOLHAT
+#endif
+
+/* HATRACK_DICT_MAX_SHARD_BITS
+ *
+ * The most shard bits you can ask for in hatrack_dict_new_sharded();
+ * the default allows up to 256 shards. Asking for more aborts.
+ * There's nothing magic about the limit; it's just there to catch
+ * people passing in a shard COUNT instead of a number of bits.
+ */
+#ifndef HATRACK_DICT_MAX_SHARD_BITS
+#define HATRACK_DICT_MAX_SHARD_BITS 8
+#endif
+
+/* HATRACK_SET_PARTS_PER_THREAD_LOG
+ *
+ * The parallel set algebra calls (hatrack_set_union_parallel() and
+ * friends) split the work into partitions by hash value, and worker
+ * threads grab partitions until they run out. This is how many
+ * partitions we make per thread, as a power of two; the default is 4.
+ * More partitions even out the load better when some threads get
+ * less CPU than others, at the cost of a bit more bookkeeping.
+ */
+#ifndef HATRACK_SET_PARTS_PER_THREAD_LOG
+#define HATRACK_SET_PARTS_PER_THREAD_LOG 2
+#endif
+
+/* HATRACK_CHANGELOG_STRIPES_LOG
+ *
+ * When the change feed is on, writes to keys that hash to the same
+ * stripe take turns, so that they land in the log in the same order
+ * the table applied them (see changelog.h). This is how many stripes
+ * each log gets, as a power of two; the default is 64. Each stripe
+ * takes up a cache line.
+ */
+#ifndef HATRACK_CHANGELOG_STRIPES_LOG
+#define HATRACK_CHANGELOG_STRIPES_LOG 6
+#endif
+
+#ifdef HATRACK_CHANGELOG_STRIPES
+#undef HATRACK_CHANGELOG_STRIPES
+#endif
+
+#define HATRACK_CHANGELOG_STRIPES (1 << HATRACK_CHANGELOG_STRIPES_LOG)
+
+/* HATRACK_OMAP_MAX_HEIGHT
+ *
+ * The tallest a node in a hatrack_omap skiplist can get. Heights are
+ * random, with each level holding about half the nodes of the one
+ * below it, so this should be at least the log base 2 of the most
+ * items you expect in a single map; past that, searches start to
+ * slow down. Each level costs 8 bytes on the stack for every write.
+ */
+#ifndef HATRACK_OMAP_MAX_HEIGHT
+#define HATRACK_OMAP_MAX_HEIGHT 32
+#endif
+
+/* HATRACK_SKIPQ_MAX_HEIGHT
+ *
+ * The same thing, for the skiplists inside skipq, our priority queue.
+ */
+#ifndef HATRACK_SKIPQ_MAX_HEIGHT
+#define HATRACK_SKIPQ_MAX_HEIGHT 32
+#endif
+
+/* HATRACK_SKIPQ_DEFAULT_LISTS
+ *
+ * How many skiplists a relaxed skipq gets when you don't say. The
+ * more lists, the less the threads fight over the front of any one
+ * of them, but the further from the true minimum a dequeue can be.
+ * A couple of lists per thread that will be using the queue is about
+ * right.
+ */
+#ifndef HATRACK_SKIPQ_DEFAULT_LISTS
+#define HATRACK_SKIPQ_DEFAULT_LISTS 8
+#endif
+
 /* HATRACK_MAX_HATS
  *
  * testhat has an interface to "register" algorithms, and then
@@ -606,6 +820,34 @@
  */
 // #define HATRACK_SKIP_ON_MIGRATIONS
 
+/* HATRACK_CROWN_SOA
+ *
+ * By default, each crown bucket keeps its hash value, its record and
+ * its neighborhood map right next to each other. That's 40 bytes per
+ * bucket, so buckets regularly straddle cache lines, and every bucket
+ * we probe drags its record into the cache along with it, even
+ * though we only need the record from the bucket that matches.
+ *
+ * Defining this switches crown stores to a "structure of arrays"
+ * layout instead: one cache-line aligned array of hash values, one
+ * of neighborhood maps, and one of records. Probing a neighborhood
+ * then only touches hash lines until we find our match.
+ *
+ * Which one wins depends on the table size and your cache sizes;
+ * tests/test --run-default-tests includes a set of crown layout
+ * benchmarks, so build once each way and compare.
+ */
+// #define HATRACK_CROWN_SOA
+
+/* HATRACK_CACHE_LINE_SIZE
+ *
+ * What we assume the cache line size is, when we care about lining
+ * things up with cache lines.
+ */
+#ifndef HATRACK_CACHE_LINE_SIZE
+#define HATRACK_CACHE_LINE_SIZE 64
+#endif
+
 /* QUEUE_HELP_STEPS
  *
  * The "bonus" directory has a fast, wait-free queue
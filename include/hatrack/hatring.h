@@ -48,8 +48,15 @@
 #include <stdatomic.h>
 #include <time.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/backoff.h>
+#include <hatrack/hatomic.h>
 
 
+/* The cell state holds the HATRING_ENQUEUED / HATRING_DEQUEUED flags
+ * in the top two bits, and the epoch the cell was last written in,
+ * in the other 62.  That's plenty; at 40M enqueues a second, it'd
+ * take thousands of years before the epoch ran into the flags.
+ */
 typedef struct {
     void    *item;
     uint64_t state;
@@ -65,23 +72,54 @@ typedef struct {
     void     *cells[];
 } hatring_view_t;
 
+/* The write (enqueue) and read (dequeue) epochs are each a 64-bit
+ * word of their own, and each side bumps its own epoch with a plain
+ * 64-bit FAA, which is a single instruction on the platforms we care
+ * about.
+ *
+ * They used to be two 32-bit epochs in one 64-bit word, so that one
+ * FAA bumped one epoch and returned a consistent snapshot of both.
+ * But a busy ring would wrap 32-bit epochs in a couple of minutes,
+ * and once they wrapped, the comparisons all over hatring.c would go
+ * wrong. Packing two 64-bit epochs into a 128-bit word doesn't work
+ * either, since there's no 128-bit FAA (or even a plain 128-bit load);
+ * the compiler turns each one into a cmpxchg16b loop, and the ring
+ * would no longer be wait-free.
+ *
+ * Nothing actually needs both epochs from the same instant, though.
+ * Both only ever go up, so when we read the read epoch first, and the
+ * write epoch second, the write epoch is at least as new as the read
+ * epoch; if they say the ring is empty, it really was empty when we
+ * read the read epoch. Everything else that looks at both (views,
+ * and the checks in enqueue and dequeue for whether the other side
+ * got ahead of us) only needs a read epoch that's no newer than the
+ * write epoch, which this gives us. hatring_epochs_t is such a
+ * snapshot; hatring_get_epochs() takes one.
+ */
 typedef struct {
-    alignas(16)
-    _Atomic uint64_t             epochs;
+    uint64_t read_epoch;
+    uint64_t write_epoch;
+} hatring_epochs_t;
+
+typedef struct {
+    _Atomic uint64_t             write_epoch;
+    _Atomic uint64_t             read_epoch;
     hatring_drop_handler         drop_handler;
     uint64_t                     last_slot;
     uint64_t                     size;
+    hatrack_backoff_t            backoff;
+    alignas(16)
     hatring_cell_t               cells[];
 } hatring_t;
 
 enum {
     HATRING_ENQUEUED = 0x8000000000000000,
     HATRING_DEQUEUED = 0x4000000000000000,
-    HATRING_MASK     = 0xcfffffffffffffff
+    HATRING_MASK     = 0x3fffffffffffffff
 };
 
 static inline bool
-hatring_is_lagging(uint32_t read_epoch, uint32_t write_epoch, uint64_t size)
+hatring_is_lagging(uint64_t read_epoch, uint64_t write_epoch, uint64_t size)
 {
     if (read_epoch + size < write_epoch) {
 	return true;
@@ -90,28 +128,33 @@ hatring_is_lagging(uint32_t read_epoch, uint32_t write_epoch, uint64_t size)
     return false;
 }
 
-static inline uint32_t
-hatring_enqueue_epoch(uint64_t ptrs)
+static inline hatring_epochs_t
+hatring_get_epochs(hatring_t *self)
 {
-    return (uint32_t)(ptrs >> 32);
+    hatring_epochs_t ret;
+
+    ret.read_epoch  = atomic_read(&self->read_epoch);
+    ret.write_epoch = atomic_read(&self->write_epoch);
+
+    return ret;
 }
 
-static inline uint32_t
-hatring_dequeue_epoch(uint64_t ptrs)
+static inline uint64_t
+hatring_enqueue_epoch(hatring_epochs_t epochs)
 {
-    return (uint32_t)(ptrs & 0x00000000ffffffff);
+    return epochs.write_epoch;
 }
 
-static inline uint32_t
-hatring_dequeue_ix(uint64_t epochs, uint32_t last_slot)
+static inline uint64_t
+hatring_dequeue_epoch(hatring_epochs_t epochs)
 {
-    return (uint32_t)(epochs & last_slot);
+    return epochs.read_epoch;
 }
     
-static inline uint32_t
+static inline uint64_t
 hatring_cell_epoch(uint64_t state)
 {
-    return (uint32_t)(state & 0x00000000ffffffff);
+    return state & HATRING_MASK;
 }
 
 static inline bool
@@ -119,22 +162,37 @@ hatring_is_enqueued(uint64_t state) {
     return state & HATRING_ENQUEUED;
 }
 
-static inline uint64_t
-hatring_fixed_epoch(uint32_t write_epoch, uint64_t store_size)
+/* Sets both epochs. Only for use before any other thread can see the
+ * ring (hatring_new() and hatring_init() start them both at the ring
+ * size; see hatring.c).
+ */
+static inline void
+hatring_set_epochs(hatring_t *self, uint64_t epoch)
 {
-    return (((uint64_t)write_epoch) << 32) | (write_epoch - store_size);
+    atomic_store(&self->write_epoch, epoch);
+    atomic_store(&self->read_epoch, epoch);
+
+    return;
 }
 
 hatring_t      *hatring_new             (uint64_t);
 void            hatring_init            (hatring_t *, uint64_t);
 void            hatring_cleanup         (hatring_t *);
 void            hatring_delete          (hatring_t *);
-uint32_t        hatring_enqueue         (hatring_t *, void *);
+uint64_t        hatring_enqueue         (hatring_t *, void *);
 void           *hatring_dequeue         (hatring_t *, bool *);
-void           *hatring_dequeue_w_epoch (hatring_t *, bool *, uint32_t *);
+void           *hatring_dequeue_w_epoch (hatring_t *, bool *, uint64_t *);
 hatring_view_t *hatring_view            (hatring_t *);
 void           *hatring_view_next       (hatring_view_t *, bool *);
 void            hatring_view_delete     (hatring_view_t *);
 void            hatring_set_drop_handler(hatring_t *, hatring_drop_handler);
+
+static inline void
+hatring_set_backoff(hatring_t *self, const hatrack_backoff_t *config)
+{
+    self->backoff = *config;
+
+    return;
+}
 			 
 #endif
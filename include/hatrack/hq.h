@@ -38,6 +38,9 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/parking.h>
+#include <hatrack/backoff.h>
+#include <hatrack/mmm.h>
 
 
 // clang-format off
@@ -57,20 +60,47 @@ typedef struct {
     hq_store_t *store;
 } hq_view_t;
     
+/* Enqueuers hammer enqueue_index, and dequeuers hammer
+ * dequeue_index, so we pad them out to keep them on separate cache
+ * lines. Otherwise, every enqueue invalidates the line every dequeuer
+ * is using, and vice versa.
+ */
 struct hq_store_t {
     alignas(8)
     _Atomic (hq_store_t *)next_store;
     uint64_t              size;
+    _Atomic bool          claimed;
     _Atomic uint64_t      enqueue_index;
+    char                  enqueue_pad[HATRACK_CACHE_LINE_SIZE - 8];
     _Atomic uint64_t      dequeue_index;
-    _Atomic bool          claimed;
+    char                  dequeue_pad[HATRACK_CACHE_LINE_SIZE - 8];
+    alignas(16)
     hq_cell_t             cells[];
 };
 
+/* 'parking' is where hq_dequeue_wait() sleeps when the queue is
+ * empty, and 'space' is where enqueuers on a bounded queue sleep when
+ * it's full; see parking.h.
+ *
+ * 'capacity' is 0 for a regular, growable queue. For a bounded queue
+ * (see hq_new_bounded()), it's the size of the one and only store.
+ *
+ * 'store_cache' holds on to retired stores for reuse (see
+ * mmm_cache_alloc_committed() in mmm.h). Bounded queues don't have
+ * one, since they never replace their store.
+ *
+ * 'backoff' is what we do when we lose a race for a cell; see
+ * backoff.h.
+ */
 typedef struct {
     alignas(8)
     _Atomic (hq_store_t *)store;
     _Atomic int64_t       len;
+    uint64_t              capacity;
+    hatrack_parking_t     parking;
+    hatrack_parking_t     space;
+    mmm_cache_t          *store_cache;
+    hatrack_backoff_t     backoff;
 } hq_t;
 
 enum {
@@ -89,17 +119,38 @@ hq_len(hq_t *self)
     return atomic_read(&self->len);
 }
 
-hq_t      *hq_new        (void);
-hq_t      *hq_new_size   (uint64_t);
-void       hq_init       (hq_t *);
-void       hq_init_size  (hq_t *, uint64_t);
-void       hq_cleanup    (hq_t *);
-void       hq_delete     (hq_t *);
-void       hq_enqueue    (hq_t *, void *);
-void      *hq_dequeue    (hq_t *, bool *);
-hq_view_t *hq_view       (hq_t *);
-void      *hq_view_next  (hq_view_t *, bool *);
-void       hq_view_delete(hq_view_t *);
+static inline bool
+hq_is_bounded(hq_t *self)
+{
+    return self->capacity != 0;
+}
+
+static inline void
+hq_set_backoff(hq_t *self, const hatrack_backoff_t *config)
+{
+    self->backoff = *config;
+
+    return;
+}
+
+hq_t      *hq_new         (void);
+hq_t      *hq_new_size    (uint64_t);
+hq_t      *hq_new_bounded (uint64_t);
+void       hq_init        (hq_t *);
+void       hq_init_size   (hq_t *, uint64_t);
+void       hq_init_bounded(hq_t *, uint64_t);
+void       hq_cleanup     (hq_t *);
+void       hq_delete      (hq_t *);
+void       hq_enqueue     (hq_t *, void *);
+bool       hq_try_enqueue (hq_t *, void *);
+bool       hq_enqueue_wait(hq_t *, void *, int64_t);
+void      *hq_dequeue     (hq_t *, bool *);
+void      *hq_dequeue_wait(hq_t *, bool *, int64_t);
+void       hq_enqueue_many(hq_t *, void **, uint64_t);
+uint64_t   hq_dequeue_many(hq_t *, void **, uint64_t);
+hq_view_t *hq_view        (hq_t *);
+void      *hq_view_next   (hq_view_t *, bool *);
+void       hq_view_delete (hq_view_t *);
 
 static inline bool
 hq_cell_too_slow(hq_item_t item)
@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hq_mpsc.h
+ *  Description:    A multi-producer, single-consumer variant of hq.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * With a single consumer, most of what makes hq complicated goes
+ * away. Nobody ever competes with the consumer for a cell, so there's
+ * no need for the consumer to mark cells as too slow, and no need for
+ * a 128-bit compare-and-swap. Producers still need to coordinate with
+ * each other, but an FAA to claim a cell is enough for that.
+ *
+ * Since producers can finish writing their cells out of order, the
+ * consumer can't just compare its index against the tail, the way it
+ * can in the SPSC queue. Instead, each cell has a 'ready' flag, which
+ * the producer sets with a release store after writing the item. The
+ * consumer does an acquire load of the flag, and if it's not set, the
+ * queue is empty, as far as the consumer is concerned (even if some
+ * faster producer has finished writing a later cell). The consumer
+ * never reads any index the producers write, so there's nothing to
+ * cache there, and it only publishes its own index for the benefit of
+ * hq_mpsc_len().
+ *
+ * Instead of a ring, the queue is a linked list of fixed-size
+ * segments, each used exactly once. Producers that claim an index
+ * past the end of their segment help link in the next segment, and
+ * then retry there. The consumer moves to the next segment once it
+ * has read every cell in the current one, and retires the old segment
+ * through mmm, since producers may still be looking at it. Segments
+ * never get reused, so there's no way for a producer to write into a
+ * cell the consumer hasn't read yet; the queue grows without any
+ * copying.
+ *
+ * Using this with more than one consumer will not end well.
+ */
+
+#ifndef __HQ_MPSC_H__
+#define __HQ_MPSC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <hatrack/hatrack_config.h>
+
+// clang-format off
+typedef struct {
+    void          *item;
+    _Atomic bool   ready;
+} hq_mpsc_cell_t;
+
+typedef struct hq_mpsc_segment_st hq_mpsc_segment_t;
+
+/* base is the index of the first cell in this segment, counting from
+ * the start of the queue.
+ */
+struct hq_mpsc_segment_st {
+    _Atomic (hq_mpsc_segment_t *) next;
+    uint64_t                      size;
+    uint64_t                      base;
+    _Atomic uint64_t              enqueue_index;
+    hq_mpsc_cell_t                cells[];
+};
+
+/* The first cache line is shared by the producers; the second belongs
+ * to the consumer.
+ */
+typedef struct {
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic (hq_mpsc_segment_t *) enqueue_segment;
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic uint64_t              head;
+    hq_mpsc_segment_t            *dequeue_segment;
+} hq_mpsc_t;
+
+hq_mpsc_t *hq_mpsc_new         (void);
+hq_mpsc_t *hq_mpsc_new_size    (uint64_t);
+void       hq_mpsc_init        (hq_mpsc_t *);
+void       hq_mpsc_init_size   (hq_mpsc_t *, uint64_t);
+void       hq_mpsc_cleanup     (hq_mpsc_t *);
+void       hq_mpsc_delete      (hq_mpsc_t *);
+void       hq_mpsc_enqueue     (hq_mpsc_t *, void *);
+void      *hq_mpsc_dequeue     (hq_mpsc_t *, bool *);
+void       hq_mpsc_enqueue_many(hq_mpsc_t *, void **, uint64_t);
+uint64_t   hq_mpsc_dequeue_many(hq_mpsc_t *, void **, uint64_t);
+int64_t    hq_mpsc_len         (hq_mpsc_t *);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hq_spsc.h
+ *  Description:    A single-producer, single-consumer variant of hq.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * hq is a general-purpose queue, and it pays for it: every cell
+ * operation is a 128-bit compare-and-swap, and there's machinery for
+ * dealing with enqueuers that are too slow, and for helping with
+ * migrations. When there's exactly one thread enqueuing, and exactly
+ * one thread dequeuing, none of that is necessary.
+ *
+ * This queue is the classic SPSC ring. The producer owns the tail
+ * index, and the consumer owns the head index, and each of them lives
+ * on its own cache line. Cells are plain pointers; the producer writes
+ * the cell, then publishes the tail with a release store, and the
+ * consumer picks up the tail with an acquire load before reading the
+ * cell. Freeing up cells works the same way, in the other direction.
+ *
+ * Each side also keeps a cached copy of the other side's index, and
+ * only goes back to the shared copy when the cached value says the
+ * queue is full (or empty). That way, in the common case, neither
+ * side touches the other side's cache line at all.
+ *
+ * hq_spsc_enqueue_many() and hq_spsc_dequeue_many() go one step
+ * further, publishing their index once per batch, instead of once per
+ * item.
+ *
+ * Like hq, the queue grows instead of failing when it fills up. Since
+ * only the producer writes into the ring, growing doesn't require any
+ * copying; the producer just starts a new ring, twice the size,
+ * linked off the old one. Indices keep counting up across rings, so
+ * the consumer knows it's done with the old ring when its head index
+ * hits the first index of the new ring, at which point it frees the
+ * old ring, since the producer has already stopped looking at it.
+ *
+ * Using this with more than one producer or more than one consumer
+ * will not end well.
+ */
+
+#ifndef __HQ_SPSC_H__
+#define __HQ_SPSC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <hatrack/hatrack_config.h>
+
+// clang-format off
+typedef struct hq_spsc_ring_st hq_spsc_ring_t;
+
+/* base is the index of the first item written into this ring. The
+ * cell for index i is cells[i & (size - 1)].
+ */
+struct hq_spsc_ring_st {
+    _Atomic (hq_spsc_ring_t *) next;
+    uint64_t                   size;
+    uint64_t                   base;
+    void                      *cells[];
+};
+
+/* The first cache line belongs to the producer, and the second to the
+ * consumer. The cached indices are only ever touched by their owners.
+ *
+ * The producer's cached_head is the larger of the consumer's head (as
+ * of the last time we looked), and the base of the producer's ring,
+ * since anything below the base lives in an older ring, and doesn't
+ * take up any room in ours.
+ */
+typedef struct {
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic uint64_t  tail;
+    hq_spsc_ring_t   *enqueue_ring;
+    uint64_t          cached_head;
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic uint64_t  head;
+    hq_spsc_ring_t   *dequeue_ring;
+    uint64_t          cached_tail;
+} hq_spsc_t;
+
+hq_spsc_t *hq_spsc_new         (void);
+hq_spsc_t *hq_spsc_new_size    (uint64_t);
+void       hq_spsc_init        (hq_spsc_t *);
+void       hq_spsc_init_size   (hq_spsc_t *, uint64_t);
+void       hq_spsc_cleanup     (hq_spsc_t *);
+void       hq_spsc_delete      (hq_spsc_t *);
+void       hq_spsc_enqueue     (hq_spsc_t *, void *);
+void      *hq_spsc_dequeue     (hq_spsc_t *, bool *);
+void       hq_spsc_enqueue_many(hq_spsc_t *, void **, uint64_t);
+uint64_t   hq_spsc_dequeue_many(hq_spsc_t *, void **, uint64_t);
+
+static inline int64_t
+hq_spsc_len(hq_spsc_t *self)
+{
+    uint64_t head;
+
+    head = atomic_load_explicit(&self->head, memory_order_acquire);
+
+    return atomic_load_explicit(&self->tail, memory_order_acquire) - head;
+}
+
+#endif
@@ -144,6 +144,27 @@
  *  people to be able to scan either forward or backward through the
  *  ring (knowing there may be dequeues and enqueues that impact us).
  *
+ *  Since the interesting part of an enqueue happens around step 2,
+ *  and the interesting part of a dequeue happens around step 3, we
+ *  can also hand those steps to the caller, and avoid a copy on each
+ *  side:
+ *
+ *  - logring_reserve() does step 1, and returns a pointer to the
+ *    slot's data, so the caller can format a message right into
+ *    it. logring_commit() does steps 3 through 5.
+ *
+ *  - logring_dequeue_inplace() does steps 1 and 2, and returns a
+ *    pointer to the slot's data. logring_release() does step 4.
+ *
+ *  While a thread holds on to a slot either way, no enqueuer can
+ *  reuse it, so don't hold on too long, and don't hold more than one
+ *  of each at a time per thread; the extra slots in L only account
+ *  for one operation per thread. A slot reserved for an enqueue isn't
+ *  in R yet, so dequeuers and views won't see it until it's been
+ *  committed. A slot lent out by logring_dequeue_inplace() can still
+ *  be copied out by a view that's in progress, but it's already been
+ *  dequeued, so nobody else can dequeue it.
+ *
  *  Author:         John Viega, john@zork.org
  */
 
@@ -153,8 +174,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include <time.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/hatring.h>
 
 #define LOGRING_MIN_SIZE 64
 
@@ -171,17 +194,24 @@ typedef struct {
 // A "view" object, where we copy contents from the big array, for
 // iteration.
 typedef struct {
-    uint64_t             start_epoch;
+    hatring_epochs_t     start_epoch;
     uint64_t             next_ix;
     _Atomic uint64_t     num_cells;
     logring_view_entry_t cells[];
 } logring_view_t;
 
-// Atomically swapped metadata about entries in the big array.
+/* Atomically swapped metadata about entries in the big array.
+ *
+ * The write epoch is the ring's write epoch, which is a full 64 bits
+ * now, so to keep this at 128 bits (so we can still CAS it), the
+ * state and the view id share the other word. The state only needs a
+ * handful of bits, and we'd need 2^56 views before the view id
+ * wrapped.
+ */
 typedef struct {
-    uint32_t        write_epoch;
-    uint32_t        state;
-    uint64_t        view_id;
+    uint64_t        write_epoch;
+    uint64_t        state   : 8;
+    uint64_t        view_id : 56;
 } logring_entry_info_t;
 
 // Entries in the bigger array.
@@ -226,7 +256,7 @@ logring_entry_is_being_used(logring_entry_info_t info)
 }
 
 static inline bool
-logring_current_entry_epoch(logring_entry_info_t info, uint32_t my_epoch)
+logring_current_entry_epoch(logring_entry_info_t info, uint64_t my_epoch)
 {
     if (info.write_epoch == my_epoch) {
 	return true;
@@ -236,7 +266,7 @@ logring_current_entry_epoch(logring_entry_info_t info, uint32_t my_epoch)
 }
 
 static inline bool
-logring_can_write_here(logring_entry_info_t info, uint32_t my_write_epoch)
+logring_can_write_here(logring_entry_info_t info, uint64_t my_write_epoch)
 {
     if (logring_entry_is_being_used(info)) {
 	return false;
@@ -250,7 +280,7 @@ logring_can_write_here(logring_entry_info_t info, uint32_t my_write_epoch)
 }
 
 static inline bool
-logring_can_dequeue_here(logring_entry_info_t info, uint32_t expected_epoch)
+logring_can_dequeue_here(logring_entry_info_t info, uint64_t expected_epoch)
 {
     if (info.write_epoch > expected_epoch) {
 	return false;
@@ -260,7 +290,7 @@ logring_can_dequeue_here(logring_entry_info_t info, uint32_t expected_epoch)
 }
 
 static inline hatring_cell_t *
-logring_get_ringcell(logring_t *self, uint32_t ix)
+logring_get_ringcell(logring_t *self, uint64_t ix)
 {
     return &self->ring->cells[ix & self->ring->last_slot];
 }
@@ -275,20 +305,32 @@ logring_get_entry(logring_t *self, uint64_t ix)
     return (logring_entry_t *)&(((char *)self->entries)[byte_ix]);
 }
 
+// Goes from a pointer we handed out back to the entry it lives in.
+static inline logring_entry_t *
+logring_get_entry_from_data(void *data)
+{
+    return (logring_entry_t *)(((char *)data)
+			       - offsetof(logring_entry_t, data));
+}
+
 static inline uint64_t
 logring_set_dequeue_done(uint64_t state)
 {
     return state & ~(LOGRING_DEQUEUE_RESERVE|LOGRING_ENQUEUE_DONE);
 }
 
-logring_t      *logring_new        (uint64_t, uint64_t);
-void            logring_init       (logring_t *, uint64_t, uint64_t);
-void            logring_cleanup    (logring_t *);
-void            logring_delete     (logring_t *);
-void            logring_enqueue    (logring_t *, void *, uint64_t);
-bool            logring_dequeue    (logring_t *, void *, uint64_t *);
-logring_view_t *logring_view       (logring_t *, bool);
-void           *logring_view_next  (logring_view_t *, uint64_t *);
-void            logring_view_delete(logring_view_t *);
+logring_t      *logring_new            (uint64_t, uint64_t);
+void            logring_init           (logring_t *, uint64_t, uint64_t);
+void            logring_cleanup        (logring_t *);
+void            logring_delete         (logring_t *);
+void            logring_enqueue        (logring_t *, void *, uint64_t);
+bool            logring_dequeue        (logring_t *, void *, uint64_t *);
+void           *logring_reserve        (logring_t *, uint64_t);
+void            logring_commit         (logring_t *, void *, uint64_t);
+void           *logring_dequeue_inplace(logring_t *, uint64_t *);
+void            logring_release        (logring_t *, void *);
+logring_view_t *logring_view           (logring_t *, bool);
+void           *logring_view_next      (logring_view_t *, uint64_t *);
+void            logring_view_delete    (logring_view_t *);
 
 #endif
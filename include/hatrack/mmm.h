@@ -45,6 +45,7 @@ typedef void (*mmm_cleanup_func)(void *, void *);
 
 typedef struct mmm_header_st    mmm_header_t;
 typedef struct mmm_free_tids_st mmm_free_tids_t;
+typedef struct mmm_cache_st     mmm_cache_t;
 
 /* We don't want to keep reservation space for threads that don't need
  * it, so we issue a threadid for each thread to keep locally, which
@@ -60,6 +61,7 @@ typedef struct mmm_free_tids_st mmm_free_tids_t;
 // clang-format off
 extern __thread int64_t        mmm_mytid;
 extern __thread pthread_once_t mmm_inited;
+extern __thread uint64_t       mmm_nesting;
 extern _Atomic  uint64_t       mmm_epoch;
 extern          uint64_t       mmm_reservations[HATRACK_THREADS_MAX];
 
@@ -97,6 +99,99 @@ void mmm_reset_tids          (void);
 void mmm_retire              (void *);
 void mmm_clean_up_before_exit(void);
 
+/* Pooled allocations.
+ *
+ * Tables like woolhat allocate a small record for every write, and
+ * retire the record it replaces, so under an update-heavy load, they
+ * call malloc() and free() as often as they write. For those, a
+ * table can register a pool for its record size, and then allocate
+ * with mmm_alloc_pooled() instead of mmm_alloc().
+ *
+ * Pooled records get retired the normal way (mmm_retire() or
+ * mmm_retire_unused()), and when mmm would otherwise free one, it
+ * instead puts it on a per-thread free list for its pool, up to
+ * mmm_pool_limit records per pool (the rest get freed). The next
+ * mmm_alloc_pooled() on that thread takes one off the list, instead
+ * of calling malloc(). Since the records only go back on the list
+ * once no reservation could still see them, this is exactly as safe
+ * as freeing them.
+ *
+ * Each pooled record needs to remember which pool it belongs to.
+ * The 'next' field of the header is only used once a record is
+ * retired, and headers are 16-byte aligned, so we keep the pool id in
+ * the low bits of 'next', and mask them off when walking the retire
+ * list. That limits us to MMM_POOLS_MAX pools, which is plenty, since
+ * pools are per-size, not per-table.
+ *
+ * mmm_pool_counts() returns how many pooled allocations the calling
+ * thread has satisfied from its free lists vs. from malloc(); it's
+ * for benchmarking.
+ *
+ * The highest id is reserved for allocations that come from an
+ * mmm_cache_t (see below), rather than a pool.
+ */
+#define MMM_POOL_ID_MASK 0x0f
+#define MMM_CACHE_ID     MMM_POOL_ID_MASK
+#define MMM_POOLS_MAX    (MMM_POOL_ID_MASK - 1)
+
+extern uint64_t mmm_pool_limit;
+
+uint64_t mmm_pool_register    (uint64_t);
+void    *mmm_alloc_pooled     (uint64_t);
+void     mmm_pool_return      (mmm_header_t *);
+void     mmm_pool_counts      (uint64_t *, uint64_t *);
+
+/* Store caches.
+ *
+ * Pools are no help for the big stuff, like the stores and segments
+ * our queues and stacks allocate when they grow or move. Those come
+ * in all sizes, they can be megabytes apiece, and a per-thread free
+ * list would hang onto them on whatever thread happened to free
+ * them. But a queue that keeps going from empty to a burst and back
+ * tends to want the same few sizes over and over, and it's a shame to
+ * hand a multi-megabyte store back to the system, only to have to
+ * fault in a fresh one a moment later.
+ *
+ * So instead, each structure can keep its own cache of a few
+ * (HATRACK_MMM_CACHE_SLOTS) allocations. Allocations made with
+ * mmm_cache_alloc_committed() get retired the normal way, but when
+ * mmm would otherwise free one, it goes back into the cache it came
+ * from, if there's room. The next allocation from that cache of
+ * about the same size (we don't hand out anything more than 50%
+ * bigger than what was asked for) takes it back out, zeroes it, and
+ * skips the allocator. As with pools, nothing goes back into the
+ * cache until no reservation could still see it.
+ *
+ * The catch is that retired allocations can outlive the structure
+ * that allocated them, sitting on some thread's retire list. So the
+ * cache is reference counted: every allocation that's out holds a
+ * reference, as does the structure. When the structure is done, it
+ * calls mmm_cache_release(), which empties the cache, and drops its
+ * reference. From then on, anything that comes back gets freed, and
+ * whoever drops the last reference frees the cache.
+ *
+ * The cache pointer lives in the header's cleanup_aux field, so
+ * cached allocations can't have cleanup handlers.
+ */
+typedef struct {
+    mmm_header_t *cell;
+    uint64_t      size;
+} mmm_cache_slot_t;
+
+struct mmm_cache_st {
+    _Atomic mmm_cache_slot_t slots[HATRACK_MMM_CACHE_SLOTS];
+    _Atomic uint64_t         refs;
+    _Atomic bool             closed;
+    _Atomic uint64_t         hits;
+    _Atomic uint64_t         misses;
+};
+
+mmm_cache_t *mmm_cache_new            (void);
+void         mmm_cache_release        (mmm_cache_t *);
+void        *mmm_cache_alloc_committed(mmm_cache_t *, uint64_t);
+void         mmm_cache_return         (mmm_header_t *);
+void         mmm_cache_counts         (mmm_cache_t *, uint64_t *, uint64_t *);
+
 #ifdef HATRACK_DEBUG
 static inline void hatrack_debug_mmm(void *, char *);
 
@@ -455,11 +550,28 @@ hatrack_debug_mmm(void *addr, char *msg)
  * possible to the threading environment, we'll go ahead and pay the
  * (admittedly very small) cost of the implied test with each
  * operation.
+ *
+ * Operations are allowed to nest. For instance, hatrack_dict can sit
+ * on top of any table we've got, and it needs to keep its own items
+ * alive while it calls into the table's public API, which will
+ * start (and end) an operation of its own. Without some care, the
+ * inner mmm_end_op() would drop the outer reservation out from
+ * underneath the caller.
+ *
+ * So we keep a thread-local nesting count, and only the outermost
+ * operation touches the reservations array. The outer reservation is
+ * always at least as old as anything an inner operation would have
+ * reserved, so keeping it is the conservative choice.
  */
 static inline void
 mmm_start_basic_op(void)
 {
     pthread_once(&mmm_inited, mmm_register_thread);
+
+    if (mmm_nesting++) {
+        return;
+    }
+
     mmm_reservations[mmm_mytid] = atomic_load(&mmm_epoch);
 
     return;
@@ -515,6 +627,11 @@ mmm_start_basic_op(void)
  *    our read epoch, and we will not read. As part of our helping, we
  *    bump the write epoch, as all writes must occur on an epoch
  *    boundary, with only one write per epoch.
+ *
+ * When nested inside another operation, we leave the (older)
+ * reservation alone, and just hand back a fresh read epoch; the
+ * argument above only needs the reservation to be no later than the
+ * read epoch.
  */
 static inline uint64_t
 mmm_start_linearized_op(void)
@@ -523,6 +640,10 @@ mmm_start_linearized_op(void)
 
     pthread_once(&mmm_inited, mmm_register_thread);
 
+    if (mmm_nesting++) {
+        return atomic_load(&mmm_epoch);
+    }
+
     mmm_reservations[mmm_mytid] = atomic_load(&mmm_epoch);
     read_epoch                  = atomic_load(&mmm_epoch);
 
@@ -538,7 +659,8 @@ mmm_start_linearized_op(void)
  *    is ordered AFTER everything that came before it.
  *
  * 2) Removes our reservation, indicating we are no longer performing
- *    a data structure operation.
+ *    a data structure operation (unless we're ending a nested
+ *    operation, in which case the outer operation keeps it).
  *
  * Note that the mmm_start* ops do not require a compiler fence,
  * because they both use a memory fence.
@@ -547,6 +669,13 @@ static inline void
 mmm_end_op(void)
 {
     atomic_signal_fence(memory_order_seq_cst);
+
+    if (mmm_nesting > 1) {
+        mmm_nesting--;
+        return;
+    }
+
+    mmm_nesting                 = 0;
     mmm_reservations[mmm_mytid] = HATRACK_EPOCH_UNRESERVED;
 
     return;
@@ -690,15 +819,36 @@ mmm_help_commit(void *ptr)
     return;
 }
 
+static inline uint64_t
+mmm_pool_id(mmm_header_t *cell)
+{
+    return ((uint64_t)cell->next) & MMM_POOL_ID_MASK;
+}
+
+static inline mmm_header_t *
+mmm_next_retired(mmm_header_t *cell)
+{
+    return (mmm_header_t *)(((uint64_t)cell->next) & ~MMM_POOL_ID_MASK);
+}
+
 // Call this when we know no other thread ever could have seen the
 // data in question, as it can be freed immediately.
 static inline void
 mmm_retire_unused(void *ptr)
 {
+    mmm_header_t *cell;
+
     DEBUG_MMM_INTERNAL(ptr, "mmm_retire_unused");
     HATRACK_RETIRE_UNUSED_CTR();
 
-    free(mmm_get_header(ptr));
+    cell = mmm_get_header(ptr);
+
+    if (mmm_pool_id(cell)) {
+	mmm_pool_return(cell);
+	return;
+    }
+
+    free(cell);
 
     return;
 }
@@ -740,7 +890,8 @@ mmm_retire_fast(void *ptr)
 
     cell               = mmm_get_header(ptr);
     cell->retire_epoch = atomic_load(&mmm_epoch);
-    cell->next         = mmm_retire_list;
+    cell->next         = (mmm_header_t *)(((uint64_t)mmm_retire_list)
+					  | mmm_pool_id(cell));
     mmm_retire_list    = cell;
 
     return;
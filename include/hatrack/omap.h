@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           omap.h
+ *  Description:    A lock-free ordered map, based on a skiplist, with
+ *                  range scans and floor / ceiling lookups.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_OMAP_H__
+#define __HATRACK_OMAP_H__
+
+#include <hatrack/dict.h>
+#include <hatrack/skiplist.h>
+
+/* Everything else in hatrack is a hash table, which is great until
+ * you need your keys in order: range queries, or "the most recent
+ * entry at or before time t". For that, hatrack_omap gives the same
+ * interface as hatrack_dict (the same key types, and the same memory
+ * management hooks, with the same meaning), plus ordered lookups,
+ * built on a lock-free skiplist.
+ *
+ * The skiplist is the usual one (see Fraser's thesis, or Herlihy and
+ * Shavit's book), and shares its core with skipq; see skiplist.h.
+ *
+ * A node holds a pointer to a hatrack_dict_item_t record (the same
+ * records that hatrack_dict uses), not the key and value directly.
+ * Overwriting an existing key just swaps in a new record, with a
+ * single CAS, and the old record gets retired (and passed to the free
+ * handler), exactly as in hatrack_dict. Removing a key sets the low
+ * bit of the record pointer, which is the point at which the removal
+ * takes effect; the node can never come back to life after that.
+ * The node keeps the pointer so that other threads can still read
+ * its key while they unlink it.
+ *
+ * One difference from hatrack_dict: records that mmm frees get passed
+ * to the free handler with NULL in place of the map, because mmm may
+ * not free them until after the map itself is deleted. Only the
+ * records still in the map when it gets cleaned up are passed along
+ * with the map.
+ *
+ * Getting the memory management right is the part that usually gets
+ * hand-waved; skiplist.h explains how we keep a node from getting
+ * retired while it's still linked in anywhere.
+ *
+ * Individual operations are linearizable. The ordered scans
+ * (hatrack_omap_range() and hatrack_omap_items()) are not snapshots:
+ * each item returned was in the map at some point during the scan,
+ * and every item that was in the map for the whole scan gets
+ * returned, but two items written during the scan may show up in a
+ * state that the map was never in all at once. If you need a
+ * consistent view of the whole thing, use a woolhat-based dict, and
+ * sort.
+ *
+ * Keys are ordered as follows:
+ *
+ * HATRACK_DICT_KEY_TYPE_INT   As unsigned 64-bit integers.
+ * HATRACK_DICT_KEY_TYPE_REAL  As doubles.
+ * HATRACK_DICT_KEY_TYPE_CSTR  By strcmp().
+ * HATRACK_DICT_KEY_TYPE_PTR   By address.
+ * HATRACK_DICT_KEY_TYPE_OBJ_CUSTOM
+ *                             By the function passed to
+ *                             hatrack_omap_set_custom_cmp(), which must be
+ *                             called before the map is used. It returns
+ *                             a negative number, 0 or a positive
+ *                             number, as with strcmp().
+ *
+ * The other dict key types are based on hashing, which is no help for
+ * ordering, and aren't supported.
+ *
+ * Range scans are over the half-open interval [lo, hi).
+ */
+
+typedef int (*hatrack_cmp_func_t)(void *, void *);
+
+typedef struct hatrack_omap_node_st hatrack_omap_node_t;
+
+// clang-format off
+struct hatrack_omap_node_st {
+    _Atomic uint64_t        item;
+    hatrack_skiplist_node_t links; // Must be last.
+};
+
+// The skiplist must come first; its hooks get back to the map by casting.
+typedef struct {
+    hatrack_skiplist_t   list;
+    _Atomic uint64_t     item_count;
+    hatrack_cmp_func_t   custom_cmp;
+    hatrack_mem_hook_t   free_handler;
+    hatrack_mem_hook_t   key_return_hook;
+    hatrack_mem_hook_t   val_return_hook;
+    uint32_t             key_type;
+} hatrack_omap_t;
+
+hatrack_omap_t      *hatrack_omap_new    (uint32_t);
+void                 hatrack_omap_init   (hatrack_omap_t *, uint32_t);
+void                 hatrack_omap_cleanup(hatrack_omap_t *);
+void                 hatrack_omap_delete (hatrack_omap_t *);
+
+void hatrack_omap_set_custom_cmp     (hatrack_omap_t *, hatrack_cmp_func_t);
+void hatrack_omap_set_free_handler   (hatrack_omap_t *, hatrack_mem_hook_t);
+void hatrack_omap_set_key_return_hook(hatrack_omap_t *, hatrack_mem_hook_t);
+void hatrack_omap_set_val_return_hook(hatrack_omap_t *, hatrack_mem_hook_t);
+
+void                *hatrack_omap_get    (hatrack_omap_t *, void *, bool *);
+void                 hatrack_omap_put    (hatrack_omap_t *, void *, void *);
+bool                 hatrack_omap_replace(hatrack_omap_t *, void *, void *);
+bool                 hatrack_omap_add    (hatrack_omap_t *, void *, void *);
+bool                 hatrack_omap_remove (hatrack_omap_t *, void *);
+uint64_t             hatrack_omap_len    (hatrack_omap_t *);
+
+bool                 hatrack_omap_floor  (hatrack_omap_t *, void *,
+					  hatrack_dict_item_t *);
+bool                 hatrack_omap_ceiling(hatrack_omap_t *, void *,
+					  hatrack_dict_item_t *);
+hatrack_dict_item_t *hatrack_omap_range  (hatrack_omap_t *, void *, void *,
+					  uint64_t *);
+hatrack_dict_item_t *hatrack_omap_items  (hatrack_omap_t *, uint64_t *);
+hatrack_view_t      *hatrack_omap_view   (hatrack_omap_t *, uint64_t *, bool);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           parking.h
+ *  Description:    A minimal futex-based parking lot, so that queue
+ *                  consumers can sleep when there's nothing to do.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_PARKING_H__
+#define __HATRACK_PARKING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Our queues never block; when they're empty, a dequeue just says so.
+ * That leaves consumers with nothing to do but spin (burning a core)
+ * or sleep for some arbitrary amount of time (adding latency).
+ *
+ * This gives them a third option: go to sleep on a futex, and have
+ * the next enqueue wake them up. The important thing is that
+ * enqueuers don't pay for it when nobody's asleep. All they do is
+ * load the waiter count, and only if it's non-zero do they make a
+ * system call.
+ *
+ * The protocol, for a consumer, is:
+ *
+ * 1) Call hatrack_park_prepare(), which registers us as a waiter, and
+ *    returns the current value of the wake-up sequence number.
+ *
+ * 2) Try to dequeue again. If we get something, call
+ *    hatrack_park_cancel() and we're done.
+ *
+ * 3) Otherwise, call hatrack_park(), with the sequence number from
+ *    step 1. The kernel will only put us to sleep if the sequence
+ *    number hasn't changed.
+ *
+ * And enqueuers call hatrack_unpark() after every successful enqueue.
+ *
+ * The reason this can't lose a wake-up is that the registration in
+ * step 1 and the enqueue's write to the queue are both sequentially
+ * consistent, as are the enqueuer's load of the waiter count and our
+ * re-check of the queue in step 2. So either the enqueuer sees our
+ * registration (and bumps the sequence number, causing the futex
+ * wait to return immediately if we haven't gone to sleep yet), or we
+ * see its item in step 2.
+ *
+ * This is Linux-specific, as is the rest of the library, in practice.
+ */
+typedef struct {
+    _Atomic uint32_t waiters;
+    _Atomic uint32_t seq;
+} hatrack_parking_t;
+
+static inline uint32_t
+hatrack_park_prepare(hatrack_parking_t *self)
+{
+    atomic_fetch_add(&self->waiters, 1);
+
+    return atomic_load(&self->seq);
+}
+
+static inline void
+hatrack_park_cancel(hatrack_parking_t *self)
+{
+    atomic_fetch_sub(&self->waiters, 1);
+
+    return;
+}
+
+/* Sleeps until we're woken up (or until the sequence number has
+ * changed), or until the deadline passes, whichever is first. A NULL
+ * deadline means no time limit. The deadline is absolute, against
+ * CLOCK_MONOTONIC, which is what FUTEX_WAIT_BITSET uses.
+ *
+ * Returns false if we hit the deadline. Either way, we're no longer
+ * registered as a waiter when this returns.
+ *
+ * Spurious wake-ups are fine; callers always go back and try to
+ * dequeue again.
+ */
+static inline bool
+hatrack_park(hatrack_parking_t *self, uint32_t seq, struct timespec *deadline)
+{
+    struct timespec now;
+    bool            ret;
+
+    syscall(SYS_futex,
+	    &self->seq,
+	    FUTEX_WAIT_BITSET_PRIVATE,
+	    seq,
+	    deadline,
+	    NULL,
+	    FUTEX_BITSET_MATCH_ANY);
+
+    ret = true;
+
+    if (deadline) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (now.tv_sec > deadline->tv_sec
+	    || (now.tv_sec == deadline->tv_sec
+		&& now.tv_nsec >= deadline->tv_nsec)) {
+	    ret = false;
+	}
+    }
+
+    atomic_fetch_sub(&self->waiters, 1);
+
+    return ret;
+}
+
+/* Wakes up to n sleepers. This is the only part of the protocol that
+ * sits on the enqueue path, so the common case, when there are no
+ * waiters, is a single load.
+ */
+static inline void
+hatrack_unpark(hatrack_parking_t *self, uint64_t n)
+{
+    if (!atomic_load(&self->waiters)) {
+	return;
+    }
+
+    atomic_fetch_add(&self->seq, 1);
+
+    syscall(SYS_futex,
+	    &self->seq,
+	    FUTEX_WAKE_PRIVATE,
+	    n > INT_MAX ? INT_MAX : (int)n,
+	    NULL,
+	    NULL,
+	    0);
+
+    return;
+}
+
+/* Turns a relative timeout in milliseconds into a deadline for
+ * hatrack_park(). A negative timeout means wait forever, in which
+ * case we return NULL.
+ */
+static inline struct timespec *
+hatrack_park_deadline(int64_t timeout_ms, struct timespec *ts)
+{
+    if (timeout_ms < 0) {
+	return NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, ts);
+
+    ts->tv_sec  += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000;
+
+    if (ts->tv_nsec >= 1000000000) {
+	ts->tv_sec++;
+	ts->tv_nsec -= 1000000000;
+    }
+
+    return ts;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           pool.h
+ *  Description:    A work-stealing thread pool.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * The obvious way to build a task executor out of this library is to
+ * put a bunch of threads on the other end of an hq. That works, but
+ * every task goes through the same queue, and with enough workers,
+ * the head and tail of that queue become the bottleneck.
+ *
+ * hatrack_pool_t spreads things out. Each worker has its own
+ * work-stealing deque (see wsdeque.h). A task submitted from inside a
+ * running task goes onto the submitting worker's own deque, which
+ * nobody else writes to, and that worker will generally pick it right
+ * back up, without touching any shared state at all. Workers that run
+ * out of work of their own go steal from a random other worker.
+ *
+ * Tasks submitted from outside the pool (from threads that aren't
+ * workers) have no deque to go to, so they go on a shared hq, which
+ * workers check after their own deque, and before they go stealing.
+ * That's still a single point of contention, but only for tasks that
+ * come in from outside. Fork-join style workloads, where tasks spawn
+ * other tasks, keep almost all of their traffic on the deques.
+ *
+ * Workers that can't find anything to do spin for a little while, and
+ * then park (see parking.h), so an idle pool doesn't burn CPU. Every
+ * submission wakes up at most one parked worker, and if nobody's
+ * parked, that costs a single load.
+ *
+ * There's no ordering guarantee between tasks. Each worker runs its
+ * own tasks most-recent-first, while thieves take the oldest.
+ *
+ * Tasks run on the worker threads, which register with mmm for the
+ * lifetime of the pool, and so count against HATRACK_THREADS_MAX.
+ *
+ * hatrack_pool_wait() blocks until every task submitted so far
+ * (including any tasks those tasks submit) has finished. Don't call it
+ * from inside a task, since the task calling it will never finish.
+ * hatrack_pool_delete() waits for any outstanding tasks before it
+ * shuts the workers down.
+ */
+
+#ifndef __HATRACK_POOL_H__
+#define __HATRACK_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <hatrack/hatrack_config.h>
+#include <hatrack/hq.h>
+#include <hatrack/wsdeque.h>
+#include <hatrack/parking.h>
+
+typedef void (*hatrack_task_func_t)(void *);
+
+typedef struct hatrack_pool_st hatrack_pool_t;
+
+// clang-format off
+typedef struct {
+    hatrack_task_func_t func;
+    void               *arg;
+} hatrack_pool_task_t;
+
+/* The deque is cache-aligned already, so each worker's deque ends up
+ * on its own lines.
+ */
+typedef struct {
+    wsdeque_t       deque;
+    hatrack_pool_t *pool;
+    pthread_t       thread;
+    uint64_t        id;
+} hatrack_pool_worker_t;
+
+struct hatrack_pool_st {
+    hatrack_pool_worker_t *workers;
+    uint64_t               num_workers;
+    hq_t                   inject;
+    hatrack_parking_t      idle;
+    hatrack_parking_t      quiet;
+    _Atomic uint64_t       pending;
+    _Atomic bool           shutdown;
+};
+
+hatrack_pool_t *hatrack_pool_new        (uint64_t);
+void            hatrack_pool_init       (hatrack_pool_t *, uint64_t);
+void            hatrack_pool_cleanup    (hatrack_pool_t *);
+void            hatrack_pool_delete     (hatrack_pool_t *);
+void            hatrack_pool_submit     (hatrack_pool_t *,
+					 hatrack_task_func_t, void *);
+void            hatrack_pool_wait       (hatrack_pool_t *);
+bool            hatrack_pool_in_worker  (hatrack_pool_t *);
+
+static inline uint64_t
+hatrack_pool_num_workers(hatrack_pool_t *self)
+{
+    return self->num_workers;
+}
+
+/* Tasks that have been submitted, but haven't finished running. */
+static inline uint64_t
+hatrack_pool_pending(hatrack_pool_t *self)
+{
+    return atomic_load(&self->pending);
+}
+
+#endif
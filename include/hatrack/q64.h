@@ -38,6 +38,7 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/mmm.h>
 
 
 #define QUEUE_HELP_VALUE 1 << QUEUE_HELP_STEPS
@@ -70,12 +71,14 @@ typedef struct {
     q64_segment_t *dequeue_segment;
 } q64_seg_ptrs_t;
 
+// As with queue_t, 'segment_cache' recycles retired segments.
 typedef struct {
     alignas(16)
     _Atomic q64_seg_ptrs_t segments;
     uint64_t               default_segment_size;
     _Atomic uint64_t       help_needed;
     _Atomic uint64_t       len;
+    mmm_cache_t           *segment_cache;
 } q64_t;
 
 enum64(q64_cell_state_t,
@@ -81,6 +81,7 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/mmm.h>
 
 
 #define QUEUE_HELP_VALUE 1 << QUEUE_HELP_STEPS
@@ -117,12 +118,18 @@ typedef struct {
     queue_segment_t *dequeue_segment;
 } queue_seg_ptrs_t;
 
+/* In the steady state, every segment's worth of enqueues needs a new
+ * segment (usually of the default size), and every segment's worth of
+ * dequeues retires one. 'segment_cache' lets the new ones come from
+ * the retired ones, instead of the allocator.
+ */
 typedef struct {
     alignas(16)
     _Atomic queue_seg_ptrs_t segments;
     uint64_t                 default_segment_size;
     _Atomic uint64_t         help_needed;
     _Atomic uint64_t         len;
+    mmm_cache_t             *segment_cache;
 } queue_t;
 
 enum64(queue_cell_state_t,
@@ -24,23 +24,43 @@
 
 #include <hatrack/woolhat.h>
 #include <hatrack/dict.h>
+#include <hatrack/bitset.h>
+#include <hatrack/pool.h>
 
 
 typedef struct hatrack_set_st hatrack_set_t;
 
+/* As with hatrack_dict, when backend_vtable is NULL, we're using the
+ * woolhat instance directly. Otherwise, backend_table holds some
+ * other table, which we access through its public API.
+ *
+ * Sets created with hatrack_set_new_bitset() use neither; they keep
+ * their items in the bitset, and the woolhat instance is never
+ * initialized.
+ */
 struct hatrack_set_st {
     woolhat_t           woolhat_instance;
+    hatrack_vtable_t   *backend_vtable;
+    void               *backend_table;
+    hatrack_backend_t   backend;
     hatrack_hash_info_t hash_info;
     uint32_t            item_type;
     hatrack_mem_hook_t  pre_return_hook;
     hatrack_mem_hook_t  free_handler;
+    hatrack_changelog_t *change_log;
+    hatrack_bitset_t    *bitset;
 };
 
 
 
 // clang-format off
 hatrack_set_t  *hatrack_set_new             (uint32_t);
+hatrack_set_t  *hatrack_set_new_with_backend(uint32_t, hatrack_backend_t);
 void            hatrack_set_init            (hatrack_set_t *, uint32_t);
+void            hatrack_set_init_with_backend(hatrack_set_t *, uint32_t,
+					      hatrack_backend_t);
+hatrack_set_t  *hatrack_set_new_bitset      (uint64_t);
+void            hatrack_set_init_bitset     (hatrack_set_t *, uint64_t);
 void            hatrack_set_cleanup         (hatrack_set_t *);
 void            hatrack_set_delete          (hatrack_set_t *);
 void            hatrack_set_set_hash_offset (hatrack_set_t *, int32_t);
@@ -67,6 +87,34 @@ hatrack_set_t  *hatrack_set_difference      (hatrack_set_t *, hatrack_set_t *);
 hatrack_set_t  *hatrack_set_union           (hatrack_set_t *, hatrack_set_t *);
 hatrack_set_t  *hatrack_set_intersection    (hatrack_set_t *, hatrack_set_t *);
 hatrack_set_t  *hatrack_set_disjunction     (hatrack_set_t *, hatrack_set_t *);
+hatrack_set_t  *hatrack_set_difference_parallel  (hatrack_set_t *,
+						  hatrack_set_t *, uint32_t);
+hatrack_set_t  *hatrack_set_union_parallel       (hatrack_set_t *,
+						  hatrack_set_t *, uint32_t);
+hatrack_set_t  *hatrack_set_intersection_parallel(hatrack_set_t *,
+						  hatrack_set_t *, uint32_t);
+hatrack_set_t  *hatrack_set_disjunction_parallel (hatrack_set_t *,
+						  hatrack_set_t *, uint32_t);
+hatrack_set_t  *hatrack_set_difference_pooled    (hatrack_set_t *,
+						  hatrack_set_t *,
+						  hatrack_pool_t *);
+hatrack_set_t  *hatrack_set_union_pooled         (hatrack_set_t *,
+						  hatrack_set_t *,
+						  hatrack_pool_t *);
+hatrack_set_t  *hatrack_set_intersection_pooled  (hatrack_set_t *,
+						  hatrack_set_t *,
+						  hatrack_pool_t *);
+hatrack_set_t  *hatrack_set_disjunction_pooled   (hatrack_set_t *,
+						  hatrack_set_t *,
+						  hatrack_pool_t *);
+void            hatrack_set_stats           (hatrack_set_t *,
+					     hatrack_stats_t *);
+
+void              hatrack_set_set_change_feed(hatrack_set_t *, bool);
+hatrack_change_t *hatrack_set_changes_since  (hatrack_set_t *, uint64_t,
+					      uint64_t *, uint64_t *);
+uint64_t          hatrack_set_changes_epoch  (hatrack_set_t *);
+void              hatrack_set_changes_trim   (hatrack_set_t *, uint64_t);
 
 
 
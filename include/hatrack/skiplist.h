@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           skiplist.h
+ *  Description:    The lock-free skiplist core shared by hatrack_omap
+ *                  and skipq.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_SKIPLIST_H__
+#define __HATRACK_SKIPLIST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <hatrack/hatrack_config.h>
+
+/* This is the part of the skiplist that hatrack_omap and skipq have
+ * in common: searching (and unlinking removed nodes along the way),
+ * linking in a new node, building and marking towers, reference
+ * counting nodes, and picking node heights. What a key is, what it
+ * means for a node to be removed, and what happens to a node once
+ * it's unreachable are up to the user, via three hooks.
+ *
+ * The skiplist is the usual one (see Fraser's thesis, or Herlihy and
+ * Shavit's book): a sorted linked list at the bottom level, which is
+ * the source of truth, and a tower of sparser linked lists above it,
+ * to make searches logarithmic. Removing a node marks the low bit of
+ * each of its 'next' pointers, so nobody can link anything in after
+ * it, and then any thread that comes across a marked node unlinks it
+ * as it goes by.
+ *
+ * mmm makes it safe for a reader to follow a pointer to a node that
+ * gets retired while the reader is looking at it. But a node must not
+ * get retired while it's still linked in anywhere. The problem is
+ * that the thread inserting a node builds its tower one level at a
+ * time, and that can race with the removal, leaving a node linked in
+ * at an upper level after the remover has unlinked it everywhere. So
+ * each node starts with two references, one for the inserting thread
+ * and one for whoever removes it. Each drops its reference when it's
+ * done with the node, and whoever drops the last one hands it to the
+ * retire hook. The inserter, when it's done building, checks whether
+ * the node got removed in the meantime, and if so, unlinks it again
+ * itself.
+ *
+ * Users embed a hatrack_skiplist_node_t as the LAST field of their
+ * own node type (the 'next' array has to come last), allocate their
+ * nodes with room for 'height' next pointers, and convert back from
+ * the embedded links with offsetof(). The head node is just the
+ * links; it's never compared against, and never removed.
+ *
+ * The hooks:
+ *
+ * cmp      Compares the key of the node with the given links against
+ *          a key, returning a negative number, 0 or a positive
+ *          number, as with strcmp(). Keys are whatever the user
+ *          passes to the calls below.
+ *
+ * removed  Returns true once the removal of the node has taken effect
+ *          (that's decided by the user; the skiplist just needs to
+ *          know, so the inserter can clean up after a racing
+ *          removal).
+ *
+ * retire   Called once, by whoever drops the last reference to a
+ *          node. Usually that's a call to mmm_retire(), on the
+ *          user's node.
+ */
+
+enum {
+    HATRACK_SKIPLIST_MARK = 0x01
+};
+
+typedef struct hatrack_skiplist_node_st hatrack_skiplist_node_t;
+typedef struct hatrack_skiplist_st      hatrack_skiplist_t;
+
+typedef int  (*hatrack_skiplist_cmp_func_t)    (hatrack_skiplist_t *,
+						hatrack_skiplist_node_t *,
+						void *);
+typedef bool (*hatrack_skiplist_removed_func_t)(hatrack_skiplist_node_t *);
+typedef void (*hatrack_skiplist_retire_func_t) (hatrack_skiplist_t *,
+						hatrack_skiplist_node_t *);
+
+// clang-format off
+struct hatrack_skiplist_node_st {
+    _Atomic uint64_t refs;
+    uint64_t         height;
+    _Atomic uint64_t next[];
+};
+
+struct hatrack_skiplist_st {
+    hatrack_skiplist_node_t        *head;
+    _Atomic uint64_t                height;
+    uint64_t                        max_height;
+    hatrack_skiplist_cmp_func_t     cmp;
+    hatrack_skiplist_removed_func_t removed;
+    hatrack_skiplist_retire_func_t  retire;
+};
+
+void                     hatrack_skiplist_init       (hatrack_skiplist_t *,
+						      uint64_t,
+						      hatrack_skiplist_cmp_func_t,
+						      hatrack_skiplist_removed_func_t,
+						      hatrack_skiplist_retire_func_t);
+void                     hatrack_skiplist_cleanup    (hatrack_skiplist_t *);
+void                     hatrack_skiplist_node_init  (hatrack_skiplist_node_t *,
+						      uint64_t);
+uint64_t                 hatrack_skiplist_pick_height(hatrack_skiplist_t *);
+hatrack_skiplist_node_t *hatrack_skiplist_find       (hatrack_skiplist_t *,
+						      void *,
+						      hatrack_skiplist_node_t **,
+						      hatrack_skiplist_node_t **,
+						      bool);
+bool                     hatrack_skiplist_link       (hatrack_skiplist_node_t *,
+						      hatrack_skiplist_node_t **,
+						      hatrack_skiplist_node_t **);
+void                     hatrack_skiplist_build_tower(hatrack_skiplist_t *,
+						      hatrack_skiplist_node_t *,
+						      void *,
+						      hatrack_skiplist_node_t **,
+						      hatrack_skiplist_node_t **);
+void                     hatrack_skiplist_mark_tower (hatrack_skiplist_node_t *);
+void                     hatrack_skiplist_unlink     (hatrack_skiplist_t *,
+						      hatrack_skiplist_node_t *,
+						      void *,
+						      hatrack_skiplist_node_t **,
+						      hatrack_skiplist_node_t **);
+void                     hatrack_skiplist_release    (hatrack_skiplist_t *,
+						      hatrack_skiplist_node_t *);
+uint64_t                 hatrack_skiplist_random     (void);
+// clang-format on
+
+static inline bool
+hatrack_skiplist_is_marked(uint64_t p)
+{
+    return p & HATRACK_SKIPLIST_MARK;
+}
+
+static inline hatrack_skiplist_node_t *
+hatrack_skiplist_ptr(uint64_t p)
+{
+    return (hatrack_skiplist_node_t *)(p & ~(uint64_t)HATRACK_SKIPLIST_MARK);
+}
+
+static inline hatrack_skiplist_node_t *
+hatrack_skiplist_next(hatrack_skiplist_node_t *node, uint64_t level)
+{
+    return hatrack_skiplist_ptr(atomic_load(&node->next[level]));
+}
+
+static inline hatrack_skiplist_node_t *
+hatrack_skiplist_first(hatrack_skiplist_t *self)
+{
+    return hatrack_skiplist_next(self->head, 0);
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           skipq.h
+ *  Description:    A lock-free priority queue, built on skiplists, with
+ *                  an optional relaxed mode.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * Items go in with a 64-bit priority, and skipq_dequeue_min() takes
+ * out the item with the lowest one.
+ *
+ * The underlying structure is the same lock-free skiplist that
+ * hatrack_omap uses; the two share the skiplist core (see skiplist.h
+ * for the details, including how we get the memory management right
+ * when a node's tower is still being built while it's removed). The
+ * differences:
+ *
+ * 1) Dequeuing never searches. The minimum is the first node at the
+ *    bottom level, so dequeuers walk from the head, and claim the
+ *    first node they find that nobody else has claimed yet, with a
+ *    single CAS on the node's 'taken' field. That's the point at
+ *    which the dequeue takes effect. Once a node is claimed, the
+ *    winner marks its tower and unlinks it, same as an omap removal;
+ *    the losers just move on to the next node. This is the approach
+ *    from Lindén and Jonsson's skiplist-based priority queue, minus
+ *    their batched unlinking.
+ *
+ * 2) Priorities don't have to be unique. Nodes are ordered by
+ *    priority, and then by address, so that every node still has a
+ *    unique key, which is what lets us find a particular node again
+ *    when it's time to unlink it. That means items with the same
+ *    priority don't come out in any particular order.
+ *
+ * Like most concurrent priority queues (including the Herlihy and
+ * Shavit SkipQueue this is descended from), the ordering guarantee is
+ * quiescent consistency: if an insert races with a dequeue, the
+ * dequeue may or may not see the new item, even if it has a lower
+ * priority than the one the dequeue returns. When there are no
+ * concurrent inserts, every dequeue gets the minimum.
+ *
+ * The trouble with any strict priority queue is that every dequeuer
+ * is fighting over the same few nodes at the front. For schedulers
+ * and the like, where getting something close to the minimum is good
+ * enough, skipq_new_relaxed() gives you the MultiQueue approach
+ * (Rihani, Sanders and Dementiev) instead: the queue is spread over
+ * several independent skiplists. Inserts go to a random list.
+ * Dequeues pick two lists at random, and take from whichever has the
+ * lower minimum. That's enough to keep the results close to the true
+ * minimum (in expectation, within a small multiple of the number of
+ * lists), while spreading the contention out.
+ *
+ * A relaxed dequeue only reports the queue as empty after it has
+ * checked every list, so a queue with items in it never looks empty
+ * when nobody else is dequeuing.
+ */
+
+#ifndef __SKIPQ_H__
+#define __SKIPQ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <hatrack/hatrack_config.h>
+#include <hatrack/skiplist.h>
+
+typedef struct skipq_node_st skipq_node_t;
+
+// clang-format off
+struct skipq_node_st {
+    uint64_t                priority;
+    void                   *item;
+    _Atomic bool            taken;
+    hatrack_skiplist_node_t links; // Must be last.
+};
+
+/* Each list gets its own cache line, so that dequeuers hammering on
+ * one list don't slow down the others.
+ */
+typedef struct {
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    hatrack_skiplist_t list;
+} skipq_list_t;
+
+typedef struct {
+    skipq_list_t     *lists;
+    uint64_t          num_lists;
+    _Atomic int64_t   len;
+} skipq_t;
+
+skipq_t *skipq_new          (void);
+skipq_t *skipq_new_relaxed  (uint64_t);
+void     skipq_init         (skipq_t *);
+void     skipq_init_relaxed (skipq_t *, uint64_t);
+void     skipq_cleanup      (skipq_t *);
+void     skipq_delete       (skipq_t *);
+void     skipq_insert       (skipq_t *, uint64_t, void *);
+void    *skipq_dequeue_min  (skipq_t *, uint64_t *, bool *);
+
+static inline int64_t
+skipq_len(skipq_t *self)
+{
+    return atomic_read(&self->len);
+}
+
+static inline bool
+skipq_is_relaxed(skipq_t *self)
+{
+    return self->num_lists > 1;
+}
+
+#endif
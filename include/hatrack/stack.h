@@ -34,6 +34,8 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <stdalign.h>
+#include <hatrack/mmm.h>
+#include <hatrack/backoff.h>
 
 /* "Valid after" means that, in any epoch after the epoch stored in
  * this field, pushers that are assigned that slot are free to try
@@ -70,10 +72,19 @@ struct stack_store_t {
     stack_cell_t             cells[];
 };
 
+/* Compressing the stack moves it to a new store of the same size, so
+ * a stack that keeps filling up with pops will keep asking for the
+ * same size store. 'store_cache' keeps the old ones around for reuse.
+ *
+ * 'backoff' is what a push does when a pop invalidates its cell out
+ * from under it.
+ */
 typedef struct {
     alignas(8)
     _Atomic (stack_store_t *)store;
     uint64_t                 compress_threshold;
+    mmm_cache_t             *store_cache;
+    hatrack_backoff_t        backoff;
     
 #ifdef HATSTACK_WAIT_FREE
     _Atomic int64_t          push_help_shift;
@@ -92,6 +103,14 @@ stack_view_t *hatstack_view       (hatstack_t *);
 void         *hatstack_view_next  (stack_view_t *, bool *);
 void          hatstack_view_delete(stack_view_t *);
 
+static inline void
+hatstack_set_backoff(hatstack_t *self, const hatrack_backoff_t *config)
+{
+    self->backoff = *config;
+
+    return;
+}
+
 enum {
     HATSTACK_HEAD_MOVE_MASK     = 0x80000000ffffffff,
     HATSTACK_HEAD_EPOCH_BUMP    = 0x0000000100000000,
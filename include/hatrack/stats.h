@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           stats.h
+ *  Description:    Per-table introspection: occupancy, probe lengths
+ *                  and memory footprint.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_STATS_H__
+#define __HATRACK_STATS_H__
+
+#include <hatrack/hatrack_common.h>
+
+/* Without some visibility into a running table, sizing is guesswork.
+ * The *_stats() calls (crown_stats(), witchhat_stats(), woolhat_stats(),
+ * hatrack_dict_stats() and hatrack_set_stats()) fill in one of these.
+ *
+ * They walk the current store once, without allocating and without
+ * helping or blocking writers, so they're cheap enough to sample
+ * every few seconds on a live table. But the walk isn't a linearized
+ * view; on a busy table, the numbers are approximate, and can even be
+ * slightly inconsistent with each other (e.g., num_items is the
+ * table's own item count, not what the walk found).
+ *
+ * Fields:
+ *
+ * num_buckets     The number of buckets in the current store.
+ *
+ * used_buckets    Buckets that have had a hash value written to them.
+ *                 In our tables, buckets are never un-reserved until
+ *                 the next migration, so this includes buckets whose
+ *                 items have been deleted. It's what drives resizing.
+ *
+ * num_items       Live items.
+ *
+ * load_factor     used_buckets / num_buckets.  We migrate at 0.75.
+ *
+ * probe_hist      For every used bucket, how far it is from the
+ *                 bucket its hash value maps to. The last slot
+ *                 collects everything at or beyond that distance.
+ *
+ * max_probe,      The longest and average distance.
+ * mean_probe
+ *
+ * max_neighborhood,       Crown only. The most items homed in any
+ * neighborhood_overflows  one neighborhood, and the number of items
+ *                         that didn't fit in their neighborhood at
+ *                         all (which means lookups for them fall back
+ *                         to linear probing). If the latter is
+ *                         growing, the table is too full for its hash
+ *                         distribution.
+ *
+ * deleted_records Woolhat only (and so, hatrack_set). Buckets whose
+ *                 current record is a deletion record. Those records
+ *                 hold memory (and a bucket) until the next migration
+ *                 drops them.
+ *
+ * max_chain,      Woolhat only. Each new record goes on top of its
+ * mean_chain      bucket's history, and keeps a pointer to the one
+ *                 it replaced, so that readers with older epochs
+ *                 (views, and the set operations) can walk down to
+ *                 the record that was current as of their epoch. The
+ *                 replaced records get retired right away, but mmm
+ *                 can't free them while those readers might still get
+ *                 to them. These are the longest and average number
+ *                 of links a reader walks below the head, over the
+ *                 used buckets. We can only follow the links our own
+ *                 reservation protects, which are the ones for writes
+ *                 that landed since the stats call started. So these
+ *                 are zero on a quiet table, and otherwise a lower
+ *                 bound on what readers that started earlier walk.
+ *
+ * migrations      The number of store migrations since the table was
+ *                 created.
+ *
+ * store_bytes     The current store, including the mmm header.
+ *
+ * record_bytes    Memory for individual records (woolhat's records,
+ *                 or the dictionary's key / value pairs), including
+ *                 mmm headers.
+ *
+ * retired_bytes   Stores that have been migrated away from, but that
+ *                 mmm hasn't freed yet, because some thread might
+ *                 still be reading them (or the retiring thread just
+ *                 hasn't gotten around to emptying its list).
+ *
+ * total_bytes     The sum of the three above.
+ */
+#define HATRACK_STATS_PROBE_BUCKETS 16
+
+// clang-format off
+typedef struct {
+    uint64_t num_buckets;
+    uint64_t used_buckets;
+    uint64_t num_items;
+    double   load_factor;
+    uint64_t probe_hist[HATRACK_STATS_PROBE_BUCKETS];
+    uint64_t max_probe;
+    double   mean_probe;
+    uint64_t max_neighborhood;
+    uint64_t neighborhood_overflows;
+    uint64_t deleted_records;
+    uint64_t max_chain;
+    double   mean_chain;
+    uint64_t migrations;
+    uint64_t store_bytes;
+    uint64_t record_bytes;
+    uint64_t retired_bytes;
+    uint64_t total_bytes;
+} hatrack_stats_t;
+
+/* To know how much memory retired stores are holding, each table
+ * keeps one of these, adds to it when it retires a store, and
+ * registers an mmm cleanup handler that subtracts when the store
+ * actually gets freed.
+ *
+ * The catch is that the table can be deleted while some of its old
+ * stores are still waiting to be freed, and the cleanup handlers
+ * would then be writing to freed memory. So the counter lives in its
+ * own allocation, with a reference count: one reference for the
+ * table, and one for each store it's waiting on. Whoever drops the
+ * last reference frees it.
+ *
+ * Tables create these lazily, on their first migration, so tables
+ * that never grow don't pay for them.
+ */
+typedef struct {
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t refs;
+} hatrack_retired_t;
+
+hatrack_retired_t *hatrack_retired_get     (_Atomic(hatrack_retired_t *) *);
+void               hatrack_retired_add     (hatrack_retired_t *, uint64_t);
+void               hatrack_retired_sub     (hatrack_retired_t *, uint64_t);
+void               hatrack_retired_release (hatrack_retired_t *);
+uint64_t           hatrack_retired_bytes   (_Atomic(hatrack_retired_t *) *);
+
+void               hatrack_stats_add_probe (hatrack_stats_t *, uint64_t);
+void               hatrack_stats_add_chain (hatrack_stats_t *, uint64_t);
+void               hatrack_stats_merge     (hatrack_stats_t *,
+					    hatrack_stats_t *);
+void               hatrack_stats_finish    (hatrack_stats_t *);
+
+#endif
@@ -90,6 +90,17 @@
  *                  just get the signal to migrate during the move to
  *                  threading, and then swap out a vtable.
  *
+ *                  Since we do detect it in the table, we try not to
+ *                  overreact. One failed trylock doesn't mean the
+ *                  table is going to see sustained parallel writes,
+ *                  so we only migrate once enough writes within a
+ *                  window have had to wait on the lock. And if, once
+ *                  we've migrated, only one thread ends up writing
+ *                  for a while, we migrate back to the
+ *                  single-threaded table, using mmm to retire the
+ *                  multi-threaded one once readers are done with it.
+ *                  See hatrack_config.h for the defaults.
+ *
  *  Author:         John Viega, john@zork.org
  */
 
@@ -106,7 +117,7 @@
  * user-accessable; the value is set based on which initialization
  * function is called, per below.
  *
- * The thinking behind these four tables is as follows:
+ * The thinking behind these tables is as follows:
  *
  * First, you may want to select between faster tables without
  * consistency, and consistent tables.
@@ -130,13 +141,23 @@
  *            TOPHAT_T_FAST_WAIT_FREE       is witchhat
  *            TOPHAT_T_CONSISTENT_LOCKING   is ballcap
  *            TOPHAT_T_CONSISTENT_WAIT_FREE is woolhat
+ *            TOPHAT_T_FAST_LOCK_FREE       is hihat
+ *            TOPHAT_T_FAST_HOPSCOTCH       is crown
+ *
+ * The last two are there because hihat and crown are generally our
+ * fastest tables, when you don't need consistent views. hihat is
+ * only lock-free, not wait-free, but in practice that rarely matters.
+ * crown is wait-free, and usually edges out witchhat, particularly
+ * when tables get full.
  */
 typedef enum
 {
     TOPHAT_T_FAST_LOCKING,
     TOPHAT_T_FAST_WAIT_FREE,
     TOPHAT_T_CONSISTENT_LOCKING,
-    TOPHAT_T_CONSISTENT_WAIT_FREE
+    TOPHAT_T_CONSISTENT_WAIT_FREE,
+    TOPHAT_T_FAST_LOCK_FREE,
+    TOPHAT_T_FAST_HOPSCOTCH
 } tophat_migration_t;
 
 /* tophat_st_record_t and tophat_st_bucket_t are straightforward,
@@ -168,45 +189,103 @@ typedef struct {
     uint64_t            next_epoch;
 } tophat_st_ctx_t;
 
+/* tophat_writers_t
+ *
+ * Once we're running a multi-threaded table, writers no longer touch
+ * the mutex. But if we want to migrate back to the single-threaded
+ * table, we need to know when the writers that are already in the
+ * multi-threaded table have left it. Each writer bumps a counter on
+ * the way in, and drops it on the way out.
+ *
+ * A single counter would put every writer on the same cache line,
+ * which is exactly what we went multi-threaded to avoid. So we stripe
+ * the counter, indexing by thread id, and pad each stripe out to a
+ * cache line. The stripes only get allocated the first time we
+ * migrate to a multi-threaded table.
+ */
+typedef struct {
+    _Atomic uint64_t n;
+    uint64_t         padding[7];
+} tophat_writers_t;
+
 /* tophat_t
  *
  * This data structure starts out single-threaded, using one set of
  * variables, and then migrating to a different set of variables, once
- * it switches implementations to support multiple writers.
+ * it switches implementations to support multiple writers. If things
+ * go back to a single writer for long enough, it migrates back.
+ *
+ * st_table      -- A pointer to the single-threaded hash table
+ *                  instance.  Here, we have inlined a version of
+ *                  refhat_t (the inlined operations do some additional
+ *                  work).
+ *
+ * mutex         -- This is used by writers to detect when we need to
+ *                  migrate to a multi-threaded implementation. The
+ *                  mutex is completely ignored by readers.
  *
- * st_table  -- A pointer to the single-threaded hash table instance.
- *              Here, we have inlined a version of refhat_t (the
- *              inlined operations do some additional work).
+ * dst_type      -- This is where we store information on which
+ *                  implementation to which we want to migrate this
+ *                  table, should it be necessary.
  *
- * mutex     -- This is used by writers to detect when we need to
- *              migrate to a multi-threaded implementation. The mutex
- *              is completely ignored by readers.
+ * mt_table      -- The multi-threaded implementation object, which
+ *                  will be one of the tables listed above (see the
+ *                  notes with tophat_migration_t).
  *
- * dst_type  -- This is where we store information on which
- *              implementation to which we want to migrate this table,
- *              should it be necessary.
+ * mt_vtable     -- A virtual call table, that we use to call the
+ *                  correct functions in whatever multi-threaded
+ *                  implementation we selected. We do pay the small
+ *                  price of an extra indirection, that we can
+ *                  eliminate easily if we only ever migrate to a
+ *                  static table type.
  *
- * mt_table  -- The multi-threaded implementation object, which will
- *              be one of the tables listed above (see the notes with
- *              tophat_migration_t).
+ * st_writes     -- The number of single-threaded writes in the
+ *                  current contention window. Only touched while
+ *                  holding the mutex.
  *
- * mt_vtable -- A virtual call table, that we use to call the correct
- *              functions in whatever multi-threaded implementation we
- *              selected. We do pay the small price of an extra
- *              indirection, that we can eliminate easily if we only
- *              ever migrate to a static table type.
+ * contended     -- How many of those writes had to wait on the mutex
+ *                  (i.e., their trylock failed). When this hits
+ *                  contention_threshold before st_writes hits
+ *                  HATRACK_TOPHAT_CONTENTION_WINDOW, we migrate to the
+ *                  multi-threaded table. Otherwise, both counters
+ *                  start over.
+ *
+ * contention_threshold -- See tophat_set_contention_threshold().
+ *
+ * quiet_ns      -- See tophat_set_quiet_period(). 0 means we never
+ *                  migrate back.
+ *
+ * draining      -- Set while migrating back to the single-threaded
+ *                  table, to keep new writers out of the
+ *                  multi-threaded table.
+ *
+ * mt_writer     -- When running multi-threaded, the thread id (plus
+ *                  one) of the last writer we sampled.
+ *
+ * mt_solo_start -- The time (CLOCK_MONOTONIC, in ns) at which
+ *                  mt_writer started being the only writer we saw.
+ *
+ * mt_writers    -- The striped in-flight writer counts (see above).
  */
 typedef struct {
     alignas(16)
-    tophat_st_ctx_t   *st_table;
-    pthread_mutex_t    mutex;
-    tophat_migration_t dst_type;
-    _Atomic (void *)   mt_table;
-    hatrack_vtable_t   mt_vtable;
+    _Atomic(tophat_st_ctx_t *) st_table;
+    pthread_mutex_t            mutex;
+    tophat_migration_t         dst_type;
+    _Atomic (void *)           mt_table;
+    hatrack_vtable_t           mt_vtable;
+    uint64_t                   st_writes;
+    uint64_t                   contended;
+    uint64_t                   contention_threshold;
+    uint64_t                   quiet_ns;
+    _Atomic bool               draining;
+    _Atomic uint64_t           mt_writer;
+    _Atomic uint64_t           mt_solo_start;
+    tophat_writers_t          *mt_writers;
 } tophat_t;        
 
 
-/* Here, we see that we have four different initialization functions,
+/* Here, we see that we have six different initialization functions,
  * each of which selects which multi-threaded implementation we want
  * to use (if necessary).
  *
@@ -217,6 +296,8 @@ typedef struct {
  * _cst  = Consistent views across the table (as opposed to faster table)
  * _mx   = Mutex variant
  * _wf   = Wait-Free variant
+ * _lf   = Lock-Free variant (hihat)
+ * _hs   = Hopscotch variant (crown, which is also wait-free)
  */
 tophat_t       *tophat_new_fast_mx      (void);
 tophat_t       *tophat_new_fast_wf      (void);
@@ -226,6 +307,10 @@ tophat_t       *tophat_new_fast_mx_size (char);
 tophat_t       *tophat_new_fast_wf_size (char);
 tophat_t       *tophat_new_cst_mx_size  (char);
 tophat_t       *tophat_new_cst_wf_size  (char);
+tophat_t       *tophat_new_fast_lf      (void);
+tophat_t       *tophat_new_fast_hs      (void);
+tophat_t       *tophat_new_fast_lf_size (char);
+tophat_t       *tophat_new_fast_hs_size (char);
 void            tophat_init_fast_mx     (tophat_t *);
 void            tophat_init_fast_wf     (tophat_t *);
 void            tophat_init_cst_mx      (tophat_t *);
@@ -234,6 +319,10 @@ void            tophat_init_fast_mx_size(tophat_t *, char);
 void            tophat_init_fast_wf_size(tophat_t *, char);
 void            tophat_init_cst_mx_size (tophat_t *, char);
 void            tophat_init_cst_wf_size (tophat_t *, char);
+void            tophat_init_fast_lf     (tophat_t *);
+void            tophat_init_fast_hs     (tophat_t *);
+void            tophat_init_fast_lf_size(tophat_t *, char);
+void            tophat_init_fast_hs_size(tophat_t *, char);
 
 void            tophat_cleanup     (tophat_t *);
 void            tophat_delete      (tophat_t *);
@@ -245,4 +334,20 @@ void           *tophat_remove      (tophat_t *, hatrack_hash_t, bool *);
 uint64_t        tophat_len         (tophat_t *);
 hatrack_view_t *tophat_view        (tophat_t *, uint64_t *, bool);
 
+/* By default, we migrate to the multi-threaded table once
+ * HATRACK_TOPHAT_CONTENTION_THRESHOLD writers in a window of
+ * HATRACK_TOPHAT_CONTENTION_WINDOW writes have had to wait on the
+ * mutex, and migrate back once a single thread has been the only
+ * writer for HATRACK_TOPHAT_QUIET_PERIOD_MS. These let you change
+ * either on a per-table basis. A threshold of 1 gives the original
+ * behavior, where the first contended write migrates. A quiet period
+ * of 0 turns off migrating back.
+ *
+ * tophat_is_multi_threaded() is mainly there for testing; the answer
+ * can be out of date by the time you look at it.
+ */
+void            tophat_set_contention_threshold(tophat_t *, uint64_t);
+void            tophat_set_quiet_period        (tophat_t *, uint64_t);
+bool            tophat_is_multi_threaded       (tophat_t *);
+
 #endif
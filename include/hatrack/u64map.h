@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           u64map.h
+ *  Description:    A lock-free map from 64-bit integers to 60-bit
+ *                  integers, based on tiara, that never allocates
+ *                  per operation.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_U64MAP_H__
+#define __HATRACK_U64MAP_H__
+
+#include <hatrack/hatrack_common.h>
+
+/* hatrack_dict is general-purpose, and you pay for that on every
+ * operation: the key gets hashed through a function pointer (or
+ * xxhash), and every write allocates a record, to hold the key and
+ * the value, that later has to go through mmm to get freed.
+ *
+ * A lot of the time, though, all you need is to map integer IDs to
+ * integer offsets (or counts). For that, hatrack_u64map takes tiara's
+ * approach, where each bucket is 128 bits, and every core operation
+ * is a single compare-and-swap on a bucket. But where tiara stores a
+ * 64-bit hash and a pointer, we store the key itself, and the value
+ * itself. Lookups never touch anything but the bucket array, and
+ * writes don't allocate anything, except when the table needs to
+ * grow.
+ *
+ * Since the key is stored directly, there are no hash collisions to
+ * worry about, and every 64-bit key is valid, including 0. To pick a
+ * bucket, we run the key through a cheap mixing function (the
+ * finalizer from MurmurHash3), so that sequential IDs spread out over
+ * the table. That function isn't keyed, so if your keys can be picked
+ * by an attacker, use hatrack_dict instead.
+ *
+ * The catch is that we still need a few status bits in each bucket,
+ * and with the full key in one half, they have to come out of the
+ * value. Values are therefore limited to 60 bits; storing anything
+ * larger than HATRACK_U64MAP_VALUE_MAX aborts. And
+ * hatrack_u64map_fetch_add() does its arithmetic modulo 2^60, so
+ * adding (uint64_t)-1 decrements, as you'd expect, as long as you
+ * only look at the result modulo 2^60 too.
+ *
+ * A few other differences from tiara:
+ *
+ * 1) We keep an accurate item count.
+ *
+ * 2) The operations that might not find their key take a bool *, as
+ *    with the rest of the library, since 0 is a perfectly good value.
+ *
+ * 3) hatrack_u64map_fetch_add() treats a missing key as having the
+ *    value 0, so counting things is a single call.
+ *
+ * hatrack_u64map_items() walks the current store, so, as with
+ * tiara's view, it isn't a consistent snapshot if there are writes
+ * going on. The items come back in no particular order.
+ */
+
+// clang-format off
+enum64(hatrack_u64map_flag_t,
+       HATRACK_U64MAP_F_RESERVED = 0x0000000000000001,
+       HATRACK_U64MAP_F_USED     = 0x0000000000000002,
+       HATRACK_U64MAP_F_MOVING   = 0x0000000000000004,
+       HATRACK_U64MAP_F_MOVED    = 0x0000000000000008,
+       HATRACK_U64MAP_F_ALL      = 0x000000000000000f);
+
+#define HATRACK_U64MAP_VALUE_SHIFT 4
+#define HATRACK_U64MAP_VALUE_MAX   (0xffffffffffffffffULL >> \
+				    HATRACK_U64MAP_VALUE_SHIFT)
+
+/* The value lives in the upper 60 bits of 'word', and the flags in
+ * the lower 4. A word of 0 is an empty bucket.
+ */
+typedef struct {
+    uint64_t key;
+    uint64_t word;
+} hatrack_u64map_record_t;
+
+typedef _Atomic(hatrack_u64map_record_t) hatrack_u64map_bucket_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t value;
+} hatrack_u64map_item_t;
+
+typedef struct hatrack_u64map_store_st hatrack_u64map_store_t;
+
+struct hatrack_u64map_store_st {
+    alignas(8)
+    uint64_t                          last_slot;
+    uint64_t                          threshold;
+    _Atomic uint64_t                  used_count;
+    _Atomic(hatrack_u64map_store_t *) store_next;
+    alignas(16)
+    hatrack_u64map_bucket_t           buckets[];
+};
+
+typedef struct {
+    alignas(8)
+    _Atomic(hatrack_u64map_store_t *) store_current;
+    _Atomic uint64_t                  item_count;
+} hatrack_u64map_t;
+
+hatrack_u64map_t      *hatrack_u64map_new      (void);
+hatrack_u64map_t      *hatrack_u64map_new_size (char);
+void                   hatrack_u64map_init     (hatrack_u64map_t *);
+void                   hatrack_u64map_init_size(hatrack_u64map_t *, char);
+void                   hatrack_u64map_cleanup  (hatrack_u64map_t *);
+void                   hatrack_u64map_delete   (hatrack_u64map_t *);
+uint64_t               hatrack_u64map_get      (hatrack_u64map_t *, uint64_t,
+						bool *);
+uint64_t               hatrack_u64map_put      (hatrack_u64map_t *, uint64_t,
+						uint64_t, bool *);
+bool                   hatrack_u64map_add      (hatrack_u64map_t *, uint64_t,
+						uint64_t);
+uint64_t               hatrack_u64map_remove   (hatrack_u64map_t *, uint64_t,
+						bool *);
+uint64_t               hatrack_u64map_fetch_add(hatrack_u64map_t *, uint64_t,
+						uint64_t);
+uint64_t               hatrack_u64map_len      (hatrack_u64map_t *);
+hatrack_u64map_item_t *hatrack_u64map_items    (hatrack_u64map_t *,
+						uint64_t *);
+
+#endif
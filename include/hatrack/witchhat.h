@@ -36,6 +36,7 @@
 #define __WITCHHAT_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/stats.h>
 
 typedef struct {
     void    *item;
@@ -68,11 +69,12 @@ struct witchhat_store_st {
 
 typedef struct {
     alignas(8)
-    _Atomic(witchhat_store_t *) store_current;
-    _Atomic uint64_t            item_count;
-    _Atomic uint64_t            help_needed;
-            uint64_t            next_epoch;
-
+    _Atomic(witchhat_store_t *)  store_current;
+    _Atomic uint64_t             item_count;
+    _Atomic uint64_t             help_needed;
+            uint64_t             next_epoch;
+    _Atomic uint64_t             migrations;
+    _Atomic(hatrack_retired_t *) retired;
 } witchhat_t;
 
 
@@ -92,6 +94,7 @@ void           *witchhat_remove     (witchhat_t *, hatrack_hash_t, bool *);
 uint64_t        witchhat_len        (witchhat_t *);
 hatrack_view_t *witchhat_view       (witchhat_t *, uint64_t *, bool);
 hatrack_view_t *witchhat_view_no_mmm(witchhat_t *, uint64_t *, bool);
+void            witchhat_stats      (witchhat_t *, hatrack_stats_t *);
 
 /* These need to be non-static because tophat and hatrack_dict both
  * need them, so that they can call in without a second call to
@@ -25,6 +25,7 @@
 #define __WOOLHAT_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/stats.h>
 
 typedef struct woolhat_record_st woolhat_record_t;
 
@@ -66,11 +67,13 @@ struct woolhat_store_st {
 
 typedef struct woolhat_st {
     alignas(8)
-    _Atomic(woolhat_store_t *) store_current;
-    _Atomic uint64_t           item_count;
-    _Atomic uint64_t           help_needed;
-    mmm_cleanup_func           cleanup_func;
-    void                      *cleanup_aux;
+    _Atomic(woolhat_store_t *)   store_current;
+    _Atomic uint64_t             item_count;
+    _Atomic uint64_t             help_needed;
+    mmm_cleanup_func             cleanup_func;
+    void                        *cleanup_aux;
+    _Atomic uint64_t             migrations;
+    _Atomic(hatrack_retired_t *) retired;
 } woolhat_t;
 
 
@@ -98,8 +101,11 @@ void           *woolhat_put             (woolhat_t *, hatrack_hash_t, void *,
 void           *woolhat_replace         (woolhat_t *, hatrack_hash_t, void *,
 					 bool *);
 bool            woolhat_add             (woolhat_t *, hatrack_hash_t, void *);
+bool            woolhat_add_ordered     (woolhat_t *, hatrack_hash_t, void *,
+					 uint64_t);
 void           *woolhat_remove          (woolhat_t *, hatrack_hash_t, bool *);
 uint64_t        woolhat_len             (woolhat_t *);
+void            woolhat_stats           (woolhat_t *, hatrack_stats_t *);
 
 hatrack_view_t     *woolhat_view        (woolhat_t *, uint64_t *, bool);
 hatrack_set_view_t *woolhat_view_epoch  (woolhat_t *, uint64_t *, uint64_t);
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           wsdeque.h
+ *  Description:    A Chase-Lev work-stealing deque.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * A work-stealing deque has one owner, and any number of thieves.
+ * The owner pushes and pops at the bottom, like a stack, and the
+ * thieves take from the top, like a queue. That's the shape a task
+ * scheduler wants: the owner works on whatever it spawned most
+ * recently (which is most likely to still be in its cache), while
+ * idle threads take the oldest work (which is most likely to be a
+ * big chunk that spawns more work of its own).
+ *
+ * This is the algorithm from Chase and Lev's "Dynamic Circular
+ * Work-Stealing Deque", with the C11 memory orderings from Lê, Pop,
+ * Cohen and Zappa Nardelli's "Correct and Efficient Work-Stealing for
+ * Weak Memory Models". The short version:
+ *
+ * - 'bottom' is only ever written by the owner, and 'top' only ever
+ *   moves up, via CAS. A push is just a write to the cell, and then
+ *   a store to bottom. No atomic read-modify-write at all.
+ *
+ * - A thief reads top, then bottom, and if there's something there,
+ *   reads the cell at top, and tries to CAS top forward. If the CAS
+ *   fails, somebody else got that item.
+ *
+ * - A pop decrements bottom first, and then reads top. If there's
+ *   more than one item left, the owner can't be racing with a thief
+ *   for the one it's taking, so it takes it without a CAS. Only when
+ *   it's down to the last item does it have to CAS top, just like a
+ *   thief would, to settle who gets it.
+ *
+ * When the owner fills up the buffer, it copies the live items into
+ * one twice the size, and swaps it in. Thieves may still be reading
+ * the old buffer (which is fine, since the items they'd see there are
+ * the same ones that are in the new buffer, and their CAS on top
+ * decides whether they actually got one), so the old buffer goes
+ * through mmm, instead of getting freed on the spot. The deque never
+ * shrinks.
+ *
+ * A steal can fail even when the deque isn't empty, if another thief
+ * (or the owner) got the item first. Thieves generally want to go try
+ * somebody else at that point, instead of fighting over the same
+ * deque, so wsdeque_steal() doesn't retry.
+ *
+ * Calling wsdeque_push() or wsdeque_pop() from any thread but the
+ * owner will not end well.
+ */
+
+#ifndef __WSDEQUE_H__
+#define __WSDEQUE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <hatrack/hatrack_config.h>
+
+// clang-format off
+typedef struct {
+    uint64_t          size;
+    _Atomic (void *)  cells[];
+} wsdeque_store_t;
+
+/* Thieves fight over top; the owner has bottom (and the store, which
+ * only the owner ever changes) to itself.
+ */
+typedef struct {
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic int64_t              top;
+    alignas(HATRACK_CACHE_LINE_SIZE)
+    _Atomic int64_t              bottom;
+    _Atomic (wsdeque_store_t *)  store;
+} wsdeque_t;
+
+wsdeque_t *wsdeque_new      (void);
+wsdeque_t *wsdeque_new_size (uint64_t);
+void       wsdeque_init     (wsdeque_t *);
+void       wsdeque_init_size(wsdeque_t *, uint64_t);
+void       wsdeque_cleanup  (wsdeque_t *);
+void       wsdeque_delete   (wsdeque_t *);
+void       wsdeque_push     (wsdeque_t *, void *);
+void      *wsdeque_pop      (wsdeque_t *, bool *);
+void      *wsdeque_steal    (wsdeque_t *, bool *);
+
+/* This can be off by one while a pop is racing with a steal. */
+static inline int64_t
+wsdeque_len(wsdeque_t *self)
+{
+    int64_t top;
+    int64_t bottom;
+
+    top    = atomic_load(&self->top);
+    bottom = atomic_load(&self->bottom);
+
+    return bottom > top ? bottom - top : 0;
+}
+
+#endif
@@ -45,6 +45,10 @@
 #include <hatrack/woolhat.h>
 #include <hatrack/tophat.h>
 #include <hatrack/crown.h>
+#include <hatrack/set.h>
+#include <hatrack/omap.h>
+#include <hatrack/u64map.h>
+#include <hatrack/cloche.h>
 
 typedef struct {
     hatrack_vtable_t vtable;
@@ -0,0 +1,197 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           backend.c
+ *  Description:    Selectable hash table backends for the high-level
+ *                  dictionary and set interfaces.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+// clang-format off
+static hatrack_vtable_t crown_backend_vtable = {
+    .init    = (hatrack_init_func)crown_init,
+    .init_sz = (hatrack_init_sz_func)crown_init_size,
+    .get     = (hatrack_get_func)crown_get,
+    .put     = (hatrack_put_func)crown_put,
+    .replace = (hatrack_replace_func)crown_replace,
+    .add     = (hatrack_add_func)crown_add,
+    .remove  = (hatrack_remove_func)crown_remove,
+    .delete  = (hatrack_delete_func)crown_delete,
+    .len     = (hatrack_len_func)crown_len,
+    .view    = (hatrack_view_func)crown_view
+};
+
+static hatrack_vtable_t woolhat_backend_vtable = {
+    .init    = (hatrack_init_func)woolhat_init,
+    .init_sz = (hatrack_init_sz_func)woolhat_init_size,
+    .get     = (hatrack_get_func)woolhat_get,
+    .put     = (hatrack_put_func)woolhat_put,
+    .replace = (hatrack_replace_func)woolhat_replace,
+    .add     = (hatrack_add_func)woolhat_add,
+    .remove  = (hatrack_remove_func)woolhat_remove,
+    .delete  = (hatrack_delete_func)woolhat_delete,
+    .len     = (hatrack_len_func)woolhat_len,
+    .view    = (hatrack_view_func)woolhat_view
+};
+
+static hatrack_vtable_t cloche_backend_vtable = {
+    .init    = (hatrack_init_func)cloche_init,
+    .init_sz = (hatrack_init_sz_func)cloche_init_size,
+    .get     = (hatrack_get_func)cloche_get,
+    .put     = (hatrack_put_func)cloche_put,
+    .replace = (hatrack_replace_func)cloche_replace,
+    .add     = (hatrack_add_func)cloche_add,
+    .remove  = (hatrack_remove_func)cloche_remove,
+    .delete  = (hatrack_delete_func)cloche_delete,
+    .len     = (hatrack_len_func)cloche_len,
+    .view    = (hatrack_view_func)cloche_view
+};
+
+#ifdef HATRACK_COMPILE_ALL_ALGORITHMS
+static hatrack_vtable_t witchhat_backend_vtable = {
+    .init    = (hatrack_init_func)witchhat_init,
+    .init_sz = (hatrack_init_sz_func)witchhat_init_size,
+    .get     = (hatrack_get_func)witchhat_get,
+    .put     = (hatrack_put_func)witchhat_put,
+    .replace = (hatrack_replace_func)witchhat_replace,
+    .add     = (hatrack_add_func)witchhat_add,
+    .remove  = (hatrack_remove_func)witchhat_remove,
+    .delete  = (hatrack_delete_func)witchhat_delete,
+    .len     = (hatrack_len_func)witchhat_len,
+    .view    = (hatrack_view_func)witchhat_view
+};
+
+static hatrack_vtable_t hihat_backend_vtable = {
+    .init    = (hatrack_init_func)hihat_init,
+    .init_sz = (hatrack_init_sz_func)hihat_init_size,
+    .get     = (hatrack_get_func)hihat_get,
+    .put     = (hatrack_put_func)hihat_put,
+    .replace = (hatrack_replace_func)hihat_replace,
+    .add     = (hatrack_add_func)hihat_add,
+    .remove  = (hatrack_remove_func)hihat_remove,
+    .delete  = (hatrack_delete_func)hihat_delete,
+    .len     = (hatrack_len_func)hihat_len,
+    .view    = (hatrack_view_func)hihat_view
+};
+
+static hatrack_vtable_t tophat_fast_backend_vtable = {
+    .init    = (hatrack_init_func)tophat_init_fast_wf,
+    .init_sz = (hatrack_init_sz_func)tophat_init_fast_wf_size,
+    .get     = (hatrack_get_func)tophat_get,
+    .put     = (hatrack_put_func)tophat_put,
+    .replace = (hatrack_replace_func)tophat_replace,
+    .add     = (hatrack_add_func)tophat_add,
+    .remove  = (hatrack_remove_func)tophat_remove,
+    .delete  = (hatrack_delete_func)tophat_delete,
+    .len     = (hatrack_len_func)tophat_len,
+    .view    = (hatrack_view_func)tophat_view
+};
+
+static hatrack_vtable_t tophat_cst_backend_vtable = {
+    .init    = (hatrack_init_func)tophat_init_cst_wf,
+    .init_sz = (hatrack_init_sz_func)tophat_init_cst_wf_size,
+    .get     = (hatrack_get_func)tophat_get,
+    .put     = (hatrack_put_func)tophat_put,
+    .replace = (hatrack_replace_func)tophat_replace,
+    .add     = (hatrack_add_func)tophat_add,
+    .remove  = (hatrack_remove_func)tophat_remove,
+    .delete  = (hatrack_delete_func)tophat_delete,
+    .len     = (hatrack_len_func)tophat_len,
+    .view    = (hatrack_view_func)tophat_view
+};
+#endif
+
+/* Indexed by hatrack_backend_t. HATRACK_BACKEND_DEFAULT has no entry
+ * of its own, since it means something different to the dictionary
+ * than it does to the set; callers resolve it before asking.
+ *
+ * Entries with a NULL vtable weren't compiled in.
+ */
+static hatrack_backend_info_t backend_info[HATRACK_BACKEND_NUM] = {
+    [HATRACK_BACKEND_CROWN] = {
+	.name   = "crown",
+	.vtable = &crown_backend_vtable,
+	.size   = sizeof(crown_t),
+	.stats  = (hatrack_stats_func)crown_stats
+    },
+    [HATRACK_BACKEND_WOOLHAT] = {
+	.name   = "woolhat",
+	.vtable = &woolhat_backend_vtable,
+	.size   = sizeof(woolhat_t),
+	.stats  = (hatrack_stats_func)woolhat_stats
+    },
+#ifdef HATRACK_COMPILE_ALL_ALGORITHMS
+    [HATRACK_BACKEND_WITCHHAT] = {
+	.name   = "witchhat",
+	.vtable = &witchhat_backend_vtable,
+	.size   = sizeof(witchhat_t),
+	.stats  = (hatrack_stats_func)witchhat_stats
+    },
+    [HATRACK_BACKEND_HIHAT] = {
+	.name   = "hihat",
+	.vtable = &hihat_backend_vtable,
+	.size   = sizeof(hihat_t)
+    },
+    [HATRACK_BACKEND_TOPHAT_FAST] = {
+	.name   = "tophat-fwf",
+	.vtable = &tophat_fast_backend_vtable,
+	.size   = sizeof(tophat_t)
+    },
+    [HATRACK_BACKEND_TOPHAT_CONSISTENT] = {
+	.name   = "tophat-cwf",
+	.vtable = &tophat_cst_backend_vtable,
+	.size   = sizeof(tophat_t)
+    },
+#endif
+    [HATRACK_BACKEND_CLOCHE] = {
+	.name   = "cloche",
+	.vtable = &cloche_backend_vtable,
+	.size   = sizeof(cloche_t)
+    },
+};
+// clang-format on
+
+hatrack_backend_info_t *
+hatrack_backend_get_info(hatrack_backend_t backend)
+{
+    if (backend <= HATRACK_BACKEND_DEFAULT || backend >= HATRACK_BACKEND_NUM) {
+        abort();
+    }
+
+    if (!backend_info[backend].vtable) {
+        abort();
+    }
+
+    return &backend_info[backend];
+}
+
+/* Note that the tables all get freed via their own delete function,
+ * which calls free() on the table, so we need to allocate them with
+ * malloc(), not via mmm.
+ */
+void *
+hatrack_backend_new(hatrack_backend_info_t *info)
+{
+    void *ret;
+
+    ret = malloc(info->size);
+
+    (*info->vtable->init)(ret);
+
+    return ret;
+}
@@ -0,0 +1,747 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           bitset.c
+ *  Description:    A lock-free dense bitmap set, for sets of integers
+ *                  from a bounded range.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+typedef enum {
+    HATRACK_BITSET_OP_DIFFERENCE,
+    HATRACK_BITSET_OP_UNION,
+    HATRACK_BITSET_OP_INTERSECTION,
+    HATRACK_BITSET_OP_DISJUNCTION
+} hatrack_bitset_op_t;
+
+/* One word's worth of a freeze. 'copied' is only ever 0 or 1; it's
+ * there so that the first thread to copy a word wins, even if the
+ * word itself is 0.
+ */
+typedef struct {
+    uint64_t bits;
+    uint64_t copied;
+} hatrack_bitset_copy_t;
+
+/* A freeze covers every set that a snapshot needs (one or two), so
+ * that the copies of both sets come from the same moment. The sets
+ * are kept in address order, which is also the order in which the
+ * freeze gets posted to them; see hatrack_bitset_freeze_help().
+ *
+ * 'refs' counts the sets the freeze is (or was) posted on. A finished
+ * freeze stays posted, with HATRACK_BITSET_F_DONE set in the pointer,
+ * until the next freeze replaces it, so the last set to let go of it
+ * is the one that retires it.
+ */
+struct hatrack_bitset_freeze_st {
+    hatrack_bitset_t              *sets[2];
+    _Atomic hatrack_bitset_copy_t *copies[2];
+    uint64_t                       num_sets;
+    _Atomic uint64_t               refs;
+    _Atomic bool                   done;
+    alignas(16)
+    _Atomic hatrack_bitset_copy_t  words[];
+};
+
+enum64(hatrack_bitset_flag_t,
+       HATRACK_BITSET_F_DONE = 0x0000000000000001
+);
+
+// clang-format off
+static void              hatrack_bitset_snapshot      (hatrack_bitset_t *,
+						       uint64_t *,
+						       hatrack_bitset_t *,
+						       uint64_t *);
+static void              hatrack_bitset_help_freeze   (hatrack_bitset_t *);
+static void              hatrack_bitset_freeze_help   (hatrack_bitset_freeze_t *);
+static void              hatrack_bitset_freeze_release(hatrack_bitset_freeze_t *);
+static hatrack_bitset_t *hatrack_bitset_combine       (hatrack_bitset_t *,
+						       hatrack_bitset_t *,
+						       hatrack_bitset_op_t);
+// clang-format on
+
+hatrack_bitset_t *
+hatrack_bitset_new(uint64_t num_bits)
+{
+    hatrack_bitset_t *ret;
+
+    ret = (hatrack_bitset_t *)malloc(sizeof(hatrack_bitset_t));
+
+    hatrack_bitset_init(ret, num_bits);
+
+    return ret;
+}
+
+void
+hatrack_bitset_init(hatrack_bitset_t *self, uint64_t num_bits)
+{
+    if (!num_bits) {
+	abort();
+    }
+
+    self->num_bits  = num_bits;
+    self->num_words = (num_bits + 63) >> 6;
+    self->words     = (_Atomic uint64_t *)calloc(self->num_words,
+						 sizeof(uint64_t));
+    self->versions  = (_Atomic uint64_t *)calloc(self->num_words,
+						 sizeof(uint64_t));
+
+    atomic_store(&self->freeze, NULL);
+
+    return;
+}
+
+/* The last freeze posted on the set is still there, unless the set
+ * was never frozen. We're one of the sets holding on to it, so we have
+ * to let go of it, but the other set (if any) might still need it.
+ */
+void
+hatrack_bitset_cleanup(hatrack_bitset_t *self)
+{
+    hatrack_bitset_freeze_t *freeze;
+
+    freeze = atomic_load(&self->freeze);
+
+    if (freeze) {
+	mmm_start_basic_op();
+	hatrack_bitset_freeze_release(
+	    hatrack_pflag_clear(freeze, HATRACK_BITSET_F_DONE));
+	mmm_end_op();
+    }
+
+    free((void *)self->words);
+    free((void *)self->versions);
+
+    return;
+}
+
+void
+hatrack_bitset_delete(hatrack_bitset_t *self)
+{
+    hatrack_bitset_cleanup(self);
+    free(self);
+
+    return;
+}
+
+bool
+hatrack_bitset_contains(hatrack_bitset_t *self, uint64_t item)
+{
+    if (item >= self->num_bits) {
+	return false;
+    }
+
+    return (atomic_load(&self->words[item >> 6]) >> (item & 63)) & 1;
+}
+
+/* Returns true if the item wasn't already in the set. If it was,
+ * we linearize on the load, and never touch the version, so that
+ * re-adding items doesn't hold up readers.
+ */
+bool
+hatrack_bitset_add(hatrack_bitset_t *self, uint64_t item)
+{
+    _Atomic uint64_t *word;
+    uint64_t          bit;
+    uint64_t          old;
+
+    if (item >= self->num_bits) {
+	abort();
+    }
+
+    word = &self->words[item >> 6];
+    bit  = 1ULL << (item & 63);
+
+    if (atomic_load(word) & bit) {
+	return false;
+    }
+
+    hatrack_bitset_help_freeze(self);
+
+    atomic_fetch_add(&self->versions[item >> 6], 1);
+    old = atomic_fetch_or(word, bit);
+    atomic_fetch_add(&self->versions[item >> 6], 1);
+
+    return !(old & bit);
+}
+
+/* Returns true if the item was in the set. */
+bool
+hatrack_bitset_remove(hatrack_bitset_t *self, uint64_t item)
+{
+    _Atomic uint64_t *word;
+    uint64_t          bit;
+    uint64_t          old;
+
+    if (item >= self->num_bits) {
+	return false;
+    }
+
+    word = &self->words[item >> 6];
+    bit  = 1ULL << (item & 63);
+
+    if (!(atomic_load(word) & bit)) {
+	return false;
+    }
+
+    hatrack_bitset_help_freeze(self);
+
+    atomic_fetch_add(&self->versions[item >> 6], 1);
+    old = atomic_fetch_and(word, ~bit);
+    atomic_fetch_add(&self->versions[item >> 6], 1);
+
+    return old & bit;
+}
+
+uint64_t
+hatrack_bitset_range(hatrack_bitset_t *self)
+{
+    return self->num_bits;
+}
+
+uint64_t
+hatrack_bitset_len(hatrack_bitset_t *self)
+{
+    uint64_t *words;
+    uint64_t  ret;
+    uint64_t  i;
+
+    words = (uint64_t *)malloc(sizeof(uint64_t) * self->num_words);
+    ret   = 0;
+
+    hatrack_bitset_snapshot(self, words, NULL, NULL);
+
+    for (i = 0; i < self->num_words; i++) {
+	ret += __builtin_popcountll(words[i]);
+    }
+
+    free(words);
+
+    return ret;
+}
+
+/* Returns the items in the set, in increasing order. */
+uint64_t *
+hatrack_bitset_items(hatrack_bitset_t *self, uint64_t *num)
+{
+    uint64_t *words;
+    uint64_t *ret;
+    uint64_t  word;
+    uint64_t  count;
+    uint64_t  i;
+    uint64_t  n;
+
+    words = (uint64_t *)malloc(sizeof(uint64_t) * self->num_words);
+    count = 0;
+
+    hatrack_bitset_snapshot(self, words, NULL, NULL);
+
+    for (i = 0; i < self->num_words; i++) {
+	count += __builtin_popcountll(words[i]);
+    }
+
+    ret = (uint64_t *)malloc(sizeof(uint64_t) * count);
+    n   = 0;
+
+    for (i = 0; i < self->num_words; i++) {
+	word = words[i];
+
+	while (word) {
+	    ret[n++] = (i << 6) + __builtin_ctzll(word);
+	    word &= word - 1;
+	}
+    }
+
+    free(words);
+
+    *num = count;
+
+    return ret;
+}
+
+/* The comparisons and the set algebra all take a snapshot of both
+ * sets at once, padded out with zeros to the larger of the two
+ * ranges, and then work a word at a time. The loops are kept simple
+ * enough for the compiler to vectorize.
+ */
+bool
+hatrack_bitset_is_eq(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    uint64_t *words1;
+    uint64_t *words2;
+    uint64_t  num_words;
+    bool      ret;
+
+    num_words = set1->num_words > set2->num_words ? set1->num_words
+						  : set2->num_words;
+    words1    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    words2    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+
+    hatrack_bitset_snapshot(set1, words1, set2, words2);
+
+    ret = !memcmp(words1, words2, sizeof(uint64_t) * num_words);
+
+    free(words1);
+    free(words2);
+
+    return ret;
+}
+
+/* Returns true if set A is a superset of set B; if proper is true,
+ * the sets also can't be equal.
+ */
+bool
+hatrack_bitset_is_superset(hatrack_bitset_t *set1,
+			   hatrack_bitset_t *set2,
+			   bool              proper)
+{
+    uint64_t *words1;
+    uint64_t *words2;
+    uint64_t  num_words;
+    uint64_t  missing;
+    uint64_t  extra;
+    uint64_t  i;
+
+    num_words = set1->num_words > set2->num_words ? set1->num_words
+						  : set2->num_words;
+    words1    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    words2    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    missing   = 0;
+    extra     = 0;
+
+    hatrack_bitset_snapshot(set1, words1, set2, words2);
+
+    for (i = 0; i < num_words; i++) {
+	missing |= words2[i] & ~words1[i];
+	extra   |= words1[i] & ~words2[i];
+    }
+
+    free(words1);
+    free(words2);
+
+    if (missing) {
+	return false;
+    }
+
+    return !proper || extra;
+}
+
+bool
+hatrack_bitset_is_subset(hatrack_bitset_t *set1,
+			 hatrack_bitset_t *set2,
+			 bool              proper)
+{
+    return hatrack_bitset_is_superset(set2, set1, proper);
+}
+
+bool
+hatrack_bitset_is_disjoint(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    uint64_t *words1;
+    uint64_t *words2;
+    uint64_t  num_words;
+    uint64_t  shared;
+    uint64_t  i;
+
+    num_words = set1->num_words > set2->num_words ? set1->num_words
+						  : set2->num_words;
+    words1    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    words2    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    shared    = 0;
+
+    hatrack_bitset_snapshot(set1, words1, set2, words2);
+
+    for (i = 0; i < num_words; i++) {
+	shared |= words1[i] & words2[i];
+    }
+
+    free(words1);
+    free(words2);
+
+    return !shared;
+}
+
+hatrack_bitset_t *
+hatrack_bitset_difference(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    return hatrack_bitset_combine(set1, set2, HATRACK_BITSET_OP_DIFFERENCE);
+}
+
+hatrack_bitset_t *
+hatrack_bitset_union(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    return hatrack_bitset_combine(set1, set2, HATRACK_BITSET_OP_UNION);
+}
+
+hatrack_bitset_t *
+hatrack_bitset_intersection(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    return hatrack_bitset_combine(set1, set2, HATRACK_BITSET_OP_INTERSECTION);
+}
+
+hatrack_bitset_t *
+hatrack_bitset_disjunction(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    return hatrack_bitset_combine(set1, set2, HATRACK_BITSET_OP_DISJUNCTION);
+}
+
+/* The result is computed in place in set 1's snapshot, which then
+ * becomes the new set's words; nobody else can see the new set until
+ * we return it.
+ */
+static hatrack_bitset_t *
+hatrack_bitset_combine(hatrack_bitset_t   *set1,
+		       hatrack_bitset_t   *set2,
+		       hatrack_bitset_op_t op)
+{
+    hatrack_bitset_t *ret;
+    uint64_t         *words1;
+    uint64_t         *words2;
+    uint64_t          num_words;
+    uint64_t          i;
+
+    num_words = set1->num_words > set2->num_words ? set1->num_words
+						  : set2->num_words;
+    words1    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+    words2    = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+
+    hatrack_bitset_snapshot(set1, words1, set2, words2);
+
+    switch (op) {
+    case HATRACK_BITSET_OP_DIFFERENCE:
+	for (i = 0; i < num_words; i++) {
+	    words1[i] &= ~words2[i];
+	}
+	break;
+    case HATRACK_BITSET_OP_UNION:
+	for (i = 0; i < num_words; i++) {
+	    words1[i] |= words2[i];
+	}
+	break;
+    case HATRACK_BITSET_OP_INTERSECTION:
+	for (i = 0; i < num_words; i++) {
+	    words1[i] &= words2[i];
+	}
+	break;
+    default:
+	for (i = 0; i < num_words; i++) {
+	    words1[i] ^= words2[i];
+	}
+	break;
+    }
+
+    free(words2);
+
+    ret            = (hatrack_bitset_t *)malloc(sizeof(hatrack_bitset_t));
+    ret->num_bits  = set1->num_bits > set2->num_bits ? set1->num_bits
+						     : set2->num_bits;
+    ret->num_words = num_words;
+    ret->words     = (_Atomic uint64_t *)words1;
+    ret->versions  = (_Atomic uint64_t *)calloc(num_words, sizeof(uint64_t));
+
+    atomic_store(&ret->freeze, NULL);
+
+    return ret;
+}
+
+/* See bitset.h for how this works. set2 / out2 can be NULL, when
+ * we only need one set. The output arrays must be at least as long
+ * as the set's words; anything past that is left alone.
+ *
+ * In the optimistic copy, the word loads themselves can be relaxed;
+ * the acquire fence keeps them from drifting past our second look at
+ * the versions.
+ */
+static inline bool
+hatrack_bitset_copy(hatrack_bitset_t *self, uint64_t *out, uint64_t *sum)
+{
+    uint64_t version;
+    uint64_t i;
+
+    for (i = 0; i < self->num_words; i++) {
+	version = atomic_load_explicit(&self->versions[i],
+				       memory_order_acquire);
+
+	if (version & 1) {
+	    return false;
+	}
+
+	*sum  += version;
+	out[i] = atomic_load_explicit(&self->words[i], memory_order_relaxed);
+    }
+
+    return true;
+}
+
+/* Versions only ever go up, so if the sum didn't change, none of
+ * them did.
+ */
+static inline uint64_t
+hatrack_bitset_version_sum(hatrack_bitset_t *self)
+{
+    uint64_t sum;
+    uint64_t i;
+
+    sum = 0;
+
+    for (i = 0; i < self->num_words; i++) {
+	sum += atomic_load_explicit(&self->versions[i], memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+static bool
+hatrack_bitset_try_snapshot(hatrack_bitset_t *set1,
+			    uint64_t         *out1,
+			    hatrack_bitset_t *set2,
+			    uint64_t         *out2)
+{
+    uint64_t sum;
+
+    sum = 0;
+
+    if (!hatrack_bitset_copy(set1, out1, &sum)) {
+	return false;
+    }
+
+    if (set2 && !hatrack_bitset_copy(set2, out2, &sum)) {
+	return false;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (set2) {
+	return hatrack_bitset_version_sum(set1)
+	    + hatrack_bitset_version_sum(set2) == sum;
+    }
+
+    return hatrack_bitset_version_sum(set1) == sum;
+}
+
+static hatrack_bitset_freeze_t *
+hatrack_bitset_freeze_new(hatrack_bitset_t *set1, hatrack_bitset_t *set2)
+{
+    hatrack_bitset_freeze_t *ret;
+    hatrack_bitset_t        *swap;
+    uint64_t                 num_words;
+
+    if (set2 == set1) {
+	set2 = NULL;
+    }
+
+    if (set2 && set2 < set1) {
+	swap = set1;
+	set1 = set2;
+	set2 = swap;
+    }
+
+    num_words = set1->num_words + (set2 ? set2->num_words : 0);
+    ret       = (hatrack_bitset_freeze_t *)mmm_alloc_committed(
+	sizeof(hatrack_bitset_freeze_t)
+	+ sizeof(hatrack_bitset_copy_t) * num_words);
+
+    ret->sets[0]   = set1;
+    ret->sets[1]   = set2;
+    ret->copies[0] = ret->words;
+    ret->copies[1] = ret->words + set1->num_words;
+    ret->num_sets  = set2 ? 2 : 1;
+
+    atomic_store(&ret->refs, ret->num_sets);
+
+    return ret;
+}
+
+static void
+hatrack_bitset_freeze_release(hatrack_bitset_freeze_t *freeze)
+{
+    if (atomic_fetch_sub(&freeze->refs, 1) == 1) {
+	mmm_retire(freeze);
+    }
+
+    return;
+}
+
+/* Called by writers before they change a bit. Most of the time,
+ * there's either no freeze on the set, or the last one is done, and
+ * we don't even need an mmm reservation. Otherwise, we take one, and
+ * look again, since the freeze we saw might have finished and been
+ * retired before we got our reservation.
+ */
+static void
+hatrack_bitset_help_freeze(hatrack_bitset_t *self)
+{
+    hatrack_bitset_freeze_t *freeze;
+
+    freeze = atomic_load(&self->freeze);
+
+    if (!freeze || hatrack_pflag_test(freeze, HATRACK_BITSET_F_DONE)) {
+	return;
+    }
+
+    mmm_start_basic_op();
+
+    freeze = atomic_load(&self->freeze);
+
+    if (freeze && !hatrack_pflag_test(freeze, HATRACK_BITSET_F_DONE)) {
+	hatrack_bitset_freeze_help(freeze);
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
+/* Anyone can call this on a freeze, and any number of threads can be
+ * at it at once. The caller needs to be in an mmm operation.
+ *
+ * First, we make sure the freeze is posted on every set it covers.
+ * Nobody copies anything until that's done, because until then,
+ * writers to the sets it isn't posted on yet don't know to help, and
+ * could change words after we copied words in the other set. If some
+ * other freeze is still going on a set, we help that one finish
+ * first. Since everybody posts in address order, the other freeze
+ * never needs a set that we've already got, so we can't end up
+ * helping each other in circles.
+ *
+ * A finished freeze stays posted, and posted freezes only ever get
+ * replaced by new ones once they're finished, so if we're slow and
+ * try to post a freeze that's already done, the CAS fails.
+ *
+ * Then we copy every word we find that nobody has copied yet, and
+ * mark the freeze as done.
+ */
+static void
+hatrack_bitset_freeze_help(hatrack_bitset_freeze_t *freeze)
+{
+    hatrack_bitset_t        *set;
+    hatrack_bitset_freeze_t *cur;
+    hatrack_bitset_freeze_t *done;
+    hatrack_bitset_copy_t    expected;
+    hatrack_bitset_copy_t    candidate;
+    uint64_t                 i;
+    uint64_t                 j;
+
+    for (i = 0; i < freeze->num_sets; i++) {
+	set = freeze->sets[i];
+	cur = atomic_load(&set->freeze);
+
+	while (cur != freeze) {
+	    if (atomic_load(&freeze->done)) {
+		return;
+	    }
+
+	    if (cur && !hatrack_pflag_test(cur, HATRACK_BITSET_F_DONE)) {
+		hatrack_bitset_freeze_help(cur);
+		cur = atomic_load(&set->freeze);
+		continue;
+	    }
+
+	    if (CAS(&set->freeze, &cur, freeze)) {
+		if (cur) {
+		    hatrack_bitset_freeze_release(
+			hatrack_pflag_clear(cur, HATRACK_BITSET_F_DONE));
+		}
+		break;
+	    }
+	}
+    }
+
+    for (i = 0; i < freeze->num_sets; i++) {
+	set              = freeze->sets[i];
+	candidate.copied = 1;
+
+	for (j = 0; j < set->num_words; j++) {
+	    if (atomic_load(&freeze->done)) {
+		break;
+	    }
+
+	    expected.bits   = 0;
+	    expected.copied = 0;
+	    candidate.bits  = atomic_load(&set->words[j]);
+
+	    CAS(&freeze->copies[i][j], &expected, candidate);
+	}
+    }
+
+    atomic_store(&freeze->done, true);
+
+    done = hatrack_pflag_set(freeze, HATRACK_BITSET_F_DONE);
+
+    for (i = 0; i < freeze->num_sets; i++) {
+	cur = freeze;
+
+	CAS(&freeze->sets[i]->freeze, &cur, done);
+    }
+
+    return;
+}
+
+static void
+hatrack_bitset_freeze_snapshot(hatrack_bitset_t *set1,
+			       uint64_t         *out1,
+			       hatrack_bitset_t *set2,
+			       uint64_t         *out2)
+{
+    hatrack_bitset_freeze_t       *freeze;
+    _Atomic hatrack_bitset_copy_t *copies;
+    uint64_t                       i;
+
+    mmm_start_basic_op();
+
+    freeze = hatrack_bitset_freeze_new(set1, set2);
+
+    hatrack_bitset_freeze_help(freeze);
+
+    copies = freeze->copies[freeze->sets[0] == set1 ? 0 : 1];
+
+    for (i = 0; i < set1->num_words; i++) {
+	out1[i] = atomic_load(&copies[i]).bits;
+    }
+
+    if (set2) {
+	copies = freeze->copies[freeze->sets[0] == set2 ? 0 : 1];
+
+	for (i = 0; i < set2->num_words; i++) {
+	    out2[i] = atomic_load(&copies[i]).bits;
+	}
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
+static void
+hatrack_bitset_snapshot(hatrack_bitset_t *set1,
+			uint64_t         *out1,
+			hatrack_bitset_t *set2,
+			uint64_t         *out2)
+{
+    uint64_t i;
+
+    for (i = 0; i < HATRACK_RETRY_THRESHOLD; i++) {
+	if (hatrack_bitset_try_snapshot(set1, out1, set2, out2)) {
+	    return;
+	}
+    }
+
+    hatrack_bitset_freeze_snapshot(set1, out1, set2, out2);
+
+    return;
+}
@@ -0,0 +1,790 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           cloche.c
+ *  Description:    Compact, Lock-free, Ordered hash table with
+ *                  Cheap Hashed Entries.
+ *
+ *                  A lock-free table that keeps its items in a dense,
+ *                  append-only array, in insertion order, so that
+ *                  views come out ordered without sorting.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+// clang-format off
+static cloche_store_t *cloche_store_new    (uint64_t);
+static void           *cloche_store_get    (cloche_store_t *, hatrack_hash_t,
+					    bool *);
+static void           *cloche_store_put    (cloche_store_t *, cloche_t *,
+					    hatrack_hash_t, void *, bool *);
+static void           *cloche_store_replace(cloche_store_t *, cloche_t *,
+					    hatrack_hash_t, void *, bool *);
+static bool            cloche_store_add    (cloche_store_t *, cloche_t *,
+					    hatrack_hash_t, void *);
+static void           *cloche_store_remove (cloche_store_t *, cloche_t *,
+					    hatrack_hash_t, bool *);
+static cloche_store_t *cloche_store_migrate(cloche_store_t *, cloche_t *);
+static cloche_entry_t *cloche_store_find   (cloche_store_t *, hatrack_hash_t);
+static cloche_entry_t *cloche_store_acquire(cloche_store_t *, hatrack_hash_t);
+// clang-format on
+
+cloche_t *
+cloche_new(void)
+{
+    cloche_t *ret;
+
+    ret = (cloche_t *)malloc(sizeof(cloche_t));
+
+    cloche_init(ret);
+
+    return ret;
+}
+
+cloche_t *
+cloche_new_size(char size)
+{
+    cloche_t *ret;
+
+    ret = (cloche_t *)malloc(sizeof(cloche_t));
+
+    cloche_init_size(ret, size);
+
+    return ret;
+}
+
+void
+cloche_init(cloche_t *self)
+{
+    cloche_init_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+/* Index slots are 32 bits, so we can't go past 2^32 of them.
+ */
+void
+cloche_init_size(cloche_t *self, char size)
+{
+    cloche_store_t *store;
+    uint64_t        len;
+
+    if (size > 32) {
+	abort();
+    }
+
+    if (size < HATRACK_MIN_SIZE_LOG) {
+	abort();
+    }
+
+    len   = 1ULL << size;
+    store = cloche_store_new(len);
+
+    atomic_store(&self->store_current, store);
+    atomic_store(&self->item_count, 0);
+
+    return;
+}
+
+void
+cloche_cleanup(cloche_t *self)
+{
+    mmm_retire(atomic_load(&self->store_current));
+
+    return;
+}
+
+void
+cloche_delete(cloche_t *self)
+{
+    cloche_cleanup(self);
+    free(self);
+
+    return;
+}
+
+/* cloche_get(), _put(), _replace(), _add(), _remove()
+ *
+ * These all work just like hihat's; see hihat.c for the discussion of
+ * how we use mmm to keep the store from getting freed out from under
+ * us.
+ */
+void *
+cloche_get(cloche_t *self, hatrack_hash_t hv, bool *found)
+{
+    void           *ret;
+    cloche_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = cloche_store_get(store, hv, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+cloche_put(cloche_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    void           *ret;
+    cloche_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = cloche_store_put(store, self, hv, item, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+cloche_replace(cloche_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    void           *ret;
+    cloche_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = cloche_store_replace(store, self, hv, item, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+bool
+cloche_add(cloche_t *self, hatrack_hash_t hv, void *item)
+{
+    bool            ret;
+    cloche_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = cloche_store_add(store, self, hv, item);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+cloche_remove(cloche_t *self, hatrack_hash_t hv, bool *found)
+{
+    void           *ret;
+    cloche_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = cloche_store_remove(store, self, hv, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+uint64_t
+cloche_len(cloche_t *self)
+{
+    return atomic_read(&self->item_count);
+}
+
+/* cloche_view()
+ *
+ * This is the whole point of cloche: the entries array is already in
+ * insertion order, so we just walk it, skipping anything that isn't
+ * live. The 'sort' parameter is ignored, since there's nothing to
+ * sort. We still fill in sort_epoch (with the entry's position), so
+ * that anyone who does sort the view gets the same order back.
+ *
+ * As with hihat, this isn't a consistent view if there are
+ * concurrent writers. We only look at entries that have been handed
+ * out, and we ignore any migration that's in progress.
+ */
+hatrack_view_t *
+cloche_view(cloche_t *self, uint64_t *num, bool sort)
+{
+    hatrack_view_t *view;
+    hatrack_view_t *p;
+    cloche_store_t *store;
+    cloche_record_t record;
+    uint64_t        num_entries;
+    uint64_t        num_items;
+    uint64_t        i;
+
+    mmm_start_basic_op();
+
+    store       = atomic_read(&self->store_current);
+    num_entries = atomic_read(&store->next_entry);
+
+    if (num_entries > store->capacity) {
+	num_entries = store->capacity;
+    }
+
+    if (!num_entries) {
+	*num = 0;
+	mmm_end_op();
+
+	return NULL;
+    }
+
+    view = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * num_entries);
+    p    = view;
+
+    for (i = 0; i < num_entries; i++) {
+	record = atomic_read(&store->entries[i].record);
+
+	if (!(record.info & CLOCHE_F_USED)) {
+	    continue;
+	}
+
+	p->item       = record.item;
+	p->sort_epoch = i + 1;
+	p++;
+    }
+
+    num_items = p - view;
+    *num      = num_items;
+
+    if (!num_items) {
+	free(view);
+	mmm_end_op();
+
+	return NULL;
+    }
+
+    view = realloc(view, num_items * sizeof(hatrack_view_t));
+
+    mmm_end_op();
+
+    return view;
+}
+
+/* The index and the entries array live in a single allocation, with
+ * the entries right after the last index slot. The index always has
+ * at least HATRACK_MIN_SIZE slots, so the entries start out 16-byte
+ * aligned, as the 128-bit compare-and-swap requires.
+ *
+ * As with hihat, mmm_alloc_committed() zeroes the memory, which
+ * leaves every slot empty, and every entry unreserved.
+ */
+static cloche_store_t *
+cloche_store_new(uint64_t size)
+{
+    cloche_store_t *store;
+    uint64_t        capacity;
+    uint64_t        alloc_len;
+
+    if (size > (1ULL << 32)) {
+	abort();
+    }
+
+    capacity  = size - (size >> 2);
+    alloc_len = sizeof(cloche_store_t) + sizeof(_Atomic uint32_t) * size
+	      + sizeof(cloche_entry_t) * capacity;
+
+    store            = (cloche_store_t *)mmm_alloc_committed(alloc_len);
+    store->last_slot = size - 1;
+    store->capacity  = capacity;
+    store->entries   = (cloche_entry_t *)&store->index[size];
+
+    return store;
+}
+
+/* Finds the entry that the index currently maps hv to, if any.  The
+ * entry might not hold a live item; callers need to check the record.
+ *
+ * Note that we load index slots with a full barrier, not
+ * atomic_read(). The writer that installs a slot writes the entry's
+ * hash value first, and we need to be sure that, if we see the slot,
+ * we also see the hash value. Otherwise, on architectures with weaker
+ * memory ordering than x86, we could skip past the key's slot, and
+ * an add could end up giving the key a second one.
+ */
+static cloche_entry_t *
+cloche_store_find(cloche_store_t *self, hatrack_hash_t hv)
+{
+    uint64_t        bix;
+    uint64_t        i;
+    uint32_t        slot;
+    cloche_entry_t *entry;
+
+    bix = hatrack_bucket_index(hv, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	slot = atomic_load(&self->index[bix]);
+
+	if (!slot) {
+	    return NULL;
+	}
+
+	entry = &self->entries[slot - 1];
+
+	if (hatrack_hashes_eq(hv, atomic_read(&entry->hv))) {
+	    return entry;
+	}
+
+	bix = (bix + 1) & self->last_slot;
+    }
+
+    return NULL;
+}
+
+/* Finds the entry that hv should be written to, for put() and add().
+ *
+ * If the index already maps hv to an entry, and that entry hasn't
+ * been deleted, that's the one. Otherwise, we need a fresh entry at
+ * the end of the entries array: we reserve one by bumping next_entry,
+ * write our hash value into it, and then try to swing the index slot
+ * over to it (from empty, or from the deleted entry).
+ *
+ * If we lose that race, whoever won had to have been writing to the
+ * same slot, so we look at the slot again. Most of the time, they were
+ * writing the same key, and we'll go use their entry. The entry we
+ * reserved just goes unused; no slot points to it, and it never gets a
+ * record, so views and migrations skip it.
+ *
+ * The caller still has to fill in the record, and the record is where
+ * it'll notice a migration. So, if we see MOVING here, we just return
+ * the entry, and let the caller deal. We return NULL when the entries
+ * array (or the index) is full, which also means it's time to migrate.
+ */
+static cloche_entry_t *
+cloche_store_acquire(cloche_store_t *self, hatrack_hash_t hv)
+{
+    uint64_t        bix;
+    uint64_t        i;
+    uint64_t        eix;
+    uint32_t        slot;
+    cloche_entry_t *entry;
+    cloche_record_t record;
+
+    bix = hatrack_bucket_index(hv, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	slot = atomic_load(&self->index[bix]);
+
+    check_slot:
+	if (slot) {
+	    entry = &self->entries[slot - 1];
+
+	    if (!hatrack_hashes_eq(hv, atomic_read(&entry->hv))) {
+		bix = (bix + 1) & self->last_slot;
+		continue;
+	    }
+
+	    record = atomic_read(&entry->record);
+
+	    if (!(record.info & CLOCHE_F_DELETED)
+		|| (record.info & CLOCHE_F_MOVING)) {
+		return entry;
+	    }
+	}
+
+	eix = atomic_fetch_add(&self->next_entry, 1);
+
+	if (eix >= self->capacity) {
+	    return NULL;
+	}
+
+	entry = &self->entries[eix];
+
+	atomic_store(&entry->hv, hv);
+
+	if (CAS(&self->index[bix], &slot, (uint32_t)(eix + 1))) {
+	    return entry;
+	}
+
+	goto check_slot;
+    }
+
+    return NULL;
+}
+
+static void *
+cloche_store_get(cloche_store_t *self, hatrack_hash_t hv, bool *found)
+{
+    cloche_entry_t *entry;
+    cloche_record_t record;
+
+    entry = cloche_store_find(self, hv);
+
+    if (!entry) {
+	return hatrack_not_found(found);
+    }
+
+    record = atomic_read(&entry->record);
+
+    if (record.info & CLOCHE_F_USED) {
+	return hatrack_found(found, record.item);
+    }
+
+    return hatrack_not_found(found);
+}
+
+/* When the entry already holds a live item, we swap in the new item,
+ * keeping the info field (and so, the entry's position). Otherwise, the
+ * entry is fresh, and we mark it used.
+ *
+ * As with hihat, if we lose the compare-and-swap to another writer,
+ * we order ourselves before that writer, and hand back our own item
+ * for the sake of memory management. And if the entry got deleted
+ * between cloche_store_acquire() finding it and us reading the
+ * record, we go back around, since the key needs a new entry now.
+ */
+static void *
+cloche_store_put(cloche_store_t *self,
+		 cloche_t       *top,
+		 hatrack_hash_t  hv,
+		 void           *item,
+		 bool           *found)
+{
+    cloche_entry_t *entry;
+    cloche_record_t record;
+    cloche_record_t candidate;
+
+    entry = cloche_store_acquire(self, hv);
+
+    if (!entry) {
+	goto migrate_and_retry;
+    }
+
+    record = atomic_read(&entry->record);
+
+    if (record.info & CLOCHE_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    if (record.info & CLOCHE_F_DELETED) {
+	return cloche_store_put(self, top, hv, item, found);
+    }
+
+    candidate.item = item;
+
+    if (record.info & CLOCHE_F_USED) {
+	candidate.info = record.info;
+
+	if (CAS(&entry->record, &record, candidate)) {
+	    return hatrack_found(found, record.item);
+	}
+    }
+    else {
+	candidate.info = CLOCHE_F_USED;
+
+	if (CAS(&entry->record, &record, candidate)) {
+	    atomic_fetch_add(&top->item_count, 1);
+
+	    return hatrack_not_found(found);
+	}
+    }
+
+    if (record.info & CLOCHE_F_MOVING) {
+    migrate_and_retry:
+	self = cloche_store_migrate(self, top);
+
+	return cloche_store_put(self, top, hv, item, found);
+    }
+
+    return hatrack_found(found, item);
+}
+
+static void *
+cloche_store_replace(cloche_store_t *self,
+		     cloche_t       *top,
+		     hatrack_hash_t  hv,
+		     void           *item,
+		     bool           *found)
+{
+    cloche_entry_t         *entry;
+    cloche_record_t         record;
+    cloche_record_t         candidate;
+    hatrack_backoff_state_t backoff;
+
+    entry = cloche_store_find(self, hv);
+
+    if (!entry) {
+	return hatrack_not_found(found);
+    }
+
+    record = atomic_read(&entry->record);
+
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+    while (true) {
+	if (record.info & CLOCHE_F_MOVING) {
+	    self = cloche_store_migrate(self, top);
+
+	    return cloche_store_replace(self, top, hv, item, found);
+	}
+
+	if (!(record.info & CLOCHE_F_USED)) {
+	    return hatrack_not_found(found);
+	}
+
+	candidate.item = item;
+	candidate.info = record.info;
+	if (CAS(&entry->record, &record, candidate)) {
+	    break;
+	}
+	hatrack_backoff(&backoff);
+    }
+
+    return hatrack_found(found, record.item);
+}
+
+static bool
+cloche_store_add(cloche_store_t *self,
+		 cloche_t       *top,
+		 hatrack_hash_t  hv,
+		 void           *item)
+{
+    cloche_entry_t *entry;
+    cloche_record_t record;
+    cloche_record_t candidate;
+
+    entry = cloche_store_acquire(self, hv);
+
+    if (!entry) {
+	goto migrate_and_retry;
+    }
+
+    record = atomic_read(&entry->record);
+
+    if (record.info & CLOCHE_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    if (record.info & CLOCHE_F_USED) {
+	return false;
+    }
+
+    if (record.info & CLOCHE_F_DELETED) {
+	return cloche_store_add(self, top, hv, item);
+    }
+
+    candidate.item = item;
+    candidate.info = CLOCHE_F_USED;
+
+    if (CAS(&entry->record, &record, candidate)) {
+	atomic_fetch_add(&top->item_count, 1);
+
+	return true;
+    }
+
+    if (record.info & CLOCHE_F_MOVING) {
+    migrate_and_retry:
+	self = cloche_store_migrate(self, top);
+
+	return cloche_store_add(self, top, hv, item);
+    }
+
+    // Someone else got an item in there first.
+    return false;
+}
+
+/* Deleted entries keep their hash value (and their index slot), but
+ * they never come back to life. If we lose a race with a put that
+ * overwrote the item, we just try again, like hihat_store_replace().
+ */
+static void *
+cloche_store_remove(cloche_store_t *self,
+		    cloche_t       *top,
+		    hatrack_hash_t  hv,
+		    bool           *found)
+{
+    cloche_entry_t         *entry;
+    cloche_record_t         record;
+    cloche_record_t         candidate;
+    hatrack_backoff_state_t backoff;
+
+    entry = cloche_store_find(self, hv);
+
+    if (!entry) {
+	return hatrack_not_found(found);
+    }
+
+    record         = atomic_read(&entry->record);
+    candidate.item = NULL;
+    candidate.info = CLOCHE_F_DELETED;
+
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+    while (true) {
+	if (record.info & CLOCHE_F_MOVING) {
+	    self = cloche_store_migrate(self, top);
+
+	    return cloche_store_remove(self, top, hv, found);
+	}
+
+	if (!(record.info & CLOCHE_F_USED)) {
+	    return hatrack_not_found(found);
+	}
+	if (CAS(&entry->record, &record, candidate)) {
+	    break;
+	}
+	hatrack_backoff(&backoff);
+    }
+
+    atomic_fetch_sub(&top->item_count, 1);
+
+    return hatrack_found(found, record.item);
+}
+
+/* The overall structure here is the same as hihat_store_migrate();
+ * see that function for the full discussion. The big difference is
+ * that we need the entries in the new store to stay in the same
+ * order, and to be dense.
+ *
+ * Once every entry in the old store is marked MOVING, no record in
+ * the old store can change. At that point, every helper agrees on
+ * which entries are live, so each can independently figure out
+ * where each live entry goes: entry i goes to position j in the new
+ * store, where j is the number of live entries before i. Deleted
+ * entries, and any entries that got reserved but never written,
+ * simply don't get copied.
+ *
+ * Note that we mark every entry up to the capacity as MOVING, not
+ * just the ones that have been handed out, so that writers that have
+ * reserved an entry, but not yet written to it, will notice the
+ * migration.
+ *
+ * Copying an entry means writing the hash value and record into the
+ * new entry, then installing the new entry in the new index, where we
+ * stop as soon as we find a slot that points to an entry with our
+ * hash value, since that means another helper already did it.
+ */
+static cloche_store_t *
+cloche_store_migrate(cloche_store_t *self, cloche_t *top)
+{
+    cloche_store_t *new_store;
+    cloche_store_t *candidate_store;
+    cloche_entry_t *entry;
+    cloche_entry_t *new_entry;
+    cloche_record_t record;
+    cloche_record_t expected_record;
+    cloche_record_t candidate_record;
+    hatrack_hash_t  hv;
+    hatrack_hash_t  expected_hv;
+    uint64_t        new_used;
+    uint64_t        expected_used;
+    uint64_t        i, j;
+    uint64_t        bix;
+    uint32_t        slot;
+
+    new_store = atomic_read(&top->store_current);
+
+    if (new_store != self) {
+	return new_store;
+    }
+
+    new_used = 0;
+
+    for (i = 0; i < self->capacity; i++) {
+	entry  = &self->entries[i];
+	record = atomic_read(&entry->record);
+
+	if (!(record.info & CLOCHE_F_MOVING)) {
+	    OR2X64L(&entry->record, CLOCHE_F_MOVING);
+	    record = atomic_read(&entry->record);
+	}
+
+	if (record.info & CLOCHE_F_USED) {
+	    new_used++;
+	}
+    }
+
+    new_store = atomic_read(&self->store_next);
+
+    if (!new_store) {
+	candidate_store = cloche_store_new(hatrack_new_size(self->last_slot,
+							    new_used));
+
+	if (!CAS(&self->store_next, &new_store, candidate_store)) {
+	    mmm_retire_unused(candidate_store);
+	}
+	else {
+	    new_store = candidate_store;
+	}
+    }
+
+    for (i = 0, j = 0; i < self->capacity; i++) {
+	entry  = &self->entries[i];
+	record = atomic_read(&entry->record);
+
+	if (!(record.info & CLOCHE_F_USED)) {
+	    continue;
+	}
+
+	if (record.info & CLOCHE_F_MOVED) {
+	    j++;
+	    continue;
+	}
+
+	hv          = atomic_read(&entry->hv);
+	new_entry   = &new_store->entries[j];
+	expected_hv = atomic_read(&new_entry->hv);
+
+	if (hatrack_bucket_unreserved(expected_hv)) {
+	    CAS(&new_entry->hv, &expected_hv, hv);
+	}
+
+	expected_record.item  = NULL;
+	expected_record.info  = 0;
+	candidate_record.item = record.item;
+	candidate_record.info = CLOCHE_F_USED;
+
+	CAS(&new_entry->record, &expected_record, candidate_record);
+
+	bix = hatrack_bucket_index(hv, new_store->last_slot);
+
+	while (true) {
+	    slot = atomic_load(&new_store->index[bix]);
+
+	    if (!slot) {
+		if (CAS(&new_store->index[bix], &slot, (uint32_t)(j + 1))) {
+		    break;
+		}
+	    }
+
+	    if (hatrack_hashes_eq(hv,
+				  atomic_read(&new_store->entries[slot - 1].hv))) {
+		break;
+	    }
+
+	    bix = (bix + 1) & new_store->last_slot;
+	}
+
+	OR2X64L(&entry->record, CLOCHE_F_MOVED);
+	j++;
+    }
+
+    expected_used = 0;
+
+    CAS(&new_store->next_entry, &expected_used, new_used);
+
+    if (CAS(&top->store_current, &self, new_store)) {
+	mmm_retire(self);
+    }
+
+    return atomic_read(&top->store_current);
+}
@@ -169,6 +169,104 @@
 static crown_store_t  *crown_store_migrate(crown_store_t *, crown_t *);
 static inline bool     crown_help_required(uint64_t);
 static inline bool     crown_need_to_help (crown_t *);
+static uint64_t        crown_store_bytes  (crown_store_t *);
+static void            crown_retire_store (crown_t *, crown_store_t *);
+
+/* The negative-lookup filter.
+ *
+ * Most of the time, a lookup for a key that isn't in the table
+ * costs us the neighborhood map, plus the hash of every bucket in
+ * the neighborhood (and then a bit of linear probing). When a table
+ * mostly gets asked about things it doesn't have, that adds up. So,
+ * optionally, each store can carry a "split block" Bloom filter: an
+ * array of 64-byte blocks. Each hash value picks one block, and one
+ * bit in each of the block's eight words. Checking the filter is
+ * therefore one cache line, and if any of our eight bits is missing,
+ * the key is definitely not in the store.
+ *
+ * We set a hash value's bits BEFORE we try to reserve a bucket for
+ * it, and since a record can't show up in a bucket until the bucket
+ * is reserved, anyone who can possibly see the item will also see the
+ * bits. If our reservation fails, we've just set some bits for no
+ * reason, which is harmless.
+ *
+ * Bloom filters can't forget anything, so deleted items keep their
+ * bits until the next migration, which builds the new store's filter
+ * from scratch, from the items that actually get migrated. Since
+ * crown doesn't reuse buckets, deleted items count toward the
+ * migration threshold, so stale bits can't pile up forever.
+ *
+ * At 8 bits per bucket, and with tables at most 75% full before
+ * they migrate, we get a false positive rate of about 1%.
+ *
+ * The salts are the ones from the Parquet bloom filter spec; they
+ * only need to be odd and reasonably random looking.
+ */
+static const uint32_t crown_filter_salts[CROWN_FILTER_BLOCK_WORDS] = {
+    0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+    0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+};
+
+/* We only use the top 64 bits of the hash value here, since crown
+ * picks buckets from the bottom bits.
+ */
+static inline _Atomic uint64_t *
+crown_filter_block(crown_store_t *self, hatrack_hash_t hv, uint64_t *bits)
+{
+    uint64_t high;
+    uint32_t key;
+    uint64_t i;
+
+#ifdef HAVE___INT128_T
+    high = (uint64_t)(hv >> 64);
+#else
+    high = hv.w2;
+#endif
+    key = (uint32_t)high;
+
+    for (i = 0; i < CROWN_FILTER_BLOCK_WORDS; i++) {
+	bits[i] = 1ULL << ((uint32_t)(key * crown_filter_salts[i]) >> 26);
+    }
+
+    return &self->filter[((high >> 32) & self->filter_mask)
+			 * CROWN_FILTER_BLOCK_WORDS];
+}
+
+static inline void
+crown_filter_add(crown_store_t *self, hatrack_hash_t hv)
+{
+    _Atomic uint64_t *block;
+    uint64_t          bits[CROWN_FILTER_BLOCK_WORDS];
+    uint64_t          i;
+
+    block = crown_filter_block(self, hv, bits);
+
+    for (i = 0; i < CROWN_FILTER_BLOCK_WORDS; i++) {
+	if (!(atomic_read(&block[i]) & bits[i])) {
+	    atomic_fetch_or(&block[i], bits[i]);
+	}
+    }
+
+    return;
+}
+
+static inline bool
+crown_filter_check(crown_store_t *self, hatrack_hash_t hv)
+{
+    _Atomic uint64_t *block;
+    uint64_t          bits[CROWN_FILTER_BLOCK_WORDS];
+    uint64_t          i;
+
+    block = crown_filter_block(self, hv, bits);
+
+    for (i = 0; i < CROWN_FILTER_BLOCK_WORDS; i++) {
+	if (!(atomic_read(&block[i]) & bits[i])) {
+	    return false;
+	}
+    }
+
+    return true;
+}
 
 crown_t *
 crown_new(void)
@@ -217,11 +315,15 @@ crown_init_size(crown_t *self, char size)
     }
 
     len              = 1 << size;
-    store            = crown_store_new(len);
+    store            = crown_store_new(len, false);
     self->next_epoch = 1;
+    self->use_filter = false;
     
     atomic_store(&self->store_current, store);
     atomic_store(&self->item_count, 0);
+    atomic_store(&self->help_needed, 0);
+    atomic_store(&self->migrations, 0);
+    atomic_store(&self->retired, NULL);
 
     return;
 }
@@ -230,6 +332,7 @@ void
 crown_cleanup(crown_t *self)
 {
     mmm_retire(atomic_load(&self->store_current));
+    hatrack_retired_release(atomic_load(&self->retired));
 
     return;
 }
@@ -329,6 +432,135 @@ crown_len(crown_t *self)
     return atomic_read(&self->item_count);
 }
 
+/* When we retire a store, we add its size to the table's count of
+ * retired-but-not-yet-freed memory, and have mmm call us back to
+ * subtract it once the store is actually freed (see stats.h).
+ */
+static void
+crown_store_freed(crown_store_t *store, hatrack_retired_t *retired)
+{
+    hatrack_retired_sub(retired, crown_store_bytes(store));
+
+    return;
+}
+
+static void
+crown_retire_store(crown_t *top, crown_store_t *store)
+{
+    hatrack_retired_t *retired;
+
+    retired = hatrack_retired_get(&top->retired);
+
+    hatrack_retired_add(retired, crown_store_bytes(store));
+    mmm_add_cleanup_handler(store, (mmm_cleanup_func)crown_store_freed, retired);
+    mmm_retire(store);
+
+    return;
+}
+
+/* Turns the negative-lookup filter on or off. Stores only get a
+ * filter when they're created, so normally this takes effect at the
+ * next migration. But if the table has never had anything put into
+ * it, we swap in a fresh store right away, so that a table that's
+ * set up right after creation gets the filter from the start.
+ *
+ * As with our other setup calls, don't call this while other
+ * threads might be using the table.
+ */
+void
+crown_set_filter(crown_t *self, bool value)
+{
+    crown_store_t *store;
+
+    self->use_filter = value;
+    store            = atomic_load(&self->store_current);
+
+    if (atomic_load(&store->used_count) || (store->filter != NULL) == value) {
+	return;
+    }
+
+    atomic_store(&self->store_current,
+		 crown_store_new(store->last_slot + 1, value));
+    crown_retire_store(self, store);
+
+    return;
+}
+
+/* See stats.h for what the fields mean. We take a basic mmm
+ * reservation so the store can't go away while we walk it, but we
+ * don't do anything else to coordinate with writers.
+ *
+ * The neighborhood numbers come straight from the neighborhood maps.
+ * Items that are further from their home bucket than the map can
+ * describe are the ones that had to spill past their neighborhood.
+ */
+void
+crown_stats(crown_t *self, hatrack_stats_t *stats)
+{
+    memset(stats, 0, sizeof(hatrack_stats_t));
+    crown_stats_raw(self, stats);
+    hatrack_stats_finish(stats);
+
+    return;
+}
+
+/* Like crown_stats(), but adds to whatever's in 'stats', and doesn't
+ * compute the averages, so that hatrack_dict can add up its shards
+ * first.
+ */
+void
+crown_stats_raw(crown_t *self, hatrack_stats_t *stats)
+{
+    crown_store_t  *store;
+    hatrack_hash_t  hv;
+    hatrack_stats_t local;
+    uint64_t        i;
+    uint64_t        distance;
+    uint64_t        count;
+
+    memset(&local, 0, sizeof(hatrack_stats_t));
+    mmm_start_basic_op();
+
+    store              = atomic_read(&self->store_current);
+    local.num_buckets  = store->last_slot + 1;
+    local.store_bytes  = crown_store_bytes(store);
+
+    for (i = 0; i <= store->last_slot; i++) {
+	count = __builtin_popcountll(atomic_read(crown_map_at(store, i)));
+
+	if (count > local.max_neighborhood) {
+	    local.max_neighborhood = count;
+	}
+
+	hv = atomic_read(crown_hv_at(store, i));
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	local.used_buckets++;
+
+	distance = (i - hatrack_bucket_index(hv, store->last_slot))
+	         & store->last_slot;
+
+	if (distance >= sizeof(hop_t) * 8) {
+	    local.neighborhood_overflows++;
+	}
+
+	hatrack_stats_add_probe(&local, distance);
+    }
+
+    mmm_end_op();
+
+    local.num_items     = atomic_read(&self->item_count);
+    local.migrations    = atomic_read(&self->migrations);
+    local.retired_bytes = hatrack_retired_bytes(&self->retired);
+
+    hatrack_stats_merge(stats, &local);
+
+    return;
+}
+
 hatrack_view_t *
 crown_view(crown_t *self, uint64_t *num, bool sort)
 {
@@ -349,53 +581,7 @@ crown_view(crown_t *self, uint64_t *num, bool sort)
 hatrack_view_t *
 crown_view_fast(crown_t *self, uint64_t *num, bool sort)
 {
-    hatrack_view_t *view;
-    hatrack_view_t *p;
-    crown_bucket_t *cur;
-    crown_bucket_t *end;
-    crown_record_t  record;
-    uint64_t        num_items;
-    uint64_t        alloc_len;
-    crown_store_t  *store;
-
-    store     = atomic_read(&self->store_current);
-    alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
-    p         = view;
-    cur       = store->buckets;
-    end       = cur + (store->last_slot + 1);
-
-    while (cur < end) {
-        record        = atomic_read(&cur->record);
-        p->sort_epoch = record.info & CROWN_EPOCH_MASK;
-
-	if (!p->sort_epoch) {
-	    cur++;
-	    continue;
-	}
-	
-        p->item = record.item;
-	
-        p++;
-        cur++;
-    }
-
-    num_items = p - view;
-    *num      = num_items;
-
-    if (!num_items) {
-        free(view);
-	
-        return NULL;
-    }
-
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
-
-    if (sort) {
-	qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
-    }
-
-    return view;
+    return crown_store_view(atomic_read(&self->store_current), num, sort);
 }
 
 
@@ -411,46 +597,85 @@ hatrack_view_t *
 crown_view_slow(crown_t *self, uint64_t *num, bool sort)
 {
     hatrack_view_t *view;
-    hatrack_view_t *p;
-    crown_bucket_t *cur;
-    crown_bucket_t *end;
-    crown_record_t  record;
-    uint64_t        num_items;
-    uint64_t        alloc_len;
     crown_store_t  *store;
-    bool            expected;
 
-    while (true) {
-	store    = atomic_read(&self->store_current);
-	expected = false;
+    do {
+	store = crown_store_claim(self);
+    } while (!store);
 
-	if (CAS(&store->claimed, &expected, true)) {
-	    break;
-	}
+    view = crown_store_view(store, num, sort);
+
+    crown_store_release(self, store);
+
+    return view;
+}
+
+/* Tries to claim the current store for a reader, and freezes it. If
+ * we get it, the store's contents can't change any more, and the
+ * store won't get retired until we hand it back via
+ * crown_store_release().
+ *
+ * If someone else already has the store claimed (another reader, or
+ * a migration that finished and is retiring it), we help the
+ * migration along, and return NULL, so that the caller can decide
+ * whether it still needs a store, and try again if so.
+ */
+crown_store_t *
+crown_store_claim(crown_t *self)
+{
+    crown_store_t *store;
+    bool           expected;
+
+    store    = atomic_read(&self->store_current);
+    expected = false;
+
+    if (!CAS(&store->claimed, &expected, true)) {
 	crown_store_migrate(store, self);
+
+	return NULL;
     }
 
     crown_store_migrate(store, self);
 
+    return store;
+}
+
+void
+crown_store_release(crown_t *self, crown_store_t *store)
+{
+    crown_retire_store(self, store);
+
+    return;
+}
+
+/* Pulls the live items out of a store, without coordinating with
+ * writers in any way. If the store came from crown_store_claim(),
+ * it's frozen, so the view is consistent.
+ */
+hatrack_view_t *
+crown_store_view(crown_store_t *store, uint64_t *num, bool sort)
+{
+    hatrack_view_t *view;
+    hatrack_view_t *p;
+    crown_record_t  record;
+    uint64_t        i;
+    uint64_t        num_items;
+    uint64_t        alloc_len;
+
     alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
     view      = (hatrack_view_t *)malloc(alloc_len);
     p         = view;
-    cur       = store->buckets;
-    end       = cur + (store->last_slot + 1);
 
-    while (cur < end) {
-        record        = atomic_read(&cur->record);
+    for (i = 0; i <= store->last_slot; i++) {
+        record        = atomic_read(crown_record_at(store, i));
         p->sort_epoch = record.info & CROWN_EPOCH_MASK;
 
 	if (!p->sort_epoch) {
-	    cur++;
 	    continue;
 	}
 
         p->item = record.item;
-	
         p++;
-        cur++;
     }
 
     num_items = p - view;
@@ -468,22 +693,101 @@ crown_view_slow(crown_t *self, uint64_t *num, bool sort)
 	qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
     }
 
-    mmm_retire(store);
-
     return view;
 }
 
-crown_store_t *
-crown_store_new(uint64_t size)
+/* Our stores get allocated in one chunk: the store header, the
+ * buckets, and then the negative-lookup filter, if we're using one.
+ *
+ * In the structure-of-arrays layout, each of the three arrays is a
+ * multiple of the cache line size long (since our tables are never
+ * smaller than 2^HATRACK_MIN_SIZE_LOG), so once we line up the first
+ * one, the others line up too. mmm doesn't give us any alignment
+ * guarantees beyond 16 bytes, so we ask for an extra cache line's
+ * worth of memory, and round up. Same goes for the filter.
+ */
+static inline uintptr_t
+crown_align_to_line(uintptr_t addr)
 {
-    crown_store_t *store;
-    uint64_t       alloc_len;
+    return (addr + HATRACK_CACHE_LINE_SIZE - 1)
+	 & ~((uintptr_t)HATRACK_CACHE_LINE_SIZE - 1);
+}
+
+static inline uint64_t
+crown_filter_blocks(uint64_t size)
+{
+    uint64_t num_blocks;
+
+    num_blocks = (size * CROWN_FILTER_BITS_PER_BUCKET)
+	       / (CROWN_FILTER_BLOCK_WORDS * 64);
 
+    if (!num_blocks) {
+	num_blocks = 1;
+    }
+
+    return num_blocks;
+}
+
+/* How much memory a store of the given size takes, not counting the
+ * mmm header. crown_stats() needs this too, and so does the cleanup
+ * handler we put on retired stores.
+ */
+static uint64_t
+crown_store_alloc_len(uint64_t size, bool filter)
+{
+    uint64_t alloc_len;
+
+#ifdef HATRACK_CROWN_SOA
+    alloc_len = sizeof(crown_store_t) + HATRACK_CACHE_LINE_SIZE
+	      + (sizeof(hatrack_hash_t) + sizeof(crown_record_t)
+		 + sizeof(hop_t)) * size;
+#else
     alloc_len = sizeof(crown_store_t) + sizeof(crown_bucket_t) * size;
-    store     = (crown_store_t *)mmm_alloc_committed(alloc_len);
+#endif
+
+    if (filter) {
+	alloc_len += HATRACK_CACHE_LINE_SIZE
+	           + crown_filter_blocks(size) * CROWN_FILTER_BLOCK_WORDS
+	           * sizeof(uint64_t);
+    }
+
+    return alloc_len;
+}
+
+static uint64_t
+crown_store_bytes(crown_store_t *store)
+{
+    return sizeof(mmm_header_t)
+	 + crown_store_alloc_len(store->last_slot + 1, store->filter != NULL);
+}
 
-    store->last_slot  = size - 1;
-    store->threshold  = hatrack_compute_table_threshold(size);
+crown_store_t *
+crown_store_new(uint64_t size, bool filter)
+{
+    crown_store_t *store;
+    uint64_t       num_blocks;
+    uintptr_t      end;
+
+    num_blocks = filter ? crown_filter_blocks(size) : 0;
+    store      = (crown_store_t *)mmm_alloc_committed(
+	crown_store_alloc_len(size, filter));
+    store->last_slot = size - 1;
+    store->threshold = hatrack_compute_table_threshold(size);
+
+#ifdef HATRACK_CROWN_SOA
+    end                  = crown_align_to_line((uintptr_t)store->arrays);
+    store->hashes        = (_Atomic hatrack_hash_t *)end;
+    store->records       = (_Atomic crown_record_t *)(store->hashes + size);
+    store->neighbor_maps = (_Atomic hop_t *)(store->records + size);
+    end                  = (uintptr_t)(store->neighbor_maps + size);
+#else
+    end = (uintptr_t)(store->buckets + size);
+#endif
+
+    if (filter) {
+	store->filter      = (_Atomic uint64_t *)crown_align_to_line(end);
+	store->filter_mask = num_blocks - 1;
+    }
 
     return store;
 }
@@ -494,7 +798,7 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
     uint64_t        bix;
     uint64_t        i;
     hatrack_hash_t  hv2;
-    crown_bucket_t *bucket;
+    uint64_t        ix;
     crown_record_t  record;
     hop_t           map;
 
@@ -509,9 +813,16 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
      * Note that we set i = -1 here (actually, MAXINT, but C doesn't
      * care), for reasons that should become clear after the first
      * loop.
+     *
+     * Before any of that, if the store has a negative-lookup filter,
+     * we ask it first; most misses end right here.
      */
+    if (self->filter && !crown_filter_check(self, hv1)) {
+	goto not_found;
+    }
+
     bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
+    map = atomic_read(crown_map_at(self, bix));
     i   = -1;
 
     /* CLZ stands for "count leading zeros."  
@@ -524,11 +835,11 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
      */
     while (map) {
 	i      = CLZ(map);
-	bucket = &self->buckets[(bix + i) & self->last_slot];
-	hv2    = atomic_read(&bucket->hv);
+	ix     = (bix + i) & self->last_slot;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
-	    record = atomic_read(&bucket->record);
+	    record = atomic_read(crown_record_at(self, ix));
 	    if (record.info & CROWN_EPOCH_MASK) {
 		if (found) {
 		    *found = true;
@@ -592,8 +903,8 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
     bix = (bix + i) & self->last_slot;
 
     for (; i < self->last_slot; i++) {
-        bucket = &self->buckets[bix];
-        hv2    = atomic_read(&bucket->hv);
+        ix     = bix;
+        hv2    = atomic_read(crown_hv_at(self, ix));
 	
         if (hatrack_bucket_unreserved(hv2)) {
             goto not_found;
@@ -604,7 +915,7 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
             continue;
         }
 
-        record = atomic_read(&bucket->record);
+        record = atomic_read(crown_record_at(self, ix));
 	
         if (record.info & CROWN_EPOCH_MASK) {
             if (found) {
@@ -659,25 +970,26 @@ crown_store_put(crown_store_t  *self,
 		bool           *found,
 		uint64_t        count)
 {
-    void           *old_item;
-    bool            new_item;
-    uint64_t        bix;
-    uint64_t        i;
-    hatrack_hash_t  hv2;
-    crown_bucket_t *bucket;
-    crown_bucket_t *orig_bucket;
-    crown_record_t  record;
-    crown_record_t  candidate;
-    hop_t           map;
-    hop_t           new_map;
-    hop_t           bit_to_set;
-    
-#ifndef HATRACK_FULL_LINEAR_PROBES
-    uint64_t        orig_index;
-#endif    
+    void                   *old_item;
+    bool                    new_item;
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    uint64_t                ix;
+    uint64_t                orig_index;
+    crown_record_t          record;
+    crown_record_t          candidate;
+    hop_t                   map;
+    hop_t                   new_map;
+    hop_t                   bit_to_set;
+    hatrack_backoff_state_t backoff;
+
+    if (self->filter) {
+	crown_filter_add(self, hv1);
+    }
 
-    bix         = hatrack_bucket_index(hv1, self->last_slot);
-    orig_bucket = &self->buckets[bix];
+    bix        = hatrack_bucket_index(hv1, self->last_slot);
+    orig_index = bix;
 
 #ifndef HATRACK_FULL_LINEAR_PROBES
     /* When we're not linear probing, we first iterate through the
@@ -687,13 +999,12 @@ crown_store_put(crown_store_t  *self,
      * the things appropriate for our operation...
      */
     i          = -1;
-    map        = atomic_read(&orig_bucket->neighbor_map);
-    orig_index = bix;
+    map        = atomic_read(crown_map_at(self, orig_index));
 
     while (map) {
-	i = CLZ(map);
-	bucket = &self->buckets[(bix + i) & self->last_slot];
-	hv2    = atomic_read(&bucket->hv);
+	i   = CLZ(map);
+	ix  = (bix + i) & self->last_slot;
+	hv2 = atomic_read(crown_hv_at(self, ix));
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
 	    goto found_bucket;
@@ -710,21 +1021,27 @@ crown_store_put(crown_store_t  *self,
 #endif    
 
     for (; i <= self->last_slot; i++) {
-        bucket = &self->buckets[bix];
-	hv2    = atomic_read(&bucket->hv);
+        ix     = bix;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 	
 	if (hatrack_bucket_unreserved(hv2)) {
-	    if (CAS(&bucket->hv, &hv2, hv1)) {
+	    if (CAS(crown_hv_at(self, ix), &hv2, hv1)) {
 		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
 		    goto migrate_and_retry;
 		}
 
-		map        = atomic_read(&orig_bucket->neighbor_map);
+		map        = atomic_read(crown_map_at(self, orig_index));
 		bit_to_set = CROWN_HOME_BIT >> i;
 		
-		do {
+		hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+		while (true) {
 		    new_map = map | bit_to_set;
-		} while (!CAS(&orig_bucket->neighbor_map, &map, new_map));
+		    if (CAS(crown_map_at(self, orig_index), &map, new_map)) {
+			break;
+		    }
+		    hatrack_backoff(&backoff);
+		}
 		
 		goto found_bucket;
 	    }
@@ -749,12 +1066,12 @@ crown_store_put(crown_store_t  *self,
 	 * eliminate the chance of a race condition.
 	 */
 	if (hatrack_bucket_index(hv2, self->last_slot) == orig_index) {
-	    map        = atomic_read(&orig_bucket->neighbor_map);
+	    map        = atomic_read(crown_map_at(self, orig_index));
 	    bit_to_set = CROWN_HOME_BIT >> i;
 	    
 	    while (!(map & bit_to_set)) {
 		new_map = map | bit_to_set;
-		CAS(&orig_bucket->neighbor_map, &map, new_map);
+		CAS(crown_map_at(self, orig_index), &map, new_map);
 	    }
 	}
 #endif	
@@ -783,7 +1100,7 @@ crown_store_put(crown_store_t  *self,
     return crown_store_put(self, top, hv1, item, found, count);
 
  found_bucket:
-    record = atomic_read(&bucket->record);
+    record = atomic_read(crown_record_at(self, ix));
     
     if (record.info & CROWN_F_MOVING) {
 	goto migrate_and_retry;
@@ -810,7 +1127,7 @@ crown_store_put(crown_store_t  *self,
 
     candidate.item = item;
 
-    if (CAS(&bucket->record, &record, candidate)) {
+    if (CAS(crown_record_at(self, ix), &record, candidate)) {
         if (new_item) {
             atomic_fetch_add(&top->item_count, 1);
         }
@@ -843,13 +1160,17 @@ crown_store_replace(crown_store_t    *self,
     uint64_t        bix;
     uint64_t        i;
     hatrack_hash_t  hv2;
-    crown_bucket_t *bucket;
+    uint64_t        ix;
     crown_record_t  record;
     crown_record_t  candidate;
     hop_t           map;    
 
+    if (self->filter && !crown_filter_check(self, hv1)) {
+	goto not_found;
+    }
+
     bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
+    map = atomic_read(crown_map_at(self, bix));
     i   = -1;
 
     /* Since replace never acquires a bucket, it is not subject to the
@@ -861,8 +1182,8 @@ crown_store_replace(crown_store_t    *self,
      */
     while (map) {
 	i      = CLZ(map);
-	bucket = &self->buckets[(bix + i) & self->last_slot];
-	hv2    = atomic_read(&bucket->hv);
+	ix     = (bix + i) & self->last_slot;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
 	    goto found_bucket;
@@ -875,8 +1196,8 @@ crown_store_replace(crown_store_t    *self,
     bix = (bix + i) & self->last_slot;
     
     for (; i <= self->last_slot; i++) {
-        bucket = &self->buckets[bix];
-	hv2    = atomic_read(&bucket->hv);
+        ix     = bix;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 	
 	if (hatrack_bucket_unreserved(hv2)) {
 	    goto not_found;
@@ -897,7 +1218,7 @@ crown_store_replace(crown_store_t    *self,
     return NULL;
 
  found_bucket:
-    record = atomic_read(&bucket->record);
+    record = atomic_read(crown_record_at(self, ix));
     
     if (record.info & CROWN_F_MOVING) {
     migrate_and_retry:
@@ -926,7 +1247,7 @@ crown_store_replace(crown_store_t    *self,
     candidate.item = item;
     candidate.info = record.info;
 
-    if(!CAS(&bucket->record, &record, candidate)) {
+    if(!CAS(crown_record_at(self, ix), &record, candidate)) {
 	if (record.info & CROWN_F_MOVING) {
 	    goto migrate_and_retry;
 	}
@@ -959,33 +1280,33 @@ crown_store_add(crown_store_t    *self,
 		   void          *item,
 		   uint64_t       count)
 {
-    uint64_t        bix;
-    uint64_t        i;
-    hatrack_hash_t  hv2;
-    crown_bucket_t *bucket;
-    crown_bucket_t *orig_bucket;    
-    crown_record_t  record;
-    crown_record_t  candidate;
-    hop_t           map;
-    hop_t           new_map;
-    hop_t           bit_to_set;
-    
-#ifndef HATRACK_FULL_LINEAR_PROBES
-    uint64_t        orig_index;
-#endif
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    uint64_t                ix;
+    uint64_t                orig_index;
+    crown_record_t          record;
+    crown_record_t          candidate;
+    hop_t                   map;
+    hop_t                   new_map;
+    hop_t                   bit_to_set;
+    hatrack_backoff_state_t backoff;
+
+    if (self->filter) {
+	crown_filter_add(self, hv1);
+    }
 
-    bix = hatrack_bucket_index(hv1, self->last_slot);
-    orig_bucket = &self->buckets[bix];
+    bix        = hatrack_bucket_index(hv1, self->last_slot);
+    orig_index = bix;
 
 #ifndef HATRACK_FULL_LINEAR_PROBES
     i          = -1;
-    map        = atomic_read(&orig_bucket->neighbor_map);
-    orig_index = bix;
+    map        = atomic_read(crown_map_at(self, orig_index));
 
     while (map) {
-	i          = CLZ(map);
-	bucket     = &self->buckets[(bix + i) & self->last_slot];
-	hv2        = atomic_read(&bucket->hv);
+	i   = CLZ(map);
+	ix  = (bix + i) & self->last_slot;
+	hv2 = atomic_read(crown_hv_at(self, ix));
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
 	    goto found_bucket;
@@ -1002,21 +1323,27 @@ crown_store_add(crown_store_t    *self,
 #endif
     
     for (; i <= self->last_slot; i++) {
-        bucket = &self->buckets[bix];
-	hv2    = atomic_read(&bucket->hv);
+        ix     = bix;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 	
 	if (hatrack_bucket_unreserved(hv2)) {
-	    if (CAS(&bucket->hv, &hv2, hv1)) {
+	    if (CAS(crown_hv_at(self, ix), &hv2, hv1)) {
 		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
 		    goto migrate_and_retry;
 		}
 		
-		map        = atomic_read(&orig_bucket->neighbor_map);
+		map        = atomic_read(crown_map_at(self, orig_index));
 		bit_to_set = CROWN_HOME_BIT >> i;
 		
-		do {
+		hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+		while (true) {
 		    new_map = map | bit_to_set;
-		} while (!CAS(&orig_bucket->neighbor_map, &map, new_map));
+		    if (CAS(crown_map_at(self, orig_index), &map, new_map)) {
+			break;
+		    }
+		    hatrack_backoff(&backoff);
+		}
 		
 		goto found_bucket;
 	    }
@@ -1028,12 +1355,12 @@ crown_store_add(crown_store_t    *self,
 
 #ifndef HATRACK_FULL_LINEAR_PROBES	
 	if (hatrack_bucket_index(hv2, self->last_slot) == orig_index) {
-	    map = atomic_read(&orig_bucket->neighbor_map);
+	    map = atomic_read(crown_map_at(self, orig_index));
 	    bit_to_set = CROWN_HOME_BIT >> i;
 	    
 	    while (!(map & bit_to_set)) {
 		new_map = map | bit_to_set;
-		CAS(&orig_bucket->neighbor_map, &map, new_map);
+		CAS(crown_map_at(self, orig_index), &map, new_map);
 	    }
 	}
 #endif	
@@ -1063,7 +1390,7 @@ crown_store_add(crown_store_t    *self,
     return crown_store_add(self, top, hv1, item, count);
 
 found_bucket:
-    record = atomic_read(&bucket->record);
+    record = atomic_read(crown_record_at(self, ix));
     if (record.info & CROWN_F_MOVING) {
 	goto migrate_and_retry;
     }
@@ -1075,7 +1402,7 @@ found_bucket:
     candidate.item = item;
     candidate.info = CROWN_F_INITED | top->next_epoch++;
 
-    if (CAS(&bucket->record, &record, candidate)) {
+    if (CAS(crown_record_at(self, ix), &record, candidate)) {
 	atomic_fetch_add(&top->item_count, 1);
         return true;
     }
@@ -1104,18 +1431,22 @@ crown_store_remove(crown_store_t *self,
     uint64_t        i;
     hop_t           map;
     hatrack_hash_t  hv2;
-    crown_bucket_t *bucket;
+    uint64_t        ix;
     crown_record_t  record;
     crown_record_t  candidate;
 
+    if (self->filter && !crown_filter_check(self, hv1)) {
+	goto not_found;
+    }
+
     bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
+    map = atomic_read(crown_map_at(self, bix));
     i   = -1;
 
     while (map) {
 	i      = CLZ(map);
-	bucket = &self->buckets[(bix + i) & self->last_slot];
-	hv2    = atomic_read(&bucket->hv);
+	ix     = (bix + i) & self->last_slot;
+	hv2    = atomic_read(crown_hv_at(self, ix));
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
 	    goto found_bucket;
@@ -1128,8 +1459,8 @@ crown_store_remove(crown_store_t *self,
     bix = (bix + i) & self->last_slot;
     
     for (; i <= self->last_slot; i++) {
-        bucket = &self->buckets[bix];
-        hv2    = atomic_read(&bucket->hv);
+        ix     = bix;
+        hv2    = atomic_read(crown_hv_at(self, ix));
 	
         if (hatrack_bucket_unreserved(hv2)) {
 	    goto not_found;
@@ -1151,7 +1482,7 @@ crown_store_remove(crown_store_t *self,
     return NULL;
 
 found_bucket:
-    record = atomic_read(&bucket->record);
+    record = atomic_read(crown_record_at(self, ix));
     if (record.info & CROWN_F_MOVING) {
     migrate_and_retry:
 	count = count + 1;
@@ -1177,7 +1508,7 @@ found_bucket:
     candidate.item = NULL;
     candidate.info = CROWN_F_INITED;
 
-    if (CAS(&bucket->record, &record, candidate)) {
+    if (CAS(crown_record_at(self, ix), &record, candidate)) {
         atomic_fetch_sub(&top->item_count, 1);
 
         if (found) {
@@ -1228,9 +1559,6 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
     crown_store_t  *new_store;
     crown_store_t  *candidate_store;
     uint64_t        new_size;
-    crown_bucket_t *bucket;
-    crown_bucket_t *new_bucket;
-    crown_bucket_t *map_bucket;
     crown_record_t  record;
     crown_record_t  candidate_record;
     crown_record_t  expected_record;
@@ -1238,10 +1566,13 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
     hatrack_hash_t  hv;
     uint64_t        i, j;
     uint64_t        bix;
+    uint64_t        new_ix;
+    uint64_t        map_ix;
     uint64_t        new_used;
     uint64_t        expected_used;
     hop_t           map;
     hop_t           new_map;
+    bool            expected_claim;
 
 #ifdef HATRACK_SKIP_ON_MIGRATIONS
     uint64_t        original_bix;
@@ -1255,8 +1586,7 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
     }
 
     for (i = 0; i <= self->last_slot; i++) {
-        bucket                = &self->buckets[i];
-        record                = atomic_read(&bucket->record);
+        record                = atomic_read(crown_record_at(self, i));
         candidate_record.item = record.item;
 
 	if (record.info & CROWN_F_MOVING) {
@@ -1267,14 +1597,14 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
 	    continue;
 	}
 	    
-	OR2X64L(&bucket->record, CROWN_F_MOVING);
+	OR2X64L(crown_record_at(self, i), CROWN_F_MOVING);
 
-	record = atomic_read(&bucket->record);
+	record = atomic_read(crown_record_at(self, i));
 
 	if (record.info & CROWN_EPOCH_MASK) {
 	    new_used++;
 	} else {
-	    OR2X64L(&bucket->record, CROWN_F_MOVED); 
+	    OR2X64L(crown_record_at(self, i), CROWN_F_MOVED); 
 	}
     }
 
@@ -1288,7 +1618,7 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
 	    new_size        = hatrack_new_size(self->last_slot, new_used);
 	}
 	
-        candidate_store = crown_store_new(new_size);
+        candidate_store = crown_store_new(new_size, top->use_filter);
 	
         if (!CAS(&self->store_next, &new_store, candidate_store)) {
             mmm_retire_unused(candidate_store);
@@ -1299,29 +1629,34 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
     }
 
     for (i = 0; i <= self->last_slot; i++) {
-        bucket = &self->buckets[i];
-        record = atomic_read(&bucket->record);
+        record = atomic_read(crown_record_at(self, i));
 
         if (record.info & CROWN_F_MOVED) {
             continue;
         }
 
-        hv         = atomic_read(&bucket->hv);
-        bix        = hatrack_bucket_index(hv, new_store->last_slot);
-	map_bucket = &new_store->buckets[bix];
+        hv     = atomic_read(crown_hv_at(self, i));
+        bix    = hatrack_bucket_index(hv, new_store->last_slot);
+	map_ix = bix;
+
+	/* This is where the new store's filter gets built; everyone
+	 * who helps with the migration sets the bits before trying to
+	 * install the record, so they're set by the time anyone can
+	 * see it.
+	 */
+	if (new_store->filter) {
+	    crown_filter_add(new_store, hv);
+	}
 
 #ifdef HATRACK_SKIP_ON_MIGRATIONS
 	original_bix = bix;
-	map          = atomic_read(&map_bucket->neighbor_map);
+	map          = atomic_read(crown_map_at(new_store, map_ix));
 	j            = -1;
 
 	while (map) {
-	    uint64_t ix;
-	    
 	    j           = CLZ(map);
-	    ix          = (original_bix + j) & new_store->last_slot;
-	    new_bucket  = &new_store->buckets[ix];
-	    expected_hv = atomic_read(&new_bucket->hv);
+	    new_ix      = (original_bix + j) & new_store->last_slot;
+	    expected_hv = atomic_read(crown_hv_at(new_store, new_ix));
 	    if (hatrack_hashes_eq(hv, expected_hv)) {
 		goto found_bucket;
 	    }
@@ -1336,14 +1671,14 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
 #endif
 	
 	for (; j <= new_store->last_slot; j++) {
-            new_bucket     = &new_store->buckets[bix];
-	    expected_hv    = atomic_read(&new_bucket->hv);
+            new_ix         = bix;
+	    expected_hv    = atomic_read(crown_hv_at(new_store, new_ix));
 	    
 	    if (hatrack_bucket_unreserved(expected_hv)) {
-		if (CAS(&new_bucket->hv, &expected_hv, hv)) {
-		    map        = atomic_read(&map_bucket->neighbor_map);
+		if (CAS(crown_hv_at(new_store, new_ix), &expected_hv, hv)) {
+		    map        = atomic_read(crown_map_at(new_store, map_ix));
 		    new_map    = map | (CROWN_HOME_BIT >> j);
-		    CAS(&map_bucket->neighbor_map, &map, new_map);
+		    CAS(crown_map_at(new_store, map_ix), &map, new_map);
 		    
 		    break;
 		}
@@ -1365,12 +1700,12 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
         expected_record.info  = 0;
         expected_record.item  = NULL;
 
-        CAS(&new_bucket->record,
+        CAS(crown_record_at(new_store, new_ix),
 	     &expected_record,
 	     candidate_record
 	   );
 
-	OR2X64L(&bucket->record, CROWN_F_MOVED);
+	OR2X64L(crown_record_at(self, i), CROWN_F_MOVED);
     }
 
     expected_used = 0;
@@ -1384,8 +1719,16 @@ crown_store_migrate(crown_store_t *self, crown_t *top)
 	     &self,
 	     new_store
 	   )) {
-	if (!self->claimed) {
-	    mmm_retire(self);
+	atomic_fetch_add(&top->migrations, 1);
+
+	/* Whoever claims the old store gets to retire it. If a reader
+	 * claimed it (see crown_store_claim()), they'll retire it
+	 * when they're done with it.
+	 */
+	expected_claim = false;
+
+	if (CAS(&self->claimed, &expected_claim, true)) {
+	    crown_retire_store(top, self);
 	}
     }
 
@@ -25,6 +25,57 @@
 static hatrack_hash_t hatrack_dict_get_hash_value(hatrack_dict_t *, void *);
 static void           hatrack_dict_record_eject  (hatrack_dict_item_t *,
 						  hatrack_dict_t *);
+static hatrack_view_t *hatrack_dict_view         (hatrack_dict_t *,
+						  uint64_t *, bool);
+static hatrack_view_t *hatrack_dict_sharded_view (hatrack_dict_t *,
+						  uint64_t *, bool);
+static void            hatrack_dict_init_options (hatrack_dict_t *, uint32_t);
+static void            hatrack_dict_crown_cleanup(hatrack_dict_t *, crown_t *);
+static void            hatrack_dict_freeze_shards(hatrack_dict_t *,
+						  hatrack_dict_freeze_t *);
+static void            hatrack_dict_feed_hooks   (hatrack_dict_t *);
+
+/* For sharded dictionaries, we pick the shard from the TOP bits of
+ * the hash value. Crown picks buckets from the bottom bits, so this
+ * way, the keys in any given shard are still spread evenly across
+ * that shard's buckets.
+ */
+static inline crown_t *
+hatrack_dict_shard(hatrack_dict_t *self, hatrack_hash_t hv)
+{
+    uint64_t high;
+
+    if (!self->shard_bits) {
+	return &self->crown_instance;
+    }
+
+#ifdef HAVE___INT128_T
+    high = (uint64_t)(hv >> 64);
+#else
+    high = hv.w2;
+#endif
+
+    return &self->shards[high >> (64 - self->shard_bits)].table;
+}
+
+/* If someone is taking a consistent view of a sharded dictionary, we
+ * help them get every shard frozen before we write to any shard; see
+ * hatrack_dict_sharded_view(). Callers need to be inside an mmm
+ * operation.
+ */
+static inline void
+hatrack_dict_help_freeze(hatrack_dict_t *self)
+{
+    hatrack_dict_freeze_t *freeze;
+
+    freeze = atomic_read(&self->freeze);
+
+    if (freeze) {
+	hatrack_dict_freeze_shards(self, freeze);
+    }
+
+    return;
+}
 
 hatrack_dict_t *
 hatrack_dict_new(uint32_t key_type)
@@ -38,11 +89,143 @@ hatrack_dict_new(uint32_t key_type)
     return ret;
 }
 
+hatrack_dict_t *
+hatrack_dict_new_with_backend(uint32_t key_type, hatrack_backend_t backend)
+{
+    hatrack_dict_t *ret;
+
+    ret = (hatrack_dict_t *)malloc(sizeof(hatrack_dict_t));
+
+    hatrack_dict_init_with_backend(ret, key_type, backend);
+
+    return ret;
+}
+
+hatrack_dict_t *
+hatrack_dict_new_sharded(uint32_t key_type, uint32_t shard_bits)
+{
+    hatrack_dict_t *ret;
+
+    ret = (hatrack_dict_t *)malloc(sizeof(hatrack_dict_t));
+
+    hatrack_dict_init_sharded(ret, key_type, shard_bits);
+
+    return ret;
+}
+
 void
 hatrack_dict_init(hatrack_dict_t *self, uint32_t key_type)
 {
-    crown_init(&self->crown_instance);
+    hatrack_dict_init_with_backend(self, key_type, HATRACK_DICT_BACKEND);
+
+    return;
+}
+
+/* Crown is our native backend. When we're on top of crown, we use
+ * the crown_store_* calls directly, to avoid double-calling mmm
+ * (though that's now safe), and to get slow (consistent) views when
+ * asked for them.
+ *
+ * For anything else, we keep a pointer to the table, and go through
+ * its public API via the vtable. Since the items we put into the
+ * table are our own mmm-allocated hatrack_dict_item_t's, the backend
+ * only ever sees opaque pointers, and hands back the old item on a
+ * put / replace / remove, so that we can run hooks and retire it,
+ * exactly like we do with crown.
+ */
+void
+hatrack_dict_init_with_backend(hatrack_dict_t   *self,
+			       uint32_t          key_type,
+			       hatrack_backend_t backend)
+{
+    hatrack_backend_info_t *info;
+
+    if (backend == HATRACK_BACKEND_DEFAULT) {
+	backend = HATRACK_DICT_BACKEND;
+    }
+
+    if (backend == HATRACK_BACKEND_CROWN) {
+	crown_init(&self->crown_instance);
+	self->backend_vtable = NULL;
+	self->backend_table  = NULL;
+    }
+    else {
+	info                 = hatrack_backend_get_info(backend);
+	self->backend_vtable = info->vtable;
+	self->backend_table  = hatrack_backend_new(info);
+    }
+
+    self->backend    = backend;
+    self->shards     = NULL;
+    self->shard_bits = 0;
+    self->freeze     = NULL;
+
+    hatrack_dict_init_options(self, key_type);
+
+    return;
+}
 
+/* A sharded dictionary splits its keys across 2^shard_bits crown
+ * tables, instead of keeping them all in one.
+ *
+ * The point is migration. When a single crown table fills up, every
+ * thread that's writing to it ends up helping to copy the whole
+ * thing to a new store, and at high thread counts, that shows up as
+ * nasty tail latency for whoever happens to be writing at the
+ * time. With shards, each table grows on its own schedule, and each
+ * migration is only 1/2^shard_bits of the work, so the stalls are
+ * both shorter and spread out. We also spread out the item counters
+ * that every write bumps.
+ *
+ * Individual operations behave exactly as before, since any given key
+ * only ever lives in one shard. The things that look at the whole
+ * dictionary (hatrack_dict_len() and the views) need to visit every
+ * shard, and so get a bit more expensive; see
+ * hatrack_dict_sharded_view() for what that means for consistent
+ * views.
+ *
+ * Sharding is only available on top of crown. Passing 0 for
+ * shard_bits gives you a plain, unsharded dictionary.
+ */
+void
+hatrack_dict_init_sharded(hatrack_dict_t *self,
+			  uint32_t        key_type,
+			  uint32_t        shard_bits)
+{
+    uint64_t i;
+    uint64_t num_shards;
+
+    if (!shard_bits) {
+	hatrack_dict_init_with_backend(self, key_type, HATRACK_BACKEND_CROWN);
+	return;
+    }
+
+    if (shard_bits > HATRACK_DICT_MAX_SHARD_BITS) {
+	abort();
+    }
+
+    num_shards           = 1ULL << shard_bits;
+    self->backend_vtable = NULL;
+    self->backend_table  = NULL;
+    self->backend        = HATRACK_BACKEND_CROWN;
+    self->shard_bits     = shard_bits;
+    self->freeze         = NULL;
+    self->shards         = (hatrack_dict_shard_t *)
+	aligned_alloc(alignof(hatrack_dict_shard_t),
+		      sizeof(hatrack_dict_shard_t) * num_shards);
+
+    for (i = 0; i < num_shards; i++) {
+	crown_init(&self->shards[i].table);
+    }
+
+    hatrack_dict_init_options(self, key_type);
+
+    return;
+}
+
+static void
+hatrack_dict_init_options(hatrack_dict_t *self, uint32_t key_type)
+{
     switch (key_type) {
     case HATRACK_DICT_KEY_TYPE_INT:
     case HATRACK_DICT_KEY_TYPE_REAL:
@@ -64,7 +247,9 @@ hatrack_dict_init(hatrack_dict_t *self, uint32_t key_type)
     self->free_handler                   = NULL;
     self->key_return_hook                = NULL;
     self->val_return_hook                = NULL;
+    self->change_log                     = NULL;
     self->slow_views                     = false;
+    self->sorted_views                   = false;
 
     return;
 }
@@ -72,26 +257,68 @@ hatrack_dict_init(hatrack_dict_t *self, uint32_t key_type)
 void
 hatrack_dict_cleanup(hatrack_dict_t *self)
 {
-    uint64_t           i;
+    uint64_t        i;
+    uint64_t        num;
+    hatrack_view_t *view;
+
+    if (self->change_log) {
+	hatrack_changelog_delete(self->change_log);
+    }
+
+    if (self->backend_vtable) {
+	if (self->free_handler) {
+	    view = (*self->backend_vtable->view)(self->backend_table,
+						 &num,
+						 false);
+	    for (i = 0; i < num; i++) {
+		(*self->free_handler)(self, view[i].item);
+	    }
+
+	    free(view);
+	}
+
+	(*self->backend_vtable->delete)(self->backend_table);
+
+	return;
+    }
+
+    if (self->shard_bits) {
+	for (i = 0; i < (1ULL << self->shard_bits); i++) {
+	    hatrack_dict_crown_cleanup(self, &self->shards[i].table);
+	}
+
+	free(self->shards);
+
+	return;
+    }
+
+    hatrack_dict_crown_cleanup(self, &self->crown_instance);
+
+    return;
+}
+
+static void
+hatrack_dict_crown_cleanup(hatrack_dict_t *self, crown_t *crown)
+{
+    uint64_t        i;
     crown_store_t  *store;
-    crown_bucket_t *bucket;
-    hatrack_hash_t     hv;
+    hatrack_hash_t  hv;
     crown_record_t  record;
 
     if (self->free_handler) {
-        store = atomic_load(&self->crown_instance.store_current);
+        store = atomic_load(&crown->store_current);
 
         for (i = 0; i <= store->last_slot; i++) {
-            bucket = &store->buckets[i];
-            hv     = atomic_load(&bucket->hv);
+            hv = atomic_load(crown_hv_at(store, i));
 
             if (hatrack_bucket_unreserved(hv)) {
                 continue;
             }
 
-            record = atomic_load(&bucket->record);
+            record = atomic_load(crown_record_at(store, i));
 
-            if (!record.info) {
+            // Deleted buckets keep their flags, but not their epoch.
+            if (!(record.info & CROWN_EPOCH_MASK)) {
                 continue;
             }
 
@@ -99,7 +326,7 @@ hatrack_dict_cleanup(hatrack_dict_t *self)
         }
     }
 
-    mmm_retire(atomic_load(&self->crown_instance.store_current));
+    mmm_retire(atomic_load(&crown->store_current));
 
     return;
 }
@@ -143,6 +370,8 @@ hatrack_dict_set_free_handler(hatrack_dict_t *self, hatrack_mem_hook_t func)
 {
     self->free_handler = func;
 
+    hatrack_dict_feed_hooks(self);
+
     return;
 }
 
@@ -151,6 +380,8 @@ hatrack_dict_set_key_return_hook(hatrack_dict_t *self, hatrack_mem_hook_t func)
 {
     self->key_return_hook = func;
 
+    hatrack_dict_feed_hooks(self);
+
     return;
 }
 
@@ -159,6 +390,8 @@ hatrack_dict_set_val_return_hook(hatrack_dict_t *self, hatrack_mem_hook_t func)
 {
     self->val_return_hook = func;
 
+    hatrack_dict_feed_hooks(self);
+
     return;
 }
 
@@ -178,6 +411,65 @@ hatrack_dict_set_sorted_views(hatrack_dict_t *self, bool value)
     return;
 }
 
+/* Turns the change feed (see changelog.h) on or off. Don't toggle this
+ * while other threads might be writing to the dictionary.
+ *
+ * Set up the memory management hooks first; if there's a free handler,
+ * the log needs a value return hook to keep the values it points to
+ * alive, and we abort without one.
+ */
+void
+hatrack_dict_set_change_feed(hatrack_dict_t *self, bool value)
+{
+    if (value && !self->change_log) {
+	self->change_log = hatrack_changelog_new();
+
+	hatrack_dict_feed_hooks(self);
+    }
+
+    if (!value && self->change_log) {
+	hatrack_changelog_delete(self->change_log);
+	self->change_log = NULL;
+    }
+
+    return;
+}
+
+/* Puts a negative-lookup filter in front of the table (see crown.c),
+ * so that most lookups for keys that aren't there get answered from
+ * a single cache line. That's a win for dictionaries that mostly get
+ * asked about things they don't have (dedup tables, for instance),
+ * and a small loss otherwise, since every write has to update the
+ * filter too.
+ *
+ * The filter is crown's, so this aborts for other backends. It's
+ * best to call it right after creating the dictionary; otherwise, it
+ * takes effect as the table migrates. And, as with our other
+ * settings, don't call it while other threads are using the
+ * dictionary.
+ */
+void
+hatrack_dict_set_miss_filter(hatrack_dict_t *self, bool value)
+{
+    uint64_t i;
+
+    if (self->backend_vtable) {
+	abort();
+    }
+
+    if (!self->shard_bits) {
+	crown_set_filter(&self->crown_instance, value);
+
+	return;
+    }
+
+    for (i = 0; i < (1ULL << self->shard_bits); i++) {
+	crown_set_filter(&self->shards[i].table, value);
+    }
+
+    return;
+}
+
 bool
 hatrack_dict_get_consistent_views(hatrack_dict_t *self)
 {
@@ -195,15 +487,19 @@ hatrack_dict_get(hatrack_dict_t *self, void *key, bool *found)
 {
     hatrack_hash_t       hv;
     hatrack_dict_item_t *item;
-    crown_store_t    *store;
+    crown_store_t       *store;
 
-    
     hv = hatrack_dict_get_hash_value(self, key);
 
     mmm_start_basic_op();
 
-    store = atomic_read(&self->crown_instance.store_current);
-    item  = crown_store_get(store, hv, found);
+    if (self->backend_vtable) {
+	item = (*self->backend_vtable->get)(self->backend_table, hv, NULL);
+    }
+    else {
+	store = atomic_read(&hatrack_dict_shard(self, hv)->store_current);
+	item  = crown_store_get(store, hv, found);
+    }
 
     if (!item) {
         if (found) {
@@ -234,6 +530,9 @@ hatrack_dict_get(hatrack_dict_t *self, void *key, bool *found)
  *
  * We could do two layers of MMM, but instead we just lift it out here,
  * and skip directly to the crown_store() calls.
+ *
+ * Other backends don't give us that option, so there we do nest;
+ * mmm keeps the outermost reservation in place until we're done.
  */
 void
 hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
@@ -241,7 +540,8 @@ hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
     hatrack_hash_t       hv;
     hatrack_dict_item_t *new_item;
     hatrack_dict_item_t *old_item;
-    crown_store_t    *store;
+    crown_store_t       *store;
+    crown_t             *crown;
 
     hv = hatrack_dict_get_hash_value(self, key);
 
@@ -250,14 +550,38 @@ hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
     new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
-    store           = atomic_read(&self->crown_instance.store_current);
 
-    old_item = crown_store_put(store,
-                                  &self->crown_instance,
-                                  hv,
-                                  new_item,
-                                  NULL,
-                                  0);
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->backend_vtable) {
+	old_item = (*self->backend_vtable->put)(self->backend_table,
+						hv,
+						new_item,
+						NULL);
+    }
+    else {
+	hatrack_dict_help_freeze(self);
+
+	crown    = hatrack_dict_shard(self, hv);
+	store    = atomic_read(&crown->store_current);
+	old_item = crown_store_put(store,
+				   crown,
+				   hv,
+				   new_item,
+				   NULL,
+				   0);
+    }
+
+    if (self->change_log) {
+	hatrack_changelog_record(self->change_log,
+				 old_item ? HATRACK_CHANGE_UPDATE
+				          : HATRACK_CHANGE_INSERT,
+				 key,
+				 value);
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
 
     if (old_item) {
         if (self->free_handler) {
@@ -280,7 +604,8 @@ hatrack_dict_replace(hatrack_dict_t *self, void *key, void *value)
     hatrack_hash_t       hv;
     hatrack_dict_item_t *new_item;
     hatrack_dict_item_t *old_item;
-    crown_store_t    *store;
+    crown_store_t       *store;
+    crown_t             *crown;
 
     hv = hatrack_dict_get_hash_value(self, key);
 
@@ -289,14 +614,29 @@ hatrack_dict_replace(hatrack_dict_t *self, void *key, void *value)
     new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
-    store           = atomic_read(&self->crown_instance.store_current);
 
-    old_item = crown_store_put(store,
-                                  &self->crown_instance,
-                                  hv,
-                                  new_item,
-                                  NULL,
-                                  0);
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->backend_vtable) {
+	old_item = (*self->backend_vtable->replace)(self->backend_table,
+						    hv,
+						    new_item,
+						    NULL);
+    }
+    else {
+	hatrack_dict_help_freeze(self);
+
+	crown    = hatrack_dict_shard(self, hv);
+	store    = atomic_read(&crown->store_current);
+	old_item = crown_store_replace(store,
+				       crown,
+				       hv,
+				       new_item,
+				       NULL,
+				       0);
+    }
 
     if (old_item) {
         if (self->free_handler) {
@@ -306,11 +646,24 @@ hatrack_dict_replace(hatrack_dict_t *self, void *key, void *value)
         }
 
         mmm_retire(old_item);
+
+	if (self->change_log) {
+	    hatrack_changelog_record(self->change_log,
+				     HATRACK_CHANGE_UPDATE,
+				     key,
+				     value);
+	    hatrack_changelog_unlock(self->change_log, hv);
+	}
+
         mmm_end_op();
 
         return true;
     }
 
+    if (self->change_log) {
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
+
     mmm_retire_unused(new_item);
     mmm_end_op();
 
@@ -322,7 +675,9 @@ hatrack_dict_add(hatrack_dict_t *self, void *key, void *value)
 {
     hatrack_hash_t       hv;
     hatrack_dict_item_t *new_item;
-    crown_store_t    *store;
+    crown_store_t       *store;
+    crown_t             *crown;
+    bool                 added;
 
     hv = hatrack_dict_get_hash_value(self, key);
 
@@ -331,9 +686,36 @@ hatrack_dict_add(hatrack_dict_t *self, void *key, void *value)
     new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
-    store           = atomic_read(&self->crown_instance.store_current);
 
-    if (crown_store_add(store, &self->crown_instance, hv, new_item, 0)) {
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->backend_vtable) {
+	added = (*self->backend_vtable->add)(self->backend_table,
+					     hv,
+					     new_item);
+    }
+    else {
+	hatrack_dict_help_freeze(self);
+
+	crown = hatrack_dict_shard(self, hv);
+	store = atomic_read(&crown->store_current);
+	added = crown_store_add(store, crown, hv, new_item, 0);
+    }
+
+    if (self->change_log) {
+	if (added) {
+	    hatrack_changelog_record(self->change_log,
+				     HATRACK_CHANGE_INSERT,
+				     key,
+				     value);
+	}
+
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
+
+    if (added) {
         mmm_end_op();
 
         return true;
@@ -350,15 +732,38 @@ hatrack_dict_remove(hatrack_dict_t *self, void *key)
 {
     hatrack_hash_t       hv;
     hatrack_dict_item_t *old_item;
-    crown_store_t    *store;
+    crown_store_t       *store;
+    crown_t             *crown;
+    bool                 found;
 
     hv = hatrack_dict_get_hash_value(self, key);
 
     mmm_start_basic_op();
 
-    store = atomic_read(&self->crown_instance.store_current);
-    old_item
-        = crown_store_remove(store, &self->crown_instance, hv, NULL, 0);
+    /* Some backends (woolhat, when it has to get help deleting) can
+     * remove successfully without being able to hand back the old
+     * item, so we go by 'found' here, not the return value.
+     */
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->backend_vtable) {
+	old_item = (*self->backend_vtable->remove)(self->backend_table,
+						   hv,
+						   &found);
+    }
+    else {
+	hatrack_dict_help_freeze(self);
+
+	crown    = hatrack_dict_shard(self, hv);
+	store    = atomic_read(&crown->store_current);
+	old_item = crown_store_remove(store,
+				      crown,
+				      hv,
+				      &found,
+				      0);
+    }
 
     if (old_item) {
         if (self->free_handler) {
@@ -368,14 +773,94 @@ hatrack_dict_remove(hatrack_dict_t *self, void *key)
         }
 
         mmm_retire(old_item);
-        mmm_end_op();
+    }
 
-        return true;
+    if (self->change_log) {
+	if (found) {
+	    hatrack_changelog_record(self->change_log,
+				     HATRACK_CHANGE_DELETE,
+				     key,
+				     NULL);
+	}
+
+	hatrack_changelog_unlock(self->change_log, hv);
     }
 
     mmm_end_op();
 
-    return false;
+    return found;
+}
+
+uint64_t
+hatrack_dict_len(hatrack_dict_t *self)
+{
+    uint64_t i;
+    uint64_t ret;
+
+    if (self->backend_vtable) {
+	return (*self->backend_vtable->len)(self->backend_table);
+    }
+
+    if (!self->shard_bits) {
+	return crown_len(&self->crown_instance);
+    }
+
+    ret = 0;
+
+    for (i = 0; i < (1ULL << self->shard_bits); i++) {
+	ret += crown_len(&self->shards[i].table);
+    }
+
+    return ret;
+}
+
+/* See stats.h. On top of whatever the table reports, each item in
+ * the dictionary is a separate mmm allocation holding the key and the
+ * value, which we count in record_bytes. For sharded dictionaries, the
+ * numbers are for all the shards together (so max_probe is the
+ * longest probe in any shard, for instance).
+ */
+void
+hatrack_dict_stats(hatrack_dict_t *self, hatrack_stats_t *stats)
+{
+    hatrack_backend_info_t *info;
+    uint64_t                item_bytes;
+    uint64_t                i;
+
+    memset(stats, 0, sizeof(hatrack_stats_t));
+
+    item_bytes = sizeof(mmm_header_t) + sizeof(hatrack_dict_item_t);
+
+    if (self->backend_vtable) {
+	info = hatrack_backend_get_info(self->backend);
+
+	if (info->stats) {
+	    (*info->stats)(self->backend_table, stats);
+	}
+	else {
+	    stats->num_items = (*self->backend_vtable->len)(self->backend_table);
+	}
+
+	stats->record_bytes += stats->num_items * item_bytes;
+	stats->total_bytes  += stats->num_items * item_bytes;
+
+	return;
+    }
+
+    if (!self->shard_bits) {
+	crown_stats_raw(&self->crown_instance, stats);
+    }
+    else {
+	for (i = 0; i < (1ULL << self->shard_bits); i++) {
+	    crown_stats_raw(&self->shards[i].table, stats);
+	}
+    }
+
+    stats->record_bytes += stats->num_items * item_bytes;
+
+    hatrack_stats_finish(stats);
+
+    return;
 }
 
 static hatrack_dict_key_t *
@@ -389,12 +874,7 @@ hatrack_dict_keys_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_start_basic_op();
 
-    if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
-    }
-    else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
-    }
+    view = hatrack_dict_view(self, num, sort);
     
     alloc_len = sizeof(hatrack_dict_key_t) * *num;
     ret       = (hatrack_dict_key_t *)malloc(alloc_len);
@@ -432,12 +912,7 @@ hatrack_dict_values_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_start_basic_op();
 
-    if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
-    }
-    else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
-    }
+    view = hatrack_dict_view(self, num, sort);
 
     alloc_len = sizeof(hatrack_dict_value_t) * *num;
     ret       = (hatrack_dict_value_t *)malloc(alloc_len);
@@ -474,12 +949,7 @@ hatrack_dict_items_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_start_basic_op();
     
-    if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
-    }
-    else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
-    }
+    view = hatrack_dict_view(self, num, sort);
 
     alloc_len = sizeof(hatrack_dict_item_t) * *num;
     ret       = (hatrack_dict_item_t *)malloc(alloc_len);
@@ -558,6 +1028,53 @@ hatrack_dict_items_nosort(hatrack_dict_t *self, uint64_t *num)
     return hatrack_dict_items_base(self, num, false);
 }
 
+/* Returns the inserts, updates and deletes since the given epoch,
+ * oldest first; see changelog.h for the details. If the change feed
+ * isn't turned on, there's no history to give, which we treat the
+ * same as if it had all been trimmed.
+ *
+ * The values in the feed may well be gone from the dictionary, but
+ * the log holds references to them (through the return hooks) until
+ * they're trimmed, so they're still good. As with our views, we run
+ * the return hooks on every key and value we hand back, and the
+ * caller owns those references.
+ */
+hatrack_change_t *
+hatrack_dict_changes_since(hatrack_dict_t *self,
+			   uint64_t        epoch,
+			   uint64_t       *num,
+			   uint64_t       *high_water)
+{
+    if (!self->change_log) {
+	*num        = 0;
+	*high_water = HATRACK_CHANGES_TRIMMED;
+
+	return NULL;
+    }
+
+    return hatrack_changelog_since(self->change_log, epoch, num, high_water);
+}
+
+uint64_t
+hatrack_dict_changes_epoch(hatrack_dict_t *self)
+{
+    if (!self->change_log) {
+	return 0;
+    }
+
+    return hatrack_changelog_epoch(self->change_log);
+}
+
+void
+hatrack_dict_changes_trim(hatrack_dict_t *self, uint64_t epoch)
+{
+    if (self->change_log) {
+	hatrack_changelog_trim(self->change_log, epoch);
+    }
+
+    return;
+}
+
 static hatrack_hash_t
 hatrack_dict_get_hash_value(hatrack_dict_t *self, void *key)
 {
@@ -625,6 +1142,218 @@ hatrack_dict_get_hash_value(hatrack_dict_t *self, void *key)
     return hv;
 }
 
+/* Slow views only mean anything when we're on crown. Other backends
+ * give whatever view they give; the consistent ones (woolhat, and
+ * tophat in consistent mode) are always fully ordered anyway.
+ */
+static hatrack_view_t *
+hatrack_dict_view(hatrack_dict_t *self, uint64_t *num, bool sort)
+{
+    if (self->backend_vtable) {
+	return (*self->backend_vtable->view)(self->backend_table, num, sort);
+    }
+
+    if (self->shard_bits) {
+	return hatrack_dict_sharded_view(self, num, sort);
+    }
+
+    if (self->slow_views) {
+	return crown_view_slow(&self->crown_instance, num, sort);
+    }
+
+    return crown_view_fast(&self->crown_instance, num, sort);
+}
+
+/* Each shard has its own epoch counter, so the sort epochs that come
+ * back from the individual crown views can't be compared across
+ * shards. Instead, we order by the mmm write epoch of our
+ * hatrack_dict_item_t's, which all come from the one global epoch
+ * counter. Since we allocate a new item on every write, that's the
+ * order in which items were last written, not the order in which
+ * their keys were first inserted.
+ *
+ * For consistent views, freezing one shard at a time isn't good
+ * enough: anything removed or overwritten in a shard we haven't got
+ * to yet would go missing, while newer writes to the shards we've
+ * already frozen wouldn't show up, so the view wouldn't match the
+ * dictionary at any single point in time.
+ *
+ * So we freeze every shard before anybody writes to any shard
+ * again. We post a hatrack_dict_freeze_t, and then claim and freeze
+ * each shard's current store (see crown_store_claim()). Any writer
+ * that sees the freeze posted helps get the rest of the shards frozen
+ * before it does its own write (see hatrack_dict_help_freeze()), so
+ * no write that starts after we post lands in a store we end up
+ * reading. Writes that were already in flight when we posted either
+ * land before their shard freezes (and show up), or after (and
+ * don't); either way, they overlapped with us, so it's fine to order
+ * them on whichever side of the view they ended up on.
+ *
+ * Once every shard is frozen, the union of the frozen stores is the
+ * state of the dictionary at that moment, so we don't need to filter
+ * anything out by epoch. The cost is that writers pay for an atomic
+ * load on every write, and have to help out while a consistent view
+ * is freezing the shards.
+ *
+ * Only one freeze can be posted at a time; if we find someone else's
+ * freeze posted, we help it along, and then try again.
+ */
+static hatrack_view_t *
+hatrack_dict_sharded_view(hatrack_dict_t *self, uint64_t *num, bool sort)
+{
+    hatrack_view_t        *view;
+    hatrack_view_t        *shard_view;
+    hatrack_dict_freeze_t *freeze;
+    hatrack_dict_freeze_t *expected;
+    crown_store_t         *store;
+    crown_t               *crown;
+    uint64_t               num_shards;
+    uint64_t               shard_num;
+    uint64_t               n;
+    uint64_t               i;
+    uint64_t               j;
+
+    view       = NULL;
+    freeze     = NULL;
+    n          = 0;
+    num_shards = 1ULL << self->shard_bits;
+
+    mmm_start_basic_op();
+
+    if (self->slow_views) {
+	freeze = mmm_alloc_committed(sizeof(hatrack_dict_freeze_t)
+				     + sizeof(crown_store_t *) * num_shards);
+	freeze->num_shards = num_shards;
+	expected           = NULL;
+
+	while (!CAS(&self->freeze, &expected, freeze)) {
+	    hatrack_dict_freeze_shards(self, expected);
+	    expected = NULL;
+	}
+
+	hatrack_dict_freeze_shards(self, freeze);
+    }
+
+    for (i = 0; i < num_shards; i++) {
+	crown = &self->shards[i].table;
+
+	if (freeze) {
+	    store      = atomic_read(&freeze->stores[i]);
+	    shard_view = crown_store_view(store, &shard_num, false);
+
+	    crown_store_release(crown, store);
+	}
+	else {
+	    shard_view = crown_view_fast(crown, &shard_num, false);
+	}
+
+	if (!shard_view) {
+	    continue;
+	}
+
+	view = (hatrack_view_t *)realloc(view,
+					 sizeof(hatrack_view_t)
+					 * (n + shard_num));
+
+	for (j = 0; j < shard_num; j++) {
+	    view[n].item       = shard_view[j].item;
+	    view[n].sort_epoch = (int64_t)mmm_get_write_epoch(shard_view[j].item);
+	    n++;
+	}
+
+	free(shard_view);
+    }
+
+    if (freeze) {
+	mmm_retire(freeze);
+    }
+
+    mmm_end_op();
+
+    *num = n;
+
+    if (!n) {
+	free(view);
+
+	return NULL;
+    }
+
+    if (sort) {
+	qsort(view, n, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
+    }
+
+    return view;
+}
+
+/* Makes sure every shard has a frozen store in the freeze, and then
+ * takes the freeze down, if nobody else has yet. Anyone can call this
+ * on a posted freeze, and several threads can be at it at once; for
+ * each shard, the first frozen store to get swapped into the freeze
+ * wins, and anyone else who froze a store for that shard just hands
+ * theirs back to crown.
+ *
+ * The caller needs to be in an mmm operation, since it's mmm that
+ * keeps the freeze from going away underneath us.
+ */
+static void
+hatrack_dict_freeze_shards(hatrack_dict_t *self, hatrack_dict_freeze_t *freeze)
+{
+    hatrack_dict_freeze_t *expected_freeze;
+    crown_store_t         *store;
+    crown_store_t         *expected;
+    crown_t               *crown;
+    uint64_t               i;
+
+    for (i = 0; i < freeze->num_shards; i++) {
+	crown = &self->shards[i].table;
+
+	while (!atomic_read(&freeze->stores[i])) {
+	    store = crown_store_claim(crown);
+
+	    if (!store) {
+		continue;
+	    }
+
+	    expected = NULL;
+
+	    if (!CAS(&freeze->stores[i], &expected, store)) {
+		crown_store_release(crown, store);
+	    }
+	}
+    }
+
+    expected_freeze = freeze;
+
+    CAS(&self->freeze, &expected_freeze, NULL);
+
+    return;
+}
+
+/* Hands our hooks to the change log, if there is one. The log keeps
+ * logged values alive through the value return hook, so with a free
+ * handler and no return hook, it can't do its job; see changelog.h.
+ */
+static void
+hatrack_dict_feed_hooks(hatrack_dict_t *self)
+{
+    if (!self->change_log) {
+	return;
+    }
+
+    if (self->free_handler && !self->val_return_hook) {
+	abort();
+    }
+
+    hatrack_changelog_set_hooks(self->change_log,
+				self,
+				self->key_return_hook,
+				self->val_return_hook,
+				self->free_handler,
+				true);
+
+    return;
+}
+
 static void
 hatrack_dict_record_eject(hatrack_dict_item_t *record,
 			  hatrack_dict_t *dict)
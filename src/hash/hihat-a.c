@@ -427,12 +427,13 @@ hihat_a_store_replace(hihat_store_t *self,
 		     void           *item,
 		     bool           *found)
 {
-    uint64_t        bix;
-    uint64_t        i;
-    hatrack_hash_t  hv2;
-    hihat_bucket_t *bucket;
-    hihat_record_t  record;
-    hihat_record_t  candidate;
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    hihat_bucket_t         *bucket;
+    hihat_record_t          record;
+    hihat_record_t          candidate;
+    hatrack_backoff_state_t backoff;
 
     bix = hatrack_bucket_index(hv1, self->last_slot);
     
@@ -475,7 +476,9 @@ hihat_a_store_replace(hihat_store_t *self,
     candidate.item = item;
     candidate.info = record.info;
 
-    while(!LCAS(&bucket->record, &record, candidate, HIHAT_CTR_REC_INSTALL)) {
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+    while (!LCAS(&bucket->record, &record, candidate, HIHAT_CTR_REC_INSTALL)) {
 	if (record.info & HIHAT_F_MOVING) {
 	    goto migrate_and_retry;
 	}
@@ -483,6 +486,8 @@ hihat_a_store_replace(hihat_store_t *self,
 	if (!(record.info & HIHAT_EPOCH_MASK)) {
 	    goto not_found;
 	}
+
+	hatrack_backoff(&backoff);
     }
     
     if (found) {
@@ -647,31 +652,35 @@ found_bucket:
  * on the overall migration approach before reviewing this, as we only 
  * comment on the differences.
  *
- * It starts with the below static const value, which is our sleep time,
- * when we choose to wait for threads in front of us.
+ * It starts with the below static const value, which is how we wait
+ * for threads in front of us, when we choose to. Unlike the CAS loops,
+ * this deliberately doesn't follow hatrack_backoff_default; the whole
+ * point of hihat-a is to test this particular fixed sleep.
  */
-static const struct timespec sleep_time = {
-    .tv_sec  = 0,
-    .tv_nsec = HIHATa_MIGRATE_SLEEP_TIME_NS
+static const hatrack_backoff_t hihat_a_migrate_backoff = {
+    .kind = HATRACK_BACKOFF_SLEEP,
+    .min  = HIHATa_MIGRATE_SLEEP_TIME_NS,
+    .max  = HIHATa_MIGRATE_SLEEP_TIME_NS
 };
 
 static hihat_store_t *
 hihat_a_store_migrate(hihat_store_t *self, hihat_t *top)
 {
-    hihat_store_t   *new_store;
-    hihat_store_t   *candidate_store;
-    uint64_t         new_size;
-    hihat_bucket_t  *bucket;
-    hihat_bucket_t  *new_bucket;
-    hihat_record_t   record;
-    hihat_record_t   candidate_record;
-    hihat_record_t   expected_record;
-    hatrack_hash_t   expected_hv;
-    hatrack_hash_t   hv;
-    uint64_t         i, j;
-    uint64_t         bix;
-    uint64_t         new_used;     
-    uint64_t         expected_used;
+    hihat_store_t          *new_store;
+    hihat_store_t          *candidate_store;
+    uint64_t                new_size;
+    hihat_bucket_t         *bucket;
+    hihat_bucket_t         *new_bucket;
+    hihat_record_t          record;
+    hihat_record_t          candidate_record;
+    hihat_record_t          expected_record;
+    hatrack_hash_t          expected_hv;
+    hatrack_hash_t          hv;
+    uint64_t                i, j;
+    uint64_t                bix;
+    uint64_t                new_used;
+    uint64_t                expected_used;
+    hatrack_backoff_state_t backoff;
 
     /* We first check to see if there's already a new
      * store in place in the top level. If there is, we can succeed
@@ -700,7 +709,8 @@ hihat_a_store_migrate(hihat_store_t *self, hihat_t *top)
     
     if (new_store) {
 	// Try twice to let anyone in front of us complete the migration.
-	nanosleep(&sleep_time, NULL);
+	hatrack_backoff_start(&backoff, &hihat_a_migrate_backoff);
+	hatrack_backoff(&backoff);
 	new_store = atomic_read(&self->store_next);
 	
 	if (new_store == atomic_read(&top->store_current)) {
@@ -710,7 +720,7 @@ hihat_a_store_migrate(hihat_store_t *self, hihat_t *top)
 	
 	HATRACK_CTR(HATRACK_CTR_HIa_SLEEP1_FAILED);
 	
-	nanosleep(&sleep_time, NULL);
+	hatrack_backoff(&backoff);
 	new_store = atomic_read(&self->store_next);
 	
 	if (new_store == atomic_read(&top->store_current)) {
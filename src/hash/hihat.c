@@ -29,7 +29,10 @@
 #ifdef HATRACK_COMPILE_ALL_ALGORITHMS
 
 // clang-format off
-static hihat_store_t *hihat_store_new    (uint64_t);
+
+// Not static, because tophat needs to call it, but nonetheless, don't
+// stick it in our public prototypes.
+       hihat_store_t *hihat_store_new    (uint64_t);
 static void          *hihat_store_get    (hihat_store_t *, hatrack_hash_t,
 					  bool *);
 static void          *hihat_store_put    (hihat_store_t *, hihat_t *,
@@ -428,7 +431,7 @@ hihat_view(hihat_t *self, uint64_t *num, bool sort)
  * underlying memory is zeroed out, so we only need to initialize
  * non-zero items.
  */
-static hihat_store_t *
+hihat_store_t *
 hihat_store_new(uint64_t size)
 {
     hihat_store_t *store;
@@ -739,12 +742,13 @@ hihat_store_replace(hihat_store_t   *self,
 		     void           *item,
 		     bool           *found)
 {
-    uint64_t        bix;
-    uint64_t        i;
-    hatrack_hash_t  hv2;
-    hihat_bucket_t *bucket;
-    hihat_record_t  record;
-    hihat_record_t  candidate;
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    hihat_bucket_t         *bucket;
+    hihat_record_t          record;
+    hihat_record_t          candidate;
+    hatrack_backoff_state_t backoff;
 
     bix = hatrack_bucket_index(hv1, self->last_slot);
     
@@ -788,6 +792,8 @@ hihat_store_replace(hihat_store_t   *self,
     candidate.item = item;
     candidate.info = record.info;
 
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
     /* If we lose the compare and swap (and since we're not storing
      * history data, as we will see in other algorithms), we have two
      * options; we can pretend we overwrote something, and return
@@ -809,7 +815,7 @@ hihat_store_replace(hihat_store_t   *self,
      * this issue is one of the two real differences between hihat
      * and witchhat.
      */    
-    while(!LCAS(&bucket->record, &record, candidate, HIHAT_CTR_REC_INSTALL)) {
+    while (!LCAS(&bucket->record, &record, candidate, HIHAT_CTR_REC_INSTALL)) {
 	if (record.info & HIHAT_F_MOVING) {
 	    goto migrate_and_retry;
 	}
@@ -817,6 +823,8 @@ hihat_store_replace(hihat_store_t   *self,
 	if (!(record.info & HIHAT_EPOCH_MASK)) {
 	    goto not_found;
 	}
+
+	hatrack_backoff(&backoff);
     }
     
     if (found) {
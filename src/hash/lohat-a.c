@@ -588,13 +588,14 @@ lohat_a_store_replace(lohat_a_store_t *self,
                       void            *item,
                       bool            *found)
 {
-    uint64_t            bix;
-    uint64_t            i;
-    hatrack_hash_t      hv2;
-    lohat_a_history_t  *bucket;
-    lohat_record_t     *head;
-    lohat_record_t     *candidate;
-    lohat_a_indirect_t *ptrbucket;
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    lohat_a_history_t      *bucket;
+    lohat_record_t         *head;
+    lohat_record_t         *candidate;
+    lohat_a_indirect_t     *ptrbucket;
+    hatrack_backoff_state_t backoff;
 
     bix = hatrack_bucket_index(hv1, self->last_slot);
 
@@ -645,7 +646,9 @@ migrate_and_retry:
     candidate->next = head;
     candidate->item = item;
 
-    do {
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+    while (true) {
         if (head->deleted) {
             mmm_retire_unused(candidate);
             goto not_found;
@@ -658,7 +661,11 @@ migrate_and_retry:
 	
         mmm_help_commit(head);
         mmm_copy_create_epoch(candidate, head);
-    } while (!LCAS(&bucket->head, &head, candidate, LOHATa_CTR_REC_INSTALL));
+	if (LCAS(&bucket->head, &head, candidate, LOHATa_CTR_REC_INSTALL)) {
+	    break;
+	}
+	hatrack_backoff(&backoff);
+    }
 
     mmm_commit_write(candidate);
     mmm_retire(head);
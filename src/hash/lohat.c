@@ -690,12 +690,13 @@ lohat_store_replace(lohat_store_t *self,
                     void          *item,
                     bool          *found)
 {
-    uint64_t         bix;
-    uint64_t         i;
-    hatrack_hash_t   hv2;
-    lohat_history_t *bucket;
-    lohat_record_t  *head;
-    lohat_record_t  *candidate;
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_hash_t          hv2;
+    lohat_history_t        *bucket;
+    lohat_record_t         *head;
+    lohat_record_t         *candidate;
+    hatrack_backoff_state_t backoff;
 
     bix = hatrack_bucket_index(hv1, self->last_slot);
 
@@ -740,6 +741,8 @@ migrate_and_retry:
     candidate->next = head;
     candidate->item = item;
 
+    hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
     /* This CAS-loop makes our replace operation lock free, not
      * wait-free.  When there's contention, as long as the new record
      * is an item, instead of a delete record, we will keep trying,
@@ -755,7 +758,7 @@ migrate_and_retry:
      * Woolhat is a wait-free version of this algorithm, which does
      * not keep going if there's contention.
      */
-    do {
+    while (true) {
         if (head->deleted) {
             mmm_retire_unused(candidate);
             goto not_found;
@@ -768,7 +771,11 @@ migrate_and_retry:
 
         mmm_help_commit(head);
         mmm_copy_create_epoch(candidate, head);
-    } while (!LCAS(&bucket->head, &head, candidate, LOHAT_CTR_REC_INSTALL));
+        if (LCAS(&bucket->head, &head, candidate, LOHAT_CTR_REC_INSTALL)) {
+            break;
+        }
+        hatrack_backoff(&backoff);
+    }
 
     mmm_commit_write(candidate);
     mmm_retire(head);
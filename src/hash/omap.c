@@ -0,0 +1,874 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           omap.c
+ *  Description:    A lock-free ordered map, based on a skiplist, with
+ *                  range scans and floor / ceiling lookups.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#include <stddef.h>
+#include <string.h>
+
+/* The low bit of a node's item pointer means the item has been
+ * removed (that's the point at which the removal takes effect). The
+ * 'next' pointers get marked the same way, by the skiplist core; see
+ * skiplist.h.
+ */
+enum {
+    HATRACK_OMAP_MARK = 0x01
+};
+
+enum {
+    HATRACK_OMAP_PUT,
+    HATRACK_OMAP_REPLACE,
+    HATRACK_OMAP_ADD
+};
+
+// clang-format off
+static hatrack_omap_node_t *hatrack_omap_node_new    (uint64_t,
+						      hatrack_dict_item_t *);
+static hatrack_omap_node_t *hatrack_omap_find        (hatrack_omap_t *, void *,
+						      hatrack_skiplist_node_t **,
+						      hatrack_skiplist_node_t **);
+static hatrack_omap_node_t *hatrack_omap_search      (hatrack_omap_t *, void *);
+static hatrack_dict_item_t *hatrack_omap_store       (hatrack_omap_t *,
+						      hatrack_dict_item_t *,
+						      uint32_t, bool *);
+static hatrack_dict_item_t *hatrack_omap_unlink      (hatrack_omap_t *, void *);
+static int                  hatrack_omap_node_cmp    (hatrack_skiplist_t *,
+						      hatrack_skiplist_node_t *,
+						      void *);
+static bool                 hatrack_omap_node_removed(hatrack_skiplist_node_t *);
+static void                 hatrack_omap_node_retire (hatrack_skiplist_t *,
+						      hatrack_skiplist_node_t *);
+static void                 hatrack_omap_record_eject(hatrack_dict_item_t *,
+						      void *);
+static void                 hatrack_omap_node_eject  (hatrack_omap_node_t *,
+						      void *);
+static hatrack_dict_item_t *hatrack_omap_collect     (hatrack_omap_t *,
+						      hatrack_omap_node_t *,
+						      void *, uint64_t *);
+// clang-format on
+
+static inline bool
+hatrack_omap_is_marked(uint64_t p)
+{
+    return p & HATRACK_OMAP_MARK;
+}
+
+// Gets from a node's skiplist links back to the node.
+static inline hatrack_omap_node_t *
+hatrack_omap_node(hatrack_skiplist_node_t *links)
+{
+    if (!links) {
+	return NULL;
+    }
+
+    return (hatrack_omap_node_t *)((char *)links
+				   - offsetof(hatrack_omap_node_t, links));
+}
+
+static inline hatrack_omap_node_t *
+hatrack_omap_next(hatrack_omap_node_t *node, uint64_t level)
+{
+    return hatrack_omap_node(hatrack_skiplist_next(&node->links, level));
+}
+
+static inline hatrack_dict_item_t *
+hatrack_omap_item(uint64_t p)
+{
+    return (hatrack_dict_item_t *)(p & ~(uint64_t)HATRACK_OMAP_MARK);
+}
+
+// Removed nodes keep their (marked) item, so this is always safe.
+static inline void *
+hatrack_omap_key(hatrack_omap_node_t *node)
+{
+    return hatrack_omap_item(atomic_load(&node->item))->key;
+}
+
+static inline int
+hatrack_omap_cmp(hatrack_omap_t *self, void *k1, void *k2)
+{
+    double d1;
+    double d2;
+
+    switch (self->key_type) {
+    case HATRACK_DICT_KEY_TYPE_INT:
+    case HATRACK_DICT_KEY_TYPE_PTR:
+	return ((uint64_t)k1 > (uint64_t)k2) - ((uint64_t)k1 < (uint64_t)k2);
+    case HATRACK_DICT_KEY_TYPE_REAL:
+	memcpy(&d1, &k1, sizeof(double));
+	memcpy(&d2, &k2, sizeof(double));
+
+	return (d1 > d2) - (d1 < d2);
+    case HATRACK_DICT_KEY_TYPE_CSTR:
+	return strcmp((char *)k1, (char *)k2);
+    default:
+	if (!self->custom_cmp) {
+	    abort();
+	}
+
+	return (*self->custom_cmp)(k1, k2);
+    }
+}
+
+hatrack_omap_t *
+hatrack_omap_new(uint32_t key_type)
+{
+    hatrack_omap_t *ret;
+
+    ret = (hatrack_omap_t *)malloc(sizeof(hatrack_omap_t));
+
+    hatrack_omap_init(ret, key_type);
+
+    return ret;
+}
+
+void
+hatrack_omap_init(hatrack_omap_t *self, uint32_t key_type)
+{
+    switch (key_type) {
+    case HATRACK_DICT_KEY_TYPE_INT:
+    case HATRACK_DICT_KEY_TYPE_REAL:
+    case HATRACK_DICT_KEY_TYPE_CSTR:
+    case HATRACK_DICT_KEY_TYPE_PTR:
+    case HATRACK_DICT_KEY_TYPE_OBJ_CUSTOM:
+	self->key_type = key_type;
+	break;
+    default:
+	abort();
+    }
+
+    hatrack_skiplist_init(&self->list,
+			  HATRACK_OMAP_MAX_HEIGHT,
+			  hatrack_omap_node_cmp,
+			  hatrack_omap_node_removed,
+			  hatrack_omap_node_retire);
+
+    self->custom_cmp      = NULL;
+    self->free_handler    = NULL;
+    self->key_return_hook = NULL;
+    self->val_return_hook = NULL;
+
+    atomic_store(&self->item_count, 0);
+
+    return;
+}
+
+/* Like the other cleanup functions, this assumes nobody else is using
+ * the map anymore. Anything still linked in at the bottom level is
+ * still in the map, and gets passed to the free handler. Anything
+ * already unlinked is in mmm's hands, and may well get freed after
+ * the map is gone; see hatrack_omap_node_retire().
+ */
+void
+hatrack_omap_cleanup(hatrack_omap_t *self)
+{
+    hatrack_omap_node_t *cur;
+    hatrack_omap_node_t *next;
+    hatrack_dict_item_t *item;
+
+    cur = hatrack_omap_node(hatrack_skiplist_first(&self->list));
+
+    while (cur) {
+	next = hatrack_omap_next(cur, 0);
+	item = hatrack_omap_item(atomic_load(&cur->item));
+
+	if (self->free_handler) {
+	    (*self->free_handler)(self, item);
+	}
+
+	mmm_retire_unused(item);
+	mmm_retire_unused(cur);
+
+	cur = next;
+    }
+
+    hatrack_skiplist_cleanup(&self->list);
+
+    return;
+}
+
+void
+hatrack_omap_delete(hatrack_omap_t *self)
+{
+    hatrack_omap_cleanup(self);
+    free(self);
+
+    return;
+}
+
+void
+hatrack_omap_set_custom_cmp(hatrack_omap_t *self, hatrack_cmp_func_t func)
+{
+    self->custom_cmp = func;
+
+    return;
+}
+
+void
+hatrack_omap_set_free_handler(hatrack_omap_t *self, hatrack_mem_hook_t func)
+{
+    self->free_handler = func;
+
+    return;
+}
+
+void
+hatrack_omap_set_key_return_hook(hatrack_omap_t *self, hatrack_mem_hook_t func)
+{
+    self->key_return_hook = func;
+
+    return;
+}
+
+void
+hatrack_omap_set_val_return_hook(hatrack_omap_t *self, hatrack_mem_hook_t func)
+{
+    self->val_return_hook = func;
+
+    return;
+}
+
+void *
+hatrack_omap_get(hatrack_omap_t *self, void *key, bool *found)
+{
+    hatrack_omap_node_t *cur;
+    hatrack_dict_item_t *item;
+    uint64_t             p;
+
+    mmm_start_basic_op();
+
+    cur = hatrack_omap_search(self, key);
+
+    /* There can be more than one node with this key: any number of
+     * removed ones that haven't been unlinked yet, and at most one
+     * live one.
+     */
+    while (cur && !hatrack_omap_cmp(self, hatrack_omap_key(cur), key)) {
+	p = atomic_load(&cur->item);
+
+	if (!hatrack_omap_is_marked(p)) {
+	    item = hatrack_omap_item(p);
+
+	    if (self->val_return_hook) {
+		(*self->val_return_hook)(self, item->value);
+	    }
+
+	    mmm_end_op();
+
+	    return hatrack_found(found, item->value);
+	}
+
+	cur = hatrack_omap_next(cur, 0);
+    }
+
+    mmm_end_op();
+
+    return hatrack_not_found(found);
+}
+
+void
+hatrack_omap_put(hatrack_omap_t *self, void *key, void *value)
+{
+    hatrack_dict_item_t *item;
+    hatrack_dict_item_t *old_item;
+
+    mmm_start_basic_op();
+
+    item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    item->key   = key;
+    item->value = value;
+    old_item    = hatrack_omap_store(self, item, HATRACK_OMAP_PUT, NULL);
+
+    if (old_item) {
+	if (self->free_handler) {
+	    mmm_add_cleanup_handler(old_item,
+				    (mmm_cleanup_func)hatrack_omap_record_eject,
+				    (void *)self->free_handler);
+	}
+
+	mmm_retire(old_item);
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
+bool
+hatrack_omap_replace(hatrack_omap_t *self, void *key, void *value)
+{
+    hatrack_dict_item_t *item;
+    hatrack_dict_item_t *old_item;
+    bool                 found;
+
+    mmm_start_basic_op();
+
+    item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    item->key   = key;
+    item->value = value;
+    old_item    = hatrack_omap_store(self, item, HATRACK_OMAP_REPLACE, &found);
+
+    if (!found) {
+	mmm_retire_unused(item);
+	mmm_end_op();
+
+	return false;
+    }
+
+    if (self->free_handler) {
+	mmm_add_cleanup_handler(old_item,
+				(mmm_cleanup_func)hatrack_omap_record_eject,
+				(void *)self->free_handler);
+    }
+
+    mmm_retire(old_item);
+    mmm_end_op();
+
+    return true;
+}
+
+bool
+hatrack_omap_add(hatrack_omap_t *self, void *key, void *value)
+{
+    hatrack_dict_item_t *item;
+    bool                 found;
+
+    mmm_start_basic_op();
+
+    item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    item->key   = key;
+    item->value = value;
+
+    hatrack_omap_store(self, item, HATRACK_OMAP_ADD, &found);
+
+    if (found) {
+	mmm_retire_unused(item);
+    }
+
+    mmm_end_op();
+
+    return !found;
+}
+
+/* The removed item stays with its node (other threads may still need
+ * its key to get past the node), and goes to the free handler when
+ * the node itself gets freed.
+ */
+bool
+hatrack_omap_remove(hatrack_omap_t *self, void *key)
+{
+    hatrack_dict_item_t *item;
+
+    mmm_start_basic_op();
+
+    item = hatrack_omap_unlink(self, key);
+
+    mmm_end_op();
+
+    return item != NULL;
+}
+
+uint64_t
+hatrack_omap_len(hatrack_omap_t *self)
+{
+    return atomic_read(&self->item_count);
+}
+
+/* Finds the largest key that's less than or equal to the given key.
+ *
+ * We only ever step onto nodes that are still live when we get to
+ * them, but keep walking past removed ones. At the bottom level, that
+ * leaves us on the last live node at or below the key, unless it got
+ * removed after we passed it, in which case we start over.
+ */
+bool
+hatrack_omap_floor(hatrack_omap_t *self, void *key, hatrack_dict_item_t *out)
+{
+    hatrack_skiplist_node_t *pred;
+    hatrack_skiplist_node_t *cur;
+    hatrack_dict_item_t     *item;
+    int64_t                  level;
+    uint64_t                 p;
+
+    mmm_start_basic_op();
+
+retry:
+    pred = self->list.head;
+
+    for (level = atomic_load(&self->list.height) - 1; level >= 0; level--) {
+	cur = hatrack_skiplist_next(pred, level);
+
+	while (cur && hatrack_omap_node_cmp(&self->list, cur, key) <= 0) {
+	    if (!hatrack_omap_node_removed(cur)) {
+		pred = cur;
+	    }
+
+	    cur = hatrack_skiplist_next(cur, level);
+	}
+    }
+
+    if (pred == self->list.head) {
+	mmm_end_op();
+	return false;
+    }
+
+    p = atomic_load(&hatrack_omap_node(pred)->item);
+
+    if (hatrack_omap_is_marked(p)) {
+	goto retry;
+    }
+
+    item       = hatrack_omap_item(p);
+    out->key   = item->key;
+    out->value = item->value;
+
+    if (self->key_return_hook) {
+	(*self->key_return_hook)(self, item->key);
+    }
+
+    if (self->val_return_hook) {
+	(*self->val_return_hook)(self, item->value);
+    }
+
+    mmm_end_op();
+
+    return true;
+}
+
+// Finds the smallest key that's greater than or equal to the given key.
+bool
+hatrack_omap_ceiling(hatrack_omap_t *self, void *key, hatrack_dict_item_t *out)
+{
+    hatrack_omap_node_t *cur;
+    hatrack_dict_item_t *item;
+    uint64_t             p;
+
+    mmm_start_basic_op();
+
+    cur = hatrack_omap_search(self, key);
+
+    while (cur) {
+	p = atomic_load(&cur->item);
+
+	if (!hatrack_omap_is_marked(p)) {
+	    item       = hatrack_omap_item(p);
+	    out->key   = item->key;
+	    out->value = item->value;
+
+	    if (self->key_return_hook) {
+		(*self->key_return_hook)(self, item->key);
+	    }
+
+	    if (self->val_return_hook) {
+		(*self->val_return_hook)(self, item->value);
+	    }
+
+	    mmm_end_op();
+
+	    return true;
+	}
+
+	cur = hatrack_omap_next(cur, 0);
+    }
+
+    mmm_end_op();
+
+    return false;
+}
+
+// Returns the items with lo <= key < hi, in order.
+hatrack_dict_item_t *
+hatrack_omap_range(hatrack_omap_t *self, void *lo, void *hi, uint64_t *num)
+{
+    hatrack_dict_item_t *ret;
+
+    mmm_start_basic_op();
+
+    ret = hatrack_omap_collect(self, hatrack_omap_search(self, lo), hi, num);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+hatrack_dict_item_t *
+hatrack_omap_items(hatrack_omap_t *self, uint64_t *num)
+{
+    hatrack_dict_item_t *ret;
+
+    mmm_start_basic_op();
+
+    ret = hatrack_omap_collect(self,
+			       hatrack_omap_node(hatrack_skiplist_first(&self->list)),
+			       NULL,
+			       num);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* This is here so the map can be driven from the same harness as the
+ * hash tables. The view is always in key order, whether or not you
+ * ask for it sorted, and the items in it are the values.
+ */
+hatrack_view_t *
+hatrack_omap_view(hatrack_omap_t *self, uint64_t *num, bool sort)
+{
+    hatrack_dict_item_t *items;
+    hatrack_view_t      *ret;
+    uint64_t             i;
+
+    items = hatrack_omap_items(self, num);
+    ret   = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * (*num + 1));
+
+    for (i = 0; i < *num; i++) {
+	ret[i].item       = items[i].value;
+	ret[i].sort_epoch = i;
+    }
+
+    free(items);
+
+    return ret;
+}
+
+static hatrack_omap_node_t *
+hatrack_omap_node_new(uint64_t height, hatrack_dict_item_t *item)
+{
+    hatrack_omap_node_t *ret;
+
+    ret = mmm_alloc(sizeof(hatrack_omap_node_t) + sizeof(uint64_t) * height);
+
+    hatrack_skiplist_node_init(&ret->links, height);
+
+    atomic_store(&ret->item, (uint64_t)item);
+
+    return ret;
+}
+
+/* Finds where the key goes (see hatrack_skiplist_find()), and returns
+ * the node at the bottom level with the key, if there is one, even if
+ * its item has been removed; it's up to the caller to check.
+ */
+static hatrack_omap_node_t *
+hatrack_omap_find(hatrack_omap_t           *self,
+		  void                     *key,
+		  hatrack_skiplist_node_t **preds,
+		  hatrack_skiplist_node_t **succs)
+{
+    hatrack_omap_node_t *cur;
+
+    cur = hatrack_omap_node(
+	hatrack_skiplist_find(&self->list, key, preds, succs, false));
+
+    if (cur && !hatrack_omap_cmp(self, hatrack_omap_key(cur), key)) {
+	return cur;
+    }
+
+    return NULL;
+}
+
+/* The read-only version of the above, for lookups: returns the first
+ * node at the bottom level with a key greater than or equal to the
+ * given key. This never writes, and so never has to start over;
+ * removed nodes still have valid 'next' pointers, so we just walk
+ * through them.
+ */
+static hatrack_omap_node_t *
+hatrack_omap_search(hatrack_omap_t *self, void *key)
+{
+    hatrack_skiplist_node_t *pred;
+    hatrack_skiplist_node_t *cur;
+    int64_t                  level;
+
+    pred = self->list.head;
+    cur  = NULL;
+
+    for (level = atomic_load(&self->list.height) - 1; level >= 0; level--) {
+	cur = hatrack_skiplist_next(pred, level);
+
+	while (cur && hatrack_omap_node_cmp(&self->list, cur, key) < 0) {
+	    pred = cur;
+	    cur  = hatrack_skiplist_next(cur, level);
+	}
+    }
+
+    return hatrack_omap_node(cur);
+}
+
+/* The guts of put, replace and add. Returns the item that was there
+ * before, if any, setting *found accordingly.
+ *
+ * If we find a live node with the key, we swap our item into it (or,
+ * for add, give up). If we find one that's been removed, we help mark
+ * it, so that the next search unlinks it, and try again; we can't
+ * link in a new node with the same key until the old one is out of
+ * the way, or a search could find the old one and stop there.
+ *
+ * Otherwise, we link a new node in at the bottom level, which is
+ * where the insertion takes effect, and then build the rest of its
+ * tower (see skiplist.c).
+ */
+static hatrack_dict_item_t *
+hatrack_omap_store(hatrack_omap_t      *self,
+		   hatrack_dict_item_t *item,
+		   uint32_t             mode,
+		   bool                *found)
+{
+    hatrack_skiplist_node_t *preds[HATRACK_OMAP_MAX_HEIGHT];
+    hatrack_skiplist_node_t *succs[HATRACK_OMAP_MAX_HEIGHT];
+    hatrack_omap_node_t     *node;
+    hatrack_omap_node_t     *new_node;
+    uint64_t                 height;
+    uint64_t                 p;
+
+    height   = hatrack_skiplist_pick_height(&self->list);
+    new_node = NULL;
+
+    while (true) {
+	node = hatrack_omap_find(self, item->key, preds, succs);
+
+	if (node) {
+	    p = atomic_load(&node->item);
+
+	    if (hatrack_omap_is_marked(p)) {
+		hatrack_skiplist_mark_tower(&node->links);
+		continue;
+	    }
+
+	    if (mode == HATRACK_OMAP_ADD) {
+		break;
+	    }
+
+	    if (!CAS(&node->item, &p, (uint64_t)item)) {
+		continue;
+	    }
+
+	    break;
+	}
+
+	if (mode == HATRACK_OMAP_REPLACE) {
+	    if (new_node) {
+		mmm_retire_unused(new_node);
+	    }
+
+	    return hatrack_not_found(found);
+	}
+
+	if (!new_node) {
+	    new_node = hatrack_omap_node_new(height, item);
+	}
+
+	if (!hatrack_skiplist_link(&new_node->links, preds, succs)) {
+	    continue;
+	}
+
+	atomic_fetch_add(&self->item_count, 1);
+
+	hatrack_skiplist_build_tower(&self->list,
+				     &new_node->links,
+				     item->key,
+				     preds,
+				     succs);
+
+	return hatrack_not_found(found);
+    }
+
+    if (new_node) {
+	mmm_retire_unused(new_node);
+    }
+
+    return hatrack_found(found, hatrack_omap_item(p));
+}
+
+/* Removes the item with the given key, returning it (or NULL if there
+ * wasn't one). Marking the item is the point where the removal takes
+ * effect, and exactly one thread can win that. The winner then marks
+ * the node's tower, makes sure it's unlinked everywhere, and drops
+ * the remover's reference to the node.
+ */
+static hatrack_dict_item_t *
+hatrack_omap_unlink(hatrack_omap_t *self, void *key)
+{
+    hatrack_skiplist_node_t *preds[HATRACK_OMAP_MAX_HEIGHT];
+    hatrack_skiplist_node_t *succs[HATRACK_OMAP_MAX_HEIGHT];
+    hatrack_omap_node_t     *node;
+    uint64_t                 p;
+
+    while (true) {
+	node = hatrack_omap_find(self, key, preds, succs);
+
+	if (!node) {
+	    return NULL;
+	}
+
+	p = atomic_load(&node->item);
+
+	if (hatrack_omap_is_marked(p)) {
+	    hatrack_skiplist_mark_tower(&node->links);
+	    continue;
+	}
+
+	if (CAS(&node->item, &p, p | HATRACK_OMAP_MARK)) {
+	    break;
+	}
+    }
+
+    atomic_fetch_sub(&self->item_count, 1);
+
+    hatrack_skiplist_unlink(&self->list, &node->links, key, preds, succs);
+
+    return hatrack_omap_item(p);
+}
+
+/* The skiplist hooks; see skiplist.h. The map's skiplist is the first
+ * thing in the map, so the hooks can get to the map with a cast.
+ */
+static int
+hatrack_omap_node_cmp(hatrack_skiplist_t      *list,
+		      hatrack_skiplist_node_t *links,
+		      void                    *key)
+{
+    return hatrack_omap_cmp((hatrack_omap_t *)list,
+			    hatrack_omap_key(hatrack_omap_node(links)),
+			    key);
+}
+
+static bool
+hatrack_omap_node_removed(hatrack_skiplist_node_t *links)
+{
+    return hatrack_omap_is_marked(atomic_load(&hatrack_omap_node(links)->item));
+}
+
+/* Called by whoever drops the last reference to a node, which then
+ * gets retired, and its item goes with it when mmm frees it.
+ *
+ * mmm can get around to that long after the map is deleted, since
+ * the node sits on the retiring thread's list until then. So the
+ * cleanup handlers we give mmm must not touch the map. Instead of the
+ * map, they get the free handler itself (or NULL if there isn't one),
+ * and pass the handler NULL in place of the map. Replaced records get
+ * the same treatment; see hatrack_omap_put().
+ */
+static void
+hatrack_omap_node_retire(hatrack_skiplist_t *list, hatrack_skiplist_node_t *links)
+{
+    hatrack_omap_node_t *node;
+
+    node = hatrack_omap_node(links);
+
+    mmm_add_cleanup_handler(node,
+			    (mmm_cleanup_func)hatrack_omap_node_eject,
+			    (void *)((hatrack_omap_t *)list)->free_handler);
+    mmm_retire(node);
+
+    return;
+}
+
+static void
+hatrack_omap_record_eject(hatrack_dict_item_t *record, void *aux)
+{
+    hatrack_mem_hook_t handler;
+
+    handler = (hatrack_mem_hook_t)aux;
+
+    (*handler)(NULL, record);
+
+    return;
+}
+
+static void
+hatrack_omap_node_eject(hatrack_omap_node_t *node, void *aux)
+{
+    hatrack_mem_hook_t   handler;
+    hatrack_dict_item_t *item;
+
+    handler = (hatrack_mem_hook_t)aux;
+    item    = hatrack_omap_item(atomic_load(&node->item));
+
+    if (handler) {
+	(*handler)(NULL, item);
+    }
+
+    mmm_retire_unused(item);
+
+    return;
+}
+
+/* Walks the bottom level from cur, collecting live items until we get
+ * to one with a key that's not less than hi (or to the end, if hi is
+ * NULL, which is only used internally).
+ */
+static hatrack_dict_item_t *
+hatrack_omap_collect(hatrack_omap_t      *self,
+		     hatrack_omap_node_t *cur,
+		     void                *hi,
+		     uint64_t            *num)
+{
+    hatrack_dict_item_t *ret;
+    hatrack_dict_item_t *item;
+    uint64_t             alloc_len;
+    uint64_t             n;
+    uint64_t             p;
+
+    alloc_len = 16;
+    n         = 0;
+    ret       = (hatrack_dict_item_t *)malloc(sizeof(hatrack_dict_item_t)
+					      * alloc_len);
+
+    while (cur) {
+	p = atomic_load(&cur->item);
+
+	if (hi && hatrack_omap_cmp(self, hatrack_omap_item(p)->key, hi) >= 0) {
+	    break;
+	}
+
+	if (!hatrack_omap_is_marked(p)) {
+	    if (n == alloc_len) {
+		alloc_len <<= 1;
+		ret = (hatrack_dict_item_t *)realloc(ret,
+						     sizeof(hatrack_dict_item_t)
+						     * alloc_len);
+	    }
+
+	    item         = hatrack_omap_item(p);
+	    ret[n].key   = item->key;
+	    ret[n].value = item->value;
+
+	    if (self->key_return_hook) {
+		(*self->key_return_hook)(self, item->key);
+	    }
+
+	    if (self->val_return_hook) {
+		(*self->val_return_hook)(self, item->value);
+	    }
+
+	    n++;
+	}
+
+	cur = hatrack_omap_next(cur, 0);
+    }
+
+    *num = n;
+
+    return ret;
+}
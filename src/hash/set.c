@@ -20,11 +20,61 @@
  */
 
 #include <hatrack.h>
+#include <sched.h>
+
+typedef enum {
+    HATRACK_SET_OP_DIFFERENCE,
+    HATRACK_SET_OP_UNION,
+    HATRACK_SET_OP_INTERSECTION,
+    HATRACK_SET_OP_DISJUNCTION
+} hatrack_set_op_t;
+
+/* State shared by all the threads working on one set algebra
+ * operation; see hatrack_set_algebra() below.
+ *
+ * items1 and items2 hold the two views, grouped by partition, and
+ * offsets1 / offsets2 say where each partition starts (with one extra
+ * entry at the end, so partition i is always offsets[i] up to
+ * offsets[i + 1]).
+ *
+ * The last three fields are only used when the work goes to a
+ * hatrack_pool; see hatrack_set_pool_helper().
+ */
+typedef struct {
+    hatrack_set_t      *set1;
+    hatrack_set_t      *set2;
+    hatrack_set_t      *result;
+    hatrack_set_op_t    op;
+    hatrack_set_view_t *items1;
+    hatrack_set_view_t *items2;
+    uint64_t           *offsets1;
+    uint64_t           *offsets2;
+    uint64_t            num_parts;
+    _Atomic uint64_t    next_part;
+    _Atomic uint64_t    workers_done;
+    _Atomic uint64_t    running;
+    _Atomic bool        closed;
+    _Atomic uint64_t    refs;
+} hatrack_set_job_t;
 
 static hatrack_hash_t hatrack_set_get_hash_value(hatrack_set_t *, void *);
 static void hatrack_set_record_eject(woolhat_record_t *, hatrack_set_t *);
 static int  hatrack_set_hv_sort_cmp(const void *, const void *);
 static int  hatrack_set_epoch_sort_cmp(const void *, const void *);
+static void hatrack_set_defer_eject(hatrack_set_t *, void *);
+static void hatrack_set_feed_hooks(hatrack_set_t *);
+static void hatrack_set_cell_eject(void **, hatrack_set_t *);
+static bool hatrack_set_add_hv(hatrack_set_t *, hatrack_hash_t, void *);
+static void hatrack_set_init_base(hatrack_set_t *, uint32_t, hatrack_backend_t,
+				  char);
+static hatrack_set_t *hatrack_set_algebra(hatrack_set_t *, hatrack_set_t *,
+					  hatrack_set_op_t, uint32_t,
+					  hatrack_pool_t *);
+static hatrack_set_view_t *hatrack_set_view_epoch(hatrack_set_t *,
+						  uint64_t *,
+						  uint64_t);
+static void hatrack_set_init_from_bitset(hatrack_set_t *, hatrack_bitset_t *);
+static hatrack_set_t *hatrack_set_wrap_bitset(hatrack_bitset_t *);
 
 hatrack_set_t *
 hatrack_set_new(uint32_t item_type)
@@ -38,10 +88,126 @@ hatrack_set_new(uint32_t item_type)
     return ret;
 }
 
+hatrack_set_t *
+hatrack_set_new_with_backend(uint32_t item_type, hatrack_backend_t backend)
+{
+    hatrack_set_t *ret;
+
+    ret = (hatrack_set_t *)malloc(sizeof(hatrack_set_t));
+
+    hatrack_set_init_with_backend(ret, item_type, backend);
+
+    return ret;
+}
+
 void
 hatrack_set_init(hatrack_set_t *self, uint32_t item_type)
 {
-    woolhat_init(&self->woolhat_instance);
+    hatrack_set_init_with_backend(self, item_type, HATRACK_SET_BACKEND);
+
+    return;
+}
+
+hatrack_set_t *
+hatrack_set_new_bitset(uint64_t num_bits)
+{
+    hatrack_set_t *ret;
+
+    ret = (hatrack_set_t *)malloc(sizeof(hatrack_set_t));
+
+    hatrack_set_init_bitset(ret, num_bits);
+
+    return ret;
+}
+
+/* A set of integers from 0 up to (but not including) num_bits, kept
+ * in a hatrack_bitset instead of a hash table; see bitset.h. The item
+ * type is always HATRACK_DICT_KEY_TYPE_INT.
+ *
+ * Everything in the set API works on these. Set algebra between two
+ * bitset-backed sets is done on the bitmaps directly, and gives you
+ * another bitset-backed set. Mixing a bitset-backed set with a
+ * table-backed one works too, but goes through the normal path, and
+ * gives you a table-backed set. Since the items are plain integers,
+ * free handlers and return hooks never get called, and the 'sorted'
+ * views are in numeric order, not insertion order.
+ */
+void
+hatrack_set_init_bitset(hatrack_set_t *self, uint64_t num_bits)
+{
+    hatrack_set_init_from_bitset(self, hatrack_bitset_new(num_bits));
+
+    return;
+}
+
+static void
+hatrack_set_init_from_bitset(hatrack_set_t *self, hatrack_bitset_t *bitset)
+{
+    self->bitset                         = bitset;
+    self->backend_vtable                 = NULL;
+    self->backend_table                  = NULL;
+    self->backend                        = HATRACK_SET_BACKEND;
+    self->item_type                      = HATRACK_DICT_KEY_TYPE_INT;
+    self->hash_info.offsets.hash_offset  = 0;
+    self->hash_info.offsets.cache_offset = HATRACK_DICT_NO_CACHE;
+    self->free_handler                   = NULL;
+    self->pre_return_hook                = NULL;
+    self->change_log                     = NULL;
+
+    return;
+}
+
+/* Woolhat is our native backend, since it gives us linearized views
+ * that we can take at a single epoch across multiple sets, which is
+ * what makes the set algebra operations below correct at a moment in
+ * time.
+ *
+ * Other backends still get the full API, but the algebra operations
+ * are only as consistent as the backend's own views. If you need the
+ * moment-in-time semantics, stick with woolhat (or at least use a
+ * backend whose views are fully ordered, like consistent tophat).
+ */
+void
+hatrack_set_init_with_backend(hatrack_set_t    *self,
+			      uint32_t          item_type,
+			      hatrack_backend_t backend)
+{
+    hatrack_set_init_base(self, item_type, backend, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+/* The set algebra operations know roughly how big their result is
+ * going to be before they start, so they start the table at that
+ * size, instead of migrating their way up to it.
+ */
+static void
+hatrack_set_init_base(hatrack_set_t    *self,
+		      uint32_t          item_type,
+		      hatrack_backend_t backend,
+		      char              size)
+{
+    hatrack_backend_info_t *info;
+
+    if (backend == HATRACK_BACKEND_DEFAULT) {
+	backend = HATRACK_SET_BACKEND;
+    }
+
+    if (backend == HATRACK_BACKEND_WOOLHAT) {
+	woolhat_init_size(&self->woolhat_instance, size);
+	self->backend_vtable = NULL;
+	self->backend_table  = NULL;
+    }
+    else {
+	info                 = hatrack_backend_get_info(backend);
+	self->backend_vtable = info->vtable;
+	self->backend_table  = malloc(info->size);
+
+	(*info->vtable->init_sz)(self->backend_table, size);
+    }
+
+    self->backend = backend;
+    self->bitset  = NULL;
 
     switch (item_type) {
     case HATRACK_DICT_KEY_TYPE_INT:
@@ -63,6 +229,7 @@ hatrack_set_init(hatrack_set_t *self, uint32_t item_type)
     self->hash_info.offsets.cache_offset = HATRACK_DICT_NO_CACHE;
     self->free_handler                   = NULL;
     self->pre_return_hook                = NULL;
+    self->change_log                     = NULL;
 
     return;
 }
@@ -76,6 +243,35 @@ hatrack_set_cleanup(hatrack_set_t *self)
     hatrack_hash_t     hv;
     woolhat_state_t    state;
     hatrack_mem_hook_t handler;
+    hatrack_view_t    *view;
+    uint64_t           num;
+
+    if (self->change_log) {
+	hatrack_changelog_delete(self->change_log);
+    }
+
+    if (self->bitset) {
+	hatrack_bitset_delete(self->bitset);
+
+	return;
+    }
+
+    if (self->backend_vtable) {
+	if (self->free_handler) {
+	    view = (*self->backend_vtable->view)(self->backend_table,
+						 &num,
+						 false);
+	    for (i = 0; i < num; i++) {
+		(*self->free_handler)(self, view[i].item);
+	    }
+
+	    free(view);
+	}
+
+	(*self->backend_vtable->delete)(self->backend_table);
+
+	return;
+    }
 
     if (self->free_handler) {
         handler = (hatrack_mem_hook_t)self->free_handler;
@@ -142,6 +338,12 @@ hatrack_set_set_free_handler(hatrack_set_t *self, hatrack_mem_hook_t func)
 {
     self->free_handler = func;
 
+    hatrack_set_feed_hooks(self);
+
+    if (self->backend_vtable || self->bitset) {
+	return;
+    }
+
     woolhat_set_cleanup_func(&self->woolhat_instance,
                              (mmm_cleanup_func)hatrack_set_record_eject,
                              self);
@@ -153,6 +355,8 @@ hatrack_set_set_return_hook(hatrack_set_t *self, hatrack_mem_hook_t func)
 {
     self->pre_return_hook = func;
 
+    hatrack_set_feed_hooks(self);
+
     return;
 }
 
@@ -161,6 +365,17 @@ hatrack_set_contains(hatrack_set_t *self, void *item)
 {
     bool ret;
 
+    if (self->bitset) {
+	return hatrack_bitset_contains(self->bitset, (uint64_t)item);
+    }
+
+    if (self->backend_vtable) {
+	(*self->backend_vtable->get)(self->backend_table,
+				     hatrack_set_get_hash_value(self, item),
+				     &ret);
+	return ret;
+    }
+
     woolhat_get(&self->woolhat_instance,
                 hatrack_set_get_hash_value(self, item),
                 &ret);
@@ -168,15 +383,61 @@ hatrack_set_contains(hatrack_set_t *self, void *item)
     return ret;
 }
 
+/* When we're not on woolhat, we don't have records of our own to hang
+ * a cleanup handler off of, so anything we knock out of the backend
+ * gets handed to hatrack_set_defer_eject(), which makes sure the free
+ * handler doesn't run until no reader can still be looking at it.
+ *
+ * With the change feed on, we hold the item's stripe in the log from
+ * before the write until the change is logged; see changelog.h. A
+ * bitset doesn't need the hash value otherwise.
+ */
 bool
 hatrack_set_put(hatrack_set_t *self, void *item)
 {
-    bool ret;
+    hatrack_hash_t hv;
+    bool           ret;
+    void          *old;
 
-    woolhat_put(&self->woolhat_instance,
-                hatrack_set_get_hash_value(self, item),
-                item,
-                &ret);
+    if (self->bitset && !self->change_log) {
+	hatrack_bucket_initialize(&hv);
+    }
+    else {
+	hv = hatrack_set_get_hash_value(self, item);
+    }
+
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->bitset) {
+	ret = !hatrack_bitset_add(self->bitset, (uint64_t)item);
+    }
+    else if (self->backend_vtable) {
+	mmm_start_basic_op();
+
+	old = (*self->backend_vtable->put)(self->backend_table,
+					   hv,
+					   item,
+					   &ret);
+	if (ret && old) {
+	    hatrack_set_defer_eject(self, old);
+	}
+
+	mmm_end_op();
+    }
+    else {
+	woolhat_put(&self->woolhat_instance, hv, item, &ret);
+    }
+
+    if (self->change_log) {
+	hatrack_changelog_record(self->change_log,
+				 ret ? HATRACK_CHANGE_UPDATE
+				     : HATRACK_CHANGE_INSERT,
+				 item,
+				 NULL);
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
 
     return ret;
 }
@@ -184,23 +445,216 @@ hatrack_set_put(hatrack_set_t *self, void *item)
 bool
 hatrack_set_add(hatrack_set_t *self, void *item)
 {
-    return woolhat_add(&self->woolhat_instance,
-                       hatrack_set_get_hash_value(self, item),
-                       item);
+    hatrack_hash_t hv;
+    bool           ret;
+
+    if (self->bitset && !self->change_log) {
+	hatrack_bucket_initialize(&hv);
+    }
+    else {
+	hv = hatrack_set_get_hash_value(self, item);
+    }
+
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->bitset) {
+	ret = hatrack_bitset_add(self->bitset, (uint64_t)item);
+    }
+    else if (self->backend_vtable) {
+	ret = (*self->backend_vtable->add)(self->backend_table, hv, item);
+    }
+    else {
+	ret = woolhat_add(&self->woolhat_instance, hv, item);
+    }
+
+    if (self->change_log) {
+	if (ret) {
+	    hatrack_changelog_record(self->change_log,
+				     HATRACK_CHANGE_INSERT,
+				     item,
+				     NULL);
+	}
+
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
+
+    return ret;
 }
 
 bool
 hatrack_set_remove(hatrack_set_t *self, void *item)
 {
-    bool ret;
+    hatrack_hash_t hv;
+    bool           ret;
+    void          *old;
+
+    if (self->bitset && !self->change_log) {
+	hatrack_bucket_initialize(&hv);
+    }
+    else {
+	hv = hatrack_set_get_hash_value(self, item);
+    }
+
+    if (self->change_log) {
+	hatrack_changelog_lock(self->change_log, hv);
+    }
+
+    if (self->bitset) {
+	ret = hatrack_bitset_remove(self->bitset, (uint64_t)item);
+    }
+    else if (self->backend_vtable) {
+	mmm_start_basic_op();
+
+	old = (*self->backend_vtable->remove)(self->backend_table, hv, &ret);
+
+	if (ret && old) {
+	    hatrack_set_defer_eject(self, old);
+	}
+
+	mmm_end_op();
+    }
+    else {
+	woolhat_remove(&self->woolhat_instance, hv, &ret);
+    }
+
+    if (self->change_log) {
+	if (ret) {
+	    hatrack_changelog_record(self->change_log,
+				     HATRACK_CHANGE_DELETE,
+				     item,
+				     NULL);
+	}
 
-    woolhat_remove(&self->woolhat_instance,
-                   hatrack_set_get_hash_value(self, item),
-                   &ret);
+	hatrack_changelog_unlock(self->change_log, hv);
+    }
 
     return ret;
 }
 
+/* See stats.h. Unlike the dictionary, the set puts the caller's items
+ * straight into the table, so the table's numbers are the whole
+ * story.
+ */
+void
+hatrack_set_stats(hatrack_set_t *self, hatrack_stats_t *stats)
+{
+    hatrack_backend_info_t *info;
+
+    if (self->bitset) {
+	memset(stats, 0, sizeof(hatrack_stats_t));
+
+	stats->num_items   = hatrack_bitset_len(self->bitset);
+	stats->store_bytes = sizeof(hatrack_bitset_t)
+	                   + self->bitset->num_words * sizeof(uint64_t);
+
+	hatrack_stats_finish(stats);
+
+	return;
+    }
+
+    if (!self->backend_vtable) {
+	woolhat_stats(&self->woolhat_instance, stats);
+
+	return;
+    }
+
+    info = hatrack_backend_get_info(self->backend);
+
+    if (info->stats) {
+	(*info->stats)(self->backend_table, stats);
+
+	return;
+    }
+
+    memset(stats, 0, sizeof(hatrack_stats_t));
+
+    stats->num_items = (*self->backend_vtable->len)(self->backend_table);
+
+    return;
+}
+
+/* Change feed support; see changelog.h, and the equivalent functions
+ * in dict.c. For sets, the item is in the 'key' field of each
+ * change, and the value is always NULL. The log keeps its items alive
+ * through the return hook, so, as with the dict, turning on the feed
+ * with a free handler and no return hook aborts.
+ */
+void
+hatrack_set_set_change_feed(hatrack_set_t *self, bool value)
+{
+    if (value && !self->change_log) {
+	self->change_log = hatrack_changelog_new();
+
+	hatrack_set_feed_hooks(self);
+    }
+
+    if (!value && self->change_log) {
+	hatrack_changelog_delete(self->change_log);
+	self->change_log = NULL;
+    }
+
+    return;
+}
+
+static void
+hatrack_set_feed_hooks(hatrack_set_t *self)
+{
+    if (!self->change_log) {
+	return;
+    }
+
+    if (self->free_handler && !self->pre_return_hook) {
+	abort();
+    }
+
+    hatrack_changelog_set_hooks(self->change_log,
+				self,
+				self->pre_return_hook,
+				NULL,
+				self->free_handler,
+				false);
+
+    return;
+}
+
+hatrack_change_t *
+hatrack_set_changes_since(hatrack_set_t *self,
+			  uint64_t       epoch,
+			  uint64_t      *num,
+			  uint64_t      *high_water)
+{
+    if (!self->change_log) {
+	*num        = 0;
+	*high_water = HATRACK_CHANGES_TRIMMED;
+
+	return NULL;
+    }
+
+    return hatrack_changelog_since(self->change_log, epoch, num, high_water);
+}
+
+uint64_t
+hatrack_set_changes_epoch(hatrack_set_t *self)
+{
+    if (!self->change_log) {
+	return 0;
+    }
+
+    return hatrack_changelog_epoch(self->change_log);
+}
+
+void
+hatrack_set_changes_trim(hatrack_set_t *self, uint64_t epoch)
+{
+    if (self->change_log) {
+	hatrack_changelog_trim(self->change_log, epoch);
+    }
+
+    return;
+}
+
 static inline void *
 hatrack_set_items_base(hatrack_set_t *self, uint64_t *num, bool sort)
 {
@@ -209,9 +663,14 @@ hatrack_set_items_base(hatrack_set_t *self, uint64_t *num, bool sort)
     uint64_t            i;
     uint64_t            epoch;
 
+    // Already in order, and there are no hooks to run.
+    if (self->bitset) {
+	return hatrack_bitset_items(self->bitset, num);
+    }
+
     epoch = mmm_start_linearized_op();
 
-    view = woolhat_view_epoch(&self->woolhat_instance, num, epoch);
+    view = hatrack_set_view_epoch(self, num, epoch);
     ret  = malloc(sizeof(void *) * *num);
 
     if (sort) {
@@ -272,10 +731,14 @@ hatrack_set_is_eq(hatrack_set_t *set1, hatrack_set_t *set2)
     hatrack_set_view_t *view2;
     uint64_t            i;
 
+    if (set1->bitset && set2->bitset) {
+	return hatrack_bitset_is_eq(set1->bitset, set2->bitset);
+    }
+
     epoch = mmm_start_linearized_op();
 
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+    view1 = hatrack_set_view_epoch(set1, &num1, epoch);
+    view2 = hatrack_set_view_epoch(set2, &num2, epoch);
 
     if (num2 != num1) {
         ret = false;
@@ -325,10 +788,14 @@ hatrack_set_is_superset(hatrack_set_t *set1, hatrack_set_t *set2, bool proper)
     hatrack_set_view_t *view2;
     uint64_t            i, j;
 
+    if (set1->bitset && set2->bitset) {
+	return hatrack_bitset_is_superset(set1->bitset, set2->bitset, proper);
+    }
+
     epoch = mmm_start_linearized_op();
 
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+    view1 = hatrack_set_view_epoch(set1, &num1, epoch);
+    view2 = hatrack_set_view_epoch(set2, &num2, epoch);
 
     if (num2 > num1) {
         ret = false;
@@ -414,10 +881,14 @@ hatrack_set_is_disjoint(hatrack_set_t *set1, hatrack_set_t *set2)
     hatrack_set_view_t *view2;
     uint64_t            i, j;
 
+    if (set1->bitset && set2->bitset) {
+	return hatrack_bitset_is_disjoint(set1->bitset, set2->bitset);
+    }
+
     epoch = mmm_start_linearized_op();
 
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+    view1 = hatrack_set_view_epoch(set1, &num1, epoch);
+    view2 = hatrack_set_view_epoch(set2, &num2, epoch);
 
     qsort(view1, num1, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
     qsort(view2, num2, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
@@ -460,184 +931,279 @@ finished:
 hatrack_set_t *
 hatrack_set_difference(hatrack_set_t *set1, hatrack_set_t *set2)
 {
-    hatrack_set_t      *ret;
-    uint64_t            epoch;
-    uint64_t            num1;
-    uint64_t            num2;
-    hatrack_set_view_t *view1;
-    hatrack_set_view_t *view2;
-    uint64_t            i, j;
-
-    if (set1->item_type != set2->item_type) {
-        abort();
-    }
-
-    ret   = hatrack_set_new(set1->item_type);
-    epoch = mmm_start_linearized_op();
-
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
-
-    qsort(view1, num1, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
-    qsort(view2, num2, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
-
-    i = 0;
-    j = 0;
-
-    while (true) {
-        if (i == num1 || j == num2) {
-            break;
-        }
-
-        if (hatrack_hashes_eq(view1[i].hv, view2[j].hv)) {
-            i++;
-            j++;
-            continue; // Not in result set.
-        }
-
-        // Next hash comes from the set on the rhs; we ignore it.
-        if (hatrack_hash_gt(view1[i].hv, view2[j].hv)) {
-            j++;
-            continue;
-        }
-
-        if (set1->pre_return_hook) {
-            (*set1->pre_return_hook)(set1, view1[i].item);
-        }
-
-        woolhat_put(&ret->woolhat_instance, view1[i].hv, view1[i].item, NULL);
-        i++;
-    }
-
-    mmm_end_op();
-
-    free(view1);
-    free(view2);
-
-    return ret;
+    return hatrack_set_algebra(set1, set2, HATRACK_SET_OP_DIFFERENCE, 1, NULL);
 }
 
 /* hatrack_set_union(A, B)
  *
  * Returns a new set that consists of all the items from both sets, at
  * the moment in time of the call (as defined by the epoch).
+ *
+ * If an item is in both sets, the result gets whichever copy was
+ * inserted first.
  */
-
 hatrack_set_t *
 hatrack_set_union(hatrack_set_t *set1, hatrack_set_t *set2)
 {
-    hatrack_set_t      *ret;
-    uint64_t            epoch;
-    uint64_t            num1;
-    uint64_t            num2;
-    hatrack_set_view_t *view1;
-    hatrack_set_view_t *view2;
-    uint64_t            i, j;
+    return hatrack_set_algebra(set1, set2, HATRACK_SET_OP_UNION, 1, NULL);
+}
 
-    if (set1->item_type != set2->item_type) {
-        abort();
-    }
+/* hatrack_set_intersection(A, B)
+ *
+ * Returns a new set that consists of only the items that exist in
+ * both sets at the time of the call (as defined by the epoch). The
+ * items come from set A.
+ */
+hatrack_set_t *
+hatrack_set_intersection(hatrack_set_t *set1, hatrack_set_t *set2)
+{
+    return hatrack_set_algebra(set1, set2, HATRACK_SET_OP_INTERSECTION, 1, NULL);
+}
 
-    ret   = hatrack_set_new(set1->item_type);
-    epoch = mmm_start_linearized_op();
+/* hatrack_set_disjunction(A, B)
+ *
+ * Returns a new set that contains items in set A that did not exist
+ * in set B, PLUS the items in set B that did not exist in set A.
+ */
+hatrack_set_t *
+hatrack_set_disjunction(hatrack_set_t *set1, hatrack_set_t *set2)
+{
+    return hatrack_set_algebra(set1, set2, HATRACK_SET_OP_DISJUNCTION, 1, NULL);
+}
 
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+/* The _parallel() versions do exactly the same thing, but spread the
+ * work across num_threads threads (counting the calling thread, so 1
+ * gives you the plain versions above). See hatrack_set_algebra() for
+ * how. Each worker thread registers with mmm for the duration, so
+ * they count against HATRACK_THREADS_MAX while they run.
+ *
+ * If you've set a return hook, note that it'll get called from the
+ * worker threads, not just the calling thread.
+ */
+hatrack_set_t *
+hatrack_set_difference_parallel(hatrack_set_t *set1,
+				hatrack_set_t *set2,
+				uint32_t       num_threads)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_DIFFERENCE,
+			       num_threads,
+			       NULL);
+}
 
-    qsort(view1, num1, sizeof(hatrack_set_view_t), hatrack_set_epoch_sort_cmp);
-    qsort(view2, num2, sizeof(hatrack_set_view_t), hatrack_set_epoch_sort_cmp);
+hatrack_set_t *
+hatrack_set_union_parallel(hatrack_set_t *set1,
+			   hatrack_set_t *set2,
+			   uint32_t       num_threads)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_UNION,
+			       num_threads,
+			       NULL);
+}
 
-    /* Here we're going to add from each array based on the insertion
-     * epoch, to preserve insertion ordering.
-     */
-    i = 0;
-    j = 0;
+hatrack_set_t *
+hatrack_set_intersection_parallel(hatrack_set_t *set1,
+				  hatrack_set_t *set2,
+				  uint32_t       num_threads)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_INTERSECTION,
+			       num_threads,
+			       NULL);
+}
 
-    while ((i < num1) && (j < num2)) {
-        if (view1[i].sort_epoch < view2[j].sort_epoch) {
-            if (woolhat_add(&ret->woolhat_instance, view1[i].hv, view1[i].item)
-                && set1->pre_return_hook) {
-                (*set1->pre_return_hook)(set1, view1[i].item);
-            }
-            i++;
-        }
-        else {
-            if (woolhat_add(&ret->woolhat_instance, view2[j].hv, view2[j].item)
-                && set2->pre_return_hook) {
-                (*set2->pre_return_hook)(set2, view2[j].item);
-            }
+hatrack_set_t *
+hatrack_set_disjunction_parallel(hatrack_set_t *set1,
+				 hatrack_set_t *set2,
+				 uint32_t       num_threads)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_DISJUNCTION,
+			       num_threads,
+			       NULL);
+}
 
-            j++;
-        }
+/* The _pooled() versions hand the work to the workers of an existing
+ * hatrack_pool, instead of starting threads of their own, which saves
+ * the cost of creating threads (and registering them with mmm) on
+ * every call. The calling thread still does its share.
+ *
+ * These are safe to call from inside a task running on the same pool;
+ * the calling thread never waits for helpers that haven't started
+ * yet, so it doesn't matter whether the other workers are busy.
+ */
+hatrack_set_t *
+hatrack_set_difference_pooled(hatrack_set_t  *set1,
+			      hatrack_set_t  *set2,
+			      hatrack_pool_t *pool)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_DIFFERENCE,
+			       hatrack_pool_num_workers(pool) + 1,
+			       pool);
+}
+
+hatrack_set_t *
+hatrack_set_union_pooled(hatrack_set_t  *set1,
+			 hatrack_set_t  *set2,
+			 hatrack_pool_t *pool)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_UNION,
+			       hatrack_pool_num_workers(pool) + 1,
+			       pool);
+}
+
+hatrack_set_t *
+hatrack_set_intersection_pooled(hatrack_set_t  *set1,
+				hatrack_set_t  *set2,
+				hatrack_pool_t *pool)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_INTERSECTION,
+			       hatrack_pool_num_workers(pool) + 1,
+			       pool);
+}
+
+hatrack_set_t *
+hatrack_set_disjunction_pooled(hatrack_set_t  *set1,
+			       hatrack_set_t  *set2,
+			       hatrack_pool_t *pool)
+{
+    return hatrack_set_algebra(set1,
+			       set2,
+			       HATRACK_SET_OP_DISJUNCTION,
+			       hatrack_pool_num_workers(pool) + 1,
+			       pool);
+}
+
+/* Partitions are picked from the top bits of the hash value, the same
+ * way the sharded dictionary picks its shards. Any item that's in
+ * both sets has the same hash value in both, so it always lands in
+ * the same partition on both sides, which is what lets us merge each
+ * partition on its own.
+ */
+static inline uint64_t
+hatrack_set_partition(hatrack_hash_t hv, uint32_t part_bits)
+{
+    uint64_t high;
+
+    if (!part_bits) {
+	return 0;
     }
 
-    while (i < num1) {
-        if (woolhat_add(&ret->woolhat_instance, view1[i].hv, view1[i].item)
-            && set1->pre_return_hook) {
-            (*set1->pre_return_hook)(set1, view1[i].item);
-        }
-        i++;
+#ifdef HAVE___INT128_T
+    high = (uint64_t)(hv >> 64);
+#else
+    high = hv.w2;
+#endif
+
+    return high >> (64 - part_bits);
+}
+
+/* Groups a view by partition, filling in offsets (which needs room
+ * for one more entry than there are partitions). This is one pass to
+ * count, and one pass to copy, so it's cheap next to the sorting that
+ * the workers then do on each partition.
+ */
+static hatrack_set_view_t *
+hatrack_set_scatter(hatrack_set_view_t *view,
+		    uint64_t            num,
+		    uint32_t            part_bits,
+		    uint64_t           *offsets)
+{
+    hatrack_set_view_t *ret;
+    uint64_t           *cursors;
+    uint64_t            num_parts;
+    uint64_t            part;
+    uint64_t            i;
+
+    num_parts = 1ULL << part_bits;
+    ret       = (hatrack_set_view_t *)malloc(sizeof(hatrack_set_view_t) * num);
+    cursors   = (uint64_t *)calloc(num_parts, sizeof(uint64_t));
+
+    for (i = 0; i < num; i++) {
+	cursors[hatrack_set_partition(view[i].hv, part_bits)]++;
     }
 
-    while (j < num2) {
-        if (woolhat_add(&ret->woolhat_instance, view2[j].hv, view2[j].item)
-            && set2->pre_return_hook) {
-            (*set2->pre_return_hook)(set2, view2[j].item);
-        }
-        j++;
+    offsets[0] = 0;
+
+    for (i = 0; i < num_parts; i++) {
+	offsets[i + 1] = offsets[i] + cursors[i];
+	cursors[i]     = offsets[i];
     }
 
-    mmm_end_op();
+    for (i = 0; i < num; i++) {
+	part                 = hatrack_set_partition(view[i].hv, part_bits);
+	ret[cursors[part]++] = view[i];
+    }
 
-    free(view1);
-    free(view2);
+    free(cursors);
 
     return ret;
 }
 
-/* hatrack_set_intersection(A, B)
- *
- * Returns a new set that consists of only the items that exist in
- * both sets at the time of the call (as defined by the epoch).
+/* Adds one item to the result of a set algebra operation. We call the
+ * return hook of the set the item came from first, so that the item
+ * is accounted for before it's reachable from the new set.
  *
- * This does NOT currently preserve insertion ordering the way that
- * hatrack_set_union() does. It could, if we first mark what gets
- * copied and what doesn't, then re-sort based on original epoch.
- *
- * But, meh.
- *
- * The basic algorithm is to sort both views by hash value, then
- * march through them in tandem.
- *
- * If we see two hash values are equal, add the item to the new set
- * and advance to the next item in both sets.
- *
- * Otherwise, the item with the lower hash value definitely is NOT
- * in the intersection (since the items are sorted by hash value).
- * Advance to the next item in that view.
+ * When the result is a woolhat, we also carry over the item's
+ * original sort epoch, so that the result's insertion order is the
+ * order in which its items went into the sets they came from, no
+ * matter which thread happened to copy them, or when.
+ */
+static inline void
+hatrack_set_emit(hatrack_set_t      *result,
+		 hatrack_set_t      *src,
+		 hatrack_set_view_t *item)
+{
+    if (src->pre_return_hook) {
+	(*src->pre_return_hook)(src, item->item);
+    }
+
+    if (result->backend_vtable) {
+	hatrack_set_add_hv(result, item->hv, item->item);
+	return;
+    }
+
+    woolhat_add_ordered(&result->woolhat_instance,
+			item->hv,
+			item->item,
+			item->sort_epoch);
+
+    return;
+}
+
+/* Sorts one partition of each view by hash value, then marches
+ * through the two in tandem. If the hash values at the current
+ * positions are equal, the item is in both sets. Otherwise, the item
+ * with the lower hash value definitely is NOT in the other set (since
+ * the items are sorted), so we deal with it, and advance past it.
  *
- * Once one view ends, there are no more items in the intersection.
+ * Whichever operation we're doing, we only have to decide what to do
+ * with those three cases.
  */
-hatrack_set_t *
-hatrack_set_intersection(hatrack_set_t *set1, hatrack_set_t *set2)
+static void
+hatrack_set_merge_partition(hatrack_set_job_t *job, uint64_t part)
 {
-    hatrack_set_t      *ret;
-    uint64_t            epoch;
-    uint64_t            num1;
-    uint64_t            num2;
     hatrack_set_view_t *view1;
     hatrack_set_view_t *view2;
+    uint64_t            num1;
+    uint64_t            num2;
     uint64_t            i, j;
 
-    if (set1->item_type != set2->item_type) {
-        abort();
-    }
-
-    ret   = hatrack_set_new(set1->item_type);
-    epoch = mmm_start_linearized_op();
-
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+    view1 = job->items1 + job->offsets1[part];
+    view2 = job->items2 + job->offsets2[part];
+    num1  = job->offsets1[part + 1] - job->offsets1[part];
+    num2  = job->offsets2[part + 1] - job->offsets2[part];
 
     qsort(view1, num1, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
     qsort(view2, num2, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
@@ -645,103 +1211,347 @@ hatrack_set_intersection(hatrack_set_t *set1, hatrack_set_t *set2)
     i = 0;
     j = 0;
 
-    while ((i < num1) && (j < num2)) {
-        if (hatrack_hashes_eq(view1[i].hv, view2[j].hv)) {
-            if (set1->pre_return_hook) {
-                (*set1->pre_return_hook)(set1, view1[i].item);
-            }
+    while (i < num1 || j < num2) {
+	// Only in set 1.
+	if (j == num2 || (i < num1 && hatrack_hash_gt(view2[j].hv, view1[i].hv))) {
+	    if (job->op != HATRACK_SET_OP_INTERSECTION) {
+		hatrack_set_emit(job->result, job->set1, &view1[i]);
+	    }
+	    i++;
+	    continue;
+	}
+
+	// Only in set 2.
+	if (i == num1 || hatrack_hash_gt(view1[i].hv, view2[j].hv)) {
+	    if (job->op == HATRACK_SET_OP_UNION
+		|| job->op == HATRACK_SET_OP_DISJUNCTION) {
+		hatrack_set_emit(job->result, job->set2, &view2[j]);
+	    }
+	    j++;
+	    continue;
+	}
+
+	// In both.
+	switch (job->op) {
+	case HATRACK_SET_OP_UNION:
+	    if (view1[i].sort_epoch < view2[j].sort_epoch) {
+		hatrack_set_emit(job->result, job->set1, &view1[i]);
+	    }
+	    else {
+		hatrack_set_emit(job->result, job->set2, &view2[j]);
+	    }
+	    break;
+	case HATRACK_SET_OP_INTERSECTION:
+	    hatrack_set_emit(job->result, job->set1, &view1[i]);
+	    break;
+	default:
+	    break;
+	}
+
+	i++;
+	j++;
+    }
 
-            woolhat_add(&ret->woolhat_instance, view1[i].hv, view1[i].item);
-            i++;
-            j++;
-            continue;
-        }
+    return;
+}
 
-        if (hatrack_hash_gt(view1[i].hv, view2[j].hv)) {
-            j++;
-        }
+static void
+hatrack_set_run_partitions(hatrack_set_job_t *job)
+{
+    uint64_t part;
 
-        else {
-            i++;
-        }
+    while (true) {
+	part = atomic_fetch_add(&job->next_part, 1);
+
+	if (part >= job->num_parts) {
+	    return;
+	}
+
+	hatrack_set_merge_partition(job, part);
     }
+}
 
-    mmm_end_op();
-    free(view1);
-    free(view2);
+static void *
+hatrack_set_worker(void *arg)
+{
+    hatrack_set_job_t *job;
+
+    job = (hatrack_set_job_t *)arg;
+
+    mmm_register_thread();
+    hatrack_set_run_partitions(job);
+    atomic_fetch_add(&job->workers_done, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void
+hatrack_set_job_release(hatrack_set_job_t *job)
+{
+    if (atomic_fetch_sub(&job->refs, 1) == 1) {
+	free(job);
+    }
+
+    return;
+}
+
+/* With a pool, we have no idea when (or if, before we're done) our
+ * helper tasks will get to run. The calling thread grabs partitions
+ * too, so by the time it runs out, the only helpers it needs to wait
+ * for are the ones that are in the middle of merging something.
+ *
+ * So, once the caller is out of partitions, it closes the job, and
+ * waits only for helpers that got in before it closed. A helper
+ * announces itself in 'running' before it checks whether the job is
+ * closed, and the caller closes the job before it checks 'running'.
+ * Both sides are sequentially consistent, so either the caller sees
+ * the helper, or the helper sees the job is closed, and leaves
+ * without touching the partitions.
+ *
+ * Helpers that show up after the caller has returned still need the
+ * job itself to be there, which is why it's reference counted.
+ */
+static void
+hatrack_set_pool_helper(void *arg)
+{
+    hatrack_set_job_t *job;
+
+    job = (hatrack_set_job_t *)arg;
+
+    atomic_fetch_add(&job->running, 1);
+
+    if (!atomic_load(&job->closed)) {
+	hatrack_set_run_partitions(job);
+    }
+
+    atomic_fetch_sub(&job->running, 1);
+    hatrack_set_job_release(job);
+
+    return;
+}
+
+/* The smallest table that can hold num_items without migrating. */
+static char
+hatrack_set_size_log(uint64_t num_items)
+{
+    char ret;
+
+    ret = HATRACK_MIN_SIZE_LOG;
+
+    while (hatrack_compute_table_threshold(1ULL << ret) < num_items) {
+	ret++;
+    }
 
     return ret;
 }
 
-/* hatrack_set_disjunction(A, B)
+/* This is where all four set algebra operations happen.
  *
- * Returns a new set that contains items in set A that did not exist
- * in set B, PLUS the items in set B that did not exist in set A.
+ * First, we take views of both sets at a single epoch, on the calling
+ * thread. That's our linearization point; everything after that just
+ * works off the views. The calling thread stays in its linearized
+ * operation until all the items are in the new set, so that none of
+ * the items we're copying can get freed out from under us, even if
+ * they get removed from the original sets in the meantime.
  *
- * Like intersection, this does not currently preserve intersection
- * order.
+ * Then we split both views into partitions by hash value, and have
+ * num_threads threads (the calling thread, plus num_threads - 1 new
+ * ones) each grab partitions until there are none left, sorting and
+ * merging them independently. We make a few partitions per thread, so
+ * one slow thread (or one unlucky partition) doesn't hold up
+ * everybody else.
  *
- * The algorithm here is to sort by hash value, then go through in
- * tandem. If the item at the current index in one view has a lower
- * hash value than the item in the current index of the other view,
- * then that item is part of the disjunction.
+ * Since we know how many items the result can have, it starts out
+ * big enough to hold them, and the workers never have to stop and
+ * migrate. The workers insert into it concurrently, but they never
+ * contend over a bucket, since no two of them have the same hash
+ * value.
+ *
+ * Before the calling thread can end its operation, it needs all the
+ * workers to be done. But the workers can't exit before the calling
+ * thread ends its operation, at least if they've retired anything
+ * (e.g., if a backend other than woolhat migrated anyway), because
+ * mmm_clean_up_before_exit() waits for retired memory to be freed,
+ * and the calling thread's reservation keeps that from happening. So
+ * the workers tell us they're done separately, before they clean up,
+ * and we wait for that before ending our operation and joining them.
+ *
+ * When we're given a pool, the helpers are pool tasks instead of new
+ * threads; see hatrack_set_pool_helper() for how we wait for them.
  */
-hatrack_set_t *
-hatrack_set_disjunction(hatrack_set_t *set1, hatrack_set_t *set2)
+static hatrack_set_t *
+hatrack_set_algebra(hatrack_set_t   *set1,
+		    hatrack_set_t   *set2,
+		    hatrack_set_op_t op,
+		    uint32_t         num_threads,
+		    hatrack_pool_t  *pool)
 {
     hatrack_set_t      *ret;
+    hatrack_set_job_t  *job;
+    hatrack_set_view_t *view1;
+    hatrack_set_view_t *view2;
+    pthread_t          *threads;
+    uint64_t            offsets1[2];
+    uint64_t            offsets2[2];
     uint64_t            epoch;
     uint64_t            num1;
     uint64_t            num2;
-    hatrack_set_view_t *view1;
-    hatrack_set_view_t *view2;
-    uint64_t            i, j;
+    uint64_t            max_items;
+    uint64_t            num_workers;
+    uint64_t            i;
+    uint32_t            part_bits;
 
     if (set1->item_type != set2->item_type) {
         abort();
     }
 
-    ret   = hatrack_set_new(set1->item_type);
+    // Bitmaps are word-parallel already; threads wouldn't buy much.
+    if (set1->bitset && set2->bitset) {
+	switch (op) {
+	case HATRACK_SET_OP_DIFFERENCE:
+	    return hatrack_set_wrap_bitset(
+		hatrack_bitset_difference(set1->bitset, set2->bitset));
+	case HATRACK_SET_OP_UNION:
+	    return hatrack_set_wrap_bitset(
+		hatrack_bitset_union(set1->bitset, set2->bitset));
+	case HATRACK_SET_OP_INTERSECTION:
+	    return hatrack_set_wrap_bitset(
+		hatrack_bitset_intersection(set1->bitset, set2->bitset));
+	default:
+	    return hatrack_set_wrap_bitset(
+		hatrack_bitset_disjunction(set1->bitset, set2->bitset));
+	}
+    }
+
+    if (!num_threads) {
+	num_threads = 1;
+    }
+
     epoch = mmm_start_linearized_op();
 
-    view1 = woolhat_view_epoch(&set1->woolhat_instance, &num1, epoch);
-    view2 = woolhat_view_epoch(&set2->woolhat_instance, &num2, epoch);
+    view1 = hatrack_set_view_epoch(set1, &num1, epoch);
+    view2 = hatrack_set_view_epoch(set2, &num2, epoch);
 
-    qsort(view1, num1, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
-    qsort(view2, num2, sizeof(hatrack_set_view_t), hatrack_set_hv_sort_cmp);
+    switch (op) {
+    case HATRACK_SET_OP_DIFFERENCE:
+	max_items = num1;
+	break;
+    case HATRACK_SET_OP_INTERSECTION:
+	max_items = num1 < num2 ? num1 : num2;
+	break;
+    default:
+	max_items = num1 + num2;
+	break;
+    }
 
-    i = 0;
-    j = 0;
+    ret = (hatrack_set_t *)malloc(sizeof(hatrack_set_t));
 
-    while ((i < num1) && (j < num2)) {
-        if (hatrack_hashes_eq(view1[i].hv, view2[j].hv)) {
-            i++;
-            j++;
-            continue;
-        }
+    hatrack_set_init_base(ret,
+			  set1->item_type,
+			  set1->backend,
+			  hatrack_set_size_log(max_items));
+
+    job         = (hatrack_set_job_t *)malloc(sizeof(hatrack_set_job_t));
+    job->set1   = set1;
+    job->set2   = set2;
+    job->result = ret;
+    job->op     = op;
+
+    atomic_store(&job->next_part, 0);
+    atomic_store(&job->workers_done, 0);
+    atomic_store(&job->running, 0);
+    atomic_store(&job->closed, false);
+    atomic_store(&job->refs, 1);
+
+    if (num_threads == 1) {
+	part_bits      = 0;
+	job->num_parts = 1;
+	job->items1    = view1;
+	job->items2    = view2;
+	job->offsets1  = offsets1;
+	job->offsets2  = offsets2;
+	offsets1[0]    = 0;
+	offsets1[1]    = num1;
+	offsets2[0]    = 0;
+	offsets2[1]    = num2;
+    }
+    else {
+	part_bits = __builtin_ctzll(hatrack_round_up_to_power_of_2(num_threads))
+	          + HATRACK_SET_PARTS_PER_THREAD_LOG;
+
+	job->num_parts = 1ULL << part_bits;
+	job->offsets1  = (uint64_t *)malloc(sizeof(uint64_t)
+					    * (job->num_parts + 1));
+	job->offsets2  = (uint64_t *)malloc(sizeof(uint64_t)
+					    * (job->num_parts + 1));
+	job->items1    = hatrack_set_scatter(view1,
+					     num1,
+					     part_bits,
+					     job->offsets1);
+	job->items2    = hatrack_set_scatter(view2,
+					     num2,
+					     part_bits,
+					     job->offsets2);
+
+	free(view1);
+	free(view2);
+    }
 
-        if (hatrack_hash_gt(view1[i].hv, view2[j].hv)) {
-            if (set2->pre_return_hook) {
-                (*set2->pre_return_hook)(set2, view2[j].item);
-            }
+    num_workers = 0;
+    threads     = NULL;
 
-            woolhat_add(&ret->woolhat_instance, view2[j].hv, view2[j].item);
-            j++;
-        }
+    if (pool) {
+	atomic_store(&job->refs, num_threads);
 
-        else {
-            if (set1->pre_return_hook) {
-                (*set1->pre_return_hook)(set1, view1[i].item);
-            }
+	for (i = 0; i < num_threads - 1; i++) {
+	    hatrack_pool_submit(pool, hatrack_set_pool_helper, job);
+	}
+    }
+    else if (num_threads > 1) {
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * (num_threads - 1));
+
+	// If we can't get as many threads as we asked for, we just
+	// make do with the ones we got.
+	while (num_workers < num_threads - 1) {
+	    if (pthread_create(&threads[num_workers],
+			       NULL,
+			       hatrack_set_worker,
+			       job)) {
+		break;
+	    }
+	    num_workers++;
+	}
+    }
 
-            woolhat_add(&ret->woolhat_instance, view1[i].hv, view1[i].item);
-            i++;
-        }
+    hatrack_set_run_partitions(job);
+
+    while (atomic_load(&job->workers_done) != num_workers) {
+	sched_yield();
+    }
+
+    atomic_store(&job->closed, true);
+
+    while (atomic_load(&job->running)) {
+	sched_yield();
     }
 
     mmm_end_op();
-    free(view1);
-    free(view2);
+
+    for (i = 0; i < num_workers; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    if (num_threads > 1) {
+	free(job->offsets1);
+	free(job->offsets2);
+    }
+
+    free(threads);
+    free(job->items1);
+    free(job->items2);
+
+    hatrack_set_job_release(job);
 
     return ret;
 }
@@ -813,6 +1623,107 @@ hatrack_set_get_hash_value(hatrack_set_t *self, void *key)
     return hv;
 }
 
+/* Woolhat gives us linearized views at a given epoch. Other backends
+ * just give us their normal view (without the hash value, which we
+ * then recompute), and the epoch is ignored.
+ */
+static hatrack_set_view_t *
+hatrack_set_view_epoch(hatrack_set_t *self, uint64_t *num, uint64_t epoch)
+{
+    hatrack_view_t     *view;
+    hatrack_set_view_t *ret;
+    uint64_t           *items;
+    uint64_t            i;
+
+    if (self->bitset) {
+	items = hatrack_bitset_items(self->bitset, num);
+	ret   = (hatrack_set_view_t *)malloc(sizeof(hatrack_set_view_t) * *num);
+
+	for (i = 0; i < *num; i++) {
+	    ret[i].hv         = hash_int(items[i]);
+	    ret[i].item       = (void *)items[i];
+	    ret[i].sort_epoch = 0;
+	}
+
+	free(items);
+
+	return ret;
+    }
+
+    if (!self->backend_vtable) {
+	return woolhat_view_epoch(&self->woolhat_instance, num, epoch);
+    }
+
+    view = (*self->backend_vtable->view)(self->backend_table, num, false);
+
+    if (!*num) {
+	free(view);
+
+	return NULL;
+    }
+
+    ret = (hatrack_set_view_t *)malloc(sizeof(hatrack_set_view_t) * *num);
+
+    for (i = 0; i < *num; i++) {
+	ret[i].hv         = hatrack_set_get_hash_value(self, view[i].item);
+	ret[i].item       = view[i].item;
+	ret[i].sort_epoch = view[i].sort_epoch;
+    }
+
+    free(view);
+
+    return ret;
+}
+
+/* Puts a set-level wrapper around the result of bitset algebra. */
+static hatrack_set_t *
+hatrack_set_wrap_bitset(hatrack_bitset_t *bitset)
+{
+    hatrack_set_t *ret;
+
+    ret = (hatrack_set_t *)malloc(sizeof(hatrack_set_t));
+
+    hatrack_set_init_from_bitset(ret, bitset);
+
+    return ret;
+}
+
+static bool
+hatrack_set_add_hv(hatrack_set_t *self, hatrack_hash_t hv, void *item)
+{
+    if (self->backend_vtable) {
+	return (*self->backend_vtable->add)(self->backend_table, hv, item);
+    }
+
+    return woolhat_add(&self->woolhat_instance, hv, item);
+}
+
+static void
+hatrack_set_defer_eject(hatrack_set_t *self, void *item)
+{
+    void **cell;
+
+    if (!self->free_handler) {
+	return;
+    }
+
+    cell  = (void **)mmm_alloc_committed(sizeof(void *));
+    *cell = item;
+
+    mmm_add_cleanup_handler(cell, (mmm_cleanup_func)hatrack_set_cell_eject, self);
+    mmm_retire(cell);
+
+    return;
+}
+
+static void
+hatrack_set_cell_eject(void **cell, hatrack_set_t *set)
+{
+    (*set->free_handler)(set, *cell);
+
+    return;
+}
+
 static void
 hatrack_set_record_eject(woolhat_record_t *record, hatrack_set_t *set)
 {
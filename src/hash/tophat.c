@@ -33,6 +33,14 @@
 // clang-format off
 static void             tophat_init_base     (tophat_t *, char);
 static void		tophat_st_migrate    (tophat_st_ctx_t *);
+static tophat_st_ctx_t *tophat_st_new        (uint64_t);
+static void             tophat_st_load       (tophat_st_ctx_t *, hatrack_hash_t,
+					      void *, uint64_t);
+static void            *tophat_enter_write   (tophat_t *, tophat_writers_t **);
+static void             tophat_exit_mt_write (tophat_t *, tophat_writers_t *);
+static void             tophat_upgrade       (tophat_t *);
+static void             tophat_downgrade     (tophat_t *);
+static void             tophat_mt_retire     (tophat_t *, void *);
 
 // The migration algorithms can be selected dynamically, but
 // at the time of initialization of the tophat_t object.
@@ -40,6 +48,16 @@ static void *tophat_migrate_to_newshat (tophat_t *);
 static void *tophat_migrate_to_ballcap (tophat_t *);
 static void *tophat_migrate_to_witchhat(tophat_t *);
 static void *tophat_migrate_to_woolhat (tophat_t *);
+static void *tophat_migrate_to_hihat   (tophat_t *);
+static void *tophat_migrate_to_crown   (tophat_t *);
+
+// And these take us back to the single-threaded table.
+static tophat_st_ctx_t *tophat_migrate_from_newshat (newshat_t *);
+static tophat_st_ctx_t *tophat_migrate_from_ballcap (ballcap_t *);
+static tophat_st_ctx_t *tophat_migrate_from_witchhat(witchhat_t *);
+static tophat_st_ctx_t *tophat_migrate_from_woolhat (woolhat_t *);
+static tophat_st_ctx_t *tophat_migrate_from_hihat   (hihat_t *);
+static tophat_st_ctx_t *tophat_migrate_from_crown   (crown_t *);
 
 /* These are meant to be "friend" methods; private to others, but we
  * need access to them. So they're not in the .h files, just re-declared
@@ -48,12 +66,14 @@ static void *tophat_migrate_to_woolhat (tophat_t *);
  * We simply dispatch to the right migration method based on the
  * dst_type field, set at initialization time.
  *
- * We also use witchhat_store_new(), but dict.c uses a bunch of the
- * witchhat_store functions as well, so they got lifted to witchhat.h.
+ * We also use witchhat_store_new() and crown_store_new(), but other
+ * modules use those store functions as well, so they got lifted to
+ * the public headers.
  */
 extern newshat_store_t  *newshat_store_new (uint64_t);
 extern ballcap_store_t  *ballcap_store_new (uint64_t);
 extern woolhat_store_t  *woolhat_store_new (uint64_t);
+extern hihat_store_t    *hihat_store_new   (uint64_t);
 
 static inline void *
 tophat_migrate(tophat_t *self)
@@ -67,11 +87,47 @@ tophat_migrate(tophat_t *self)
 	return tophat_migrate_to_ballcap(self);
     case TOPHAT_T_CONSISTENT_WAIT_FREE:
 	return tophat_migrate_to_woolhat(self);
+    case TOPHAT_T_FAST_LOCK_FREE:
+	return tophat_migrate_to_hihat(self);
+    case TOPHAT_T_FAST_HOPSCOTCH:
+	return tophat_migrate_to_crown(self);
     default:
 	__builtin_unreachable();
     }
 }    
 
+static inline tophat_st_ctx_t *
+tophat_migrate_back(tophat_t *self, void *mt_table)
+{
+    switch (self->dst_type) {
+    case TOPHAT_T_FAST_LOCKING:
+	return tophat_migrate_from_newshat((newshat_t *)mt_table);
+    case TOPHAT_T_FAST_WAIT_FREE:
+	return tophat_migrate_from_witchhat((witchhat_t *)mt_table);
+    case TOPHAT_T_CONSISTENT_LOCKING:
+	return tophat_migrate_from_ballcap((ballcap_t *)mt_table);
+    case TOPHAT_T_CONSISTENT_WAIT_FREE:
+	return tophat_migrate_from_woolhat((woolhat_t *)mt_table);
+    case TOPHAT_T_FAST_LOCK_FREE:
+	return tophat_migrate_from_hihat((hihat_t *)mt_table);
+    case TOPHAT_T_FAST_HOPSCOTCH:
+	return tophat_migrate_from_crown((crown_t *)mt_table);
+    default:
+	__builtin_unreachable();
+    }
+}
+
+/* How often (in writes, per thread) a writer in the multi-threaded
+ * table checks whether it has been the only writer for the quiet
+ * period, and how many stripes we count in-flight multi-threaded
+ * writers across (see tophat_writers_t in tophat.h). Both need to be
+ * powers of two.
+ */
+#define TOPHAT_QUIET_CHECK_INTERVAL 64
+#define TOPHAT_WRITER_STRIPES       8
+
+static __thread uint64_t tophat_mt_write_count = 0;
+
 tophat_t *
 tophat_new_fast_mx(void)
 {
@@ -168,24 +224,83 @@ tophat_new_cst_wf_size(char size)
     return ret;
 }
 
+tophat_t *
+tophat_new_fast_lf(void)
+{
+    tophat_t *ret;
+
+    ret = (tophat_t *)malloc(sizeof(tophat_t));
+
+    tophat_init_fast_lf(ret);
+
+    return ret;
+}
+
+tophat_t *
+tophat_new_fast_hs(void)
+{
+    tophat_t *ret;
+
+    ret = (tophat_t *)malloc(sizeof(tophat_t));
+
+    tophat_init_fast_hs(ret);
+
+    return ret;
+}
+
+tophat_t *
+tophat_new_fast_lf_size(char size)
+{
+    tophat_t *ret;
+
+    ret = (tophat_t *)malloc(sizeof(tophat_t));
+
+    tophat_init_fast_lf_size(ret, size);
+
+    return ret;
+}
+
+tophat_t *
+tophat_new_fast_hs_size(char size)
+{
+    tophat_t *ret;
+
+    ret = (tophat_t *)malloc(sizeof(tophat_t));
+
+    tophat_init_fast_hs_size(ret, size);
+
+    return ret;
+}
+
 /* If we've migrated to a multi-threaded table, then the
  * single-threaded implementation is already cleaned up, except for
  * deallocating the mutex.
  * 
  * Similarly, if we never migrate, then there's nothing there to clean
  * up.
+ *
+ * The multi-threaded table gets allocated via mmm (so that migrating
+ * back can retire it safely), so we don't use the vtable's delete
+ * function on it; tophat_mt_retire() handles it.
  */
 void
 tophat_cleanup(tophat_t *self)
 {
-    if (atomic_load(&self->mt_table)) {
-	(*self->mt_vtable.delete)(self->mt_table);
+    void            *mt_table;
+    tophat_st_ctx_t *ctx;
+
+    mt_table = atomic_load(&self->mt_table);
+    
+    if (mt_table) {
+	tophat_mt_retire(self, mt_table);
     }
     else {
-	mmm_retire(self->st_table->buckets);
-	mmm_retire(self->st_table);
+	ctx = atomic_load(&self->st_table);
+	mmm_retire(ctx->buckets);
+	mmm_retire(ctx);
     }
-    
+
+    free(self->mt_writers);
     pthread_mutex_destroy(&self->mutex);
 
     return;
@@ -237,6 +352,22 @@ tophat_init_cst_wf(tophat_t *self)
     return;
 }
 
+void
+tophat_init_fast_lf(tophat_t *self)
+{
+    tophat_init_fast_lf_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+void
+tophat_init_fast_hs(tophat_t *self)
+{
+    tophat_init_fast_hs_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
 void
 tophat_init_fast_mx_size(tophat_t *self, char size)
 {
@@ -313,9 +444,81 @@ tophat_init_cst_wf_size(tophat_t *self, char size)
     return;
 }
 
+void
+tophat_init_fast_lf_size(tophat_t *self, char size)
+{
+    tophat_init_base(self, size);
+    
+    self->dst_type          = TOPHAT_T_FAST_LOCK_FREE;
+    self->mt_vtable.init    = (hatrack_init_func)hihat_init;
+    self->mt_vtable.get     = (hatrack_get_func)hihat_get;
+    self->mt_vtable.put     = (hatrack_put_func)hihat_put;
+    self->mt_vtable.replace = (hatrack_replace_func)hihat_replace;    
+    self->mt_vtable.add     = (hatrack_add_func)hihat_add;
+    self->mt_vtable.remove  = (hatrack_remove_func)hihat_remove;
+    self->mt_vtable.delete  = (hatrack_delete_func)hihat_delete;
+    self->mt_vtable.len     = (hatrack_len_func)hihat_len;
+    self->mt_vtable.view    = (hatrack_view_func)hihat_view;
+
+    return;
+}
+
+void
+tophat_init_fast_hs_size(tophat_t *self, char size)
+{
+    tophat_init_base(self, size);
+    
+    self->dst_type          = TOPHAT_T_FAST_HOPSCOTCH;
+    self->mt_vtable.init    = (hatrack_init_func)crown_init;
+    self->mt_vtable.get     = (hatrack_get_func)crown_get;
+    self->mt_vtable.put     = (hatrack_put_func)crown_put;
+    self->mt_vtable.replace = (hatrack_replace_func)crown_replace;    
+    self->mt_vtable.add     = (hatrack_add_func)crown_add;
+    self->mt_vtable.remove  = (hatrack_remove_func)crown_remove;
+    self->mt_vtable.delete  = (hatrack_delete_func)crown_delete;
+    self->mt_vtable.len     = (hatrack_len_func)crown_len;
+    self->mt_vtable.view    = (hatrack_view_func)crown_view;
+
+    return;
+}
+
+/* The threshold is the number of writes, out of a window of
+ * HATRACK_TOPHAT_CONTENTION_WINDOW, that need to have waited on the
+ * mutex before we migrate. 0 is treated as 1.
+ *
+ * These are meant to be called right after initialization, before
+ * the table is shared.
+ */
+void
+tophat_set_contention_threshold(tophat_t *self, uint64_t threshold)
+{
+    if (!threshold) {
+	threshold = 1;
+    }
+    
+    self->contention_threshold = threshold;
+
+    return;
+}
+
+void
+tophat_set_quiet_period(tophat_t *self, uint64_t ms)
+{
+    self->quiet_ns = ms * 1000000;
+
+    return;
+}
+
+bool
+tophat_is_multi_threaded(tophat_t *self)
+{
+    return atomic_load(&self->mt_table) != NULL;
+}
+
 void *
 tophat_get(tophat_t *self, hatrack_hash_t hv, bool *found) {
     void               *mt_table;
+    void               *ret;
     uint64_t            bix, i;
     tophat_st_ctx_t    *ctx;
     tophat_st_bucket_t *cur;
@@ -349,11 +552,16 @@ tophat_get(tophat_t *self, hatrack_hash_t hv, bool *found) {
     mmm_start_basic_op();
 
     mt_table = atomic_read(&self->mt_table);
-    
+
+    /* Since we can migrate back to the single-threaded table, the
+     * multi-threaded table can get retired out from under us too, so
+     * we keep our reservation until the call returns.
+     */
     if (mt_table) {
+	ret = (*self->mt_vtable.get)(mt_table, hv, found);
 	mmm_end_op();
 	
-	return (*self->mt_vtable.get)(mt_table, hv, found);
+	return ret;
     }
 
     /* Note that the call to mmm_start_basic_op() guaranteed that, if
@@ -362,9 +570,10 @@ tophat_get(tophat_t *self, hatrack_hash_t hv, bool *found) {
      * thread until AFTER it sets mt_table. So if we read that NULL,
      * then we know a concurrent write thread will respect our
      * reservation, and not free the single threaded table out from
-     * under us.
+     * under us. That goes for whichever st_table we see, including
+     * a new one installed by migrating back.
      */
-    ctx = self->st_table;
+    ctx = atomic_load(&self->st_table);
 
     /* From this point down, the implementation is basically the same
      * as in refhat, except for the calls to mmm_end_op(), and the
@@ -417,6 +626,7 @@ tophat_get(tophat_t *self, hatrack_hash_t hv, bool *found) {
 void *
 tophat_put(tophat_t *self, hatrack_hash_t hv, void *item, bool *found) {
     void               *mt_table;
+    tophat_writers_t   *writers;
     tophat_st_ctx_t    *ctx;
     uint64_t            bix;
     uint64_t            i;
@@ -434,6 +644,11 @@ tophat_put(tophat_t *self, hatrack_hash_t hv, void *item, bool *found) {
      *
      * Of course, it could end up initialized while we're waiting on
      * the lock, so we need to check again once the lock is acquired.
+     * All of that lives in tophat_enter_write(), which either hands
+     * us the multi-threaded table to use, or returns NULL with the
+     * lock held. It's also where we decide whether there's enough
+     * contention to migrate, and tophat_exit_mt_write() is where we
+     * decide whether things have been quiet enough to migrate back.
      *
      * As with the read operation above, there's really no reason for
      * this extra complexity if the language is willing to perform
@@ -441,42 +656,19 @@ tophat_put(tophat_t *self, hatrack_hash_t hv, void *item, bool *found) {
      * process, making all of this overhead go away (even though it's
      * already exceptionally small).
      */
-    mt_table = atomic_load(&self->mt_table);
+    mt_table = tophat_enter_write(self, &writers);
 
     if (mt_table) {
-	return (*self->mt_vtable.put)(mt_table, hv, item, found);
+	ret = (*self->mt_vtable.put)(mt_table, hv, item, found);
+	tophat_exit_mt_write(self, writers);
+
+	return ret;
     }
 
-    if (pthread_mutex_trylock(&self->mutex)) {
-	/* If we get here, we found someone else had the write-lock.
-	 * Once they're done, we'll first see if someone else
-	 * completed the migration, by trying to read mt_table (any
-	 * thread that came before us and noticed a migration was
-	 * necessary will have set it, before releasing the lock).  If
-	 * not, we'll do a migration, and then retry in the new table.
-	 */
-	if (pthread_mutex_lock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_read(&self->mt_table);
-	
-	if (!mt_table) {
-	    mt_table = tophat_migrate(self);
-	}
-	
-	if (pthread_mutex_unlock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_load(&self->mt_table);
-	
-	return (*self->mt_vtable.put)(mt_table, hv, item, found);
-    } 
-    /* Here we successfully acquired the lock, so we didn't detect
-     * multiple concurrent writers, so we can proceed with our write
-     * without any worries; no migration to a different table type can
-     * begin until after we yield the lock.
+    /* Here we hold the lock, and haven't seen enough contention to
+     * migrate, so we can proceed with our write without any worries;
+     * no migration to a different table type can begin until after
+     * we yield the lock.
      *
      * This is semantically identical to refhat, except for the calls
      * to pthread_mutex_unlock(), and the differtent data structure
@@ -565,6 +757,7 @@ void *
 tophat_replace(tophat_t *self, hatrack_hash_t hv, void *item, bool *found)
 {
     void               *mt_table;
+    tophat_writers_t   *writers;
     tophat_st_ctx_t    *ctx;
     uint64_t            bix;
     uint64_t            i;
@@ -572,30 +765,13 @@ tophat_replace(tophat_t *self, hatrack_hash_t hv, void *item, bool *found)
     tophat_st_record_t  record;
     void               *ret;
 
-    mt_table = atomic_load(&self->mt_table);
+    mt_table = tophat_enter_write(self, &writers);
 
     if (mt_table) {
-	return (*self->mt_vtable.replace)(mt_table, hv, item, found);
-    }
+	ret = (*self->mt_vtable.replace)(mt_table, hv, item, found);
+	tophat_exit_mt_write(self, writers);
 
-    if (pthread_mutex_trylock(&self->mutex)) {
-	if (pthread_mutex_lock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_read(&self->mt_table);
-	
-	if (!mt_table) {
-	    mt_table = tophat_migrate(self);
-	}
-	
-	if (pthread_mutex_unlock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_load(&self->mt_table);
-	
-	return (*self->mt_vtable.replace)(mt_table, hv, item, found);
+	return ret;
     }
 
     ctx = self->st_table;
@@ -650,37 +826,22 @@ bool
 tophat_add(tophat_t *self, hatrack_hash_t hv, void *item)
 {
     void               *mt_table;
+    tophat_writers_t   *writers;
     tophat_st_ctx_t    *ctx;
     uint64_t            bix;
     uint64_t            i;
     tophat_st_bucket_t *cur;
     tophat_st_record_t  record;
+    bool                ret;
     
 
-    mt_table = atomic_load(&self->mt_table);
+    mt_table = tophat_enter_write(self, &writers);
 
     if (mt_table) {
-	return (*self->mt_vtable.add)(mt_table, hv, item);
-    }
+	ret = (*self->mt_vtable.add)(mt_table, hv, item);
+	tophat_exit_mt_write(self, writers);
 
-    if (pthread_mutex_trylock(&self->mutex)) {
-	if (pthread_mutex_lock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_read(&self->mt_table);
-	
-	if (!mt_table) {
-	    mt_table = tophat_migrate(self);
-	}
-	
-	if (pthread_mutex_unlock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_load(&self->mt_table);
-	
-	return (*self->mt_vtable.add)(mt_table, hv, item);
+	return ret;
     }
 
     ctx = self->st_table;
@@ -750,6 +911,7 @@ void *
 tophat_remove(tophat_t *self, hatrack_hash_t hv, bool *found)
 {
     void               *mt_table;
+    tophat_writers_t   *writers;
     tophat_st_ctx_t    *ctx;
     uint64_t            bix;
     uint64_t            i;
@@ -758,30 +920,13 @@ tophat_remove(tophat_t *self, hatrack_hash_t hv, bool *found)
     void               *ret;
     
 
-    mt_table = atomic_load(&self->mt_table);
+    mt_table = tophat_enter_write(self, &writers);
 
     if (mt_table) {
-	return (*self->mt_vtable.remove)(mt_table, hv, found);
-    }
+	ret = (*self->mt_vtable.remove)(mt_table, hv, found);
+	tophat_exit_mt_write(self, writers);
 
-    if (pthread_mutex_trylock(&self->mutex)) {
-	if (pthread_mutex_lock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_read(&self->mt_table);
-	
-	if (!mt_table) {
-	    mt_table = tophat_migrate(self);
-	}
-	
-	if (pthread_mutex_unlock(&self->mutex)) {
-	    abort();
-	}
-	
-	mt_table = atomic_load(&self->mt_table);
-	
-	return (*self->mt_vtable.remove)(mt_table, hv, found);
+	return ret;
     }
 
     ctx = self->st_table;
@@ -860,12 +1005,13 @@ tophat_len(tophat_t *self)
     mt_table = atomic_load(&self->mt_table);
     
     if (mt_table) {
+	ret = (*self->mt_vtable.len)(mt_table);
 	mmm_end_op();
 	
-	return (*self->mt_vtable.len)(mt_table);	    
+	return ret;
     }
     
-    ret = self->st_table->item_count;
+    ret = atomic_load(&self->st_table)->item_count;
     mmm_end_op();
     
     return ret;
@@ -899,12 +1045,13 @@ tophat_view(tophat_t *self, uint64_t *num, bool sort)
     mt_table = atomic_load(&self->mt_table);
     
     if (mt_table) {
+	view = (*self->mt_vtable.view)(mt_table, num, sort);
 	mmm_end_op();
 	
-	return (*self->mt_vtable.view)(mt_table, num, sort);
+	return view;
     }
     
-    ctx = self->st_table;
+    ctx = atomic_load(&self->st_table);
 
     /* Allow for concurrent writes by resizing down.  Upper
      * bound for buckets needed is the table size.
@@ -955,10 +1102,6 @@ tophat_view(tophat_t *self, uint64_t *num, bool sort)
 static void
 tophat_init_base(tophat_t *self, char size)
 {
-    uint64_t            table_len;
-    uint64_t            alloc_len;
-    tophat_st_ctx_t    *table;
-
     if (size > (ssize_t)(sizeof(intptr_t) * 8)) {
 	abort();
     }
@@ -967,104 +1110,493 @@ tophat_init_base(tophat_t *self, char size)
 	abort();
     }
 
-    table_len         = 1 << size;
-    alloc_len         = sizeof(tophat_st_ctx_t);
-    table             = (tophat_st_ctx_t *)mmm_alloc_committed(alloc_len);
-    self->st_table    = table;
-    self->mt_table    = NULL;
-    alloc_len         = sizeof(tophat_st_bucket_t) * table_len;
-    table->last_slot  = table_len - 1;
-    table->threshold  = hatrack_compute_table_threshold(table_len);
-    table->next_epoch = 1; // 0 is reserved for deleted.
-    table->buckets    = (tophat_st_bucket_t *)mmm_alloc_committed(alloc_len);
+    atomic_store(&self->st_table, tophat_st_new(1 << size));
+    atomic_store(&self->mt_table, NULL);
+    atomic_store(&self->draining, false);
+    atomic_store(&self->mt_writer, 0);
+    atomic_store(&self->mt_solo_start, 0);
+    
+    self->st_writes            = 0;
+    self->contended            = 0;
+    self->contention_threshold = HATRACK_TOPHAT_CONTENTION_THRESHOLD;
+    self->quiet_ns             = HATRACK_TOPHAT_QUIET_PERIOD_MS * 1000000ULL;
+    self->mt_writers           = NULL;
 
     pthread_mutex_init(&self->mutex, NULL);
 
     return;
 }
 
-/* This migration function is the one used by single-threaded
- * instances to migrate stores when we're staying single-threaded.
- *
- * Per above, it's identical to refhat's implementation, except for
- * the atomic reading / writing of the item/epoch, and the slightly
- * different data structure layout that results.
+static tophat_st_ctx_t *
+tophat_st_new(uint64_t table_len)
+{
+    tophat_st_ctx_t *ctx;
+    uint64_t         alloc_len;
+
+    alloc_len       = sizeof(tophat_st_ctx_t);
+    ctx             = (tophat_st_ctx_t *)mmm_alloc_committed(alloc_len);
+    alloc_len       = sizeof(tophat_st_bucket_t) * table_len;
+    ctx->last_slot  = table_len - 1;
+    ctx->threshold  = hatrack_compute_table_threshold(table_len);
+    ctx->next_epoch = 1; // 0 is reserved for deleted.
+    ctx->buckets    = (tophat_st_bucket_t *)mmm_alloc_committed(alloc_len);
+
+    return ctx;
+}
+
+/* Used when migrating back from a multi-threaded table, to drop an
+ * item into a freshly allocated single-threaded table. We know the
+ * item isn't already there, and that the table is big enough, since
+ * it's the same size as the store we're copying out of.
  */
 static void
-tophat_st_migrate(tophat_st_ctx_t *ctx)
+tophat_st_load(tophat_st_ctx_t *ctx,
+	       hatrack_hash_t   hv,
+	       void            *item,
+	       uint64_t         epoch)
 {
-    tophat_st_bucket_t *new_buckets;
-    tophat_st_bucket_t *cur_bucket;
-    tophat_st_bucket_t *new_bucket;
+    tophat_st_bucket_t *bucket;
     tophat_st_record_t  record;
-    uint64_t            bucket_size;
-    uint64_t            num_buckets;
-    uint64_t            new_last_slot;
-    uint64_t            size;
-    uint64_t            i, n, bix;
-
-    bucket_size   = sizeof(tophat_st_bucket_t);
-    num_buckets   = hatrack_new_size(ctx->last_slot, ctx->item_count + 1);
-    new_last_slot = num_buckets - 1;
-    size          = num_buckets * bucket_size;
-    new_buckets   = (tophat_st_bucket_t *)mmm_alloc_committed(size);
-
-    for (n = 0; n <= ctx->last_slot; n++) {
-        cur_bucket = &ctx->buckets[n];
-
-        if (hatrack_bucket_unreserved(cur_bucket->hv)) {
-            continue;
-        }
+    uint64_t            bix;
 
-        record = atomic_read(&cur_bucket->record);
+    bix = hatrack_bucket_index(hv, ctx->last_slot);
 
-        if (!record.epoch) {
-            continue;
-        }
+    while (true) {
+	bucket = &ctx->buckets[bix];
 
-        bix = hatrack_bucket_index(cur_bucket->hv, new_last_slot);
+	if (hatrack_bucket_unreserved(bucket->hv)) {
+	    break;
+	}
 	
-        for (i = 0; i < num_buckets; i++) {
-            new_bucket = &new_buckets[bix];
-	    
-            if (hatrack_bucket_unreserved(new_bucket->hv)) {
-                new_bucket->hv     = cur_bucket->hv;
-                new_bucket->record = record;
-                break;
-            }
-	    
-            bix = (bix + 1) & new_last_slot;
-        }
+	bix = (bix + 1) & ctx->last_slot;
     }
+
+    record.item  = item;
+    record.epoch = epoch;
+    bucket->hv   = hv;
     
-    mmm_retire(ctx->buckets);
+    atomic_store(&bucket->record, record);
+    
+    ctx->used_count++;
+    ctx->item_count++;
 
-    ctx->used_count = ctx->item_count;
-    ctx->buckets    = new_buckets;
-    ctx->last_slot  = new_last_slot;
-    ctx->threshold  = hatrack_compute_table_threshold(num_buckets);
+    if (epoch >= ctx->next_epoch) {
+	ctx->next_epoch = epoch + 1;
+    }
 
     return;
 }
 
-/* Remember that we already have a lock at this point. So the
- * migration is fairly straightforward, and will look not unlike the
- * newshat->newshat migration.
+/* Every write operation starts here. If we're running
+ * multi-threaded, we return the multi-threaded table, having
+ * registered ourselves as an in-flight writer in *writers; the caller
+ * must call tophat_exit_mt_write() once its operation on that table
+ * is done.
+ *
+ * Otherwise, we return NULL, holding the mutex, and the caller does
+ * its write in the single-threaded table.
+ *
+ * In the single-threaded case, this is also where we measure
+ * contention. If our trylock fails, someone else is writing at the
+ * same time, and we count it. But we only migrate once we've seen
+ * contention_threshold such writes within a window of
+ * HATRACK_TOPHAT_CONTENTION_WINDOW writes. An occasional collision
+ * (say, a second thread that does a bit of setup and goes away)
+ * isn't worth leaving the single-threaded table for.
+ *
+ * Note that registering as an in-flight writer is a fetch-and-add,
+ * which is a full barrier. So if we see draining as false after
+ * we've registered, tophat_downgrade() is guaranteed to see our
+ * registration, and will wait for us to leave.
  */
 static void *
-tophat_migrate_to_newshat(tophat_t *self)
+tophat_enter_write(tophat_t *self, tophat_writers_t **writers)
 {
-    tophat_st_ctx_t    *ctx;        // essentially, the current table.
-    newshat_t          *new_table;
-    tophat_st_bucket_t *cur_bucket; // pointer to the st bucket
-    newshat_bucket_t   *new_bucket; // pointer to the newshat bucket
-    tophat_st_record_t  cur_record;
-    newshat_record_t    new_record;
-    uint64_t            n, i, bix;
-    
+    void             *mt_table;
+    tophat_writers_t *stripe;
 
-    ctx                      = self->st_table;
-    new_table                = (newshat_t *)malloc(sizeof(newshat_t));
+    while (true) {
+	mt_table = atomic_load(&self->mt_table);
+
+	if (mt_table) {
+	    /* The stripes are allocated before mt_table first gets set,
+	     * and live until the tophat is cleaned up. We make sure
+	     * we're registered with mmm before picking our stripe, so
+	     * that our thread id can't change before we leave.
+	     */
+	    pthread_once(&mmm_inited, mmm_register_thread);
+	    
+	    stripe = &self->mt_writers[mmm_mytid
+				       & (TOPHAT_WRITER_STRIPES - 1)];
+	    
+	    atomic_fetch_add(&stripe->n, 1);
+
+	    mt_table = atomic_load(&self->mt_table);
+	    
+	    if (mt_table && !atomic_load(&self->draining)) {
+		*writers = stripe;
+		
+		return mt_table;
+	    }
+
+	    atomic_fetch_sub(&stripe->n, 1);
+	}
+
+	if (pthread_mutex_trylock(&self->mutex)) {
+	    if (pthread_mutex_lock(&self->mutex)) {
+		abort();
+	    }
+	    
+	    self->contended++;
+	}
+
+	/* Someone else may have migrated while we were waiting on the
+	 * lock; if so, go back around, and use their table.
+	 */
+	if (atomic_load(&self->mt_table)) {
+	    if (pthread_mutex_unlock(&self->mutex)) {
+		abort();
+	    }
+	    
+	    continue;
+	}
+
+	if (self->contended >= self->contention_threshold) {
+	    tophat_upgrade(self);
+	    
+	    if (pthread_mutex_unlock(&self->mutex)) {
+		abort();
+	    }
+	    
+	    continue;
+	}
+
+	if (++self->st_writes == HATRACK_TOPHAT_CONTENTION_WINDOW) {
+	    self->st_writes = 0;
+	    self->contended = 0;
+	}
+	
+	return NULL;
+    }
+}
+
+static inline uint64_t
+tophat_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Once a write to the multi-threaded table is done, we leave, and
+ * then, every TOPHAT_QUIET_CHECK_INTERVAL writes, check to see if we
+ * should migrate back.
+ *
+ * The idea is that, if the same thread is the only writer we've
+ * sampled for the whole quiet period, then we're back to being a
+ * single-writer table, and can go back to the cheaper
+ * implementation. Whenever we sample a different writer, the clock
+ * starts over.
+ *
+ * Sampling means we might miss a writer that writes rarely. That's
+ * fine; if we migrate back too eagerly, the contention counting will
+ * bring us back to the multi-threaded table if it's warranted.
+ */
+static void
+tophat_exit_mt_write(tophat_t *self, tophat_writers_t *writers)
+{
+    uint64_t me;
+    uint64_t now;
+
+    atomic_fetch_sub(&writers->n, 1);
+
+    if (!self->quiet_ns) {
+	return;
+    }
+
+    if (++tophat_mt_write_count & (TOPHAT_QUIET_CHECK_INTERVAL - 1)) {
+	return;
+    }
+
+    me  = mmm_mytid + 1;
+    now = tophat_now();
+    
+    if (atomic_load(&self->mt_writer) != me) {
+	atomic_store(&self->mt_writer, me);
+	atomic_store(&self->mt_solo_start, now);
+	
+	return;
+    }
+
+    if (now - atomic_load(&self->mt_solo_start) < self->quiet_ns) {
+	return;
+    }
+
+    tophat_downgrade(self);
+
+    return;
+}
+
+/* Called with the mutex held. The migration functions handle
+ * retiring the single-threaded table; we just need to make sure the
+ * writer stripes exist before the world can see the multi-threaded
+ * table, and reset our bookkeeping.
+ */
+static void
+tophat_upgrade(tophat_t *self)
+{
+    if (!self->mt_writers) {
+	self->mt_writers = (tophat_writers_t *)
+	    calloc(TOPHAT_WRITER_STRIPES, sizeof(tophat_writers_t));
+    }
+
+    self->st_writes = 0;
+    self->contended = 0;
+    
+    atomic_store(&self->mt_writer, 0);
+    
+    tophat_migrate(self);
+
+    return;
+}
+
+/* Migrating back to the single-threaded table.
+ *
+ * If we can't get the lock, someone else is either already doing
+ * this, or is waiting to do a single-threaded write, so we just move
+ * on; if things stay quiet, we'll get another chance.
+ *
+ * Once we have the lock, we set draining, which sends new writers to
+ * the mutex (where they'll wait for us), and then wait for the
+ * writers that were already in the multi-threaded table to leave. At
+ * that point, the multi-threaded table can't change, so we copy it
+ * into a new single-threaded table, install that, and only then
+ * unset mt_table.
+ *
+ * Readers may still be in the multi-threaded table (it's read-only
+ * now, so that's fine), which is why we retire it through mmm, just
+ * as the upgrade does with the single-threaded table. Writers waiting
+ * on the mutex hold no reservations on our behalf, so there's no
+ * chance of us waiting on each other.
+ */
+static void
+tophat_downgrade(tophat_t *self)
+{
+    void            *mt_table;
+    tophat_st_ctx_t *ctx;
+    uint64_t         i;
+
+    if (pthread_mutex_trylock(&self->mutex)) {
+	return;
+    }
+
+    mt_table = atomic_load(&self->mt_table);
+
+    if (!mt_table) {
+	if (pthread_mutex_unlock(&self->mutex)) {
+	    abort();
+	}
+	
+	return;
+    }
+
+    atomic_store(&self->draining, true);
+
+    for (i = 0; i < TOPHAT_WRITER_STRIPES; i++) {
+	while (atomic_load(&self->mt_writers[i].n)) {
+	    sched_yield();
+	}
+    }
+
+    ctx = tophat_migrate_back(self, mt_table);
+
+    atomic_store(&self->st_table, ctx);
+    atomic_store(&self->mt_table, NULL);
+    atomic_store(&self->draining, false);
+
+    tophat_mt_retire(self, mt_table);
+
+    self->st_writes = 0;
+    self->contended = 0;
+    
+    if (pthread_mutex_unlock(&self->mutex)) {
+	abort();
+    }
+
+    return;
+}
+
+/* Retire a multi-threaded table that nobody can find anymore (though
+ * readers might still be in it). We can't use the tables' own
+ * cleanup functions here, since the ones that keep per-item records
+ * use mmm_retire_unused() on them, assuming nobody else can be
+ * looking.
+ *
+ * For ballcap and woolhat, superseded records have already been
+ * retired when they were replaced, so we only need the ones at the
+ * head of each bucket.
+ */
+static void
+tophat_mt_retire(tophat_t *self, void *mt_table)
+{
+    newshat_t         *newshat;
+    witchhat_t        *witchhat;
+    ballcap_t         *ballcap;
+    ballcap_store_t   *bstore;
+    woolhat_t         *woolhat;
+    woolhat_store_t   *wstore;
+    woolhat_state_t    state;
+    hihat_t           *hihat;
+    crown_t           *crown;
+    uint64_t           i;
+
+    switch (self->dst_type) {
+    case TOPHAT_T_FAST_LOCKING:
+	newshat = (newshat_t *)mt_table;
+	mmm_retire(newshat->store_current);
+	pthread_mutex_destroy(&newshat->migrate_mutex);
+	break;
+	
+    case TOPHAT_T_FAST_WAIT_FREE:
+	witchhat = (witchhat_t *)mt_table;
+	mmm_retire(atomic_load(&witchhat->store_current));
+	hatrack_retired_release(atomic_load(&witchhat->retired));
+	break;
+	
+    case TOPHAT_T_CONSISTENT_LOCKING:
+	ballcap = (ballcap_t *)mt_table;
+	bstore  = ballcap->store_current;
+	
+	for (i = 0; i <= bstore->last_slot; i++) {
+	    if (bstore->buckets[i].record) {
+		mmm_retire(bstore->buckets[i].record);
+	    }
+	}
+	
+	mmm_retire(bstore);
+	pthread_mutex_destroy(&ballcap->migrate_mutex);
+	break;
+	
+    case TOPHAT_T_CONSISTENT_WAIT_FREE:
+	woolhat = (woolhat_t *)mt_table;
+	wstore  = atomic_load(&woolhat->store_current);
+	
+	for (i = 0; i <= wstore->last_slot; i++) {
+	    state = atomic_load(&wstore->hist_buckets[i].state);
+	    
+	    if (state.head) {
+		mmm_retire(state.head);
+	    }
+	}
+	
+	mmm_retire(wstore);
+	hatrack_retired_release(atomic_load(&woolhat->retired));
+	break;
+
+    case TOPHAT_T_FAST_LOCK_FREE:
+	hihat = (hihat_t *)mt_table;
+	mmm_retire(atomic_load(&hihat->store_current));
+	break;
+
+    case TOPHAT_T_FAST_HOPSCOTCH:
+	crown = (crown_t *)mt_table;
+	mmm_retire(atomic_load(&crown->store_current));
+	hatrack_retired_release(atomic_load(&crown->retired));
+	break;
+	
+    default:
+	__builtin_unreachable();
+    }
+
+    mmm_retire(mt_table);
+
+    return;
+}
+
+/* This migration function is the one used by single-threaded
+ * instances to migrate stores when we're staying single-threaded.
+ *
+ * Per above, it's identical to refhat's implementation, except for
+ * the atomic reading / writing of the item/epoch, and the slightly
+ * different data structure layout that results.
+ */
+static void
+tophat_st_migrate(tophat_st_ctx_t *ctx)
+{
+    tophat_st_bucket_t *new_buckets;
+    tophat_st_bucket_t *cur_bucket;
+    tophat_st_bucket_t *new_bucket;
+    tophat_st_record_t  record;
+    uint64_t            bucket_size;
+    uint64_t            num_buckets;
+    uint64_t            new_last_slot;
+    uint64_t            size;
+    uint64_t            i, n, bix;
+
+    bucket_size   = sizeof(tophat_st_bucket_t);
+    num_buckets   = hatrack_new_size(ctx->last_slot, ctx->item_count + 1);
+    new_last_slot = num_buckets - 1;
+    size          = num_buckets * bucket_size;
+    new_buckets   = (tophat_st_bucket_t *)mmm_alloc_committed(size);
+
+    for (n = 0; n <= ctx->last_slot; n++) {
+        cur_bucket = &ctx->buckets[n];
+
+        if (hatrack_bucket_unreserved(cur_bucket->hv)) {
+            continue;
+        }
+
+        record = atomic_read(&cur_bucket->record);
+
+        if (!record.epoch) {
+            continue;
+        }
+
+        bix = hatrack_bucket_index(cur_bucket->hv, new_last_slot);
+	
+        for (i = 0; i < num_buckets; i++) {
+            new_bucket = &new_buckets[bix];
+	    
+            if (hatrack_bucket_unreserved(new_bucket->hv)) {
+                new_bucket->hv     = cur_bucket->hv;
+                new_bucket->record = record;
+                break;
+            }
+	    
+            bix = (bix + 1) & new_last_slot;
+        }
+    }
+    
+    mmm_retire(ctx->buckets);
+
+    ctx->used_count = ctx->item_count;
+    ctx->buckets    = new_buckets;
+    ctx->last_slot  = new_last_slot;
+    ctx->threshold  = hatrack_compute_table_threshold(num_buckets);
+
+    return;
+}
+
+/* Remember that we already have a lock at this point. So the
+ * migration is fairly straightforward, and will look not unlike the
+ * newshat->newshat migration.
+ */
+static void *
+tophat_migrate_to_newshat(tophat_t *self)
+{
+    tophat_st_ctx_t    *ctx;        // essentially, the current table.
+    newshat_t          *new_table;
+    tophat_st_bucket_t *cur_bucket; // pointer to the st bucket
+    newshat_bucket_t   *new_bucket; // pointer to the newshat bucket
+    tophat_st_record_t  cur_record;
+    newshat_record_t    new_record;
+    uint64_t            n, i, bix;
+    
+
+    ctx                      = self->st_table;
+    new_table                = (newshat_t *)mmm_alloc_committed(sizeof(newshat_t));
     new_table->store_current = newshat_store_new(ctx->last_slot + 1);
 
     for (n = 0; n <= ctx->last_slot; n++) {
@@ -1140,10 +1672,12 @@ tophat_migrate_to_witchhat(tophat_t *self)
     uint64_t            i, n, bix;
 
     ctx                      = self->st_table;
-    new_table                = (witchhat_t *)malloc(sizeof(witchhat_t));
+    new_table                = (witchhat_t *)mmm_alloc_committed(sizeof(witchhat_t));
     new_table->store_current = witchhat_store_new(ctx->last_slot + 1);
     new_table->next_epoch    = ctx->next_epoch;
     new_table->item_count    = ctx->item_count;
+    new_table->migrations    = 0;
+    new_table->retired       = NULL;
 
     for (n = 0; n <= ctx->last_slot; n++) {
 	cur_bucket = &ctx->buckets[n];
@@ -1219,7 +1753,7 @@ tophat_migrate_to_ballcap(tophat_t *self)
 
 
     ctx                      = self->st_table;
-    new_table                = (ballcap_t *)malloc(sizeof(ballcap_t));
+    new_table                = (ballcap_t *)mmm_alloc_committed(sizeof(ballcap_t));
     new_table->store_current = ballcap_store_new(ctx->last_slot + 1);
     record_len               = sizeof(ballcap_record_t);
 
@@ -1288,11 +1822,13 @@ tophat_migrate_to_woolhat(tophat_t *self)
     uint64_t            n, i, bix, record_len;
 
     ctx                      = self->st_table;
-    new_table                = (woolhat_t *)malloc(sizeof(woolhat_t));
+    new_table                = (woolhat_t *)mmm_alloc_committed(sizeof(woolhat_t));
     new_table->store_current = woolhat_store_new(ctx->last_slot + 1);
     record_len               = sizeof(woolhat_record_t);
     new_table->cleanup_func  = NULL;
     new_table->cleanup_aux   = NULL;
+    new_table->migrations    = 0;
+    new_table->retired       = NULL;
     
     atomic_store(&new_table->help_needed, 0);
 
@@ -1349,4 +1885,387 @@ tophat_migrate_to_woolhat(tophat_t *self)
     return (void *)new_table;
 }
 
+/* hihat's buckets are laid out just like witchhat's, so this is the
+ * same as the witchhat migration above.
+ */
+static void *
+tophat_migrate_to_hihat(tophat_t *self)
+{
+    tophat_st_ctx_t    *ctx;
+    hihat_t            *new_table;
+    hihat_store_t      *new_store;
+    tophat_st_bucket_t *cur_bucket;
+    hihat_bucket_t     *new_bucket;
+    tophat_st_record_t  cur_record;
+    hihat_record_t      new_record;
+    uint64_t            i, n, bix;
+
+    ctx                      = self->st_table;
+    new_table                = (hihat_t *)mmm_alloc_committed(sizeof(hihat_t));
+    new_store                = hihat_store_new(ctx->last_slot + 1);
+    new_table->next_epoch    = ctx->next_epoch;
+
+    for (n = 0; n <= ctx->last_slot; n++) {
+	cur_bucket = &ctx->buckets[n];
+	
+	if (hatrack_bucket_unreserved(cur_bucket->hv)) {
+	    continue;
+	}
+	
+	cur_record = atomic_read(&cur_bucket->record);
+	
+	if (!cur_record.epoch) {
+	    continue;
+	}
+	
+	bix = hatrack_bucket_index(cur_bucket->hv, new_store->last_slot);
+
+	for (i = 0; i <= new_store->last_slot; i++) {
+	    new_bucket = &new_store->buckets[bix];
+	    
+	    if (hatrack_bucket_unreserved(atomic_read(&new_bucket->hv))) {
+		break;
+	    }
+	    
+	    bix = (bix + 1) & new_store->last_slot;
+	}
+
+	new_record.item = cur_record.item;
+	new_record.info = cur_record.epoch;
+	
+	atomic_store(&new_bucket->hv, cur_bucket->hv);
+	atomic_store(&new_bucket->record, new_record);
+    }
+    
+    atomic_store(&new_store->used_count, ctx->item_count);
+    atomic_store(&new_table->item_count, ctx->item_count);
+    atomic_store(&new_table->store_current, new_store);
+    atomic_store(&self->mt_table, new_table);
+
+    // Now that mt_table is set, we can retire the st implementation.
+    mmm_retire(ctx->buckets);
+    mmm_retire(ctx);
+
+    return (void *)new_table;
+}
+
+/* crown's records are also laid out like witchhat's, but each bucket
+ * also keeps a neighborhood map, with one bit for each of the buckets
+ * that follow it (itself included), telling readers which of those
+ * buckets hold items whose home is this bucket. So when we place an
+ * item, we set the right bit in its home bucket's map.
+ *
+ * Items that land too far from home to fit in the map just don't get
+ * a bit; crown falls back to linear probing past the neighborhood
+ * for those, as it does when its own migrations place them.
+ *
+ * crown only builds its negative-lookup filter when asked to (see
+ * crown_set_filter()), and we don't ask, so there's no filter to
+ * fill in here.
+ */
+static void *
+tophat_migrate_to_crown(tophat_t *self)
+{
+    tophat_st_ctx_t    *ctx;
+    crown_t            *new_table;
+    crown_store_t      *new_store;
+    tophat_st_bucket_t *cur_bucket;
+    tophat_st_record_t  cur_record;
+    crown_record_t      new_record;
+    hop_t               map;
+    uint64_t            i, n, bix, home;
+
+    ctx                      = self->st_table;
+    new_table                = (crown_t *)mmm_alloc_committed(sizeof(crown_t));
+    new_store                = crown_store_new(ctx->last_slot + 1, false);
+    new_table->next_epoch    = ctx->next_epoch;
+    new_table->use_filter    = false;
+
+    for (n = 0; n <= ctx->last_slot; n++) {
+	cur_bucket = &ctx->buckets[n];
+	
+	if (hatrack_bucket_unreserved(cur_bucket->hv)) {
+	    continue;
+	}
+	
+	cur_record = atomic_read(&cur_bucket->record);
+	
+	if (!cur_record.epoch) {
+	    continue;
+	}
+	
+	home = hatrack_bucket_index(cur_bucket->hv, new_store->last_slot);
+	bix  = home;
+
+	for (i = 0; i <= new_store->last_slot; i++) {
+	    if (hatrack_bucket_unreserved(atomic_read(crown_hv_at(new_store,
+								    bix)))) {
+		break;
+	    }
+	    
+	    bix = (bix + 1) & new_store->last_slot;
+	}
+
+	new_record.item = cur_record.item;
+	new_record.info = cur_record.epoch;
+	
+	atomic_store(crown_hv_at(new_store, bix), cur_bucket->hv);
+	atomic_store(crown_record_at(new_store, bix), new_record);
+
+	if (i < sizeof(hop_t) * 8) {
+	    map = atomic_read(crown_map_at(new_store, home));
+	    atomic_store(crown_map_at(new_store, home), map | (CROWN_HOME_BIT >> i));
+	}
+    }
+
+    atomic_store(&new_store->used_count, ctx->item_count);
+    atomic_store(&new_table->item_count, ctx->item_count);
+    atomic_store(&new_table->help_needed, 0);
+    atomic_store(&new_table->migrations, 0);
+    atomic_store(&new_table->retired, NULL);
+    atomic_store(&new_table->store_current, new_store);
+    atomic_store(&self->mt_table, new_table);
+
+    // Now that mt_table is set, we can retire the st implementation.
+    mmm_retire(ctx->buckets);
+    mmm_retire(ctx);
+
+    return (void *)new_table;
+}
+
+/* The migrate_from functions copy a multi-threaded table back into a
+ * new single-threaded table. tophat_downgrade() has the lock, and has
+ * waited out all the writers, so nothing in the table can change
+ * underneath us, and, as with the migrations above, we don't need to
+ * worry about CAS operations.
+ *
+ * We keep the same number of buckets; the multi-threaded store can't
+ * have more items in it than its own threshold allows, so they'll fit.
+ *
+ * For the two tables that keep their own epoch counters, we carry
+ * over the epochs directly. For ballcap and woolhat, the sort epoch
+ * is the creation epoch of the record, and those come from mmm's
+ * global epoch, so we keep using those. tophat_st_load() makes sure
+ * next_epoch ends up above anything we copied.
+ */
+static tophat_st_ctx_t *
+tophat_migrate_from_newshat(newshat_t *table)
+{
+    tophat_st_ctx_t  *ctx;
+    newshat_store_t  *store;
+    newshat_bucket_t *bucket;
+    newshat_record_t  record;
+    uint64_t          n;
+
+    store = table->store_current;
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	bucket = &store->buckets[n];
+
+	if (hatrack_bucket_unreserved(bucket->hv)) {
+	    continue;
+	}
+
+	record = atomic_read(&bucket->record);
+
+	if (!record.epoch) {
+	    continue;
+	}
+
+	tophat_st_load(ctx, bucket->hv, record.item, record.epoch);
+    }
+
+    if (ctx->next_epoch < table->next_epoch) {
+	ctx->next_epoch = table->next_epoch;
+    }
+
+    return ctx;
+}
+
+static tophat_st_ctx_t *
+tophat_migrate_from_witchhat(witchhat_t *table)
+{
+    tophat_st_ctx_t   *ctx;
+    witchhat_store_t  *store;
+    witchhat_bucket_t *bucket;
+    witchhat_record_t  record;
+    hatrack_hash_t     hv;
+    uint64_t           epoch;
+    uint64_t           n;
+
+    store = atomic_load(&table->store_current);
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	bucket = &store->buckets[n];
+	hv     = atomic_load(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	record = atomic_load(&bucket->record);
+	epoch  = record.info & WITCHHAT_EPOCH_MASK;
+
+	if (!epoch) {
+	    continue;
+	}
+
+	tophat_st_load(ctx, hv, record.item, epoch);
+    }
+
+    if (ctx->next_epoch < table->next_epoch) {
+	ctx->next_epoch = table->next_epoch;
+    }
+
+    return ctx;
+}
+
+static tophat_st_ctx_t *
+tophat_migrate_from_ballcap(ballcap_t *table)
+{
+    tophat_st_ctx_t  *ctx;
+    ballcap_store_t  *store;
+    ballcap_bucket_t *bucket;
+    ballcap_record_t *record;
+    uint64_t          n;
+
+    store = table->store_current;
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	bucket = &store->buckets[n];
+
+	if (hatrack_bucket_unreserved(bucket->hv)) {
+	    continue;
+	}
+
+	record = bucket->record;
+
+	if (!record || record->deleted) {
+	    continue;
+	}
+
+	tophat_st_load(ctx,
+		       bucket->hv,
+		       record->item,
+		       mmm_get_create_epoch(record));
+    }
+
+    return ctx;
+}
+
+static tophat_st_ctx_t *
+tophat_migrate_from_woolhat(woolhat_t *table)
+{
+    tophat_st_ctx_t   *ctx;
+    woolhat_store_t   *store;
+    woolhat_history_t *bucket;
+    woolhat_state_t    state;
+    hatrack_hash_t     hv;
+    uint64_t           n;
+
+    store = atomic_load(&table->store_current);
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	bucket = &store->hist_buckets[n];
+	hv     = atomic_load(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	state = atomic_load(&bucket->state);
+
+	if (!state.head || state.head->deleted) {
+	    continue;
+	}
+
+	tophat_st_load(ctx,
+		       hv,
+		       state.head->item,
+		       mmm_get_create_epoch(state.head));
+    }
+
+    return ctx;
+}
+
+static tophat_st_ctx_t *
+tophat_migrate_from_hihat(hihat_t *table)
+{
+    tophat_st_ctx_t *ctx;
+    hihat_store_t   *store;
+    hihat_bucket_t  *bucket;
+    hihat_record_t   record;
+    hatrack_hash_t   hv;
+    uint64_t         epoch;
+    uint64_t         n;
+
+    store = atomic_load(&table->store_current);
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	bucket = &store->buckets[n];
+	hv     = atomic_load(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	record = atomic_load(&bucket->record);
+	epoch  = record.info & HIHAT_EPOCH_MASK;
+
+	if (!epoch) {
+	    continue;
+	}
+
+	tophat_st_load(ctx, hv, record.item, epoch);
+    }
+
+    if (ctx->next_epoch < table->next_epoch) {
+	ctx->next_epoch = table->next_epoch;
+    }
+
+    return ctx;
+}
+
+static tophat_st_ctx_t *
+tophat_migrate_from_crown(crown_t *table)
+{
+    tophat_st_ctx_t *ctx;
+    crown_store_t   *store;
+    crown_record_t   record;
+    hatrack_hash_t   hv;
+    uint64_t         epoch;
+    uint64_t         n;
+
+    store = atomic_load(&table->store_current);
+    ctx   = tophat_st_new(store->last_slot + 1);
+
+    for (n = 0; n <= store->last_slot; n++) {
+	hv = atomic_load(crown_hv_at(store, n));
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	record = atomic_load(crown_record_at(store, n));
+	epoch  = record.info & CROWN_EPOCH_MASK;
+
+	if (!epoch) {
+	    continue;
+	}
+
+	tophat_st_load(ctx, hv, record.item, epoch);
+    }
+
+    if (ctx->next_epoch < table->next_epoch) {
+	ctx->next_epoch = table->next_epoch;
+    }
+
+    return ctx;
+}
+
 #endif
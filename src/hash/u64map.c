@@ -0,0 +1,786 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           u64map.c
+ *  Description:    A lock-free map from 64-bit integers to 60-bit
+ *                  integers, based on tiara, that never allocates
+ *                  per operation.
+ *
+ *                  The algorithm is tiara's: a single CAS per core
+ *                  operation, on a 128-bit bucket, with migrations
+ *                  done by first marking every bucket MOVING, and
+ *                  then copying, marking each bucket MOVED as it
+ *                  goes.
+ *
+ *                  The main difference in the bucket states is that,
+ *                  since 0 is a valid key, we can't use the key to
+ *                  tell if a bucket is empty. The RESERVED bit does
+ *                  that job instead, and a bucket stays reserved for
+ *                  its key for the life of the store, even if the
+ *                  item gets removed. The USED bit says whether
+ *                  there's currently a value.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+// clang-format off
+static hatrack_u64map_store_t *u64map_store_new      (uint64_t);
+static uint64_t                u64map_store_get      (hatrack_u64map_store_t *,
+						      uint64_t, bool *);
+static uint64_t                u64map_store_put      (hatrack_u64map_store_t *,
+						      hatrack_u64map_t *,
+						      uint64_t, uint64_t,
+						      bool *);
+static bool                    u64map_store_add      (hatrack_u64map_store_t *,
+						      hatrack_u64map_t *,
+						      uint64_t, uint64_t);
+static uint64_t                u64map_store_remove   (hatrack_u64map_store_t *,
+						      hatrack_u64map_t *,
+						      uint64_t, bool *);
+static uint64_t                u64map_store_fetch_add(hatrack_u64map_store_t *,
+						      hatrack_u64map_t *,
+						      uint64_t, uint64_t);
+static hatrack_u64map_store_t *u64map_store_migrate  (hatrack_u64map_store_t *,
+						      hatrack_u64map_t *);
+// clang-format on
+
+/* The MurmurHash3 finalizer. It's a bijection, so distinct keys
+ * always start their probes from well-spread places, but we only
+ * use it to pick the starting bucket; the bucket holds the key
+ * itself.
+ */
+static inline uint64_t
+u64map_mix(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+static inline uint64_t
+u64map_value(uint64_t word)
+{
+    return word >> HATRACK_U64MAP_VALUE_SHIFT;
+}
+
+static inline uint64_t
+u64map_word(uint64_t value)
+{
+    return (value << HATRACK_U64MAP_VALUE_SHIFT) | HATRACK_U64MAP_F_RESERVED
+	 | HATRACK_U64MAP_F_USED;
+}
+
+/* hatrack_found() and hatrack_not_found() deal in pointers, and our
+ * values are integers.
+ */
+static inline void
+u64map_found(bool *found, bool value)
+{
+    if (found) {
+	*found = value;
+    }
+
+    return;
+}
+
+hatrack_u64map_t *
+hatrack_u64map_new(void)
+{
+    hatrack_u64map_t *ret;
+
+    ret = (hatrack_u64map_t *)malloc(sizeof(hatrack_u64map_t));
+
+    hatrack_u64map_init(ret);
+
+    return ret;
+}
+
+hatrack_u64map_t *
+hatrack_u64map_new_size(char size)
+{
+    hatrack_u64map_t *ret;
+
+    ret = (hatrack_u64map_t *)malloc(sizeof(hatrack_u64map_t));
+
+    hatrack_u64map_init_size(ret, size);
+
+    return ret;
+}
+
+void
+hatrack_u64map_init(hatrack_u64map_t *self)
+{
+    hatrack_u64map_init_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+void
+hatrack_u64map_init_size(hatrack_u64map_t *self, char size)
+{
+    hatrack_u64map_store_t *store;
+    uint64_t                len;
+
+    if (size > (ssize_t)(sizeof(intptr_t) * 8)) {
+	abort();
+    }
+
+    if (size < HATRACK_MIN_SIZE_LOG) {
+	abort();
+    }
+
+    len   = 1ULL << size;
+    store = u64map_store_new(len);
+
+    atomic_store(&self->store_current, store);
+    atomic_store(&self->item_count, 0);
+
+    return;
+}
+
+void
+hatrack_u64map_cleanup(hatrack_u64map_t *self)
+{
+    mmm_retire(atomic_load(&self->store_current));
+
+    return;
+}
+
+void
+hatrack_u64map_delete(hatrack_u64map_t *self)
+{
+    hatrack_u64map_cleanup(self);
+    free(self);
+
+    return;
+}
+
+uint64_t
+hatrack_u64map_get(hatrack_u64map_t *self, uint64_t key, bool *found)
+{
+    uint64_t                ret;
+    hatrack_u64map_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = u64map_store_get(store, key, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Returns the old value, if there was one. */
+uint64_t
+hatrack_u64map_put(hatrack_u64map_t *self,
+		   uint64_t          key,
+		   uint64_t          value,
+		   bool             *found)
+{
+    uint64_t                ret;
+    hatrack_u64map_store_t *store;
+
+    if (value > HATRACK_U64MAP_VALUE_MAX) {
+	abort();
+    }
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = u64map_store_put(store, self, key, value, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+bool
+hatrack_u64map_add(hatrack_u64map_t *self, uint64_t key, uint64_t value)
+{
+    bool                    ret;
+    hatrack_u64map_store_t *store;
+
+    if (value > HATRACK_U64MAP_VALUE_MAX) {
+	abort();
+    }
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = u64map_store_add(store, self, key, value);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+uint64_t
+hatrack_u64map_remove(hatrack_u64map_t *self, uint64_t key, bool *found)
+{
+    uint64_t                ret;
+    hatrack_u64map_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = u64map_store_remove(store, self, key, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Adds delta to the value (modulo 2^60), and returns the value from
+ * before the add. If the key isn't there, it gets added with a value
+ * of delta, and we return 0.
+ */
+uint64_t
+hatrack_u64map_fetch_add(hatrack_u64map_t *self, uint64_t key, uint64_t delta)
+{
+    uint64_t                ret;
+    hatrack_u64map_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = u64map_store_fetch_add(store, self, key, delta);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+uint64_t
+hatrack_u64map_len(hatrack_u64map_t *self)
+{
+    return atomic_read(&self->item_count);
+}
+
+hatrack_u64map_item_t *
+hatrack_u64map_items(hatrack_u64map_t *self, uint64_t *num)
+{
+    hatrack_u64map_item_t   *ret;
+    hatrack_u64map_item_t   *p;
+    hatrack_u64map_bucket_t *cur;
+    hatrack_u64map_bucket_t *end;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_store_t  *store;
+    uint64_t                 num_items;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = (hatrack_u64map_item_t *)malloc(sizeof(hatrack_u64map_item_t)
+					  * (store->last_slot + 1));
+    p     = ret;
+    cur   = store->buckets;
+    end   = cur + (store->last_slot + 1);
+
+    while (cur < end) {
+	record = atomic_read(cur);
+
+	if (record.word & HATRACK_U64MAP_F_USED) {
+	    p->key   = record.key;
+	    p->value = u64map_value(record.word);
+	    p++;
+	}
+
+	cur++;
+    }
+
+    mmm_end_op();
+
+    num_items = p - ret;
+    *num      = num_items;
+
+    if (!num_items) {
+	free(ret);
+
+	return NULL;
+    }
+
+    return (hatrack_u64map_item_t *)realloc(ret,
+					    num_items
+						* sizeof(hatrack_u64map_item_t));
+}
+
+static hatrack_u64map_store_t *
+u64map_store_new(uint64_t size)
+{
+    hatrack_u64map_store_t *store;
+    uint64_t                alloc_len;
+
+    alloc_len = sizeof(hatrack_u64map_store_t)
+	      + sizeof(hatrack_u64map_bucket_t) * size;
+    store     = (hatrack_u64map_store_t *)mmm_alloc_committed(alloc_len);
+
+    store->last_slot = size - 1;
+    store->threshold = hatrack_compute_table_threshold(size);
+
+    return store;
+}
+
+/* A bucket that isn't reserved ends the probe, even if it has been
+ * marked by a migration; nothing can get reserved past it after
+ * that.
+ */
+static uint64_t
+u64map_store_get(hatrack_u64map_store_t *self, uint64_t key, bool *found)
+{
+    uint64_t                bix;
+    uint64_t                i;
+    hatrack_u64map_record_t record;
+
+    bix = u64map_mix(key) & self->last_slot;
+
+    for (i = 0; i <= self->last_slot; i++) {
+	record = atomic_read(&self->buckets[bix]);
+
+	if (!(record.word & HATRACK_U64MAP_F_RESERVED)) {
+	    break;
+	}
+
+	if (record.key != key) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	if (!(record.word & HATRACK_U64MAP_F_USED)) {
+	    break;
+	}
+
+	u64map_found(found, true);
+
+	return u64map_value(record.word);
+    }
+
+    u64map_found(found, false);
+
+    return 0;
+}
+
+/* Tiara gives up if it loses the race to overwrite a bucket, figuring
+ * that its write happened just before the winner's. We can't do that
+ * here, since we need to know whether the bucket had a value, to keep
+ * the item count right, so we retry until we succeed, or until the
+ * bucket starts migrating.
+ */
+static uint64_t
+u64map_store_put(hatrack_u64map_store_t *self,
+		 hatrack_u64map_t       *top,
+		 uint64_t                key,
+		 uint64_t                value,
+		 bool                   *found)
+{
+    uint64_t                 bix;
+    uint64_t                 i;
+    hatrack_u64map_bucket_t *bucket;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_record_t  candidate;
+    hatrack_backoff_state_t  backoff;
+
+    bix            = u64map_mix(key) & self->last_slot;
+    candidate.key  = key;
+    candidate.word = u64map_word(value);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	record = atomic_load(bucket);
+
+	if (!record.word) {
+	    if (CAS(bucket, &record, candidate)) {
+		atomic_fetch_add(&top->item_count, 1);
+
+		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		    u64map_store_migrate(self, top);
+		}
+
+		u64map_found(found, false);
+
+		return 0;
+	    }
+	    // Someone beat us to the bucket. Fall through to see if
+	    // it's our key.
+	}
+
+	if (record.word & HATRACK_U64MAP_F_MOVING) {
+	    goto migrate_and_retry;
+	}
+
+	if (record.key != key) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+	while (!CAS(bucket, &record, candidate)) {
+	    if (record.word & HATRACK_U64MAP_F_MOVING) {
+		goto migrate_and_retry;
+	    }
+
+	    hatrack_backoff(&backoff);
+	}
+
+	if (record.word & HATRACK_U64MAP_F_USED) {
+	    u64map_found(found, true);
+
+	    return u64map_value(record.word);
+	}
+
+	atomic_fetch_add(&top->item_count, 1);
+	u64map_found(found, false);
+
+	return 0;
+    }
+
+migrate_and_retry:
+    self = u64map_store_migrate(self, top);
+
+    return u64map_store_put(self, top, key, value, found);
+}
+
+static bool
+u64map_store_add(hatrack_u64map_store_t *self,
+		 hatrack_u64map_t       *top,
+		 uint64_t                key,
+		 uint64_t                value)
+{
+    uint64_t                 bix;
+    uint64_t                 i;
+    hatrack_u64map_bucket_t *bucket;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_record_t  candidate;
+    hatrack_backoff_state_t  backoff;
+
+    bix            = u64map_mix(key) & self->last_slot;
+    candidate.key  = key;
+    candidate.word = u64map_word(value);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	record = atomic_load(bucket);
+
+	if (!record.word) {
+	    if (CAS(bucket, &record, candidate)) {
+		atomic_fetch_add(&top->item_count, 1);
+
+		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		    u64map_store_migrate(self, top);
+		}
+
+		return true;
+	    }
+	}
+
+	if (record.word & HATRACK_U64MAP_F_MOVING) {
+	    goto migrate_and_retry;
+	}
+
+	if (record.key != key) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	// The bucket is ours. We can only add if there's no value.
+	hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+	while (true) {
+	    if (record.word & HATRACK_U64MAP_F_MOVING) {
+		goto migrate_and_retry;
+	    }
+
+	    if (record.word & HATRACK_U64MAP_F_USED) {
+		return false;
+	    }
+	    if (CAS(bucket, &record, candidate)) {
+		break;
+	    }
+	    hatrack_backoff(&backoff);
+	}
+
+	atomic_fetch_add(&top->item_count, 1);
+
+	return true;
+    }
+
+migrate_and_retry:
+    self = u64map_store_migrate(self, top);
+
+    return u64map_store_add(self, top, key, value);
+}
+
+static uint64_t
+u64map_store_remove(hatrack_u64map_store_t *self,
+		    hatrack_u64map_t       *top,
+		    uint64_t                key,
+		    bool                   *found)
+{
+    uint64_t                 bix;
+    uint64_t                 i;
+    hatrack_u64map_bucket_t *bucket;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_record_t  candidate;
+    hatrack_backoff_state_t  backoff;
+
+    bix            = u64map_mix(key) & self->last_slot;
+    candidate.key  = key;
+    candidate.word = HATRACK_U64MAP_F_RESERVED;
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	record = atomic_load(bucket);
+
+	if (!(record.word & HATRACK_U64MAP_F_RESERVED)) {
+	    break;
+	}
+
+	if (record.key != key) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+	while (true) {
+	    if (record.word & HATRACK_U64MAP_F_MOVING) {
+		goto migrate_and_retry;
+	    }
+
+	    if (!(record.word & HATRACK_U64MAP_F_USED)) {
+		u64map_found(found, false);
+
+		return 0;
+	    }
+	    if (CAS(bucket, &record, candidate)) {
+		break;
+	    }
+	    hatrack_backoff(&backoff);
+	}
+
+	atomic_fetch_sub(&top->item_count, 1);
+	u64map_found(found, true);
+
+	return u64map_value(record.word);
+    }
+
+    u64map_found(found, false);
+
+    return 0;
+
+migrate_and_retry:
+    self = u64map_store_migrate(self, top);
+
+    return u64map_store_remove(self, top, key, found);
+}
+
+static uint64_t
+u64map_store_fetch_add(hatrack_u64map_store_t *self,
+		       hatrack_u64map_t       *top,
+		       uint64_t                key,
+		       uint64_t                delta)
+{
+    uint64_t                 bix;
+    uint64_t                 i;
+    uint64_t                 old;
+    hatrack_u64map_bucket_t *bucket;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_record_t  candidate;
+    hatrack_backoff_state_t  backoff;
+
+    bix            = u64map_mix(key) & self->last_slot;
+    delta         &= HATRACK_U64MAP_VALUE_MAX;
+    candidate.key  = key;
+    candidate.word = u64map_word(delta);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	record = atomic_load(bucket);
+
+	if (!record.word) {
+	    if (CAS(bucket, &record, candidate)) {
+		atomic_fetch_add(&top->item_count, 1);
+
+		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		    u64map_store_migrate(self, top);
+		}
+
+		return 0;
+	    }
+	}
+
+	if (record.word & HATRACK_U64MAP_F_MOVING) {
+	    goto migrate_and_retry;
+	}
+
+	if (record.key != key) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	hatrack_backoff_start(&backoff, &hatrack_backoff_default);
+
+	while (true) {
+	    if (record.word & HATRACK_U64MAP_F_MOVING) {
+		goto migrate_and_retry;
+	    }
+
+	    if (record.word & HATRACK_U64MAP_F_USED) {
+		old = u64map_value(record.word);
+	    }
+	    else {
+		old = 0;
+	    }
+
+	    candidate.word = u64map_word((old + delta) & HATRACK_U64MAP_VALUE_MAX);
+	    if (CAS(bucket, &record, candidate)) {
+		break;
+	    }
+	    hatrack_backoff(&backoff);
+	}
+
+	if (!(record.word & HATRACK_U64MAP_F_USED)) {
+	    atomic_fetch_add(&top->item_count, 1);
+	}
+
+	return old;
+    }
+
+migrate_and_retry:
+    self = u64map_store_migrate(self, top);
+
+    return u64map_store_fetch_add(self, top, key, delta);
+}
+
+/* This is tiara's migration, with one fix: when a CAS on a bucket
+ * fails, the bucket's key may have changed underneath us (an empty
+ * bucket can get reserved), so the candidate always takes its key
+ * from the record we just read.
+ */
+static hatrack_u64map_store_t *
+u64map_store_migrate(hatrack_u64map_store_t *self, hatrack_u64map_t *top)
+{
+    hatrack_u64map_store_t  *new_store;
+    hatrack_u64map_store_t  *candidate_store;
+    hatrack_u64map_bucket_t *bucket;
+    hatrack_u64map_bucket_t *new_bucket;
+    hatrack_u64map_record_t  record;
+    hatrack_u64map_record_t  new_record;
+    hatrack_u64map_record_t  candidate;
+    uint64_t                 new_size;
+    uint64_t                 new_used;
+    uint64_t                 expected_used;
+    uint64_t                 bix;
+    uint64_t                 i, j;
+
+    new_store = atomic_read(&top->store_current);
+
+    if (new_store != self) {
+	return new_store;
+    }
+
+    new_used = 0;
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[i];
+	record = atomic_read(bucket);
+
+	do {
+	    if (record.word & HATRACK_U64MAP_F_MOVING) {
+		break;
+	    }
+
+	    candidate.key = record.key;
+
+	    if (record.word & HATRACK_U64MAP_F_USED) {
+		candidate.word = record.word | HATRACK_U64MAP_F_MOVING;
+	    }
+	    else {
+		candidate.word = record.word | HATRACK_U64MAP_F_MOVING
+			       | HATRACK_U64MAP_F_MOVED;
+	    }
+	} while (!CAS(bucket, &record, candidate));
+
+	if (record.word & HATRACK_U64MAP_F_USED) {
+	    new_used++;
+	}
+    }
+
+    new_store = atomic_read(&self->store_next);
+
+    if (!new_store) {
+	new_size        = hatrack_new_size(self->last_slot, new_used);
+	candidate_store = u64map_store_new(new_size);
+
+	if (!CAS(&self->store_next, &new_store, candidate_store)) {
+	    mmm_retire_unused(candidate_store);
+	}
+	else {
+	    new_store = candidate_store;
+	}
+    }
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[i];
+	record = atomic_read(bucket);
+
+	if (record.word & HATRACK_U64MAP_F_MOVED) {
+	    continue;
+	}
+
+	bix            = u64map_mix(record.key) & new_store->last_slot;
+	candidate.key  = record.key;
+	candidate.word = record.word & ~HATRACK_U64MAP_F_MOVING;
+
+	for (j = 0; j <= new_store->last_slot; j++) {
+	    new_bucket = &new_store->buckets[bix];
+	    new_record = atomic_read(new_bucket);
+
+	    if (!new_record.word) {
+		if (CAS(new_bucket, &new_record, candidate)) {
+		    break;
+		}
+	    }
+
+	    if (new_record.key != record.key) {
+		bix = (bix + 1) & new_store->last_slot;
+		continue;
+	    }
+
+	    break;
+	}
+
+	candidate.word = record.word | HATRACK_U64MAP_F_MOVED;
+
+	CAS(bucket, &record, candidate);
+    }
+
+    expected_used = 0;
+
+    CAS(&new_store->used_count, &expected_used, new_used);
+
+    if (CAS(&top->store_current, &self, new_store)) {
+	mmm_retire(self);
+    }
+
+    return atomic_read(&top->store_current);
+}
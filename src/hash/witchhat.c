@@ -43,6 +43,9 @@ static witchhat_store_t  *witchhat_store_migrate(witchhat_store_t *,
 						 witchhat_t *);
 static inline bool        witchhat_help_required(uint64_t);
 static inline bool        witchhat_need_to_help (witchhat_t *);
+static uint64_t           witchhat_store_bytes  (witchhat_store_t *);
+static void               witchhat_retire_store (witchhat_t *,
+						 witchhat_store_t *);
 
 witchhat_t *
 witchhat_new(void)
@@ -96,6 +99,8 @@ witchhat_init_size(witchhat_t *self, char size)
     
     atomic_store(&self->store_current, store);
     atomic_store(&self->item_count, 0);
+    atomic_store(&self->migrations, 0);
+    atomic_store(&self->retired, NULL);
 
     return;
 }
@@ -104,6 +109,7 @@ void
 witchhat_cleanup(witchhat_t *self)
 {
     mmm_retire(atomic_load(&self->store_current));
+    hatrack_retired_release(atomic_load(&self->retired));
 
     return;
 }
@@ -287,6 +293,82 @@ witchhat_store_new(uint64_t size)
     return store;
 }
 
+/* See stats.h, and crown_stats(), which this mirrors, minus the
+ * neighborhood information, since witchhat doesn't have any.
+ */
+void
+witchhat_stats(witchhat_t *self, hatrack_stats_t *stats)
+{
+    witchhat_store_t *store;
+    hatrack_hash_t    hv;
+    uint64_t          i;
+
+    memset(stats, 0, sizeof(hatrack_stats_t));
+    mmm_start_basic_op();
+
+    store               = atomic_read(&self->store_current);
+    stats->num_buckets  = store->last_slot + 1;
+    stats->store_bytes  = witchhat_store_bytes(store);
+
+    for (i = 0; i <= store->last_slot; i++) {
+	hv = atomic_read(&store->buckets[i].hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	stats->used_buckets++;
+
+	hatrack_stats_add_probe(stats,
+				(i - hatrack_bucket_index(hv, store->last_slot))
+				& store->last_slot);
+    }
+
+    mmm_end_op();
+
+    stats->num_items     = atomic_read(&self->item_count);
+    stats->migrations    = atomic_read(&self->migrations);
+    stats->retired_bytes = hatrack_retired_bytes(&self->retired);
+
+    hatrack_stats_finish(stats);
+
+    return;
+}
+
+static uint64_t
+witchhat_store_bytes(witchhat_store_t *store)
+{
+    return sizeof(mmm_header_t) + sizeof(witchhat_store_t)
+	 + sizeof(witchhat_bucket_t) * (store->last_slot + 1);
+}
+
+/* Retired stores count toward the table's memory until mmm actually
+ * frees them; see stats.h.
+ */
+static void
+witchhat_store_freed(witchhat_store_t *store, hatrack_retired_t *retired)
+{
+    hatrack_retired_sub(retired, witchhat_store_bytes(store));
+
+    return;
+}
+
+static void
+witchhat_retire_store(witchhat_t *top, witchhat_store_t *store)
+{
+    hatrack_retired_t *retired;
+
+    retired = hatrack_retired_get(&top->retired);
+
+    hatrack_retired_add(retired, witchhat_store_bytes(store));
+    mmm_add_cleanup_handler(store,
+			    (mmm_cleanup_func)witchhat_store_freed,
+			    retired);
+    mmm_retire(store);
+
+    return;
+}
+
 void *
 witchhat_store_get(witchhat_store_t *self,
                  hatrack_hash_t      hv1,
@@ -934,7 +1016,8 @@ witchhat_store_migrate(witchhat_store_t *self, witchhat_t *top)
 	     &self,
 	     new_store,
 	     WITCHHAT_CTR_STORE_INSTALL)) {
-        mmm_retire(self);
+	atomic_fetch_add(&top->migrations, 1);
+        witchhat_retire_store(top, self);
     }
 
     return top->store_current;
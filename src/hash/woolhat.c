@@ -43,7 +43,7 @@ static void            *woolhat_store_replace(woolhat_store_t *, woolhat_t *,
 					      uint64_t);
 static bool             woolhat_store_add    (woolhat_store_t *, woolhat_t *,
 					      hatrack_hash_t, void *,
-					      uint64_t);
+					      uint64_t, uint64_t);
 static void            *woolhat_store_remove (woolhat_store_t *, woolhat_t *,
 					      hatrack_hash_t, bool *,
 					      uint64_t);
@@ -52,6 +52,50 @@ static inline bool      woolhat_help_required(uint64_t);
 static inline bool      woolhat_need_to_help (woolhat_t *);
 static uint64_t         woolhat_set_ordering (woolhat_record_t *, bool);
 static inline void      woolhat_new_insertion(woolhat_record_t *);
+static uint64_t         woolhat_store_bytes  (woolhat_store_t *);
+static void             woolhat_retire_store (woolhat_t *, woolhat_store_t *);
+static inline woolhat_record_t *woolhat_record_new(void);
+
+/* Every write to a woolhat allocates a new record, and retires the
+ * one it replaces, so an update-heavy workload is mostly a malloc()
+ * and free() benchmark. Instead, we allocate records out of an mmm
+ * pool; when mmm determines that no reservation can still see a
+ * retired record, the record goes back on the freeing thread's free
+ * list, and the next write on that thread reuses it.
+ *
+ * That's also what keeps the history chains short. Once a record is
+ * retired, no reader that starts after that point will ever follow a
+ * 'next' pointer to it: woolhat_get() only ever looks at the head
+ * record, and the view operations only walk down the chain while the
+ * write epoch is newer than their linearization epoch. Each record
+ * below the head got retired when the record above it was committed,
+ * so every record a view can actually reach has a retirement epoch
+ * newer than the view's reservation, and mmm won't recycle it out
+ * from under us. Everything further down is garbage that the pool
+ * reclaims, even though the stale 'next' pointer is left in place.
+ *
+ * The pool id is shared by all woolhats (and by everything else that
+ * happens to want pooled records of the same size). We register it
+ * once, the first time any thread needs a record; pthread_once()
+ * makes every other thread wait for that, and guarantees they see
+ * the id it stored.
+ */
+static uint64_t       woolhat_record_pool      = 0;
+static pthread_once_t woolhat_record_pool_once = PTHREAD_ONCE_INIT;
+
+static void
+woolhat_record_pool_init(void)
+{
+    woolhat_record_pool = mmm_pool_register(sizeof(woolhat_record_t));
+}
+
+static inline woolhat_record_t *
+woolhat_record_new(void)
+{
+    pthread_once(&woolhat_record_pool_once, woolhat_record_pool_init);
+
+    return (woolhat_record_t *)mmm_alloc_pooled(woolhat_record_pool);
+}
 
 static uint64_t
 woolhat_set_ordering(woolhat_record_t *record, bool deleted_below)
@@ -141,6 +185,9 @@ woolhat_init_size(woolhat_t *self, char size)
     atomic_store(&self->item_count, 0);
     atomic_store(&self->store_current, store);
 
+    atomic_store(&self->migrations, 0);
+    atomic_store(&self->retired, NULL);
+
     self->cleanup_func = NULL;
     self->cleanup_aux  = NULL;
 
@@ -170,6 +217,7 @@ woolhat_cleanup(woolhat_t *self)
     }
 
     mmm_retire(store);
+    hatrack_retired_release(atomic_load(&self->retired));
 
     return;
 }
@@ -279,7 +327,39 @@ woolhat_add(woolhat_t *self, hatrack_hash_t hv, void *item)
     mmm_start_basic_op();
 
     store = atomic_read(&self->store_current);
-    ret   = woolhat_store_add(store, self, hv, item, 0);
+    ret   = woolhat_store_add(store, self, hv, item, 0, 0);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Like woolhat_add(), but the new record sorts as if it had been
+ * inserted at create_epoch, instead of at the time it actually gets
+ * written. This is for building a new table out of items from an
+ * existing one (the set algebra in set.c does this), where we want
+ * the new table's sort order to match the order in which the items
+ * went into the original tables, no matter what order we happen to
+ * copy them in.
+ *
+ * The write epoch is still the real one, so linearized views of the
+ * new table still only see the record once it's actually there.
+ *
+ * Passing 0 for create_epoch is the same as calling woolhat_add().
+ */
+bool
+woolhat_add_ordered(woolhat_t     *self,
+		    hatrack_hash_t hv,
+		    void          *item,
+		    uint64_t       create_epoch)
+{
+    bool             ret;
+    woolhat_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store_current);
+    ret   = woolhat_store_add(store, self, hv, item, create_epoch, 0);
 
     mmm_end_op();
 
@@ -488,6 +568,137 @@ woolhat_store_new(uint64_t size)
     return store;
 }
 
+/* See stats.h. Woolhat has no neighborhoods, but it does have records,
+ * and history chains below them. Only the current record in each
+ * bucket counts toward record_bytes; everything below it has been
+ * retired already.
+ *
+ * The chain walk is the same one the views do, and it's safe for the
+ * same reason: a record whose write epoch is after our read epoch
+ * replaced its 'next' after our reservation, so that one can't have
+ * been freed yet. We stop at the first record that's old enough,
+ * since below that, we'd be following pointers into memory mmm may
+ * already have handed back.
+ */
+void
+woolhat_stats(woolhat_t *self, hatrack_stats_t *stats)
+{
+    woolhat_store_t  *store;
+    hatrack_hash_t    hv;
+    woolhat_state_t   state;
+    woolhat_record_t *rec;
+    uint64_t          epoch;
+    uint64_t          links;
+    uint64_t          i;
+
+    memset(stats, 0, sizeof(hatrack_stats_t));
+
+    epoch = mmm_start_linearized_op();
+
+    store               = atomic_read(&self->store_current);
+    stats->num_buckets  = store->last_slot + 1;
+    stats->store_bytes  = woolhat_store_bytes(store);
+
+    for (i = 0; i <= store->last_slot; i++) {
+	hv = atomic_read(&store->hist_buckets[i].hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    continue;
+	}
+
+	stats->used_buckets++;
+
+	hatrack_stats_add_probe(stats,
+				(i - hatrack_bucket_index(hv, store->last_slot))
+				& store->last_slot);
+
+	state = atomic_read(&store->hist_buckets[i].state);
+	rec   = state.head;
+
+	if (!rec) {
+	    continue;
+	}
+
+	mmm_help_commit(rec);
+
+	stats->record_bytes += sizeof(mmm_header_t) + sizeof(woolhat_record_t);
+
+	if (rec->deleted) {
+	    stats->deleted_records++;
+	}
+
+	links = 0;
+
+	while (rec->next && mmm_get_write_epoch(rec) > epoch) {
+	    rec = rec->next;
+	    links++;
+	}
+
+	hatrack_stats_add_chain(stats, links);
+    }
+
+    mmm_end_op();
+
+    stats->num_items     = atomic_read(&self->item_count);
+    stats->migrations    = atomic_read(&self->migrations);
+    stats->retired_bytes = hatrack_retired_bytes(&self->retired);
+
+    hatrack_stats_finish(stats);
+
+    return;
+}
+
+static uint64_t
+woolhat_store_bytes(woolhat_store_t *store)
+{
+    return sizeof(mmm_header_t) + sizeof(woolhat_store_t)
+	 + sizeof(woolhat_history_t) * (store->last_slot + 1);
+}
+
+/* Retired stores count toward the table's memory until mmm actually
+ * frees them; see stats.h.
+ */
+static void
+woolhat_store_freed(woolhat_store_t *store, hatrack_retired_t *retired)
+{
+    hatrack_retired_sub(retired, woolhat_store_bytes(store));
+
+    return;
+}
+
+/* Only called by the thread that swapped in the new store, so this
+ * happens once per store. At this point, every bucket is marked as
+ * moved, and any deletion record still at the head of a bucket was
+ * left behind by the migration. Anyone who can still see it also
+ * has a reservation that keeps the store itself alive, so it's safe
+ * to retire both now.
+ */
+static void
+woolhat_retire_store(woolhat_t *top, woolhat_store_t *store)
+{
+    hatrack_retired_t *retired;
+    woolhat_state_t    state;
+    uint64_t           i;
+
+    for (i = 0; i <= store->last_slot; i++) {
+	state = atomic_read(&store->hist_buckets[i].state);
+
+	if (state.head && state.head->deleted) {
+	    mmm_retire(state.head);
+	}
+    }
+
+    retired = hatrack_retired_get(&top->retired);
+
+    hatrack_retired_add(retired, woolhat_store_bytes(store));
+    mmm_add_cleanup_handler(store,
+			    (mmm_cleanup_func)woolhat_store_freed,
+			    retired);
+    mmm_retire(store);
+
+    return;
+}
+
 static void *
 woolhat_store_get(woolhat_store_t *self, hatrack_hash_t hv1, bool *found)
 {
@@ -653,7 +864,7 @@ found_history_bucket:
 	deletion_below = false;
     }
     
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = woolhat_record_new();
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
@@ -791,7 +1002,7 @@ migrate_and_retry:
 	 * return failure.
 	 */
 
-	newhead          = mmm_alloc(sizeof(woolhat_record_t));
+	newhead          = woolhat_record_new();
 	newhead->next    = head;
 	newhead->deleted = true;
 	candidate.head   = newhead;
@@ -823,7 +1034,7 @@ migrate_and_retry:
         goto not_found;
     }
 
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = woolhat_record_new();
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
@@ -870,6 +1081,7 @@ woolhat_store_add(woolhat_store_t *self,
                   woolhat_t       *top,
                   hatrack_hash_t   hv1,
                   void            *item,
+                  uint64_t         create_epoch,
                   uint64_t         count)
 {
     uint64_t           bix;
@@ -919,14 +1131,14 @@ migrate_and_retry:
         atomic_fetch_add(&top->help_needed, 1);
 
         self = woolhat_store_migrate(self, top);
-        ret  = woolhat_store_add(self, top, hv1, item, count);
+        ret  = woolhat_store_add(self, top, hv1, item, create_epoch, count);
 
         atomic_fetch_sub(&top->help_needed, 1);
 
         return ret;
     }
     self = woolhat_store_migrate(self, top);
-    return woolhat_store_add(self, top, hv1, item, count);
+    return woolhat_store_add(self, top, hv1, item, create_epoch, count);
 
 found_history_bucket:
     state = atomic_read(&bucket->state);
@@ -947,12 +1159,20 @@ found_history_bucket:
         return false;
     }
 
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = woolhat_record_new();
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
     candidate.flags = 0;
 
+    /* For woolhat_add_ordered(), the create epoch has to be there
+     * before anyone can see the record, since readers only fall back
+     * to the write epoch when it's 0.
+     */
+    if (create_epoch) {
+	mmm_set_create_epoch(newhead, create_epoch);
+    }
+
     if (!CAS(&bucket->state, &state, candidate)) {
         mmm_retire_unused(newhead);
 	/* If our 'add' lost, the possible cases are:
@@ -983,8 +1203,11 @@ found_history_bucket:
 
     atomic_fetch_add(&top->item_count, 1);
 
-    mmm_commit_write     (newhead);
-    woolhat_new_insertion(newhead);
+    mmm_commit_write(newhead);
+
+    if (!create_epoch) {
+	woolhat_new_insertion(newhead);
+    }
     
     if (head) {
         mmm_retire(head);
@@ -1084,9 +1307,9 @@ migrate_and_retry:
 	deleting_for_ourselves = true;
     }
     
-    newhead            = mmm_alloc(sizeof(woolhat_record_t));
+    newhead            = woolhat_record_new();
     newhead->next      = head;
-    newhead->deleted   = true; // ->item is 0'd out by mmm_alloc.
+    newhead->deleted   = true; // ->item is 0'd out by the allocator.
     candidate.head     = newhead;
     candidate.flags    = 0;
 
@@ -1153,6 +1376,7 @@ migrate_and_retry:
 	 * will get ignored.
 	 */
 	if (state.state.head->deleted) {
+	    mmm_retire_unused(newhead);
 	    return hatrack_not_found(found);
 	}
 
@@ -1170,11 +1394,13 @@ migrate_and_retry:
 	    atomic_fetch_sub(&top->item_count, 1);
 	    
 	    if (deleting_for_ourselves) {
-		return hatrack_found(found, NULL);
+		return hatrack_found(found, state.state.head->item);
 	    }
 	    return hatrack_not_found(found);
 	}
 	
+	head = newhead->next;
+
 	mmm_retire_unused(newhead);
 
 	/* If the CAS failed and the state is the same,
@@ -1184,7 +1410,7 @@ migrate_and_retry:
 	 * Otherwise, it will have been serviced.
 	 */
 	if ((state.state.flags & WOOLHAT_F_DELETE_HELP) &&
-	    (state.state.head == newhead->next) &&
+	    (state.state.head == head) &&
 	    (state.state.flags & WOOLHAT_F_MOVING)) {
 	    goto migrate_and_retry;
 	}
@@ -1197,7 +1423,7 @@ migrate_and_retry:
     mmm_retire(head);
     atomic_fetch_sub(&top->item_count, 1);
 
-    return hatrack_found(found, NULL);
+    return hatrack_found(found, head->item);
 }
 
 static woolhat_store_t *
@@ -1243,12 +1469,15 @@ woolhat_store_migrate(woolhat_store_t *self, woolhat_t *top)
 	if ((!state.state.head) || state.state.head->deleted) {
 	    state.kludge = OR2X64L(&cur->state, WOOLHAT_F_MOVED);
 
-	    /* Only the first thread that successfully sets the MOVED
-	     * bit on the state should retire the old record.
+	    /* Deletion records don't get copied to the new store, but
+	     * we can't retire them here: until the new store gets
+	     * swapped in, readers can still find them at the head of
+	     * this bucket, including readers that show up after we'd
+	     * have retired the record. They get retired along with the
+	     * store instead; see woolhat_retire_store().
 	     */
 	    if (state.state.head && !(state.state.flags & WOOLHAT_F_MOVED)) {
 		mmm_help_commit(state.state.head);
-		mmm_retire_fast(state.state.head);
 	    }
 	    
 	    continue;
@@ -1310,6 +1539,22 @@ woolhat_store_migrate(woolhat_store_t *self, woolhat_t *top)
 	    continue;
 	}
 
+	/* The thread that marked this bucket in the first pass may
+	 * not have gotten around to setting MOVED yet. If the bucket
+	 * is empty or deleted, we must not copy it either: a deletion
+	 * record copied into the new store would get retired once
+	 * from there (when it's overwritten), and again along with
+	 * this store.
+	 */
+	if (!state.state.head || state.state.head->deleted) {
+	    if (state.state.head) {
+		mmm_help_commit(state.state.head);
+	    }
+
+	    OR2X64L(&cur->state, WOOLHAT_F_MOVED);
+	    continue;
+	}
+
         hv  = atomic_read(&cur->hv);
         bix = hatrack_bucket_index(hv, new_store->last_slot);
 
@@ -1342,7 +1587,8 @@ woolhat_store_migrate(woolhat_store_t *self, woolhat_t *top)
     CAS(&new_store->used_count, &expected_used, new_used);
 
     if (CAS(&top->store_current, &self, new_store)) {
-        mmm_retire(self);
+	atomic_fetch_add(&top->migrations, 1);
+        woolhat_retire_store(top, self);
     }
 
     return top->store_current;
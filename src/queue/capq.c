@@ -60,7 +60,7 @@ static const unholy_u moved_cell  = { .cell = { NULL, CAPQ_MOVING | CAPQ_MOVED }
 
 
 
-static capq_store_t *capq_new_store(uint64_t);
+static capq_store_t *capq_new_store(capq_t *, uint64_t);
 static void          capq_migrate  (capq_store_t *, capq_t *);
 
 void
@@ -78,8 +78,12 @@ capq_init_size(capq_t *self, uint64_t size)
 	size = CAPQ_MINIMUM_SIZE;
     }
     
-    self->store         = capq_new_store(size);
-    self->len           = 0;
+    self->store_cache     = mmm_cache_new();
+    self->store           = capq_new_store(self, size);
+    self->len             = 0;
+    self->parking.waiters = 0;
+    self->parking.seq     = 0;
+    self->backoff         = hatrack_backoff_default;
     
     self->store->dequeue_index = 1L<<32;
     self->store->enqueue_index = 1L<<32;
@@ -113,6 +117,7 @@ void
 capq_cleanup(capq_t *self)
 {
     mmm_retire(self->store);
+    mmm_cache_release(self->store_cache);
     
     return;
 }
@@ -137,18 +142,20 @@ capq_delete(capq_t *self)
 uint64_t
 capq_enqueue(capq_t *self, void *item)
 {
-    capq_store_t *store;
-    capq_item_t   expected;
-    capq_item_t   candidate;
-    uint64_t      cur_ix;
-    uint64_t      end_ix;
-    uint64_t      max;
-    uint64_t      step;
-    uint64_t      sz;
-    uint64_t      epoch;
-    capq_cell_t  *cell;    
+    capq_store_t           *store;
+    capq_item_t             expected;
+    capq_item_t             candidate;
+    uint64_t                cur_ix;
+    uint64_t                end_ix;
+    uint64_t                max;
+    uint64_t                step;
+    uint64_t                sz;
+    uint64_t                epoch;
+    capq_cell_t            *cell;
+    hatrack_backoff_state_t backoff;
     
     mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
     
     candidate.item  = item;
     
@@ -228,12 +235,14 @@ capq_enqueue(capq_t *self, void *item)
 
 	    if (epoch >= cur_ix) {
 		step <<= 1;
+		hatrack_backoff(&backoff);
 		continue;
 	    }
 
 	    if (CAS(cell, &expected, candidate)) {
 		atomic_fetch_add(&self->len, 1);
 		mmm_end_op();
+		hatrack_unpark(&self->parking, 1);
 
 		return cur_ix;
 	    }
@@ -244,6 +253,7 @@ capq_enqueue(capq_t *self, void *item)
 
 	    // Otherwise, we got invalidated.
 	    step <<= 1;
+	    hatrack_backoff(&backoff);
 	    continue;
 	}
 	
@@ -318,18 +328,20 @@ capq_enqueue(capq_t *self, void *item)
 capq_top_t
 capq_top(capq_t *self, bool *found)
 {
-    capq_store_t *store;
-    uint64_t      cur_ix;
-    uint64_t      end_ix;
-    uint64_t      candidate_ix;
-    uint64_t      sz;
-    uint64_t      suspension_retries;
-    uint64_t      epoch;
-    capq_cell_t  *cell;
-    capq_item_t   item;
-    capq_item_t   marker;
+    capq_store_t           *store;
+    uint64_t                cur_ix;
+    uint64_t                end_ix;
+    uint64_t                candidate_ix;
+    uint64_t                sz;
+    uint64_t                suspension_retries;
+    uint64_t                epoch;
+    capq_cell_t            *cell;
+    capq_item_t             item;
+    capq_item_t             marker;
+    hatrack_backoff_state_t backoff;
     
     mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     suspension_retries = 0;
     store              = atomic_read(&self->store);
@@ -439,6 +451,7 @@ capq_top(capq_t *self, bool *found)
 		 * been a successful write. Re-try the loop, without
 		 * bumping the value cur_ix, so we can see what's up!
 		 */
+		hatrack_backoff(&backoff);
 		continue;
 	    }
 	}
@@ -455,6 +468,9 @@ capq_top(capq_t *self, bool *found)
 	    capq_migrate(store, self);
 	    store = atomic_read(&self->store);
 	}
+	else {
+	    hatrack_backoff(&backoff);
+	}
 
 	cur_ix = atomic_load(&store->dequeue_index);
 	end_ix = atomic_load(&store->enqueue_index);
@@ -584,8 +600,11 @@ capq_cap(capq_t *self, uint64_t epoch)
 void *
 capq_dequeue(capq_t *self, bool *found)
 {
-    capq_top_t top;
-    bool       f;
+    capq_top_t              top;
+    bool                    f;
+    hatrack_backoff_state_t backoff;
+
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     while (true) {
 	top = capq_top(self, &f);
@@ -595,17 +614,66 @@ capq_dequeue(capq_t *self, bool *found)
 	if (capq_cap(self, capq_extract_epoch(top.state))) {
 	    return hatrack_found(found, top.item);
 	}
+	hatrack_backoff(&backoff);
+    }
+}
+
+/* The same as hq_dequeue_wait(); see hq.c and parking.h.
+ */
+void *
+capq_dequeue_wait(capq_t *self, bool *found, int64_t timeout_ms)
+{
+    struct timespec  ts;
+    struct timespec *deadline;
+    uint32_t         seq;
+    uint64_t         i;
+    void            *ret;
+    bool             f;
+
+    for (i = 0; i <= HATRACK_QUEUE_WAIT_SPINS; i++) {
+	ret = capq_dequeue(self, &f);
+
+	if (f) {
+	    return hatrack_found(found, ret);
+	}
+    }
+
+    deadline = hatrack_park_deadline(timeout_ms, &ts);
+
+    while (true) {
+	seq = hatrack_park_prepare(&self->parking);
+	ret = capq_dequeue(self, &f);
+
+	if (f) {
+	    hatrack_park_cancel(&self->parking);
+
+	    return hatrack_found(found, ret);
+	}
+
+	if (!hatrack_park(&self->parking, seq, deadline)) {
+	    break;
+	}
     }
+
+    ret = capq_dequeue(self, &f);
+
+    if (f) {
+	return hatrack_found(found, ret);
+    }
+
+    return hatrack_not_found(found);
 }
 
+// See hq_new_store() for why this goes through the store cache.
 static capq_store_t *
-capq_new_store(uint64_t size)
+capq_new_store(capq_t *self, uint64_t size)
 {
     capq_store_t *ret;
     uint64_t    alloc_len;
 
     alloc_len = sizeof(capq_store_t) + sizeof(capq_cell_t) * size;
-    ret       = (capq_store_t *)mmm_alloc_committed(alloc_len);
+    ret       = (capq_store_t *)mmm_cache_alloc_committed(self->store_cache,
+							  alloc_len);
     
     ret->size = size;
 
@@ -692,7 +760,7 @@ capq_migrate(capq_store_t *store, capq_t *top)
 
     // Phase 2: agree on the new store.
     expected_store = NULL;
-    next_store     = capq_new_store(store->size << 1);
+    next_store     = capq_new_store(top, store->size << 1);
 
     atomic_store(&next_store->enqueue_index, CAPQ_STORE_INITIALIZING);
     atomic_store(&next_store->dequeue_index, CAPQ_STORE_INITIALIZING);
@@ -24,18 +24,6 @@
 
 #define HATRING_MINIMUM_SIZE 16
 
-/* The overhead for a call to nanosleep should be probably a couple
- * hundred nanoseconds, so this seems like a reasonable starting point. 
- */
-#define HATRING_STARTING_SLEEP_TIME  100
-
-/* Sleep time can double 23 times while staying under a second.
- * We'll use this as a cap, even though we never expect to see this
- * much of a delay in the real world.
- */
-#define HATRING_MAX_SLEEP_TIME 999999999
-
-
 hatring_t *
 hatring_new(uint64_t num_buckets)
 {
@@ -56,9 +44,11 @@ hatring_new(uint64_t num_buckets)
      * numbered 0.
      */
     
-    ret->epochs    = (num_buckets << 32) | num_buckets;
+    hatring_set_epochs(ret, num_buckets);
+
     ret->last_slot = num_buckets - 1;
     ret->size      = num_buckets;
+    ret->backoff   = hatrack_backoff_default;
 
     return ret;
 }
@@ -74,7 +64,11 @@ hatring_init(hatring_t *self, uint64_t num_buckets)
     
     bzero(self, sizeof(hatring_t) + sizeof(hatring_cell_t) * num_buckets);
 
+    hatring_set_epochs(self, num_buckets);
+
     self->last_slot = num_buckets - 1;
+    self->size      = num_buckets;
+    self->backoff   = hatrack_backoff_default;
 
     return;
 }
@@ -107,75 +101,47 @@ hatring_delete(hatring_t *self)
     return;
 }
 
-uint32_t
+uint64_t
 hatring_enqueue(hatring_t *self, void *item)
 {
-    uint64_t       epochs;
-    uint32_t       read_epoch;
-    uint32_t       write_epoch;
-    uint32_t       cell_epoch;        
-    uint64_t       candidate_epoch;
-    uint64_t       ix;
-    hatring_item_t expected;
-    hatring_item_t candidate;
-    
-    struct timespec sleep_time = {
-	.tv_sec  = 0,
-	.tv_nsec = HATRING_STARTING_SLEEP_TIME
-    };
+    uint64_t                read_epoch;
+    uint64_t                write_epoch;
+    uint64_t                cell_epoch;
+    uint64_t                ix;
+    hatring_item_t          expected;
+    hatring_item_t          candidate;
+    hatrack_backoff_state_t backoff;
+
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     candidate.item = item;
 
     while (true) {
-	epochs      = atomic_read(&self->epochs);
-	read_epoch  = hatring_dequeue_epoch(epochs);
-	write_epoch = hatring_enqueue_epoch(epochs);
+	/* If we're confident we're going to lose to a reader who got
+	 * FAA'd past us, don't bother writing.
+	 */
+	do {
+	    write_epoch = atomic_fetch_add(&self->write_epoch, 1);
+	    read_epoch  = atomic_read(&self->read_epoch);
+	} while (write_epoch < read_epoch);
 
 	/*  If there are more enqueues than dequeues, we may end up
 	 *  with the tail lagging. The enqueue side is responsible for
-	 *  keeping the tail close; if we're having a problem doing
-	 *  that, then we are competing either with dequeuers who are
-	 *  overwhelmed by the enqueues, or with other enqueuers.
-	 *
-	 *  In this kind of case, we want to slow things down some, to
-	 *  give dequeuers a bit of time to finish an operation.
-	 *  Basically, once the ring fills up, we make enqueues
-	 *  deferential to operations that might be having a hard time
-	 *  completing, using exponential backoff.
+	 *  keeping the tail close, so if the read epoch is more than a
+	 *  ring behind the slot we just claimed, we drag it up to the
+	 *  oldest epoch that can still be in the ring.
 	 *
-	 * This will not only help out dequeue attempts, it will also
-         * help slow enqueuers.
+	 *  We only try once. If the CAS fails, the read epoch moved
+	 *  forward, either because of a dequeue or because another
+	 *  enqueuer dragged it up already. Either way, somebody else
+	 *  is making progress, and the dequeuers can deal with the
+	 *  rest of the lag themselves (they see they got lapped, and
+	 *  try again), so we don't need to spin here.
 	 */
-	while (hatring_is_lagging(read_epoch, write_epoch, self->size)) {
-	    candidate_epoch = hatring_fixed_epoch(write_epoch + 1,
-						  self->size);
-	    
-	    if (CAS(&self->epochs, &epochs, candidate_epoch)) {
-		goto try_once;
-	    }
-	    
-	    nanosleep(&sleep_time, NULL);
-
-	    sleep_time.tv_nsec <<= 1;
-	    if (sleep_time.tv_nsec > HATRING_MAX_SLEEP_TIME) {
-		sleep_time.tv_nsec = HATRING_MAX_SLEEP_TIME;
-	    }
-	    
-	    epochs      = atomic_read(&self->epochs);	    
-	    read_epoch  = hatring_dequeue_epoch(epochs);
-	    write_epoch = hatring_enqueue_epoch(epochs);
+	if (hatring_is_lagging(read_epoch, write_epoch, self->size)) {
+	    CAS(&self->read_epoch, &read_epoch, write_epoch + 1 - self->size);
 	}
 
-	/* If we're confident we're going to lose to a writer who got
-	 * FAA'd past us, don't bother writing.
-	 */
-	do {
-	epochs      = atomic_fetch_add(&self->epochs, 1L << 32);
-	read_epoch  = hatring_dequeue_epoch(epochs);
-	write_epoch = hatring_enqueue_epoch(epochs);
-	} while (write_epoch < read_epoch);
-	
-    try_once:
 	ix          = write_epoch & self->last_slot;
 	expected    = atomic_read(&self->cells[ix]);
 	cell_epoch  = hatring_cell_epoch(expected.state);
@@ -195,6 +161,7 @@ hatring_enqueue(hatring_t *self, void *item)
 	    cell_epoch = hatring_cell_epoch(expected.state);
 	}
 
+	hatrack_backoff(&backoff);
 	continue; 	// We were too slow, so we start again.
     }
 }
@@ -202,30 +169,30 @@ hatring_enqueue(hatring_t *self, void *item)
 void *
 hatring_dequeue(hatring_t *self, bool *found)
 {
-    uint64_t       epochs;
-    uint32_t       read_epoch;
-    uint32_t       write_epoch;
-    uint32_t       cell_epoch;    
-    uint64_t       ix;
-    hatring_item_t expected;
-    hatring_item_t candidate;
-    hatring_item_t saw;
+    hatring_epochs_t        epochs;
+    uint64_t                read_epoch;
+    uint64_t                write_epoch;
+    uint64_t                cell_epoch;
+    uint64_t                ix;
+    hatring_item_t          expected;
+    hatring_item_t          candidate;
+    hatring_item_t          saw;
+    hatrack_backoff_state_t backoff;
+
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     candidate.item = NULL;
 
     while (true) {
-	epochs      = atomic_read(&self->epochs);
-	read_epoch  = hatring_dequeue_epoch(epochs);
-	write_epoch = hatring_enqueue_epoch(epochs);
+	epochs = hatring_get_epochs(self);
 
-	if (read_epoch >= write_epoch) {
+	if (hatring_dequeue_epoch(epochs) >= hatring_enqueue_epoch(epochs)) {
 	    return hatrack_not_found(found);
 	}
 	
-	epochs          = atomic_fetch_add(&self->epochs, 1);
-	ix              = hatring_dequeue_ix(epochs, self->last_slot);
-	read_epoch      = hatring_dequeue_epoch(epochs);
-	write_epoch     = hatring_enqueue_epoch(epochs);
+	read_epoch      = atomic_fetch_add(&self->read_epoch, 1);
+	write_epoch     = atomic_read(&self->write_epoch);
+	ix              = read_epoch & self->last_slot;
 	expected        = atomic_read(&self->cells[ix]);
 	cell_epoch      = hatring_cell_epoch(expected.state);
 	candidate.state = HATRING_DEQUEUED | read_epoch;
@@ -291,37 +258,36 @@ hatring_dequeue(hatring_t *self, bool *found)
 		cell_epoch = hatring_cell_epoch(expected.state);		
 	    }
 	}
+	hatrack_backoff(&backoff);
 	continue;  	// we got lapped.
     }
 }
 
 void *
-hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint32_t *epoch)
+hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint64_t *epoch)
 {
-    uint64_t       epochs;
-    uint32_t       read_epoch;
-    uint32_t       write_epoch;
-    uint32_t       cell_epoch;    
-    uint64_t       ix;
-    hatring_item_t expected;
-    hatring_item_t candidate;
-    hatring_item_t saw;
+    hatring_epochs_t        epochs;
+    uint64_t                read_epoch;
+    uint64_t                cell_epoch;
+    uint64_t                ix;
+    hatring_item_t          expected;
+    hatring_item_t          candidate;
+    hatring_item_t          saw;
+    hatrack_backoff_state_t backoff;
+
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     candidate.item = NULL;
 
     while (true) {
-	epochs      = atomic_read(&self->epochs);
-	read_epoch  = hatring_dequeue_epoch(epochs);
-	write_epoch = hatring_enqueue_epoch(epochs);
+	epochs = hatring_get_epochs(self);
 
-	if (read_epoch >= write_epoch) {
+	if (hatring_dequeue_epoch(epochs) >= hatring_enqueue_epoch(epochs)) {
 	    return hatrack_not_found(found);
 	}
 	
-	epochs          = atomic_fetch_add(&self->epochs, 1);
-	ix              = hatring_dequeue_ix(epochs, self->last_slot);
-	read_epoch      = hatring_dequeue_epoch(epochs);
-	write_epoch     = hatring_enqueue_epoch(epochs);
+	read_epoch      = atomic_fetch_add(&self->read_epoch, 1);
+	ix              = read_epoch & self->last_slot;
 	expected        = atomic_read(&self->cells[ix]);
 	cell_epoch      = hatring_cell_epoch(expected.state);
 	candidate.state = HATRING_DEQUEUED | read_epoch;
@@ -385,6 +351,7 @@ hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint32_t *epoch)
 		cell_epoch = hatring_cell_epoch(expected.state);		
 	    }
 	}
+	hatrack_backoff(&backoff);
 	continue;  	// we got lapped.
     }
 }
@@ -397,14 +364,14 @@ hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint32_t *epoch)
 hatring_view_t *
 hatring_view(hatring_t *self)
 {
-    hatring_view_t *ret;
-    uint64_t        epochs;
-    uint32_t        n;
-    uint32_t        end;
-    hatring_item_t  cell;
+    hatring_view_t  *ret;
+    hatring_epochs_t epochs;
+    uint64_t         n;
+    uint64_t         end;
+    hatring_item_t   cell;
 
     ret    = hatrack_cell_alloc(hatring_view_t, hatring_item_t, self->size);
-    epochs = atomic_read(&self->epochs);
+    epochs = hatring_get_epochs(self);
     n      = hatring_dequeue_epoch(epochs);
     end    = hatring_enqueue_epoch(epochs);
 
@@ -417,8 +384,7 @@ hatring_view(hatring_t *self)
 	}
 
 	n++;
-	epochs = atomic_read(&self->epochs);
-	end    = hatring_enqueue_epoch(epochs);
+	end = atomic_read(&self->write_epoch);
 
     }
 
@@ -127,11 +127,13 @@ static const union {
 
 
 
-static hq_store_t *hq_new_store(uint64_t);
-static uint64_t    hq_migrate  (hq_store_t *, hq_t *);
+static hq_store_t *hq_new_store        (hq_t *, uint64_t);
+static hq_store_t *hq_new_bounded_store(uint64_t);
+static uint64_t    hq_migrate          (hq_store_t *, hq_t *);
 
 #define HQ_DEFAULT_SIZE 1024
 #define HQ_MINIMUM_SIZE 128
+#define HQ_MINIMUM_BOUND 2
 
 void
 hq_init(hq_t *self)
@@ -148,8 +150,15 @@ hq_init_size(hq_t *self, uint64_t size)
 	size = HQ_MINIMUM_SIZE;
     }
     
-    self->store         = hq_new_store(size);
-    self->len           = 0;
+    self->store_cache     = mmm_cache_new();
+    self->store           = hq_new_store(self, size);
+    self->len             = 0;
+    self->capacity        = 0;
+    self->parking.waiters = 0;
+    self->parking.seq     = 0;
+    self->space.waiters   = 0;
+    self->space.seq       = 0;
+    self->backoff         = hatrack_backoff_default;
     
     self->store->dequeue_index = size;
     self->store->enqueue_index = size;
@@ -157,6 +166,42 @@ hq_init_size(hq_t *self, uint64_t size)
     return;
 }
 
+/* A bounded queue is one that never migrates. Its one and only store
+ * is allocated up front, aligned to a cache line, and holds exactly
+ * 'capacity' items, rounded up to a power of two (since we index
+ * cells with a mask). Once it's full, hq_try_enqueue() fails, and
+ * hq_enqueue() and hq_enqueue_wait() block until a dequeue makes
+ * room.
+ *
+ * That keeps a slow consumer from causing the queue to double in
+ * size over and over, until we run out of memory; instead, the
+ * producers get pushed back on.
+ */
+void
+hq_init_bounded(hq_t *self, uint64_t capacity)
+{
+    capacity = hatrack_round_up_to_power_of_2(capacity);
+
+    if (capacity < HQ_MINIMUM_BOUND) {
+	capacity = HQ_MINIMUM_BOUND;
+    }
+
+    self->store_cache     = NULL;
+    self->store           = hq_new_bounded_store(capacity);
+    self->len             = 0;
+    self->capacity        = capacity;
+    self->parking.waiters = 0;
+    self->parking.seq     = 0;
+    self->space.waiters   = 0;
+    self->space.seq       = 0;
+    self->backoff         = hatrack_backoff_default;
+
+    self->store->dequeue_index = capacity;
+    self->store->enqueue_index = capacity;
+
+    return;
+}
+
 hq_t *
 hq_new(void)
 {
@@ -174,6 +219,17 @@ hq_new_size(uint64_t size)
     return ret;
 }
 
+hq_t *
+hq_new_bounded(uint64_t capacity)
+{
+    hq_t *ret;
+
+    ret = (hq_t *)malloc(sizeof(hq_t));
+    hq_init_bounded(ret, capacity);
+
+    return ret;
+}
+
 /* We assume here that this is only going to get called when there are
  * definitely no more enqueuers/dequeuers in the queue.  If you need
  * to decref or free any remaining contents, drain the queue before
@@ -182,7 +238,13 @@ hq_new_size(uint64_t size)
 void
 hq_cleanup(hq_t *self)
 {
+    if (hq_is_bounded(self)) {
+	free(self->store);
+	return;
+    }
+    
     mmm_retire(self->store);
+    mmm_cache_release(self->store_cache);
     
     return;
 }
@@ -207,18 +269,25 @@ hq_delete(hq_t *self)
 void
 hq_enqueue(hq_t *self, void *item)
 {
-    hq_store_t *store;
-    hq_item_t   expected;
-    hq_item_t   candidate;
-    uint64_t    cur_ix;
-    uint64_t    end_ix;
-    uint64_t    max;
-    uint64_t    step;
-    uint64_t    sz;
-    uint64_t    epoch;
-    hq_cell_t  *cell;    
+    hq_store_t             *store;
+    hq_item_t               expected;
+    hq_item_t               candidate;
+    uint64_t                cur_ix;
+    uint64_t                end_ix;
+    uint64_t                max;
+    uint64_t                step;
+    uint64_t                sz;
+    uint64_t                epoch;
+    hq_cell_t              *cell;
+    hatrack_backoff_state_t backoff;
+
+    if (hq_is_bounded(self)) {
+	hq_enqueue_wait(self, item, -1);
+	return;
+    }
     
     mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
     
     candidate.item  = item;
     
@@ -260,7 +329,8 @@ hq_enqueue(hq_t *self, void *item)
 	    }
 
 	    if ((epoch == cur_ix) && hq_cell_too_slow(expected)) {
-		step <<= 1;		
+		step <<= 1;
+		hatrack_backoff(&backoff);
 		continue;
 	    }
 	    
@@ -269,6 +339,7 @@ hq_enqueue(hq_t *self, void *item)
 	    if (CAS(cell, &expected, candidate)) {
 		atomic_fetch_add(&self->len, 1);
 		mmm_end_op();
+		hatrack_unpark(&self->parking, 1);
 
 		return;
 	    }
@@ -282,26 +353,142 @@ hq_enqueue(hq_t *self, void *item)
 	    }
 
 	    step <<= 1;
+	    hatrack_backoff(&backoff);
 	}
 	
 	hq_migrate(store, self);
     }
 }
 
+/* hq_try_enqueue() is the enqueue operation for bounded queues. It
+ * returns false, instead of migrating, whenever the regular enqueue
+ * would have migrated because the queue is full.
+ *
+ * Since the store never changes, we don't need to check for
+ * migrations, and we don't need an mmm reservation to protect the
+ * store, either.
+ *
+ * We look before we FAA; if the queue is full, we'd otherwise push
+ * the head past the tail on every failed attempt, creating a pile of
+ * skipped cells the dequeuers then have to plow through. Two
+ * enqueuers can still race for the last free cell, though. When the
+ * loser finds its cell still occupied, it just gives up, and its
+ * index gets skipped, just like any other cell an enqueuer abandons.
+ *
+ * On a regular queue, this is just hq_enqueue(), and always succeeds.
+ */
+bool
+hq_try_enqueue(hq_t *self, void *item)
+{
+    hq_store_t             *store;
+    hq_item_t               expected;
+    hq_item_t               candidate;
+    uint64_t                cur_ix;
+    uint64_t                sz;
+    uint64_t                epoch;
+    hq_cell_t              *cell;
+    hatrack_backoff_state_t backoff;
+
+    if (!hq_is_bounded(self)) {
+	hq_enqueue(self, item);
+	return true;
+    }
+
+    store          = atomic_read(&self->store);
+    sz             = store->size;
+    candidate.item = item;
+
+    hatrack_backoff_start(&backoff, &self->backoff);
+
+    while (true) {
+	cur_ix = atomic_read(&store->enqueue_index);
+
+	if (cur_ix >= atomic_read(&store->dequeue_index) + sz) {
+	    return false;
+	}
+
+	cur_ix   = atomic_fetch_add(&store->enqueue_index, 1);
+	cell     = &store->cells[hq_ix(cur_ix, sz)];
+	expected = atomic_read(cell);
+	epoch    = hq_extract_epoch(expected.state);
+
+	if ((epoch < cur_ix) && hq_is_queued(expected.state)) {
+	    return false;
+	}
+
+	// Either we were too slow, or somebody lapped us.
+	if (epoch >= cur_ix) {
+	    hatrack_backoff(&backoff);
+	    continue;
+	}
+
+	candidate.state = hq_set_used(cur_ix);
+
+	if (CAS(cell, &expected, candidate)) {
+	    atomic_fetch_add(&self->len, 1);
+	    hatrack_unpark(&self->parking, 1);
+
+	    return true;
+	}
+
+	hatrack_backoff(&backoff);
+    }
+}
+
+/* hq_enqueue_wait() is to hq_try_enqueue() what hq_dequeue_wait() is
+ * to hq_dequeue(): it spins a little, then sleeps until a dequeuer
+ * makes room, for up to timeout_ms milliseconds (or forever, if
+ * timeout_ms is negative). Returns false if it timed out without
+ * enqueuing.
+ */
+bool
+hq_enqueue_wait(hq_t *self, void *item, int64_t timeout_ms)
+{
+    struct timespec  ts;
+    struct timespec *deadline;
+    uint32_t         seq;
+    uint64_t         i;
+
+    for (i = 0; i <= HATRACK_QUEUE_WAIT_SPINS; i++) {
+	if (hq_try_enqueue(self, item)) {
+	    return true;
+	}
+    }
+
+    deadline = hatrack_park_deadline(timeout_ms, &ts);
+
+    while (true) {
+	seq = hatrack_park_prepare(&self->space);
+
+	if (hq_try_enqueue(self, item)) {
+	    hatrack_park_cancel(&self->space);
+	    return true;
+	}
+
+	if (!hatrack_park(&self->space, seq, deadline)) {
+	    break;
+	}
+    }
+
+    return hq_try_enqueue(self, item);
+}
+
 void *
 hq_dequeue(hq_t *self, bool *found)
 {
-    hq_store_t *store;
-    uint64_t    sz;
-    uint64_t    cur_ix;
-    uint64_t    end_ix;
-    uint64_t    epoch;
-    hq_item_t   expected;
-    hq_item_t   candidate;
-    void       *ret;
-    hq_cell_t  *cell;
+    hq_store_t             *store;
+    uint64_t                sz;
+    uint64_t                cur_ix;
+    uint64_t                end_ix;
+    uint64_t                epoch;
+    hq_item_t               expected;
+    hq_item_t               candidate;
+    void                   *ret;
+    hq_cell_t              *cell;
+    hatrack_backoff_state_t backoff;
 
     mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     store          = atomic_read(&self->store);
     candidate.item = NULL;
@@ -362,7 +549,10 @@ hq_dequeue(hq_t *self, bool *found)
 	    }
 
 	    atomic_fetch_sub(&self->len, 1);	    
-	    return hatrack_found_w_mmm(found, expected.item);
+	    mmm_end_op();
+	    hatrack_unpark(&self->space, 1);
+	    
+	    return hatrack_found(found, expected.item);
 	}
 	
 	cell      = &store->cells[hq_ix(cur_ix, sz)];
@@ -387,6 +577,10 @@ hq_dequeue(hq_t *self, bool *found)
 		if ((cur_ix + 1) == end_ix) {
 		    return hatrack_not_found_w_mmm(found);			
 		}
+		/* We got ahead of an enqueuer; give it a moment
+		 * before we go try again.
+		 */
+		hatrack_backoff(&backoff);
 		goto retry_dequeue;
 	    }
 	    epoch = hq_extract_epoch(expected.state);
@@ -398,10 +592,15 @@ hq_dequeue(hq_t *self, bool *found)
 	     * previously skipped, otherwise the enqueuer would have
 	     * triggered a resize.  There's probably a resize in
 	     * progress, but let's make sure, and then restart the op.
+	     *
+	     * Bounded queues never resize; there, this only means the
+	     * enqueuer for our cell gave up on it, so we just restart.
 	     */
 
-	    hq_migrate(store, self);
-	    store = atomic_read(&self->store);
+	    if (!hq_is_bounded(self)) {
+		hq_migrate(store, self);
+		store = atomic_read(&self->store);
+	    }
 	    continue;
 	}
 	
@@ -418,10 +617,338 @@ hq_dequeue(hq_t *self, bool *found)
 	}
 
 	atomic_fetch_sub(&self->len, 1);
-	return hatrack_found_w_mmm(found, ret);
+	mmm_end_op();
+	hatrack_unpark(&self->space, 1);
+	
+	return hatrack_found(found, ret);
     }
 }
 
+/* hq_enqueue_many() is hq_enqueue(), except that we reserve a whole
+ * range of cells with a single FAA, and then fill them in order. The
+ * per-cell checks are the same as above, and so is the length update,
+ * except we only do it once per range.
+ *
+ * Since we write the cells in order, when something goes wrong part
+ * way through a range, everything before the problem cell is already
+ * enqueued, and we just need to enqueue the rest of the items with a
+ * new reservation. The cells we reserved but didn't use are skipped,
+ * just as if a single enqueuer had given up on them.
+ *
+ * That happens in two cases:
+ *
+ * 1) A dequeuer marked one of our cells as too slow. We re-reserve
+ *    for the remaining items, out of the same store.
+ *
+ * 2) We need to migrate (either the store is full, or someone else
+ *    started a migration). Anything we've already written into the
+ *    old store will get migrated, ahead of anything we write into the
+ *    new store, so we keep our items in order.
+ *
+ * We never reserve more than a store's worth of cells at once; if
+ * we're asked to enqueue more than that, it'll take multiple
+ * reservations (and will certainly cause the queue to grow).
+ */
+void
+hq_enqueue_many(hq_t *self, void **items, uint64_t num)
+{
+    hq_store_t             *store;
+    hq_item_t               expected;
+    hq_item_t               candidate;
+    uint64_t                cur_ix;
+    uint64_t                end_ix;
+    uint64_t                last_ix;
+    uint64_t                max;
+    uint64_t                sz;
+    uint64_t                epoch;
+    uint64_t                written;
+    uint64_t                total;
+    hq_cell_t              *cell;
+    hatrack_backoff_state_t backoff;
+
+    if (hq_is_bounded(self)) {
+	while (num--) {
+	    hq_enqueue_wait(self, *items++, -1);
+	}
+	return;
+    }
+
+    mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
+
+    total = num;
+
+    while (num) {
+	store   = atomic_read(&self->store);
+	sz      = store->size;
+	written = 0;
+	cur_ix  = atomic_fetch_add(&store->enqueue_index, num < sz ? num : sz);
+	end_ix  = atomic_read(&store->dequeue_index);
+	last_ix = cur_ix + (num < sz ? num : sz);
+
+	if (end_ix & HQ_MOVING) {
+	    goto migrate;
+	}
+
+	max = end_ix + sz;
+
+	for (; cur_ix < last_ix; cur_ix++) {
+	    if (cur_ix >= max) {
+		goto migrate;
+	    }
+
+	    cell     = &store->cells[hq_ix(cur_ix, sz)];
+	    expected = atomic_read(cell);
+	    epoch    = hq_extract_epoch(expected.state);
+
+	    if (epoch > cur_ix || hq_is_moving(expected.state)) {
+		goto migrate;
+	    }
+
+	    if ((epoch < cur_ix) && hq_is_queued(expected.state)) {
+		goto migrate;
+	    }
+
+	    if ((epoch == cur_ix) && hq_cell_too_slow(expected)) {
+		hatrack_backoff(&backoff);
+		break;
+	    }
+
+	    candidate.item  = items[written];
+	    candidate.state = hq_set_used(cur_ix);
+
+	    if (!CAS(cell, &expected, candidate)) {
+		if (hq_extract_epoch(expected.state) != cur_ix
+		    || hq_is_moving(expected.state)) {
+		    goto migrate;
+		}
+		hatrack_backoff(&backoff);
+		break;
+	    }
+
+	    written++;
+	}
+
+	atomic_fetch_add(&self->len, written);
+	items += written;
+	num   -= written;
+	continue;
+
+    migrate:
+	atomic_fetch_add(&self->len, written);
+	items += written;
+	num   -= written;
+
+	hq_migrate(store, self);
+    }
+
+    mmm_end_op();
+    hatrack_unpark(&self->parking, total);
+
+    return;
+}
+
+/* hq_dequeue_many() claims a range of up to max cells with a single
+ * FAA, and then dequeues each of them, following the same rules as
+ * hq_dequeue(). It returns the number of items written into 'out',
+ * which will be fewer than max if the queue runs dry.
+ *
+ * As with hq_dequeue(), we don't bother to FAA if the queue looks
+ * empty, and we don't claim more cells than look like they're in the
+ * queue, so that we don't push the tail way past the head.
+ *
+ * The interesting case is when we notice a migration part way through
+ * our range. The rule from hq_dequeue() applies to each cell we've
+ * got left: any cell with an epoch lower than the one hq_migrate()
+ * returns didn't get migrated, so we must finish dequeuing it out of
+ * the old store. Since our cells are in epoch order, once we hit one
+ * that did get migrated, all the rest did too, and we go back to
+ * claim however many items we still want from the new store. That
+ * keeps everything we return in queue order.
+ */
+uint64_t
+hq_dequeue_many(hq_t *self, void **out, uint64_t max)
+{
+    hq_store_t *store;
+    uint64_t    sz;
+    uint64_t    cur_ix;
+    uint64_t    end_ix;
+    uint64_t    last_ix;
+    uint64_t    epoch;
+    uint64_t    n;
+    uint64_t    taken;
+    uint64_t    ret;
+    hq_item_t   expected;
+    hq_item_t   candidate;
+    hq_cell_t  *cell;
+
+    mmm_start_basic_op();
+
+    store          = atomic_read(&self->store);
+    candidate.item = NULL;
+    ret            = 0;
+
+    while (ret < max) {
+	sz     = store->size;
+	cur_ix = atomic_read(&store->dequeue_index);
+
+	if (cur_ix & HQ_MOVING) {
+	    hq_migrate(store, self);
+	    store = atomic_read(&self->store);
+	    continue;
+	}
+
+	end_ix = atomic_read(&store->enqueue_index);
+
+	if (cur_ix >= end_ix) {
+	    break;
+	}
+
+	n       = end_ix - cur_ix;
+	n       = n < (max - ret) ? n : (max - ret);
+	cur_ix  = atomic_fetch_add(&store->dequeue_index, n);
+	taken   = 0;
+
+	if (cur_ix & HQ_MOVING) {
+	    cur_ix &= ~HQ_MOVING;
+	    last_ix = cur_ix + n;
+	    goto migrate_then_finish;
+	}
+
+	last_ix = cur_ix + n;
+
+	for (; cur_ix < last_ix; cur_ix++) {
+	    cell     = &store->cells[hq_ix(cur_ix, sz)];
+	    expected = atomic_read(cell);
+	    epoch    = hq_extract_epoch(expected.state);
+
+	    while (epoch < cur_ix) {
+		// An old item that's still enqueued means we're past
+		// the head, and the enqueuer for this cell will end up
+		// migrating, so there's nothing to do.
+		if (hq_is_queued(expected.state)) {
+		    goto next_cell;
+		}
+
+		candidate.state = HQ_TOOSLOW | cur_ix;
+
+		if (CAS(cell, &expected, candidate)) {
+		    goto next_cell;
+		}
+
+		epoch = hq_extract_epoch(expected.state);
+	    }
+
+	    if (epoch > cur_ix && hq_is_bounded(self)) {
+		// The cell was skipped, and then reused; see hq_dequeue().
+		goto next_cell;
+	    }
+
+	    if (epoch > cur_ix || hq_is_moving(expected.state)) {
+		goto migrate_then_finish;
+	    }
+
+	    candidate.state = cur_ix;
+
+	    if (!CAS(cell, &expected, candidate)) {
+		goto migrate_then_finish;
+	    }
+
+	    out[ret++] = expected.item;
+	    taken++;
+
+	next_cell:
+	    continue;
+	}
+
+	atomic_fetch_sub(&self->len, taken);
+	continue;
+
+    migrate_then_finish:
+	epoch = hq_migrate(store, self);
+
+	for (; cur_ix < last_ix && cur_ix < epoch; cur_ix++) {
+	    expected = atomic_read(&store->cells[hq_ix(cur_ix, sz)]);
+
+	    if (hq_extract_epoch(expected.state) == cur_ix
+		&& hq_is_queued(expected.state)) {
+		out[ret++] = expected.item;
+		taken++;
+	    }
+	}
+
+	atomic_fetch_sub(&self->len, taken);
+	store = atomic_read(&self->store);
+    }
+
+    mmm_end_op();
+
+    if (ret) {
+	hatrack_unpark(&self->space, ret);
+    }
+
+    return ret;
+}
+
+/* hq_dequeue_wait() is hq_dequeue(), except that, when the queue is
+ * empty, it waits for something to show up, for up to timeout_ms
+ * milliseconds (or forever, if timeout_ms is negative).
+ *
+ * We retry HATRACK_QUEUE_WAIT_SPINS times first, since, if an item is
+ * about to show up, that's much cheaper than a trip through the
+ * kernel. After that, we sleep on the queue's futex, per the protocol
+ * in parking.h. Since the enqueue side only makes a system call when
+ * someone is actually asleep, this costs enqueuers nothing unless
+ * it's actually needed.
+ *
+ * Note that we don't hold an mmm reservation while we're asleep;
+ * each attempt is a regular call to hq_dequeue().
+ */
+void *
+hq_dequeue_wait(hq_t *self, bool *found, int64_t timeout_ms)
+{
+    struct timespec  ts;
+    struct timespec *deadline;
+    uint32_t         seq;
+    uint64_t         i;
+    void            *ret;
+    bool             f;
+
+    for (i = 0; i <= HATRACK_QUEUE_WAIT_SPINS; i++) {
+	ret = hq_dequeue(self, &f);
+
+	if (f) {
+	    return hatrack_found(found, ret);
+	}
+    }
+
+    deadline = hatrack_park_deadline(timeout_ms, &ts);
+
+    while (true) {
+	seq = hatrack_park_prepare(&self->parking);
+	ret = hq_dequeue(self, &f);
+
+	if (f) {
+	    hatrack_park_cancel(&self->parking);
+
+	    return hatrack_found(found, ret);
+	}
+
+	if (!hatrack_park(&self->parking, seq, deadline)) {
+	    break;
+	}
+    }
+
+    // We timed out, but give it one last shot.
+    ret = hq_dequeue(self, &f);
+
+    if (f) {
+	return hatrack_found(found, ret);
+    }
+
+    return hatrack_not_found(found);
+}
+
 hq_view_t *
 hq_view(hq_t *self)
 {
@@ -429,6 +956,13 @@ hq_view(hq_t *self)
     hq_store_t *store;
     bool        expected;
 
+    /* Views work by migrating the store out from under the queue,
+     * which is exactly what a bounded queue can't do.
+     */
+    if (hq_is_bounded(self)) {
+	abort();
+    }
+
     mmm_start_basic_op();
 
     ret = (hq_view_t *)malloc(sizeof(hq_view_t));
@@ -489,20 +1023,48 @@ hq_view_delete(hq_view_t *view)
     return;
 }
 
+/* Every thread that notices a migration is needed allocates a new
+ * store, and all but one of them throw theirs away, which is a lot of
+ * allocator traffic for stores this big. Going through the cache
+ * means the losers' stores get reused by the next thread along.
+ */
 static hq_store_t *
-hq_new_store(uint64_t size)
+hq_new_store(hq_t *self, uint64_t size)
 {
     hq_store_t *ret;
     uint64_t    alloc_len;
 
     alloc_len = sizeof(hq_store_t) + sizeof(hq_cell_t) * size;
-    ret       = (hq_store_t *)mmm_alloc_committed(alloc_len);
+    ret       = (hq_store_t *)mmm_cache_alloc_committed(self->store_cache,
+							alloc_len);
     
     ret->size = size;
 
     return ret;
 }
 
+/* Bounded stores never get retired through mmm, since they live as
+ * long as the queue does, so we skip the mmm header, and give the
+ * store its own cache-aligned allocation.
+ */
+static hq_store_t *
+hq_new_bounded_store(uint64_t size)
+{
+    hq_store_t *ret;
+    uint64_t    alloc_len;
+
+    alloc_len = sizeof(hq_store_t) + sizeof(hq_cell_t) * size;
+    alloc_len = (alloc_len + HATRACK_CACHE_LINE_SIZE - 1)
+	& ~((uint64_t)HATRACK_CACHE_LINE_SIZE - 1);
+    ret       = (hq_store_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+					    alloc_len);
+
+    memset(ret, 0, alloc_len);
+    ret->size = size;
+
+    return ret;
+}
+
 static uint64_t
 hq_migrate(hq_store_t *store, hq_t *top)
 {
@@ -516,6 +1078,13 @@ hq_migrate(hq_store_t *store, hq_t *top)
     uint64_t    lowest;
     uint64_t    epoch;
 
+    /* Bounded queues never set the MOVING bit, and never skip cells
+     * in a way that requires a migration, so we should never get
+     * here with one.
+     */
+    if (hq_is_bounded(top)) {
+	abort();
+    }
 
     atomic_fetch_or_explicit(&store->dequeue_index,
     			     HQ_MOVING,
@@ -550,8 +1119,12 @@ hq_migrate(hq_store_t *store, hq_t *top)
 	}
     }
 
+    /* Anything lower than this is a skip. Note the + 1; the epoch
+     * exactly one store-length below the highest lives in the same
+     * cell as the highest, so it can't still be in the queue.
+     */
     n      = highest;
-    lowest = (highest - store->size); // Anything lower than this is a skip.
+    lowest = (highest - store->size) + 1;
     
 
     // When starting at the highest epoch, the lowest non-skipped
@@ -574,7 +1147,7 @@ hq_migrate(hq_store_t *store, hq_t *top)
     }
 
     expected_store = NULL;
-    next_store     = hq_new_store(store->size << 1);
+    next_store     = hq_new_store(top, store->size << 1);
 
     atomic_store(&next_store->enqueue_index, HQ_STORE_INITIALIZING);
     atomic_store(&next_store->dequeue_index, HQ_STORE_INITIALIZING);    
@@ -0,0 +1,361 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hq_mpsc.c
+ *  Description:    A multi-producer, single-consumer variant of hq.
+ *
+ *                  See hq_mpsc.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#define HQ_MPSC_DEFAULT_SIZE 1024
+#define HQ_MPSC_MINIMUM_SIZE 128
+
+static hq_mpsc_segment_t *hq_mpsc_new_segment(uint64_t, uint64_t);
+static void               hq_mpsc_extend     (hq_mpsc_t *,
+					      hq_mpsc_segment_t *);
+static hq_mpsc_segment_t *hq_mpsc_advance    (hq_mpsc_t *,
+					      hq_mpsc_segment_t *);
+
+void
+hq_mpsc_init(hq_mpsc_t *self)
+{
+    hq_mpsc_init_size(self, HQ_MPSC_DEFAULT_SIZE);
+
+    return;
+}
+
+/* Here, the size is the size of each segment, not the size of the
+ * queue. Since segments are never reused, there's no reason for it to
+ * be a power of two, but we round it up anyway, for consistency with
+ * everything else.
+ */
+void
+hq_mpsc_init_size(hq_mpsc_t *self, uint64_t size)
+{
+    hq_mpsc_segment_t *segment;
+
+    size = hatrack_round_up_to_power_of_2(size);
+
+    if (size < HQ_MPSC_MINIMUM_SIZE) {
+	size = HQ_MPSC_MINIMUM_SIZE;
+    }
+
+    segment               = hq_mpsc_new_segment(size, 0);
+    self->dequeue_segment = segment;
+
+    atomic_store(&self->enqueue_segment, segment);
+    atomic_store(&self->head, 0);
+
+    return;
+}
+
+hq_mpsc_t *
+hq_mpsc_new(void)
+{
+    return hq_mpsc_new_size(HQ_MPSC_DEFAULT_SIZE);
+}
+
+hq_mpsc_t *
+hq_mpsc_new_size(uint64_t size)
+{
+    hq_mpsc_t *ret;
+
+    ret = (hq_mpsc_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+				     sizeof(hq_mpsc_t));
+    hq_mpsc_init_size(ret, size);
+
+    return ret;
+}
+
+/* As with hq, this assumes nobody is using the queue anymore. Any
+ * items left in it are not freed.
+ */
+void
+hq_mpsc_cleanup(hq_mpsc_t *self)
+{
+    hq_mpsc_segment_t *segment;
+    hq_mpsc_segment_t *next;
+
+    segment = self->dequeue_segment;
+
+    while (segment) {
+	next = atomic_read(&segment->next);
+	mmm_retire(segment);
+	segment = next;
+    }
+
+    return;
+}
+
+void
+hq_mpsc_delete(hq_mpsc_t *self)
+{
+    hq_mpsc_cleanup(self);
+    free(self);
+
+    return;
+}
+
+void
+hq_mpsc_enqueue(hq_mpsc_t *self, void *item)
+{
+    hq_mpsc_segment_t *segment;
+    hq_mpsc_cell_t    *cell;
+    uint64_t           ix;
+
+    mmm_start_basic_op();
+
+    while (true) {
+	segment = atomic_read(&self->enqueue_segment);
+	ix      = atomic_fetch_add(&segment->enqueue_index, 1);
+
+	if (ix < segment->size) {
+	    break;
+	}
+
+	hq_mpsc_extend(self, segment);
+    }
+
+    cell       = &segment->cells[ix];
+    cell->item = item;
+
+    atomic_store_explicit(&cell->ready, true, memory_order_release);
+    mmm_end_op();
+
+    return;
+}
+
+void *
+hq_mpsc_dequeue(hq_mpsc_t *self, bool *found)
+{
+    hq_mpsc_segment_t *segment;
+    hq_mpsc_cell_t    *cell;
+    uint64_t           head;
+
+    segment = self->dequeue_segment;
+    head    = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    if (head - segment->base == segment->size) {
+	segment = hq_mpsc_advance(self, segment);
+
+	if (!segment) {
+	    return hatrack_not_found(found);
+	}
+    }
+
+    cell = &segment->cells[head - segment->base];
+
+    if (!atomic_load_explicit(&cell->ready, memory_order_acquire)) {
+	return hatrack_not_found(found);
+    }
+
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+
+    return hatrack_found(found, cell->item);
+}
+
+/* One FAA reserves a run of cells for the whole batch (or as much of
+ * it as could possibly fit in the segment). If the run goes off the
+ * end of the segment, we fill what we got, and get a new reservation
+ * for the rest in the next segment. Either way, our items land in
+ * order.
+ */
+void
+hq_mpsc_enqueue_many(hq_mpsc_t *self, void **items, uint64_t num)
+{
+    hq_mpsc_segment_t *segment;
+    hq_mpsc_cell_t    *cell;
+    uint64_t           ix;
+    uint64_t           end;
+
+    mmm_start_basic_op();
+
+    while (num) {
+	segment = atomic_read(&self->enqueue_segment);
+	end     = num < segment->size ? num : segment->size;
+	ix      = atomic_fetch_add(&segment->enqueue_index, end);
+	end    += ix;
+
+	if (end > segment->size) {
+	    end = segment->size;
+	}
+
+	for (; ix < end; ix++) {
+	    cell       = &segment->cells[ix];
+	    cell->item = *items++;
+	    num--;
+
+	    atomic_store_explicit(&cell->ready, true, memory_order_release);
+	}
+
+	if (num) {
+	    hq_mpsc_extend(self, segment);
+	}
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
+/* We read ready cells until we run out, hit max, or hit the end of a
+ * segment with no next segment yet, and then publish our index once.
+ */
+uint64_t
+hq_mpsc_dequeue_many(hq_mpsc_t *self, void **out, uint64_t max)
+{
+    hq_mpsc_segment_t *segment;
+    hq_mpsc_cell_t    *cell;
+    uint64_t           head;
+    uint64_t           ret;
+
+    segment = self->dequeue_segment;
+    head    = atomic_load_explicit(&self->head, memory_order_relaxed);
+    ret     = 0;
+
+    while (ret < max) {
+	if (head - segment->base == segment->size) {
+	    segment = hq_mpsc_advance(self, segment);
+
+	    if (!segment) {
+		break;
+	    }
+	}
+
+	cell = &segment->cells[head - segment->base];
+
+	if (!atomic_load_explicit(&cell->ready, memory_order_acquire)) {
+	    break;
+	}
+
+	out[ret++] = cell->item;
+	head++;
+    }
+
+    if (ret) {
+	atomic_store_explicit(&self->head, head, memory_order_release);
+    }
+
+    return ret;
+}
+
+/* This counts cells that have been claimed, but not yet written, so
+ * it can be a little high while enqueues are in progress.
+ */
+int64_t
+hq_mpsc_len(hq_mpsc_t *self)
+{
+    hq_mpsc_segment_t *segment;
+    uint64_t           head;
+    uint64_t           ix;
+
+    mmm_start_basic_op();
+
+    head    = atomic_load_explicit(&self->head, memory_order_acquire);
+    segment = atomic_read(&self->enqueue_segment);
+    ix      = atomic_read(&segment->enqueue_index);
+
+    if (ix > segment->size) {
+	ix = segment->size;
+    }
+
+    ix += segment->base;
+
+    mmm_end_op();
+
+    if (ix < head) {
+	return 0;
+    }
+
+    return ix - head;
+}
+
+static hq_mpsc_segment_t *
+hq_mpsc_new_segment(uint64_t size, uint64_t base)
+{
+    hq_mpsc_segment_t *ret;
+    uint64_t           alloc_len;
+
+    alloc_len = sizeof(hq_mpsc_segment_t) + sizeof(hq_mpsc_cell_t) * size;
+    ret       = (hq_mpsc_segment_t *)mmm_alloc_committed(alloc_len);
+    ret->size = size;
+    ret->base = base;
+
+    return ret;
+}
+
+/* Called by a producer that got an index past the end of its segment.
+ * Whoever manages to link in the next segment wins; everyone else
+ * throws theirs away. Then we make sure the queue's enqueue segment
+ * points past the full one.
+ */
+static void
+hq_mpsc_extend(hq_mpsc_t *self, hq_mpsc_segment_t *segment)
+{
+    hq_mpsc_segment_t *next;
+    hq_mpsc_segment_t *expected;
+
+    next = atomic_read(&segment->next);
+
+    if (!next) {
+	expected = NULL;
+	next     = hq_mpsc_new_segment(segment->size,
+				       segment->base + segment->size);
+
+	if (!CAS(&segment->next, &expected, next)) {
+	    mmm_retire_unused(next);
+	    next = expected;
+	}
+    }
+
+    CAS(&self->enqueue_segment, &segment, next);
+
+    return;
+}
+
+/* Called by the consumer when it has read every cell in its segment.
+ * Returns NULL if there's no next segment yet.
+ *
+ * Before we retire the old segment, we make sure the enqueue segment
+ * pointer has moved past it. Otherwise, a producer that shows up after
+ * the retirement could still pick the segment up off the queue, and
+ * mmm wouldn't know to keep it around. Producers that already had
+ * their hands on it are covered by their reservations.
+ */
+static hq_mpsc_segment_t *
+hq_mpsc_advance(hq_mpsc_t *self, hq_mpsc_segment_t *segment)
+{
+    hq_mpsc_segment_t *next;
+    hq_mpsc_segment_t *expected;
+
+    next = atomic_load_explicit(&segment->next, memory_order_acquire);
+
+    if (!next) {
+	return NULL;
+    }
+
+    expected = segment;
+
+    CAS(&self->enqueue_segment, &expected, next);
+
+    self->dequeue_segment = next;
+    mmm_retire(segment);
+
+    return next;
+}
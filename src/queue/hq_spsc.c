@@ -0,0 +1,329 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hq_spsc.c
+ *  Description:    A single-producer, single-consumer variant of hq.
+ *
+ *                  See hq_spsc.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#define HQ_SPSC_DEFAULT_SIZE 1024
+#define HQ_SPSC_MINIMUM_SIZE 16
+
+static hq_spsc_ring_t *hq_spsc_new_ring(uint64_t, uint64_t);
+static hq_spsc_ring_t *hq_spsc_grow    (hq_spsc_t *, hq_spsc_ring_t *,
+					uint64_t);
+static hq_spsc_ring_t *hq_spsc_advance (hq_spsc_t *, uint64_t);
+
+void
+hq_spsc_init(hq_spsc_t *self)
+{
+    hq_spsc_init_size(self, HQ_SPSC_DEFAULT_SIZE);
+
+    return;
+}
+
+void
+hq_spsc_init_size(hq_spsc_t *self, uint64_t size)
+{
+    size = hatrack_round_up_to_power_of_2(size);
+
+    if (size < HQ_SPSC_MINIMUM_SIZE) {
+	size = HQ_SPSC_MINIMUM_SIZE;
+    }
+
+    self->enqueue_ring = hq_spsc_new_ring(size, 0);
+    self->dequeue_ring = self->enqueue_ring;
+    self->cached_head  = 0;
+    self->cached_tail  = 0;
+
+    atomic_store(&self->tail, 0);
+    atomic_store(&self->head, 0);
+
+    return;
+}
+
+hq_spsc_t *
+hq_spsc_new(void)
+{
+    return hq_spsc_new_size(HQ_SPSC_DEFAULT_SIZE);
+}
+
+hq_spsc_t *
+hq_spsc_new_size(uint64_t size)
+{
+    hq_spsc_t *ret;
+
+    ret = (hq_spsc_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+				     sizeof(hq_spsc_t));
+    hq_spsc_init_size(ret, size);
+
+    return ret;
+}
+
+/* As with hq, this assumes nobody is using the queue anymore. Any
+ * items left in it are not freed.
+ */
+void
+hq_spsc_cleanup(hq_spsc_t *self)
+{
+    hq_spsc_ring_t *ring;
+    hq_spsc_ring_t *next;
+
+    ring = self->dequeue_ring;
+
+    while (ring) {
+	next = atomic_load(&ring->next);
+	free(ring);
+	ring = next;
+    }
+
+    return;
+}
+
+void
+hq_spsc_delete(hq_spsc_t *self)
+{
+    hq_spsc_cleanup(self);
+    free(self);
+
+    return;
+}
+
+void
+hq_spsc_enqueue(hq_spsc_t *self, void *item)
+{
+    hq_spsc_ring_t *ring;
+    uint64_t        tail;
+    uint64_t        head;
+
+    ring = self->enqueue_ring;
+    tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    if (tail - self->cached_head >= ring->size) {
+	head              = atomic_load_explicit(&self->head,
+						 memory_order_acquire);
+	self->cached_head = head > ring->base ? head : ring->base;
+
+	if (tail - self->cached_head >= ring->size) {
+	    ring = hq_spsc_grow(self, ring, tail);
+	}
+    }
+
+    ring->cells[tail & (ring->size - 1)] = item;
+
+    atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+
+    return;
+}
+
+void *
+hq_spsc_dequeue(hq_spsc_t *self, bool *found)
+{
+    hq_spsc_ring_t *ring;
+    uint64_t        head;
+    void           *ret;
+
+    head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    if (head == self->cached_tail) {
+	self->cached_tail = atomic_load_explicit(&self->tail,
+						 memory_order_acquire);
+
+	if (head == self->cached_tail) {
+	    return hatrack_not_found(found);
+	}
+    }
+
+    ring = hq_spsc_advance(self, head);
+    ret  = ring->cells[head & (ring->size - 1)];
+
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+
+    return hatrack_found(found, ret);
+}
+
+/* We fill in as much of the current ring as we can, and publish the
+ * new tail once for the lot. If that doesn't get everything, we grow,
+ * and go again.
+ */
+void
+hq_spsc_enqueue_many(hq_spsc_t *self, void **items, uint64_t num)
+{
+    hq_spsc_ring_t *ring;
+    uint64_t        tail;
+    uint64_t        head;
+    uint64_t        room;
+    uint64_t        i;
+
+    ring = self->enqueue_ring;
+    tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    while (num) {
+	room = ring->size - (tail - self->cached_head);
+
+	if (room < num) {
+	    head              = atomic_load_explicit(&self->head,
+						     memory_order_acquire);
+	    self->cached_head = head > ring->base ? head : ring->base;
+	    room              = ring->size - (tail - self->cached_head);
+
+	    if (!room) {
+		ring = hq_spsc_grow(self, ring, tail);
+		room = ring->size;
+	    }
+	}
+
+	if (room > num) {
+	    room = num;
+	}
+
+	for (i = 0; i < room; i++) {
+	    ring->cells[(tail + i) & (ring->size - 1)] = items[i];
+	}
+
+	tail  += room;
+	items += room;
+	num   -= room;
+
+	atomic_store_explicit(&self->tail, tail, memory_order_release);
+    }
+
+    return;
+}
+
+/* Here, we grab everything that's available in the current ring (up
+ * to max), and publish the head once. We only need to go around again
+ * if we hit the end of a ring, and there's more in the next one.
+ */
+uint64_t
+hq_spsc_dequeue_many(hq_spsc_t *self, void **out, uint64_t max)
+{
+    hq_spsc_ring_t *ring;
+    hq_spsc_ring_t *next;
+    uint64_t        head;
+    uint64_t        n;
+    uint64_t        ret;
+    uint64_t        i;
+
+    head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    ret  = 0;
+
+    while (ret < max) {
+	if (head == self->cached_tail) {
+	    self->cached_tail = atomic_load_explicit(&self->tail,
+						     memory_order_acquire);
+
+	    if (head == self->cached_tail) {
+		break;
+	    }
+	}
+
+	ring = hq_spsc_advance(self, head);
+	next = atomic_load_explicit(&ring->next, memory_order_acquire);
+	n    = self->cached_tail - head;
+
+	if (next && next->base - head < n) {
+	    n = next->base - head;
+	}
+
+	if (n > max - ret) {
+	    n = max - ret;
+	}
+
+	for (i = 0; i < n; i++) {
+	    out[ret++] = ring->cells[(head + i) & (ring->size - 1)];
+	}
+
+	head += n;
+
+	atomic_store_explicit(&self->head, head, memory_order_release);
+    }
+
+    return ret;
+}
+
+static hq_spsc_ring_t *
+hq_spsc_new_ring(uint64_t size, uint64_t base)
+{
+    hq_spsc_ring_t *ret;
+    uint64_t        alloc_len;
+
+    alloc_len = sizeof(hq_spsc_ring_t) + sizeof(void *) * size;
+    alloc_len = (alloc_len + HATRACK_CACHE_LINE_SIZE - 1)
+	& ~((uint64_t)HATRACK_CACHE_LINE_SIZE - 1);
+    ret       = (hq_spsc_ring_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+						alloc_len);
+    ret->size = size;
+    ret->base = base;
+
+    atomic_store_explicit(&ret->next, NULL, memory_order_relaxed);
+
+    return ret;
+}
+
+/* Called by the producer when the current ring is full. The new ring
+ * starts at the current tail. We switch to it before we link it in,
+ * and once it's linked in, we never look at the old ring again, which
+ * is what lets the consumer free it without any further
+ * coordination.
+ *
+ * Since the link is published before the tail gets bumped for any
+ * item in the new ring, a consumer that sees such an item is sure to
+ * see the link.
+ */
+static hq_spsc_ring_t *
+hq_spsc_grow(hq_spsc_t *self, hq_spsc_ring_t *ring, uint64_t tail)
+{
+    hq_spsc_ring_t *next;
+
+    next               = hq_spsc_new_ring(ring->size << 1, tail);
+    self->enqueue_ring = next;
+    self->cached_head  = tail;
+
+    atomic_store_explicit(&ring->next, next, memory_order_release);
+
+    return next;
+}
+
+/* Called by the consumer, once it knows the item at 'head' has been
+ * published. If that item lives in the next ring, we're done with the
+ * current one.
+ *
+ * The producer only ever grows when a ring has at least one item in
+ * it, so there's never more than one ring to skip.
+ */
+static hq_spsc_ring_t *
+hq_spsc_advance(hq_spsc_t *self, uint64_t head)
+{
+    hq_spsc_ring_t *ring;
+    hq_spsc_ring_t *next;
+
+    ring = self->dequeue_ring;
+    next = atomic_load_explicit(&ring->next, memory_order_acquire);
+
+    if (next && head == next->base) {
+	self->dequeue_ring = next;
+	free(ring);
+
+	return next;
+    }
+
+    return ring;
+}
@@ -23,7 +23,15 @@
 
 #include <hatrack.h>
 
-static void logring_view_help_if_needed(logring_t *);
+// clang-format off
+static void             logring_view_help_if_needed(logring_t *);
+static logring_entry_t *logring_reserve_entry      (logring_t *);
+static void             logring_publish_entry      (logring_t *,
+						    logring_entry_t *,
+						    uint64_t);
+static logring_entry_t *logring_dequeue_entry      (logring_t *);
+static void             logring_dequeue_done       (logring_entry_t *);
+// clang-format on
 
 static const logring_entry_info_t empty_entry = {
     .write_epoch = 0,
@@ -95,49 +103,16 @@ logring_delete(logring_t *self)
 void
 logring_enqueue(logring_t *self, void *item, uint64_t len)
 {
-    uint64_t             ix;
-    uint64_t             byte_ix;
-    uint32_t             start_epoch;
-    logring_entry_info_t expected;
-    logring_entry_info_t candidate;
-    logring_entry_t     *cur;
+    logring_entry_t *cur;
 
     if (len > self->entry_len) {
 	len = self->entry_len;
     }
 
-    logring_view_help_if_needed(self);
-	
-    while (true) {
-	start_epoch = hatring_enqueue_epoch(atomic_read(&self->ring->epochs));
-	ix          = atomic_fetch_add(&self->entry_ix, 1) & self->last_entry;
-	expected    = empty_entry;
-	byte_ix     = ix * (sizeof(logring_entry_t) + self->entry_len);
-	cur         = (logring_entry_t *)&(((char *)self->entries)[byte_ix]);
-
-	candidate.write_epoch = 0;
-	candidate.state       = LOGRING_RESERVED;
-    
-	if (CAS(&cur->info, &expected, candidate)) {
-	    break;
-	}
-
-	if (!logring_can_write_here(expected, start_epoch)) {
-	    continue;
-	}
-
-	if (CAS(&cur->info, &expected, candidate)) {
-	    break;
-	}
-    }
+    cur = logring_reserve_entry(self);
 
     memcpy(cur->data, item, len);
-    
-    candidate.write_epoch = hatring_enqueue(self->ring, (void *)ix);
-    candidate.state       = LOGRING_ENQUEUE_DONE;
-    cur->len              = len;
-
-    atomic_store(&cur->info, candidate);
+    logring_publish_entry(self, cur, len);
 
     return;
 }
@@ -145,53 +120,88 @@ logring_enqueue(logring_t *self, void *item, uint64_t len)
 bool
 logring_dequeue(logring_t *self, void *output, uint64_t *len)
 {
-    uint64_t             ix;
-    uint64_t             byte_ix;
-    uint32_t             epoch;
-    bool                 found;
-    logring_entry_info_t expected;
-    logring_entry_info_t candidate;
-    logring_entry_t     *cur;    
+    logring_entry_t *cur;    
 
-    logring_view_help_if_needed(self);
+    cur = logring_dequeue_entry(self);
+
+    if (!cur) {
+	return false;
+    }
+
+    memcpy(output, cur->data, cur->len);
+
+    *len = cur->len;
     
-    while (true) {
-	ix = (uint64_t)hatring_dequeue_w_epoch(self->ring, &found, &epoch);
+    logring_dequeue_done(cur);
 
-	if (!found) {
-	    return false;
-	}
+    return true;
+}
 
-	byte_ix  = ix * (sizeof(logring_entry_t) + self->entry_len);
-	cur      = (logring_entry_t *)&(((char *)self->entries)[byte_ix]);
-	expected = atomic_read(&cur->info);
+/* Unlike logring_enqueue(), we can't quietly truncate here, since the
+ * caller is about to write 'len' bytes into what we return. We stash
+ * 'len' in the entry, so logring_commit() can make sure the caller
+ * stayed inside it.
+ */
+void *
+logring_reserve(logring_t *self, uint64_t len)
+{
+    logring_entry_t *cur;
 
-	while (logring_can_dequeue_here(expected, epoch)) {
-	    candidate        = expected;
-	    candidate.state |= LOGRING_DEQUEUE_RESERVE;
+    if (len > self->entry_len) {
+	abort();
+    }
 
-	    if (CAS(&cur->info, &expected, candidate)) {
-		goto safely_dequeue;
-	    }
-	}
+    cur      = logring_reserve_entry(self);
+    cur->len = len;
+
+    return cur->data;
+}
+
+/* 'len' is how much of the reservation actually got used, so callers
+ * can reserve the most they might need, and commit what they wrote.
+ */
+void
+logring_commit(logring_t *self, void *data, uint64_t len)
+{
+    logring_entry_t *cur;
+
+    cur = logring_get_entry_from_data(data);
+
+    if (len > cur->len) {
+	abort();
     }
 
- safely_dequeue:
-    memcpy(output, cur->data, cur->len);
+    logring_publish_entry(self, cur, len);
 
-    *len                  = cur->len;
-    expected              = candidate;
-    candidate.write_epoch = expected.write_epoch;
+    return;
+}
 
-    while (true) {
-	candidate.state = logring_set_dequeue_done(candidate.state);
-	
-	if (CAS(&cur->info, &expected, candidate)) {
-	    return true;
-	}
+/* Returns NULL if there was nothing to dequeue. Otherwise, the data
+ * is ours until we hand it back via logring_release().
+ */
+void *
+logring_dequeue_inplace(logring_t *self, uint64_t *len)
+{
+    logring_entry_t *cur;
+
+    cur = logring_dequeue_entry(self);
+
+    if (!cur) {
+	return NULL;
     }
+
+    *len = cur->len;
+
+    return cur->data;
 }
 
+void
+logring_release(logring_t *self, void *data)
+{
+    logring_dequeue_done(logring_get_entry_from_data(data));
+
+    return;
+}
 
 logring_view_t *
 logring_view(logring_t *self, bool lax_view)
@@ -216,7 +226,7 @@ logring_view(logring_t *self, bool lax_view)
 	logring_view_help_if_needed(self);
 	
 	candidate.last_viewid = expected.last_viewid + 1;
-	ret->start_epoch      = atomic_read(&self->ring->epochs);
+	ret->start_epoch      = hatring_get_epochs(self->ring);
 	
 	if (CAS(&self->view_state, &expected, candidate)) {
 	    break;
@@ -290,18 +300,18 @@ logring_view(logring_t *self, bool lax_view)
     
     i = ret->num_cells;
 
-    while (i--) {
-	entry = &ret->cells[i];
+    while (i) {
+	entry = &ret->cells[i - 1];
 
 	if (!entry->value && !entry->cell_skipped) {
-	    i++;
 	    break;
 	}
+
+	i--;
     }
 
     if ((ret->num_cells - i) > self->ring->size) {
 	i = ret->num_cells - self->ring->size;
-	ret->num_cells = self->ring->size;
     }
 
     ret->next_ix = i;
@@ -374,9 +384,9 @@ logring_view_help_if_needed(logring_t *self)
     uint64_t              offset_entry_ix;
     uint64_t              entry_ix;
     uint64_t              exp_len;
-    uint32_t              rix;
-    uint32_t              end_ix;
-    uint32_t              cell_epoch;
+    uint64_t              rix;
+    uint64_t              end_ix;
+    uint64_t              cell_epoch;
     hatring_item_t        ringcell;
     hatring_item_t        cand_cell;
     logring_view_entry_t *cur_view_entry;
@@ -390,6 +400,7 @@ logring_view_help_if_needed(logring_t *self)
     view_info = atomic_read(&self->view_state);
 
     if (!view_info.view) {
+	mmm_end_op();
 	return;
     }
 
@@ -568,7 +579,20 @@ logring_view_help_if_needed(logring_t *self)
 	cand_de_info = exp_de_info;
 	cand_de_info.state &= ~LOGRING_VIEW_RESERVE;
 
-	CAS(&data_entry->info, &exp_de_info, cand_de_info);
+	/* A dequeue can finish up while we're copying, which changes
+	 * the state out from under us, so we keep trying as long as
+	 * it's still our view's flag to clear.
+	 */
+	while (!CAS(&data_entry->info, &exp_de_info, cand_de_info)) {
+	    if (exp_de_info.view_id != vid
+		|| !logring_current_entry_epoch(exp_de_info, rix)
+		|| !(exp_de_info.state & LOGRING_VIEW_RESERVE)) {
+		break;
+	    }
+	    
+	    cand_de_info        = exp_de_info;
+	    cand_de_info.state &= ~LOGRING_VIEW_RESERVE;
+	}
 	    
     next_cell:
 	end_ix          = hatring_enqueue_epoch(view->start_epoch);
@@ -591,3 +615,124 @@ logring_view_help_if_needed(logring_t *self)
 
     return;
 }
+
+/* Steps 1 through 3 of an enqueue (see logring.h), up to the point
+ * where the caller can write into the entry.
+ */
+static logring_entry_t *
+logring_reserve_entry(logring_t *self)
+{
+    uint64_t             ix;
+    uint64_t             start_epoch;
+    logring_entry_info_t expected;
+    logring_entry_info_t candidate;
+    logring_entry_t     *cur;
+
+    logring_view_help_if_needed(self);
+	
+    while (true) {
+	start_epoch = atomic_read(&self->ring->write_epoch);
+	ix          = atomic_fetch_add(&self->entry_ix, 1) & self->last_entry;
+	expected    = empty_entry;
+	cur         = logring_get_entry(self, ix);
+
+	candidate.write_epoch = 0;
+	candidate.state       = LOGRING_RESERVED;
+	candidate.view_id     = 0;
+    
+	if (CAS(&cur->info, &expected, candidate)) {
+	    return cur;
+	}
+
+	if (!logring_can_write_here(expected, start_epoch)) {
+	    continue;
+	}
+
+	if (CAS(&cur->info, &expected, candidate)) {
+	    return cur;
+	}
+    }
+}
+
+/* The rest of an enqueue, once the data is in place. We only need
+ * the entry's index for the ring, so we recover it from the pointer.
+ */
+static void
+logring_publish_entry(logring_t *self, logring_entry_t *cur, uint64_t len)
+{
+    uint64_t             ix;
+    logring_entry_info_t candidate;
+
+    ix = ((char *)cur - (char *)self->entries)
+	/ (sizeof(logring_entry_t) + self->entry_len);
+    
+    candidate.write_epoch = hatring_enqueue(self->ring, (void *)ix);
+    candidate.state       = LOGRING_ENQUEUE_DONE;
+    candidate.view_id     = 0;
+    cur->len              = len;
+
+    atomic_store(&cur->info, candidate);
+
+    return;
+}
+
+/* Dequeues from the ring, and reserves the entry it points to for
+ * reading, or returns NULL if the ring is empty.
+ */
+static logring_entry_t *
+logring_dequeue_entry(logring_t *self)
+{
+    uint64_t             ix;
+    uint64_t             epoch;
+    bool                 found;
+    logring_entry_info_t expected;
+    logring_entry_info_t candidate;
+    logring_entry_t     *cur;    
+
+    logring_view_help_if_needed(self);
+    
+    while (true) {
+	ix = (uint64_t)hatring_dequeue_w_epoch(self->ring, &found, &epoch);
+
+	if (!found) {
+	    return NULL;
+	}
+
+	cur      = logring_get_entry(self, ix);
+	expected = atomic_read(&cur->info);
+
+	while (logring_can_dequeue_here(expected, epoch)) {
+	    candidate        = expected;
+	    candidate.state |= LOGRING_DEQUEUE_RESERVE;
+
+	    if (CAS(&cur->info, &expected, candidate)) {
+		return cur;
+	    }
+	}
+    }
+}
+
+/* Once a dequeue has finished reading, the entry can be reused.
+ *
+ * A view might have set LOGRING_VIEW_RESERVE since we reserved the
+ * entry; we leave that flag alone, so that nobody can write over the
+ * entry while the view is still copying it out. The view clears the
+ * flag itself, when it's done.
+ */
+static void
+logring_dequeue_done(logring_entry_t *cur)
+{
+    logring_entry_info_t expected;
+    logring_entry_info_t candidate;
+
+    expected = atomic_read(&cur->info);
+
+    while (true) {
+	candidate       = expected;
+	candidate.state = logring_set_dequeue_done(expected.state);
+	
+	if (CAS(&cur->info, &expected, candidate)) {
+	    return;
+	}
+    }
+}
@@ -27,13 +27,13 @@ static const q64_item_t too_slow_marker = Q64_TOOSLOW;
 static const q64_item_t value_mask      = ~(Q64_TOOSLOW|Q64_USED);
 
 static q64_segment_t *
-q64_new_segment(uint64_t num_cells)
+q64_new_segment(q64_t *self, uint64_t num_cells)
 {
     q64_segment_t *ret;
     uint64_t         len;
 
     len       = sizeof(q64_segment_t) + sizeof(q64_item_t) * num_cells;
-    ret       = mmm_alloc_committed(len);
+    ret       = mmm_cache_alloc_committed(self->segment_cache, len);
     ret->size = num_cells;
 
     return ret;
@@ -62,7 +62,8 @@ q64_init_size(q64_t *self, char size_log)
     
     seg_cells                  = 1 << size_log;
     self->default_segment_size = seg_cells;
-    initial_segment            = q64_new_segment(seg_cells);
+    self->segment_cache        = mmm_cache_new();
+    initial_segment            = q64_new_segment(self, seg_cells);
     segments.enqueue_segment   = initial_segment;
     segments.dequeue_segment   = initial_segment;
 
@@ -112,6 +113,8 @@ q64_cleanup(q64_t *self)
 
 	cur = next;
     }
+
+    mmm_cache_release(self->segment_cache);
     
     return;
 }
@@ -209,7 +212,7 @@ q64_enqueue(q64_t *self, void *item)
 	}
     }
 
-    new_segment                = q64_new_segment(new_size);
+    new_segment                = q64_new_segment(self, new_size);
     new_segment->enqueue_index = 1;
     expected_segment           = NULL;
     
@@ -25,13 +25,13 @@ static const queue_item_t empty_cell      = { NULL, QUEUE_EMPTY };
 static const queue_item_t too_slow_marker = { NULL, QUEUE_TOOSLOW };
 
 static queue_segment_t *
-queue_new_segment(uint64_t num_cells)
+queue_new_segment(queue_t *self, uint64_t num_cells)
 {
     queue_segment_t *ret;
     uint64_t         len;
 
     len       = sizeof(queue_segment_t) + sizeof(queue_item_t) * num_cells;
-    ret       = mmm_alloc_committed(len);
+    ret       = mmm_cache_alloc_committed(self->segment_cache, len);
     ret->size = num_cells;
 
     return ret;
@@ -60,7 +60,8 @@ queue_init_size(queue_t *self, char size_log)
     
     seg_cells                  = 1 << size_log;
     self->default_segment_size = seg_cells;
-    initial_segment            = queue_new_segment(seg_cells);
+    self->segment_cache        = mmm_cache_new();
+    initial_segment            = queue_new_segment(self, seg_cells);
     segments.enqueue_segment   = initial_segment;
     segments.dequeue_segment   = initial_segment;
 
@@ -110,6 +111,8 @@ queue_cleanup(queue_t *self)
 
 	cur = next;
     }
+
+    mmm_cache_release(self->segment_cache);
     
     return;
 }
@@ -208,7 +211,7 @@ queue_enqueue(queue_t *self, void *item)
 	}
     }
 
-    new_segment                = queue_new_segment(new_size);
+    new_segment                = queue_new_segment(self, new_size);
     new_segment->enqueue_index = 1;
     expected_segment           = NULL;
     
@@ -0,0 +1,409 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           skipq.c
+ *  Description:    A lock-free priority queue, built on skiplists, with
+ *                  an optional relaxed mode.
+ *
+ *                  See skipq.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#include <stddef.h>
+
+// clang-format off
+static void          skipq_list_init    (skipq_list_t *);
+static void          skipq_list_cleanup (skipq_list_t *);
+static skipq_node_t *skipq_node_new     (uint64_t, uint64_t, void *);
+static void          skipq_list_insert  (skipq_t *, skipq_list_t *,
+					 uint64_t, void *);
+static skipq_node_t *skipq_list_first   (skipq_list_t *);
+static skipq_node_t *skipq_list_claim   (skipq_list_t *);
+static void          skipq_finish_claim (skipq_t *, skipq_list_t *,
+					 skipq_node_t *);
+static int           skipq_node_cmp     (hatrack_skiplist_t *,
+					 hatrack_skiplist_node_t *, void *);
+static bool          skipq_node_removed (hatrack_skiplist_node_t *);
+static void          skipq_node_retire  (hatrack_skiplist_t *,
+					 hatrack_skiplist_node_t *);
+// clang-format on
+
+// Gets from a node's skiplist links back to the node.
+static inline skipq_node_t *
+skipq_node(hatrack_skiplist_node_t *links)
+{
+    if (!links) {
+	return NULL;
+    }
+
+    return (skipq_node_t *)((char *)links - offsetof(skipq_node_t, links));
+}
+
+static inline skipq_node_t *
+skipq_next(skipq_node_t *node)
+{
+    return skipq_node(hatrack_skiplist_next(&node->links, 0));
+}
+
+static inline skipq_node_t *
+skipq_first(skipq_list_t *list)
+{
+    return skipq_node(hatrack_skiplist_first(&list->list));
+}
+
+skipq_t *
+skipq_new(void)
+{
+    skipq_t *ret;
+
+    ret = (skipq_t *)malloc(sizeof(skipq_t));
+
+    skipq_init(ret);
+
+    return ret;
+}
+
+skipq_t *
+skipq_new_relaxed(uint64_t num_lists)
+{
+    skipq_t *ret;
+
+    ret = (skipq_t *)malloc(sizeof(skipq_t));
+
+    skipq_init_relaxed(ret, num_lists);
+
+    return ret;
+}
+
+void
+skipq_init(skipq_t *self)
+{
+    skipq_init_relaxed(self, 1);
+
+    return;
+}
+
+/* A relaxed queue with one list is just a strict queue. Passing 0
+ * gets HATRACK_SKIPQ_DEFAULT_LISTS.
+ */
+void
+skipq_init_relaxed(skipq_t *self, uint64_t num_lists)
+{
+    uint64_t i;
+
+    if (!num_lists) {
+	num_lists = HATRACK_SKIPQ_DEFAULT_LISTS;
+    }
+
+    self->num_lists = num_lists;
+    self->lists     = (skipq_list_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+						    sizeof(skipq_list_t)
+						    * num_lists);
+
+    for (i = 0; i < num_lists; i++) {
+	skipq_list_init(&self->lists[i]);
+    }
+
+    atomic_store(&self->len, 0);
+
+    return;
+}
+
+/* As with our other queues, this assumes nobody is using the queue
+ * anymore. Items still in the queue are not freed.
+ */
+void
+skipq_cleanup(skipq_t *self)
+{
+    uint64_t i;
+
+    for (i = 0; i < self->num_lists; i++) {
+	skipq_list_cleanup(&self->lists[i]);
+    }
+
+    free(self->lists);
+
+    return;
+}
+
+void
+skipq_delete(skipq_t *self)
+{
+    skipq_cleanup(self);
+    free(self);
+
+    return;
+}
+
+void
+skipq_insert(skipq_t *self, uint64_t priority, void *item)
+{
+    skipq_list_t *list;
+
+    mmm_start_basic_op();
+
+    list = &self->lists[0];
+
+    if (skipq_is_relaxed(self)) {
+	list = &self->lists[hatrack_skiplist_random() % self->num_lists];
+    }
+
+    skipq_list_insert(self, list, priority, item);
+
+    mmm_end_op();
+
+    return;
+}
+
+/* In relaxed mode, we peek at the minimum of two random lists, and
+ * try to claim from the one with the lower priority. If that list got
+ * emptied out from under us, we try the other one, and failing that,
+ * we walk through all the lists, starting at a random one, so that we
+ * don't report the queue as empty when it isn't.
+ */
+void *
+skipq_dequeue_min(skipq_t *self, uint64_t *priority, bool *found)
+{
+    skipq_list_t *list;
+    skipq_list_t *other;
+    skipq_list_t *tmp;
+    skipq_node_t *node;
+    skipq_node_t *n1;
+    skipq_node_t *n2;
+    uint64_t      start;
+    uint64_t      i;
+    void         *ret;
+
+    mmm_start_basic_op();
+
+    list = &self->lists[0];
+    node = NULL;
+
+    if (!skipq_is_relaxed(self)) {
+	node = skipq_list_claim(list);
+    }
+    else {
+	start = hatrack_skiplist_random();
+	list  = &self->lists[start % self->num_lists];
+	other = &self->lists[(start >> 32) % self->num_lists];
+	n1    = skipq_list_first(list);
+	n2    = skipq_list_first(other);
+
+	if (!n1 || (n2 && n2->priority < n1->priority)) {
+	    tmp   = list;
+	    list  = other;
+	    other = tmp;
+	}
+
+	node = skipq_list_claim(list);
+
+	if (!node) {
+	    list = other;
+	    node = skipq_list_claim(list);
+	}
+
+	for (i = 0; !node && i < self->num_lists; i++) {
+	    list = &self->lists[(start + i) % self->num_lists];
+	    node = skipq_list_claim(list);
+	}
+    }
+
+    if (!node) {
+	mmm_end_op();
+
+	return hatrack_not_found(found);
+    }
+
+    ret = node->item;
+
+    if (priority) {
+	*priority = node->priority;
+    }
+
+    skipq_finish_claim(self, list, node);
+
+    mmm_end_op();
+
+    return hatrack_found(found, ret);
+}
+
+static void
+skipq_list_init(skipq_list_t *list)
+{
+    hatrack_skiplist_init(&list->list,
+			  HATRACK_SKIPQ_MAX_HEIGHT,
+			  skipq_node_cmp,
+			  skipq_node_removed,
+			  skipq_node_retire);
+
+    return;
+}
+
+static void
+skipq_list_cleanup(skipq_list_t *list)
+{
+    skipq_node_t *cur;
+    skipq_node_t *next;
+
+    cur = skipq_first(list);
+
+    while (cur) {
+	next = skipq_next(cur);
+	mmm_retire_unused(cur);
+	cur = next;
+    }
+
+    hatrack_skiplist_cleanup(&list->list);
+
+    return;
+}
+
+static skipq_node_t *
+skipq_node_new(uint64_t height, uint64_t priority, void *item)
+{
+    skipq_node_t *ret;
+
+    ret = mmm_alloc_committed(sizeof(skipq_node_t)
+			      + sizeof(uint64_t) * height);
+
+    ret->priority = priority;
+    ret->item     = item;
+
+    hatrack_skiplist_node_init(&ret->links, height);
+
+    return ret;
+}
+
+/* This is the insertion half of hatrack_omap_store(), minus the bits
+ * that deal with existing keys, since every node's key is unique. A
+ * node's key is the node itself; see skipq_node_cmp().
+ */
+static void
+skipq_list_insert(skipq_t      *self,
+		  skipq_list_t *list,
+		  uint64_t      priority,
+		  void         *item)
+{
+    hatrack_skiplist_node_t *preds[HATRACK_SKIPQ_MAX_HEIGHT];
+    hatrack_skiplist_node_t *succs[HATRACK_SKIPQ_MAX_HEIGHT];
+    skipq_node_t            *node;
+
+    node = skipq_node_new(hatrack_skiplist_pick_height(&list->list),
+			  priority,
+			  item);
+
+    do {
+	hatrack_skiplist_find(&list->list, node, preds, succs, false);
+    } while (!hatrack_skiplist_link(&node->links, preds, succs));
+
+    atomic_fetch_add(&self->len, 1);
+
+    hatrack_skiplist_build_tower(&list->list, &node->links, node, preds, succs);
+
+    return;
+}
+
+// Returns the first node that hasn't been claimed yet, if any.
+static skipq_node_t *
+skipq_list_first(skipq_list_t *list)
+{
+    skipq_node_t *cur;
+
+    cur = skipq_first(list);
+
+    while (cur && atomic_load(&cur->taken)) {
+	cur = skipq_next(cur);
+    }
+
+    return cur;
+}
+
+/* Walks the bottom level, and claims the first node we can. Claimed
+ * nodes that haven't been unlinked yet just get stepped over; their
+ * 'next' pointers are still good, even if they're marked.
+ */
+static skipq_node_t *
+skipq_list_claim(skipq_list_t *list)
+{
+    skipq_node_t *cur;
+    bool          expected;
+
+    cur = skipq_first(list);
+
+    while (cur) {
+	expected = false;
+
+	if (!atomic_load(&cur->taken)
+	    && CAS(&cur->taken, &expected, true)) {
+	    return cur;
+	}
+
+	cur = skipq_next(cur);
+    }
+
+    return NULL;
+}
+
+// Called by the thread that won the claim on a node.
+static void
+skipq_finish_claim(skipq_t *self, skipq_list_t *list, skipq_node_t *node)
+{
+    hatrack_skiplist_node_t *preds[HATRACK_SKIPQ_MAX_HEIGHT];
+    hatrack_skiplist_node_t *succs[HATRACK_SKIPQ_MAX_HEIGHT];
+
+    atomic_fetch_sub(&self->len, 1);
+
+    hatrack_skiplist_unlink(&list->list, &node->links, node, preds, succs);
+
+    return;
+}
+
+/* The skiplist hooks; see skiplist.h. Nodes are ordered by priority,
+ * and then by address (see skipq.h), and the key we search with is
+ * always a node.
+ */
+static int
+skipq_node_cmp(hatrack_skiplist_t *list, hatrack_skiplist_node_t *links, void *key)
+{
+    skipq_node_t *n1;
+    skipq_node_t *n2;
+
+    n1 = skipq_node(links);
+    n2 = (skipq_node_t *)key;
+
+    if (n1->priority != n2->priority) {
+	return n1->priority < n2->priority ? -1 : 1;
+    }
+
+    return ((uintptr_t)n1 > (uintptr_t)n2) - ((uintptr_t)n1 < (uintptr_t)n2);
+}
+
+// A node's been removed once it's been claimed.
+static bool
+skipq_node_removed(hatrack_skiplist_node_t *links)
+{
+    return atomic_load(&skipq_node(links)->taken);
+}
+
+static void
+skipq_node_retire(hatrack_skiplist_t *list, hatrack_skiplist_node_t *links)
+{
+    mmm_retire(skipq_node(links));
+
+    return;
+}
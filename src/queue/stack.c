@@ -104,7 +104,7 @@ static const stack_item_t proto_item_pushed = {
 };
 
 // clang-format off
-static stack_store_t *hatstack_new_store (uint64_t);
+static stack_store_t *hatstack_new_store (hatstack_t *, uint64_t);
 static stack_store_t *hatstack_grow_store(stack_store_t *, hatstack_t *);
 // clang-format on
 
@@ -123,9 +123,11 @@ hatstack_new(uint64_t prealloc)
 void
 hatstack_init(hatstack_t *self, uint64_t prealloc)
 {
-    prealloc = hatrack_round_up_to_power_of_2(prealloc);
+    prealloc          = hatrack_round_up_to_power_of_2(prealloc);
+    self->store_cache = mmm_cache_new();
+    self->backoff     = hatrack_backoff_default;
 
-    atomic_store(&self->store, hatstack_new_store(prealloc));
+    atomic_store(&self->store, hatstack_new_store(self, prealloc));
 
 #ifdef HATSTACK_WAIT_FREE
     atomic_store(&self->push_help_shift, 0);
@@ -138,6 +140,7 @@ void
 hatstack_cleanup(hatstack_t *self)
 {
     mmm_retire_unused(atomic_read(&self->store));
+    mmm_cache_release(self->store_cache);
 
     return;
 }
@@ -155,22 +158,24 @@ hatstack_delete(hatstack_t *self)
 void
 hatstack_push(hatstack_t *self, void *item)
 {
-    stack_store_t *store;
-    uint64_t       head_state;
-    uint32_t       ix;
-    uint32_t       epoch;
-    stack_item_t   candidate;
-    stack_item_t   expected;
+    stack_store_t          *store;
+    uint64_t                head_state;
+    uint32_t                ix;
+    uint32_t                epoch;
+    stack_item_t            candidate;
+    stack_item_t            expected;
+    hatrack_backoff_state_t backoff;
 
 #ifdef HATSTACK_WAIT_FREE
-    uint32_t       retries = 0;
-    uint32_t       tosub   = 0;
+    uint32_t                retries = 0;
+    uint32_t                tosub   = 0;
 #endif    
     
     candidate      = proto_item_pushed;
     candidate.item = item;
     
     mmm_start_basic_op();
+    hatrack_backoff_start(&backoff, &self->backoff);
 
     store = atomic_read(&self->store);
 
@@ -217,6 +222,7 @@ hatstack_push(hatstack_t *self, void *item)
 	     * 'invalid' flag was meant for us, not for some future
 	     * thread that's also assigned this bucket.
 	     */
+	    hatrack_backoff(&backoff);
 	    continue;
 	}
 
@@ -248,6 +254,7 @@ hatstack_push(hatstack_t *self, void *item)
 	    atomic_fetch_add(&self->push_help_shift, 1);
 	}
 #endif	
+	hatrack_backoff(&backoff);
 	continue;
     }
     abort();
@@ -484,7 +491,7 @@ hatstack_view_delete(stack_view_t *view)
 }
 
 static stack_store_t *
-hatstack_new_store(uint64_t num_cells)
+hatstack_new_store(hatstack_t *self, uint64_t num_cells)
 {
     stack_store_t *ret;
     uint64_t       alloc_len;
@@ -494,7 +501,9 @@ hatstack_new_store(uint64_t num_cells)
     }
     
     alloc_len       = sizeof(stack_store_t) + num_cells * sizeof(stack_cell_t);
-    ret             = (stack_store_t *)mmm_alloc_committed(alloc_len);
+    ret             = (stack_store_t *)mmm_cache_alloc_committed(
+	self->store_cache,
+	alloc_len);
     ret->num_cells  = num_cells;
     ret->head_state = head_candidate_new_epoch(0, 0);
 
@@ -570,10 +579,10 @@ hatstack_grow_store(stack_store_t *store, hatstack_t *top)
 #else    
     if (j < (store->num_cells >> 1)) {
 #endif
-	next_store     = hatstack_new_store(store->num_cells);	
+	next_store     = hatstack_new_store(top, store->num_cells);
     }
     else {
-	next_store     = hatstack_new_store(store->num_cells << 1);
+	next_store     = hatstack_new_store(top, store->num_cells << 1);
     }
 
 
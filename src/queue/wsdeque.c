@@ -0,0 +1,259 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           wsdeque.c
+ *  Description:    A Chase-Lev work-stealing deque.
+ *
+ *                  See wsdeque.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#define WSDEQUE_DEFAULT_SIZE 256
+#define WSDEQUE_MINIMUM_SIZE 16
+
+static wsdeque_store_t *wsdeque_new_store(uint64_t);
+static wsdeque_store_t *wsdeque_grow     (wsdeque_t *, wsdeque_store_t *,
+					  int64_t, int64_t);
+
+void
+wsdeque_init(wsdeque_t *self)
+{
+    wsdeque_init_size(self, WSDEQUE_DEFAULT_SIZE);
+
+    return;
+}
+
+void
+wsdeque_init_size(wsdeque_t *self, uint64_t size)
+{
+    size = hatrack_round_up_to_power_of_2(size);
+
+    if (size < WSDEQUE_MINIMUM_SIZE) {
+	size = WSDEQUE_MINIMUM_SIZE;
+    }
+
+    atomic_store(&self->top, 0);
+    atomic_store(&self->bottom, 0);
+    atomic_store(&self->store, wsdeque_new_store(size));
+
+    return;
+}
+
+wsdeque_t *
+wsdeque_new(void)
+{
+    return wsdeque_new_size(WSDEQUE_DEFAULT_SIZE);
+}
+
+wsdeque_t *
+wsdeque_new_size(uint64_t size)
+{
+    wsdeque_t *ret;
+
+    ret = (wsdeque_t *)aligned_alloc(HATRACK_CACHE_LINE_SIZE,
+				     sizeof(wsdeque_t));
+    wsdeque_init_size(ret, size);
+
+    return ret;
+}
+
+/* As with our other queues, this assumes nobody is using the deque
+ * anymore. Any items left in it are not freed.
+ */
+void
+wsdeque_cleanup(wsdeque_t *self)
+{
+    mmm_retire(atomic_load(&self->store));
+
+    return;
+}
+
+void
+wsdeque_delete(wsdeque_t *self)
+{
+    wsdeque_cleanup(self);
+    free(self);
+
+    return;
+}
+
+/* The release fence is what makes the item visible to any thief that
+ * sees the new value of bottom.
+ */
+void
+wsdeque_push(wsdeque_t *self, void *item)
+{
+    wsdeque_store_t *store;
+    int64_t          bottom;
+    int64_t          top;
+
+    bottom = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    top    = atomic_load_explicit(&self->top, memory_order_acquire);
+    store  = atomic_load_explicit(&self->store, memory_order_relaxed);
+
+    if ((uint64_t)(bottom - top) >= store->size) {
+	store = wsdeque_grow(self, store, top, bottom);
+    }
+
+    atomic_store_explicit(&store->cells[bottom & (store->size - 1)],
+			  item,
+			  memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+
+    return;
+}
+
+/* The full fence between our store to bottom and our load of top is
+ * the important part. It pairs with the one in wsdeque_steal(): either
+ * the thief sees our decremented bottom (and backs off from the item
+ * we're about to take), or we see the thief's incremented top. Without
+ * it, both of us could walk away with the same item.
+ */
+void *
+wsdeque_pop(wsdeque_t *self, bool *found)
+{
+    wsdeque_store_t *store;
+    int64_t          bottom;
+    int64_t          top;
+    void            *ret;
+
+    bottom = atomic_load_explicit(&self->bottom, memory_order_relaxed) - 1;
+    store  = atomic_load_explicit(&self->store, memory_order_relaxed);
+
+    atomic_store_explicit(&self->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    top = atomic_load_explicit(&self->top, memory_order_relaxed);
+
+    if (top > bottom) {
+	atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+
+	return hatrack_not_found(found);
+    }
+
+    ret = atomic_load_explicit(&store->cells[bottom & (store->size - 1)],
+			       memory_order_relaxed);
+
+    if (top == bottom) {
+	// Last item; we have to race the thieves for it.
+	if (!atomic_compare_exchange_strong_explicit(&self->top,
+						     &top,
+						     top + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed)) {
+	    atomic_store_explicit(&self->bottom,
+				  bottom + 1,
+				  memory_order_relaxed);
+
+	    return hatrack_not_found(found);
+	}
+
+	atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return hatrack_found(found, ret);
+}
+
+/* We need to be in an mmm operation before we load the store, since
+ * the owner might be swapping in a bigger one, and retiring this one,
+ * while we're reading from it.
+ *
+ * If we lose the CAS, we report the deque as empty; see wsdeque.h.
+ */
+void *
+wsdeque_steal(wsdeque_t *self, bool *found)
+{
+    wsdeque_store_t *store;
+    int64_t          bottom;
+    int64_t          top;
+    void            *ret;
+
+    mmm_start_basic_op();
+
+    top = atomic_load_explicit(&self->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&self->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+	mmm_end_op();
+
+	return hatrack_not_found(found);
+    }
+
+    store = atomic_load_explicit(&self->store, memory_order_acquire);
+    ret   = atomic_load_explicit(&store->cells[top & (store->size - 1)],
+				 memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&self->top,
+						 &top,
+						 top + 1,
+						 memory_order_seq_cst,
+						 memory_order_relaxed)) {
+	mmm_end_op();
+
+	return hatrack_not_found(found);
+    }
+
+    mmm_end_op();
+
+    return hatrack_found(found, ret);
+}
+
+static wsdeque_store_t *
+wsdeque_new_store(uint64_t size)
+{
+    wsdeque_store_t *ret;
+
+    ret = (wsdeque_store_t *)mmm_alloc_committed(sizeof(wsdeque_store_t)
+						 + sizeof(void *) * size);
+    ret->size = size;
+
+    return ret;
+}
+
+/* Only the owner calls this. Items between top and bottom land at the
+ * same indices in the new store, so a thief that read a cell out of
+ * the old store got the same item it would have gotten from the new
+ * one; its CAS on top is still what decides whether it keeps it.
+ */
+static wsdeque_store_t *
+wsdeque_grow(wsdeque_t       *self,
+	     wsdeque_store_t *store,
+	     int64_t          top,
+	     int64_t          bottom)
+{
+    wsdeque_store_t *ret;
+    int64_t          i;
+    void            *item;
+
+    ret = wsdeque_new_store(store->size << 1);
+
+    for (i = top; i < bottom; i++) {
+	item = atomic_load_explicit(&store->cells[i & (store->size - 1)],
+				    memory_order_relaxed);
+	atomic_store_explicit(&ret->cells[i & (ret->size - 1)],
+			      item,
+			      memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&self->store, ret, memory_order_release);
+    mmm_retire(store);
+
+    return ret;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           backoff.c
+ *  Description:    Pluggable backoff for CAS retry loops.
+ *
+ *                  See backoff.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+/* These have to be constant expressions, since we use them to
+ * statically initialize hatrack_backoff_default.
+ */
+#define HATRACK_BACKOFF_PRESET_MIN(kind)                                       \
+    ((kind) == HATRACK_BACKOFF_SPIN    ? HATRACK_BACKOFF_SPIN_MIN              \
+     : (kind) == HATRACK_BACKOFF_SLEEP ? HATRACK_BACKOFF_SLEEP_MIN_NS          \
+                                       : 0)
+
+#define HATRACK_BACKOFF_PRESET_MAX(kind)                                       \
+    ((kind) == HATRACK_BACKOFF_SPIN    ? HATRACK_BACKOFF_SPIN_MAX              \
+     : (kind) == HATRACK_BACKOFF_SLEEP ? HATRACK_BACKOFF_SLEEP_MAX_NS          \
+                                       : 0)
+
+hatrack_backoff_t hatrack_backoff_default = {
+    .kind = HATRACK_BACKOFF_DEFAULT,
+    .min  = HATRACK_BACKOFF_PRESET_MIN(HATRACK_BACKOFF_DEFAULT),
+    .max  = HATRACK_BACKOFF_PRESET_MAX(HATRACK_BACKOFF_DEFAULT)
+};
+
+static const char *hatrack_backoff_names[] = {
+    [HATRACK_BACKOFF_NONE]  = "none",
+    [HATRACK_BACKOFF_PAUSE] = "pause",
+    [HATRACK_BACKOFF_SPIN]  = "spin",
+    [HATRACK_BACKOFF_YIELD] = "yield",
+    [HATRACK_BACKOFF_SLEEP] = "sleep"
+};
+
+#define HATRACK_BACKOFF_NUM_KINDS                                              \
+    (sizeof(hatrack_backoff_names) / sizeof(char *))
+
+/* Fills in the configuration for the given strategy, with the bounds
+ * from hatrack_config.h. Callers who want different bounds can just
+ * change 'min' and 'max' afterward.
+ */
+void
+hatrack_backoff_init(hatrack_backoff_t *self, hatrack_backoff_kind_t kind)
+{
+    if ((uint64_t)kind >= HATRACK_BACKOFF_NUM_KINDS) {
+	abort();
+    }
+
+    self->kind = kind;
+    self->min  = HATRACK_BACKOFF_PRESET_MIN(kind);
+    self->max  = HATRACK_BACKOFF_PRESET_MAX(kind);
+
+    return;
+}
+
+/* This only affects hash tables, and queues, rings and stacks that
+ * get created afterward, since those copy the default when they're
+ * initialized.
+ */
+void
+hatrack_backoff_set_default(const hatrack_backoff_t *config)
+{
+    hatrack_backoff_default = *config;
+
+    return;
+}
+
+/* For command-line flags. Returns false if we don't recognize the
+ * name, leaving the configuration alone.
+ */
+bool
+hatrack_backoff_from_name(hatrack_backoff_t *self, const char *name)
+{
+    uint64_t i;
+
+    for (i = 0; i < HATRACK_BACKOFF_NUM_KINDS; i++) {
+	if (!strcmp(name, hatrack_backoff_names[i])) {
+	    hatrack_backoff_init(self, (hatrack_backoff_kind_t)i);
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+const char *
+hatrack_backoff_name(const hatrack_backoff_t *self)
+{
+    return hatrack_backoff_names[self->kind];
+}
+
+void
+hatrack_backoff_slow(hatrack_backoff_state_t *state)
+{
+    struct timespec sleep_time;
+
+    switch (state->config->kind) {
+    case HATRACK_BACKOFF_YIELD:
+	sched_yield();
+	return;
+    case HATRACK_BACKOFF_SLEEP:
+	sleep_time.tv_sec  = state->delay / 1000000000;
+	sleep_time.tv_nsec = state->delay % 1000000000;
+
+	nanosleep(&sleep_time, NULL);
+
+	if (state->delay < state->config->max) {
+	    state->delay <<= 1;
+
+	    if (state->delay > state->config->max) {
+		state->delay = state->config->max;
+	    }
+	}
+	return;
+    default:
+	return;
+    }
+}
@@ -0,0 +1,407 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           changelog.c
+ *  Description:    A lock-free change feed, used by hatrack_dict and
+ *                  hatrack_set to answer "what changed since epoch E?"
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+static void hatrack_changelog_retire(hatrack_change_record_t *);
+static void hatrack_changelog_record_eject(hatrack_change_record_t *, void *);
+
+hatrack_changelog_t *
+hatrack_changelog_new(void)
+{
+    hatrack_changelog_t *ret;
+
+    ret = (hatrack_changelog_t *)aligned_alloc(alignof(hatrack_changelog_t),
+					       sizeof(hatrack_changelog_t));
+
+    hatrack_changelog_init(ret);
+
+    return ret;
+}
+
+void
+hatrack_changelog_init(hatrack_changelog_t *self)
+{
+    uint64_t i;
+
+    atomic_store(&self->head, NULL);
+    atomic_store(&self->trimmed_epoch, 0);
+    atomic_store(&self->trimming, false);
+
+    self->items           = false;
+    self->owner           = NULL;
+    self->key_return_hook = NULL;
+    self->val_return_hook = NULL;
+    self->free_handler    = NULL;
+
+    hatrack_backoff_init(&self->backoff, HATRACK_BACKOFF_YIELD);
+
+    for (i = 0; i < HATRACK_CHANGELOG_STRIPES; i++) {
+	atomic_store(&self->stripes[i].locked, false);
+    }
+
+    return;
+}
+
+/* Like the rest of our cleanup functions, this assumes nobody else is
+ * using the log anymore.
+ */
+void
+hatrack_changelog_cleanup(hatrack_changelog_t *self)
+{
+    hatrack_change_record_t *cur;
+    hatrack_change_record_t *next;
+
+    cur = atomic_load(&self->head);
+
+    while (cur) {
+        next = atomic_load(&cur->next);
+        hatrack_changelog_retire(cur);
+        cur = next;
+    }
+
+    return;
+}
+
+void
+hatrack_changelog_delete(hatrack_changelog_t *self)
+{
+    hatrack_changelog_cleanup(self);
+    free(self);
+
+    return;
+}
+
+/* The owning table passes in its memory management hooks, and itself,
+ * for the hooks to get as their first argument; see the top of
+ * changelog.h for how we use them. 'items' says whether the free
+ * handler expects a hatrack_dict_item_t (as the dict's does), or just
+ * the key (as the set's does).
+ *
+ * The owner has to call this again whenever its hooks change. Like
+ * the hooks themselves, they shouldn't change while other threads are
+ * writing.
+ */
+void
+hatrack_changelog_set_hooks(hatrack_changelog_t *self,
+			    void                *owner,
+			    hatrack_mem_hook_t   key_return_hook,
+			    hatrack_mem_hook_t   val_return_hook,
+			    hatrack_mem_hook_t   free_handler,
+			    bool                 items)
+{
+    self->owner           = owner;
+    self->key_return_hook = key_return_hook;
+    self->val_return_hook = val_return_hook;
+    self->free_handler    = free_handler;
+    self->items           = items;
+
+    return;
+}
+
+/* Writers hold the stripe for their key's hash from before they write
+ * to the table until their change is in the log; see changelog.h.
+ * Stripes go by the low bits of the hash value, like bucket indexes.
+ */
+void
+hatrack_changelog_lock(hatrack_changelog_t *self, hatrack_hash_t hv)
+{
+    hatrack_changelog_stripe_t *stripe;
+    hatrack_backoff_state_t     backoff;
+    bool                        expected;
+
+    stripe = &self->stripes[hatrack_bucket_index(hv,
+						 HATRACK_CHANGELOG_STRIPES - 1)];
+
+    hatrack_backoff_start(&backoff, &self->backoff);
+
+    while (true) {
+	expected = false;
+
+	if (CAS(&stripe->locked, &expected, true)) {
+	    break;
+	}
+
+	hatrack_backoff(&backoff);
+    }
+
+    return;
+}
+
+void
+hatrack_changelog_unlock(hatrack_changelog_t *self, hatrack_hash_t hv)
+{
+    hatrack_changelog_stripe_t *stripe;
+
+    stripe = &self->stripes[hatrack_bucket_index(hv,
+						 HATRACK_CHANGELOG_STRIPES - 1)];
+
+    atomic_store(&stripe->locked, false);
+
+    return;
+}
+
+/* Push a change onto the head of the log. The epoch is always one
+ * higher than whatever we're pushing on top of, and since the CAS
+ * only succeeds if the head didn't change, the epochs along the list
+ * are strictly decreasing.
+ *
+ * The record holds its own reference to the key and value, taken
+ * through the return hooks, until it gets freed.
+ *
+ * Note that we dereference the old head to get its epoch, which is
+ * only safe because a concurrent trim can't free it out from under
+ * our reservation.
+ */
+void
+hatrack_changelog_record(hatrack_changelog_t *self,
+                         uint32_t             kind,
+                         void                *key,
+                         void                *value)
+{
+    hatrack_change_record_t *record;
+    hatrack_change_record_t *head;
+
+    mmm_start_basic_op();
+
+    record               = mmm_alloc_committed(sizeof(hatrack_change_record_t));
+    record->change.key   = key;
+    record->change.value = value;
+    record->change.kind  = kind;
+    record->free_handler = self->free_handler;
+    record->items        = self->items;
+    head                 = atomic_read(&self->head);
+
+    if (key && self->key_return_hook) {
+	(*self->key_return_hook)(self->owner, key);
+    }
+
+    if (value && self->val_return_hook) {
+	(*self->val_return_hook)(self->owner, value);
+    }
+
+    do {
+        atomic_store(&record->next, head);
+        record->change.epoch = head ? head->change.epoch + 1 : 1;
+    } while (!CAS(&self->head, &head, record));
+
+    mmm_end_op();
+
+    return;
+}
+
+uint64_t
+hatrack_changelog_epoch(hatrack_changelog_t *self)
+{
+    hatrack_change_record_t *head;
+    uint64_t                 ret;
+
+    mmm_start_basic_op();
+
+    head = atomic_read(&self->head);
+    ret  = head ? head->change.epoch : 0;
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Returns the changes with an epoch higher than the one passed,
+ * oldest first (i.e., in the order you'd want to replay them). The
+ * caller is responsible for freeing the result, and, if there are
+ * return hooks, for the references they took on its keys and values.
+ * We take those before ending our op, since once we do, a trim could
+ * free the records, and drop the log's own references.
+ *
+ * *high_water gets the epoch to pass next time. If the requested
+ * epoch has been trimmed away, we return NULL, and *high_water is
+ * HATRACK_CHANGES_TRIMMED.
+ *
+ * We check the trim point AFTER walking, since a trim could cut off
+ * records we'd have otherwise walked.
+ */
+hatrack_change_t *
+hatrack_changelog_since(hatrack_changelog_t *self,
+                        uint64_t             epoch,
+                        uint64_t            *num,
+                        uint64_t            *high_water)
+{
+    hatrack_change_record_t *cur;
+    hatrack_change_t        *ret;
+    hatrack_change_t         tmp;
+    uint64_t                 alloc_len;
+    uint64_t                 n;
+    uint64_t                 i;
+
+    mmm_start_basic_op();
+
+    alloc_len = 16;
+    ret       = (hatrack_change_t *)malloc(sizeof(hatrack_change_t) * alloc_len);
+    n         = 0;
+    cur       = atomic_read(&self->head);
+
+    while (cur && cur->change.epoch > epoch) {
+        if (n == alloc_len) {
+            alloc_len <<= 1;
+            ret = (hatrack_change_t *)realloc(ret,
+                                              sizeof(hatrack_change_t)
+                                                  * alloc_len);
+        }
+
+        ret[n++] = cur->change;
+        cur      = atomic_read(&cur->next);
+    }
+
+    if (epoch < atomic_read(&self->trimmed_epoch)) {
+        mmm_end_op();
+        free(ret);
+
+        *num        = 0;
+        *high_water = HATRACK_CHANGES_TRIMMED;
+
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+	if (ret[i].key && self->key_return_hook) {
+	    (*self->key_return_hook)(self->owner, ret[i].key);
+	}
+
+	if (ret[i].value && self->val_return_hook) {
+	    (*self->val_return_hook)(self->owner, ret[i].value);
+	}
+    }
+
+    mmm_end_op();
+
+    *num = n;
+
+    if (!n) {
+        free(ret);
+
+        *high_water = epoch;
+
+        return NULL;
+    }
+
+    *high_water = ret[0].epoch;
+
+    for (i = 0; i < n / 2; i++) {
+        tmp            = ret[i];
+        ret[i]         = ret[n - i - 1];
+        ret[n - i - 1] = tmp;
+    }
+
+    return ret;
+}
+
+/* Drops all records at or below the given epoch, except that we always
+ * keep the head, so that new records keep getting higher epochs.
+ *
+ * Only one thread trims at a time; if someone else is already at it,
+ * we just return, since they'll get to it (or somebody will, next
+ * time). That keeps two trimmers from both retiring the same tail.
+ */
+void
+hatrack_changelog_trim(hatrack_changelog_t *self, uint64_t epoch)
+{
+    hatrack_change_record_t *prev;
+    hatrack_change_record_t *cur;
+    hatrack_change_record_t *next;
+    bool                     expected;
+
+    expected = false;
+
+    if (!CAS(&self->trimming, &expected, true)) {
+        return;
+    }
+
+    mmm_start_basic_op();
+
+    prev = atomic_read(&self->head);
+
+    if (!prev) {
+        goto finished;
+    }
+
+    cur = atomic_read(&prev->next);
+
+    while (cur && cur->change.epoch > epoch) {
+        prev = cur;
+        cur  = atomic_read(&cur->next);
+    }
+
+    if (!cur) {
+        goto finished;
+    }
+
+    atomic_store(&self->trimmed_epoch, cur->change.epoch);
+    atomic_store(&prev->next, NULL);
+
+    while (cur) {
+        next = atomic_read(&cur->next);
+        hatrack_changelog_retire(cur);
+        cur = next;
+    }
+
+finished:
+    mmm_end_op();
+    atomic_store(&self->trimming, false);
+
+    return;
+}
+
+static void
+hatrack_changelog_retire(hatrack_change_record_t *record)
+{
+    if (record->free_handler) {
+	mmm_add_cleanup_handler(record,
+				(mmm_cleanup_func)hatrack_changelog_record_eject,
+				NULL);
+    }
+
+    mmm_retire(record);
+
+    return;
+}
+
+/* Called by mmm when a record gets freed, to give back the record's
+ * references. The table may be gone, so the handler gets NULL for it.
+ */
+static void
+hatrack_changelog_record_eject(hatrack_change_record_t *record, void *aux)
+{
+    hatrack_dict_item_t item;
+
+    if (!record->items) {
+	(*record->free_handler)(NULL, record->change.key);
+
+	return;
+    }
+
+    item.key   = record->change.key;
+    item.value = record->change.value;
+
+    (*record->free_handler)(NULL, &item);
+
+    return;
+}
@@ -27,23 +27,27 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include <string.h>
+#include <unistd.h>
+
 // clang-format off
-_Atomic uint64_t hatrack_counters[HATRACK_COUNTERS_NUM]            = {};
-uint64_t hatrack_last_counters[HATRACK_COUNTERS_NUM]               = {};
+__thread hatrack_ctr_block_t *hatrack_my_counters = NULL;
+
+static _Atomic(hatrack_ctr_block_t *) hatrack_ctr_blocks = NULL;
 
-_Atomic uint64_t hatrack_yn_counters[HATRACK_YN_COUNTERS_NUM][2]   = {};
-uint64_t hatrack_last_yn_counters[HATRACK_YN_COUNTERS_NUM][2]      = {};
+static uint64_t hatrack_last_counters[HATRACK_COUNTERS_NUM]          = {};
+static uint64_t hatrack_last_yn_counters[HATRACK_YN_COUNTERS_NUM][2] = {};
 
 char *hatrack_counter_names[HATRACK_COUNTERS_NUM] = {
     "mmm alloc calls",
     "mmm used retires",
     "mmm unused retires",
     "stores shrunk",
+    "wh help requests",
     "hi-a sleep 1 worked",
     "hi-a sleep 1 failed",    
     "hi-a sleep 2 worked",
-    "hi-a sleep 2 failed",
-    "wh help requests"
+    "hi-a sleep 2 failed"
 };
 
 char *hatrack_yn_counter_names[HATRACK_YN_COUNTERS_NUM] = {
@@ -134,6 +138,198 @@ char *hatrack_yn_counter_names[HATRACK_YN_COUNTERS_NUM] = {
 
 // clang-format on
 
+/* Gives the calling thread a block of counters, preferring one that a
+ * thread that has since exited gave back. This only happens the first
+ * time a thread touches a counter (or the first time after it called
+ * hatrack_counters_detach()).
+ */
+hatrack_ctr_block_t *
+hatrack_counters_attach(void)
+{
+    hatrack_ctr_block_t *block;
+    hatrack_ctr_block_t *head;
+    bool                 expected;
+
+    block = atomic_load(&hatrack_ctr_blocks);
+
+    while (block) {
+	expected = false;
+
+	if (CAS(&block->in_use, &expected, true)) {
+	    hatrack_my_counters = block;
+
+	    return block;
+	}
+
+	block = block->next;
+    }
+
+    block = (hatrack_ctr_block_t *)aligned_alloc(alignof(hatrack_ctr_block_t),
+						 sizeof(hatrack_ctr_block_t));
+
+    memset(block, 0, sizeof(hatrack_ctr_block_t));
+    atomic_store(&block->in_use, true);
+
+    head = atomic_load(&hatrack_ctr_blocks);
+
+    do {
+	block->next = head;
+    } while (!CAS(&hatrack_ctr_blocks, &head, block));
+
+    hatrack_my_counters = block;
+
+    return block;
+}
+
+void
+hatrack_counters_detach(void)
+{
+    if (!hatrack_my_counters) {
+	return;
+    }
+
+    atomic_store(&hatrack_my_counters->in_use, false);
+    hatrack_my_counters = NULL;
+
+    return;
+}
+
+/* Adds up every thread's block. Either argument can be NULL, if you
+ * only want one kind of counter. Threads keep counting while we read,
+ * so the result is a snapshot of each counter at some point during
+ * the call, not of all of them at once.
+ */
+void
+hatrack_counters_read(uint64_t *counters, uint64_t (*yn_counters)[2])
+{
+    hatrack_ctr_block_t *block;
+    uint64_t             i;
+
+    if (counters) {
+	memset(counters, 0, sizeof(uint64_t) * HATRACK_COUNTERS_NUM);
+    }
+
+    if (yn_counters) {
+	memset(yn_counters, 0, sizeof(uint64_t) * 2 * HATRACK_YN_COUNTERS_NUM);
+    }
+
+    block = atomic_load(&hatrack_ctr_blocks);
+
+    while (block) {
+	for (i = 0; counters && i < HATRACK_COUNTERS_NUM; i++) {
+	    counters[i] += atomic_load_explicit(&block->counters[i],
+						memory_order_relaxed);
+	}
+
+	for (i = 0; yn_counters && i < HATRACK_YN_COUNTERS_NUM; i++) {
+	    yn_counters[i][0] += atomic_load_explicit(&block->yn_counters[i][0],
+						      memory_order_relaxed);
+	    yn_counters[i][1] += atomic_load_explicit(&block->yn_counters[i][1],
+						      memory_order_relaxed);
+	}
+
+	block = block->next;
+    }
+
+    return;
+}
+
+/* Writes every counter to the given file descriptor, whether it's
+ * been touched or not (monitoring systems prefer series that don't
+ * come and go).
+ *
+ * In Prometheus format, the plain counters are all one metric,
+ * hatrack_events_total, and the yes / no counters are
+ * hatrack_cas_total, with our counter names as a label (and for the
+ * latter, a second label saying which way the operation went). Our
+ * names don't have any characters that need escaping in a label
+ * value, or in a JSON string.
+ *
+ * Returns 0 on success, and -1 if a write failed, in which case errno
+ * is set.
+ */
+int
+hatrack_counters_export(int fd, hatrack_counters_format_t format)
+{
+    uint64_t counters[HATRACK_COUNTERS_NUM];
+    uint64_t yn_counters[HATRACK_YN_COUNTERS_NUM][2];
+    uint64_t i;
+
+    hatrack_counters_read(counters, yn_counters);
+
+    if (format == HATRACK_COUNTERS_JSON) {
+	if (dprintf(fd, "{\n  \"counters\": {") < 0) {
+	    return -1;
+	}
+
+	for (i = 0; i < HATRACK_COUNTERS_NUM; i++) {
+	    if (dprintf(fd,
+			"%s\n    \"%s\": %llu",
+			i ? "," : "",
+			hatrack_counter_names[i],
+			(unsigned long long)counters[i])
+		< 0) {
+		return -1;
+	    }
+	}
+
+	if (dprintf(fd, "\n  },\n  \"yn_counters\": {") < 0) {
+	    return -1;
+	}
+
+	for (i = 0; i < HATRACK_YN_COUNTERS_NUM; i++) {
+	    if (dprintf(fd,
+			"%s\n    \"%s\": {\"yes\": %llu, \"no\": %llu}",
+			i ? "," : "",
+			hatrack_yn_counter_names[i],
+			(unsigned long long)yn_counters[i][0],
+			(unsigned long long)yn_counters[i][1])
+		< 0) {
+		return -1;
+	    }
+	}
+
+	if (dprintf(fd, "\n  }\n}\n") < 0) {
+	    return -1;
+	}
+
+	return 0;
+    }
+
+    if (dprintf(fd, "# TYPE hatrack_events_total counter\n") < 0) {
+	return -1;
+    }
+
+    for (i = 0; i < HATRACK_COUNTERS_NUM; i++) {
+	if (dprintf(fd,
+		    "hatrack_events_total{counter=\"%s\"} %llu\n",
+		    hatrack_counter_names[i],
+		    (unsigned long long)counters[i])
+	    < 0) {
+	    return -1;
+	}
+    }
+
+    if (dprintf(fd, "# TYPE hatrack_cas_total counter\n") < 0) {
+	return -1;
+    }
+
+    for (i = 0; i < HATRACK_YN_COUNTERS_NUM; i++) {
+	if (dprintf(fd,
+		    "hatrack_cas_total{counter=\"%s\",result=\"yes\"} %llu\n"
+		    "hatrack_cas_total{counter=\"%s\",result=\"no\"} %llu\n",
+		    hatrack_yn_counter_names[i],
+		    (unsigned long long)yn_counters[i][0],
+		    hatrack_yn_counter_names[i],
+		    (unsigned long long)yn_counters[i][1])
+	    < 0) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
 /*
  * Used to output (to stderr) the difference between counters, from
  * the last time counters_output_delta() was called, until now.
@@ -141,12 +337,16 @@ char *hatrack_yn_counter_names[HATRACK_YN_COUNTERS_NUM] = {
 void
 counters_output_delta(void)
 {
+    uint64_t hatrack_counters[HATRACK_COUNTERS_NUM];
+    uint64_t hatrack_yn_counters[HATRACK_YN_COUNTERS_NUM][2];
     uint64_t i;
     uint64_t total;
     uint64_t y_cur, n_cur, y_last, n_last;
     uint64_t ydelta, ndelta;
     double   percent;
 
+    hatrack_counters_read(hatrack_counters, hatrack_yn_counters);
+
     fprintf(stderr, "----------- Counter Deltas --------------\n");
     for (i = 0; i < HATRACK_COUNTERS_NUM; i++) {
         if (hatrack_counters[i] == hatrack_last_counters[i]) {
@@ -194,11 +394,15 @@ counters_output_delta(void)
 void
 counters_output_alltime(void)
 {
+    uint64_t hatrack_counters[HATRACK_COUNTERS_NUM];
+    uint64_t hatrack_yn_counters[HATRACK_YN_COUNTERS_NUM][2];
     uint64_t i;
     uint64_t total;
     bool     unused_counters = false;
     bool     print_comma     = false;
 
+    hatrack_counters_read(hatrack_counters, hatrack_yn_counters);
+
     fprintf(stderr, "----------- Counter TOTALS --------------\n");
 
     for (i = 0; i < HATRACK_COUNTERS_NUM; i++) {
@@ -265,4 +469,16 @@ counters_output_alltime(void)
     return;
 }
 
+#else
+
+#include <errno.h>
+
+int
+hatrack_counters_export(int fd, hatrack_counters_format_t format)
+{
+    errno = ENOTSUP;
+
+    return -1;
+}
+
 #endif
@@ -22,10 +22,12 @@
  */
 
 #include <hatrack.h>
+#include <malloc.h>
 
 // clang-format off
 __thread mmm_header_t  *mmm_retire_list  = NULL;
 __thread pthread_once_t mmm_inited       = PTHREAD_ONCE_INIT;
+__thread uint64_t       mmm_nesting      = 0;
 _Atomic  uint64_t       mmm_epoch        = HATRACK_EPOCH_FIRST;
 _Atomic  uint64_t       mmm_nexttid      = 0;
 __thread int64_t        mmm_mytid        = -1; 
@@ -33,10 +35,18 @@ __thread uint64_t       mmm_retire_ctr   = 0;
 
          uint64_t       mmm_reservations[HATRACK_THREADS_MAX] = { 0, };
 
+         uint64_t       mmm_pool_limit   = HATRACK_MMM_POOL_LIMIT;
+static _Atomic uint64_t mmm_pool_sizes[MMM_POOLS_MAX + 1];
+__thread mmm_header_t  *mmm_pools[MMM_POOLS_MAX + 1];
+__thread uint64_t       mmm_pool_lens[MMM_POOLS_MAX + 1];
+__thread uint64_t       mmm_pool_hits    = 0;
+__thread uint64_t       mmm_pool_misses  = 0;
+
 //clang-format on
 
 
 static void    mmm_empty(void);
+static void    mmm_pool_drain(void);
 
 
 /*
@@ -132,13 +142,16 @@ mmm_clean_up_before_exit(void)
 	return;
     }
 
+    mmm_nesting = 0;
     mmm_end_op();
     
     while (mmm_retire_list) {
 	mmm_empty();
     }
-    
+
+    mmm_pool_drain();
     mmm_tid_giveback();
+    hatrack_counters_detach();
     
     return;
 }
@@ -186,7 +199,8 @@ mmm_retire(void *ptr)
 #endif	
     
     cell->retire_epoch = atomic_load(&mmm_epoch);
-    cell->next         = mmm_retire_list;
+    cell->next         = (mmm_header_t *)(((uint64_t)mmm_retire_list)
+					  | mmm_pool_id(cell));
     mmm_retire_list    = cell;
 
     DEBUG_MMM_INTERNAL(cell->data, "mmm_retire");
@@ -267,25 +281,25 @@ mmm_empty(void)
 	while (true) {
 	    // We got to the end of the list, and didn't
 	    // find one we should bother deleting.
-	    if (!cell->next) {
+	    if (!mmm_next_retired(cell)) {
 		return;
 	    }
 	    
-	    if (cell->next->retire_epoch < lowest) {
+	    if (mmm_next_retired(cell)->retire_epoch < lowest) {
 		tmp       = cell;
-		cell      = cell->next;
-		tmp->next = NULL;
+		cell      = mmm_next_retired(cell);
+		tmp->next = (mmm_header_t *)mmm_pool_id(tmp);
 		break;
 	    }
 	    
-	    cell = cell->next;
+	    cell = mmm_next_retired(cell);
 	}
     }
 
     // Now cell and everything below it can be freed.
     while (cell) {
 	tmp  = cell;
-	cell = cell->next;
+	cell = mmm_next_retired(cell);
 	HATRACK_FREE_CTR();
 	DEBUG_MMM_INTERNAL(tmp->data, "mmm_empty::free");
 
@@ -293,9 +307,303 @@ mmm_empty(void)
 	if (tmp->cleanup) {
 	    (*tmp->cleanup)(&tmp->data, tmp->cleanup_aux);
 	}
+
+	if (mmm_pool_id(tmp)) {
+	    mmm_pool_return(tmp);
+	    continue;
+	}
 	
 	free(tmp);
     }
 
     return;
 }
+
+/* Returns the id of the pool for allocations of the given size,
+ * creating the pool if there isn't one yet.
+ *
+ * A pool exists once its slot in mmm_pool_sizes holds its size, and
+ * we claim a free slot by CASing the size in, so the size is always
+ * visible by the time anyone can get the id back. If two threads
+ * race to create the same pool, one of them loses the CAS, sees the
+ * size it wanted, and returns the same id as the winner.
+ *
+ * Slots are claimed in order and never given back, so the first empty
+ * slot means no later slot is in use.
+ *
+ * Aborts if we're out of pools.
+ */
+uint64_t
+mmm_pool_register(uint64_t size)
+{
+    uint64_t i;
+    uint64_t found;
+
+    for (i = 1; i <= MMM_POOLS_MAX; i++) {
+	found = atomic_load(&mmm_pool_sizes[i]);
+
+	if (!found && CAS(&mmm_pool_sizes[i], &found, size)) {
+	    return i;
+	}
+
+	if (found == size) {
+	    return i;
+	}
+    }
+
+    abort();
+}
+
+/* Like mmm_alloc(), the write epoch needs to be committed by the
+ * caller. Records from the free list get zeroed, so the caller can't
+ * tell the difference.
+ */
+void *
+mmm_alloc_pooled(uint64_t pool)
+{
+    mmm_header_t *cell;
+    uint64_t      actual_size;
+
+    actual_size = sizeof(mmm_header_t) + atomic_load(&mmm_pool_sizes[pool]);
+    cell        = mmm_pools[pool];
+
+    if (cell) {
+	mmm_pools[pool] = cell->next;
+	mmm_pool_lens[pool]--;
+	mmm_pool_hits++;
+
+	memset(cell, 0, actual_size);
+    }
+    else {
+	cell = (mmm_header_t *)calloc(1, actual_size);
+	mmm_pool_misses++;
+
+	HATRACK_MALLOC_CTR();
+    }
+
+    cell->next = (mmm_header_t *)pool;
+
+    DEBUG_MMM_INTERNAL(cell->data, "mmm_alloc_pooled");
+
+    return (void *)cell->data;
+}
+
+/* Called in place of free() for pooled records, once nobody can be
+ * looking at them anymore.
+ */
+void
+mmm_pool_return(mmm_header_t *cell)
+{
+    uint64_t pool;
+
+    pool = mmm_pool_id(cell);
+
+    if (pool == MMM_CACHE_ID) {
+	mmm_cache_return(cell);
+	return;
+    }
+
+    if (mmm_pool_lens[pool] >= mmm_pool_limit) {
+	free(cell);
+	return;
+    }
+
+    cell->next      = mmm_pools[pool];
+    mmm_pools[pool] = cell;
+
+    mmm_pool_lens[pool]++;
+
+    return;
+}
+
+void
+mmm_pool_counts(uint64_t *hits, uint64_t *misses)
+{
+    *hits   = mmm_pool_hits;
+    *misses = mmm_pool_misses;
+
+    return;
+}
+
+mmm_cache_t *
+mmm_cache_new(void)
+{
+    mmm_cache_t *ret;
+
+    ret = (mmm_cache_t *)calloc(1, sizeof(mmm_cache_t));
+
+    atomic_store(&ret->refs, 1);
+
+    return ret;
+}
+
+// Frees anything sitting in the cache.
+static void
+mmm_cache_drain(mmm_cache_t *cache)
+{
+    mmm_cache_slot_t empty = {NULL, 0};
+    mmm_cache_slot_t slot;
+    uint64_t         i;
+
+    for (i = 0; i < HATRACK_MMM_CACHE_SLOTS; i++) {
+	slot = atomic_exchange(&cache->slots[i], empty);
+
+	if (slot.cell) {
+	    free(slot.cell);
+	}
+    }
+
+    return;
+}
+
+static void
+mmm_cache_decref(mmm_cache_t *cache)
+{
+    if (atomic_fetch_sub(&cache->refs, 1) == 1) {
+	free(cache);
+    }
+
+    return;
+}
+
+void
+mmm_cache_release(mmm_cache_t *cache)
+{
+    atomic_store(&cache->closed, true);
+    mmm_cache_drain(cache);
+    mmm_cache_decref(cache);
+
+    return;
+}
+
+/* Anything in a slot is ours once our CAS takes it out, so we never
+ * touch an allocation we don't own. We use the size the allocator
+ * actually gave us, since that's what we've really got to work with.
+ */
+void *
+mmm_cache_alloc_committed(mmm_cache_t *cache, uint64_t size)
+{
+    mmm_cache_slot_t empty = {NULL, 0};
+    mmm_cache_slot_t slot;
+    mmm_header_t    *cell;
+    uint64_t         actual_size;
+    uint64_t         i;
+
+    actual_size = sizeof(mmm_header_t) + size;
+    cell        = NULL;
+
+    for (i = 0; i < HATRACK_MMM_CACHE_SLOTS; i++) {
+	slot = atomic_load(&cache->slots[i]);
+
+	if (!slot.cell || slot.size < actual_size
+	    || slot.size > actual_size + (actual_size >> 1)) {
+	    continue;
+	}
+
+	if (CAS(&cache->slots[i], &slot, empty)) {
+	    cell = slot.cell;
+	    break;
+	}
+    }
+
+    if (cell) {
+	memset(cell, 0, actual_size);
+	atomic_fetch_add(&cache->hits, 1);
+    }
+    else {
+	cell = (mmm_header_t *)calloc(1, actual_size);
+	atomic_fetch_add(&cache->misses, 1);
+
+	HATRACK_MALLOC_CTR();
+    }
+
+    atomic_fetch_add(&cache->refs, 1);
+
+    cell->next        = (mmm_header_t *)MMM_CACHE_ID;
+    cell->cleanup_aux = cache;
+
+    atomic_store(&cell->write_epoch, atomic_fetch_add(&mmm_epoch, 1) + 1);
+
+    DEBUG_MMM_INTERNAL(cell->data, "mmm_cache_alloc_committed");
+
+    return (void *)cell->data;
+}
+
+/* Called in place of free() for cached allocations, once nobody can
+ * be looking at them anymore.
+ *
+ * If the cache gets closed while we're putting something into it, the
+ * owner's drain might have gone by before our CAS landed. So after a
+ * successful put, we check again, and if it's closed, drain it
+ * ourselves. Our reference keeps the cache around until we're done.
+ */
+void
+mmm_cache_return(mmm_header_t *cell)
+{
+    mmm_cache_t     *cache;
+    mmm_cache_slot_t empty = {NULL, 0};
+    mmm_cache_slot_t slot;
+    uint64_t         i;
+
+    cache = (mmm_cache_t *)cell->cleanup_aux;
+
+    if (atomic_load(&cache->closed)) {
+	free(cell);
+	mmm_cache_decref(cache);
+	return;
+    }
+
+    slot.cell = cell;
+    slot.size = malloc_usable_size(cell);
+
+    for (i = 0; i < HATRACK_MMM_CACHE_SLOTS; i++) {
+	empty.cell = NULL;
+	empty.size = 0;
+
+	if (CAS(&cache->slots[i], &empty, slot)) {
+	    break;
+	}
+    }
+
+    if (i == HATRACK_MMM_CACHE_SLOTS) {
+	free(cell);
+    }
+    else if (atomic_load(&cache->closed)) {
+	mmm_cache_drain(cache);
+    }
+
+    mmm_cache_decref(cache);
+
+    return;
+}
+
+void
+mmm_cache_counts(mmm_cache_t *cache, uint64_t *hits, uint64_t *misses)
+{
+    *hits   = atomic_load(&cache->hits);
+    *misses = atomic_load(&cache->misses);
+
+    return;
+}
+
+// When a thread exits, whatever is on its free lists goes back to
+// the system.
+static void
+mmm_pool_drain(void)
+{
+    mmm_header_t *cell;
+    uint64_t      i;
+
+    for (i = 1; i <= MMM_POOLS_MAX; i++) {
+	while (mmm_pools[i]) {
+	    cell         = mmm_pools[i];
+	    mmm_pools[i] = cell->next;
+
+	    free(cell);
+	}
+
+	mmm_pool_lens[i] = 0;
+    }
+
+    return;
+}
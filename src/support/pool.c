@@ -0,0 +1,335 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           pool.c
+ *  Description:    A work-stealing thread pool.
+ *
+ *                  See pool.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+#include <unistd.h>
+
+// The worker we're running on, if any.
+static __thread hatrack_pool_worker_t *hatrack_pool_me  = NULL;
+static __thread uint64_t               hatrack_pool_rng = 0;
+
+static void                *hatrack_pool_worker_main(void *);
+static hatrack_pool_task_t *hatrack_pool_find_task  (hatrack_pool_t *,
+						     hatrack_pool_worker_t *);
+static void                 hatrack_pool_run_task   (hatrack_pool_t *,
+						     hatrack_pool_task_t *);
+static uint64_t             hatrack_pool_random     (void);
+
+/* Passing 0 for num_workers gets you one worker per online CPU. */
+void
+hatrack_pool_init(hatrack_pool_t *self, uint64_t num_workers)
+{
+    hatrack_pool_worker_t *worker;
+    uint64_t               i;
+    long                   ncpus;
+
+    if (!num_workers) {
+	ncpus       = sysconf(_SC_NPROCESSORS_ONLN);
+	num_workers = ncpus > 0 ? (uint64_t)ncpus : 1;
+    }
+
+    self->num_workers = num_workers;
+    self->workers     = (hatrack_pool_worker_t *)aligned_alloc(
+	HATRACK_CACHE_LINE_SIZE,
+	sizeof(hatrack_pool_worker_t) * num_workers);
+
+    hq_init(&self->inject);
+
+    atomic_store(&self->idle.waiters, 0);
+    atomic_store(&self->idle.seq, 0);
+    atomic_store(&self->quiet.waiters, 0);
+    atomic_store(&self->quiet.seq, 0);
+    atomic_store(&self->pending, 0);
+    atomic_store(&self->shutdown, false);
+
+    for (i = 0; i < num_workers; i++) {
+	worker       = &self->workers[i];
+	worker->pool = self;
+	worker->id   = i;
+
+	wsdeque_init(&worker->deque);
+    }
+
+    // Every deque has to be set up before any worker might go
+    // looking in it.
+    for (i = 0; i < num_workers; i++) {
+	worker = &self->workers[i];
+
+	if (pthread_create(&worker->thread,
+			   NULL,
+			   hatrack_pool_worker_main,
+			   worker)) {
+	    abort();
+	}
+    }
+
+    return;
+}
+
+hatrack_pool_t *
+hatrack_pool_new(uint64_t num_workers)
+{
+    hatrack_pool_t *ret;
+
+    ret = (hatrack_pool_t *)malloc(sizeof(hatrack_pool_t));
+
+    hatrack_pool_init(ret, num_workers);
+
+    return ret;
+}
+
+/* Waits for everything that's been submitted to finish, then stops
+ * the workers. Setting the shutdown flag and waking everybody up
+ * follows the same protocol as a submission, so a worker that's
+ * about to park will either see the flag, or get woken.
+ */
+void
+hatrack_pool_cleanup(hatrack_pool_t *self)
+{
+    uint64_t i;
+
+    hatrack_pool_wait(self);
+
+    atomic_store(&self->shutdown, true);
+    hatrack_unpark(&self->idle, self->num_workers);
+
+    for (i = 0; i < self->num_workers; i++) {
+	pthread_join(self->workers[i].thread, NULL);
+	wsdeque_cleanup(&self->workers[i].deque);
+    }
+
+    hq_cleanup(&self->inject);
+    free(self->workers);
+
+    return;
+}
+
+void
+hatrack_pool_delete(hatrack_pool_t *self)
+{
+    hatrack_pool_cleanup(self);
+    free(self);
+
+    return;
+}
+
+/* If we're running on one of this pool's workers, the task goes on
+ * that worker's deque. Otherwise, it goes on the shared queue.
+ *
+ * The fence matters when the task went on a deque, since the push
+ * only does a relaxed store to bottom, and parking.h needs the write
+ * to the queue to be ordered before our check for parked workers.
+ * Without it, a worker could check our deque, find it empty, and
+ * park, right as we decide nobody's parked.
+ */
+void
+hatrack_pool_submit(hatrack_pool_t     *self,
+		    hatrack_task_func_t func,
+		    void               *arg)
+{
+    hatrack_pool_task_t *task;
+
+    task       = (hatrack_pool_task_t *)malloc(sizeof(hatrack_pool_task_t));
+    task->func = func;
+    task->arg  = arg;
+
+    atomic_fetch_add(&self->pending, 1);
+
+    if (hatrack_pool_me && hatrack_pool_me->pool == self) {
+	wsdeque_push(&hatrack_pool_me->deque, task);
+    }
+    else {
+	hq_enqueue(&self->inject, task);
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    hatrack_unpark(&self->idle, 1);
+
+    return;
+}
+
+void
+hatrack_pool_wait(hatrack_pool_t *self)
+{
+    uint32_t seq;
+
+    while (atomic_load(&self->pending)) {
+	seq = hatrack_park_prepare(&self->quiet);
+
+	if (!atomic_load(&self->pending)) {
+	    hatrack_park_cancel(&self->quiet);
+	    break;
+	}
+
+	hatrack_park(&self->quiet, seq, NULL);
+    }
+
+    return;
+}
+
+bool
+hatrack_pool_in_worker(hatrack_pool_t *self)
+{
+    return hatrack_pool_me && hatrack_pool_me->pool == self;
+}
+
+/* Our own deque first, then the shared queue, then everybody else's
+ * deques, starting from a random one, so that thieves don't all pile
+ * onto the same victim.
+ */
+static hatrack_pool_task_t *
+hatrack_pool_find_task(hatrack_pool_t *self, hatrack_pool_worker_t *me)
+{
+    hatrack_pool_task_t *ret;
+    uint64_t             start;
+    uint64_t             i;
+    uint64_t             victim;
+    bool                 found;
+
+    ret = wsdeque_pop(&me->deque, &found);
+
+    if (found) {
+	return ret;
+    }
+
+    ret = hq_dequeue(&self->inject, &found);
+
+    if (found) {
+	return ret;
+    }
+
+    start = hatrack_pool_random();
+
+    for (i = 0; i < self->num_workers; i++) {
+	victim = (start + i) % self->num_workers;
+
+	if (victim == me->id) {
+	    continue;
+	}
+
+	ret = wsdeque_steal(&self->workers[victim].deque, &found);
+
+	if (found) {
+	    return ret;
+	}
+    }
+
+    return NULL;
+}
+
+static void
+hatrack_pool_run_task(hatrack_pool_t *self, hatrack_pool_task_t *task)
+{
+    (*task->func)(task->arg);
+    free(task);
+
+    if (atomic_fetch_sub(&self->pending, 1) == 1) {
+	hatrack_unpark(&self->quiet, UINT64_MAX);
+    }
+
+    return;
+}
+
+/* We only park if a pass over everything, made after we've registered
+ * as a waiter, comes up empty. Anything submitted after that
+ * registration will wake us.
+ *
+ * A steal can come up empty because somebody else beat us to the
+ * item, even if there's more behind it, so we can end up parking
+ * while there's still work sitting in some other worker's deque.
+ * That costs parallelism, but never progress: the owner of a deque
+ * never parks until its deque is empty.
+ */
+static void *
+hatrack_pool_worker_main(void *arg)
+{
+    hatrack_pool_worker_t *me;
+    hatrack_pool_t        *pool;
+    hatrack_pool_task_t   *task;
+    uint64_t               spins;
+    uint32_t               seq;
+
+    me              = (hatrack_pool_worker_t *)arg;
+    pool            = me->pool;
+    hatrack_pool_me = me;
+
+    mmm_register_thread();
+
+    while (true) {
+	for (spins = 0; spins < HATRACK_QUEUE_WAIT_SPINS; spins++) {
+	    task = hatrack_pool_find_task(pool, me);
+
+	    if (task) {
+		break;
+	    }
+	}
+
+	if (task) {
+	    hatrack_pool_run_task(pool, task);
+	    continue;
+	}
+
+	seq  = hatrack_park_prepare(&pool->idle);
+	task = hatrack_pool_find_task(pool, me);
+
+	if (task) {
+	    hatrack_park_cancel(&pool->idle);
+	    hatrack_pool_run_task(pool, task);
+	    continue;
+	}
+
+	if (atomic_load(&pool->shutdown)) {
+	    hatrack_park_cancel(&pool->idle);
+	    break;
+	}
+
+	hatrack_park(&pool->idle, seq, NULL);
+    }
+
+    hatrack_pool_me = NULL;
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// A per-thread xorshift, as in omap.
+static uint64_t
+hatrack_pool_random(void)
+{
+    uint64_t r;
+
+    if (!hatrack_pool_rng) {
+	hatrack_pool_rng = ((uint64_t)&hatrack_pool_rng) | 1;
+    }
+
+    r = hatrack_pool_rng;
+
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+
+    hatrack_pool_rng = r;
+
+    return r;
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           skiplist.c
+ *  Description:    The lock-free skiplist core shared by hatrack_omap
+ *                  and skipq.
+ *
+ *                  See skiplist.h for an overview.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+static __thread uint64_t hatrack_skiplist_rng = 0;
+
+/* The head node doesn't need to come from mmm, since it never gets
+ * removed. Heights are stored in a uint64_t bit mask when we pick
+ * them (see hatrack_skiplist_pick_height()), so 64 is the most we
+ * can do.
+ */
+void
+hatrack_skiplist_init(hatrack_skiplist_t             *self,
+		      uint64_t                        max_height,
+		      hatrack_skiplist_cmp_func_t     cmp,
+		      hatrack_skiplist_removed_func_t removed,
+		      hatrack_skiplist_retire_func_t  retire)
+{
+    uint64_t sz;
+
+    if (!max_height || max_height > 64) {
+	abort();
+    }
+
+    sz = sizeof(hatrack_skiplist_node_t) + sizeof(uint64_t) * max_height;
+
+    self->head         = (hatrack_skiplist_node_t *)calloc(1, sz);
+    self->head->height = max_height;
+    self->max_height   = max_height;
+    self->cmp          = cmp;
+    self->removed      = removed;
+    self->retire       = retire;
+
+    atomic_store(&self->height, 1);
+
+    return;
+}
+
+/* The user has to deal with any nodes still in the list first; this
+ * only gets rid of the head.
+ */
+void
+hatrack_skiplist_cleanup(hatrack_skiplist_t *self)
+{
+    free(self->head);
+
+    return;
+}
+
+void
+hatrack_skiplist_node_init(hatrack_skiplist_node_t *node, uint64_t height)
+{
+    node->height = height;
+
+    atomic_store(&node->refs, 2);
+
+    return;
+}
+
+/* Node heights are geometrically distributed: half the nodes are on
+ * just the bottom level, a quarter are also on level 1, and so on.
+ *
+ * Searches start at the highest level in use, so we make sure that
+ * includes the height we pick, before anyone can see a node with it.
+ */
+uint64_t
+hatrack_skiplist_pick_height(hatrack_skiplist_t *self)
+{
+    uint64_t height;
+    uint64_t cur_height;
+
+    height = 1 + __builtin_ctzll(hatrack_skiplist_random()
+				 | (1ULL << (self->max_height - 1)));
+
+    cur_height = atomic_load(&self->height);
+
+    while (cur_height < height) {
+	if (CAS(&self->height, &cur_height, height)) {
+	    break;
+	}
+    }
+
+    return height;
+}
+
+/* Finds, at each level, the last node with a key less than the given
+ * key (preds), and the node after it (succs), unlinking any removed
+ * nodes we come across along the way. Returns the node after the
+ * predecessor at the bottom level, if any, which may or may not have
+ * the key; it's up to the caller to check.
+ *
+ * When past_equal is true, we go past any nodes with the key we're
+ * looking for, instead of stopping in front of them. That's used to
+ * unlink a removed node, which can sit behind a newer node with the
+ * same key; see hatrack_skiplist_unlink().
+ *
+ * If we ever fail to unlink a node, it's because the node in front of
+ * it changed under us (possibly because it got removed itself), and
+ * we start over from the top.
+ */
+hatrack_skiplist_node_t *
+hatrack_skiplist_find(hatrack_skiplist_t       *self,
+		      void                     *key,
+		      hatrack_skiplist_node_t **preds,
+		      hatrack_skiplist_node_t **succs,
+		      bool                      past_equal)
+{
+    hatrack_skiplist_node_t *pred;
+    hatrack_skiplist_node_t *cur;
+    uint64_t                 succ;
+    uint64_t                 expected;
+    int64_t                  level;
+    int                      cmp;
+
+retry:
+    pred = self->head;
+
+    for (level = atomic_load(&self->height) - 1; level >= 0; level--) {
+	cur = hatrack_skiplist_next(pred, level);
+
+	while (cur) {
+	    succ = atomic_load(&cur->next[level]);
+
+	    if (hatrack_skiplist_is_marked(succ)) {
+		expected = (uint64_t)cur;
+		succ     = (uint64_t)hatrack_skiplist_ptr(succ);
+
+		if (!CAS(&pred->next[level], &expected, succ)) {
+		    goto retry;
+		}
+
+		cur = (hatrack_skiplist_node_t *)succ;
+		continue;
+	    }
+
+	    cmp = (*self->cmp)(self, cur, key);
+
+	    if (cmp < 0 || (past_equal && !cmp)) {
+		pred = cur;
+		cur  = (hatrack_skiplist_node_t *)succ;
+		continue;
+	    }
+
+	    break;
+	}
+
+	preds[level] = pred;
+	succs[level] = cur;
+    }
+
+    return succs[0];
+}
+
+/* Links a new node in at the bottom level, between the preds and
+ * succs from the last hatrack_skiplist_find(), which is where the
+ * insertion takes effect. If this fails, the neighborhood changed,
+ * and the caller needs to search again.
+ */
+bool
+hatrack_skiplist_link(hatrack_skiplist_node_t  *node,
+		      hatrack_skiplist_node_t **preds,
+		      hatrack_skiplist_node_t **succs)
+{
+    uint64_t expected;
+    uint64_t i;
+
+    for (i = 0; i < node->height; i++) {
+	atomic_store(&node->next[i], (uint64_t)succs[i]);
+    }
+
+    expected = (uint64_t)succs[0];
+
+    return CAS(&preds[0]->next[0], &expected, (uint64_t)node);
+}
+
+/* Links a freshly inserted node in at each of its upper levels, and
+ * then drops the inserter's reference. The key is the node's own key.
+ *
+ * Before linking at a level, we point the node at its successor there
+ * with a CAS, which fails if the node's pointer at that level has been
+ * marked, i.e., if the node is being removed, in which case we stop.
+ * Then we CAS the node in after its predecessor; if that fails, the
+ * neighborhood changed, and we search again.
+ *
+ * The remover can still mark the node between those two CASes, and
+ * run its unlinking pass before we link the node in, in which case
+ * the node ends up linked in after the remover thinks it's gone. So
+ * when we're done, if the node's been removed, we unlink it
+ * ourselves. Only after that do we drop our reference.
+ */
+void
+hatrack_skiplist_build_tower(hatrack_skiplist_t       *self,
+			     hatrack_skiplist_node_t  *node,
+			     void                     *key,
+			     hatrack_skiplist_node_t **preds,
+			     hatrack_skiplist_node_t **succs)
+{
+    uint64_t level;
+    uint64_t p;
+    uint64_t expected;
+
+    for (level = 1; level < node->height; level++) {
+	while (true) {
+	    p = atomic_load(&node->next[level]);
+
+	    if (hatrack_skiplist_is_marked(p)) {
+		goto done;
+	    }
+
+	    if (p != (uint64_t)succs[level]
+		&& !CAS(&node->next[level], &p, (uint64_t)succs[level])) {
+		goto done;
+	    }
+
+	    expected = (uint64_t)succs[level];
+
+	    if (CAS(&preds[level]->next[level], &expected, (uint64_t)node)) {
+		break;
+	    }
+
+	    hatrack_skiplist_find(self, key, preds, succs, false);
+	}
+    }
+
+done:
+    if ((*self->removed)(node)) {
+	hatrack_skiplist_mark_tower(node);
+	hatrack_skiplist_find(self, key, preds, succs, true);
+    }
+
+    hatrack_skiplist_release(self, node);
+
+    return;
+}
+
+// Top down, so that the bottom level, which is what matters for
+// searches, is the last to go.
+void
+hatrack_skiplist_mark_tower(hatrack_skiplist_node_t *node)
+{
+    int64_t  level;
+    uint64_t p;
+
+    for (level = node->height - 1; level >= 0; level--) {
+	p = atomic_load(&node->next[level]);
+
+	while (!hatrack_skiplist_is_marked(p)) {
+	    if (CAS(&node->next[level], &p, p | HATRACK_SKIPLIST_MARK)) {
+		break;
+	    }
+	}
+    }
+
+    return;
+}
+
+/* Called by whoever won the removal of a node, once the removal has
+ * taken effect: marks the node's tower, makes sure it's unlinked
+ * everywhere, and drops the remover's reference.
+ */
+void
+hatrack_skiplist_unlink(hatrack_skiplist_t       *self,
+			hatrack_skiplist_node_t  *node,
+			void                     *key,
+			hatrack_skiplist_node_t **preds,
+			hatrack_skiplist_node_t **succs)
+{
+    hatrack_skiplist_mark_tower(node);
+    hatrack_skiplist_find(self, key, preds, succs, true);
+    hatrack_skiplist_release(self, node);
+
+    return;
+}
+
+void
+hatrack_skiplist_release(hatrack_skiplist_t *self, hatrack_skiplist_node_t *node)
+{
+    if (atomic_fetch_sub(&node->refs, 1) == 1) {
+	(*self->retire)(self, node);
+    }
+
+    return;
+}
+
+/* A per-thread xorshift, which is plenty random for picking heights
+ * (and for skipq picking lists); we just don't want threads sharing
+ * state.
+ */
+uint64_t
+hatrack_skiplist_random(void)
+{
+    uint64_t r;
+
+    if (!hatrack_skiplist_rng) {
+	hatrack_skiplist_rng = ((uint64_t)&hatrack_skiplist_rng) | 1;
+    }
+
+    r = hatrack_skiplist_rng;
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+
+    hatrack_skiplist_rng = r;
+
+    return r;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           stats.c
+ *  Description:    Per-table introspection: occupancy, probe lengths
+ *                  and memory footprint.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+/* Returns the table's retired-store counter, creating it if this is
+ * the first time anyone needed it. Two threads can't both be retiring
+ * a store from the same table at the same time (only the thread that
+ * wins the CAS to install a new store retires the old one), but we
+ * CAS the pointer in anyway, since it costs nothing here, and makes
+ * this safe no matter who calls it.
+ */
+hatrack_retired_t *
+hatrack_retired_get(_Atomic(hatrack_retired_t *) *slot)
+{
+    hatrack_retired_t *ret;
+    hatrack_retired_t *expected;
+
+    ret = atomic_load(slot);
+
+    if (ret) {
+	return ret;
+    }
+
+    ret      = (hatrack_retired_t *)malloc(sizeof(hatrack_retired_t));
+    expected = NULL;
+
+    atomic_store(&ret->bytes, 0);
+    atomic_store(&ret->refs, 1);
+
+    if (!CAS(slot, &expected, ret)) {
+	free(ret);
+
+	return expected;
+    }
+
+    return ret;
+}
+
+void
+hatrack_retired_add(hatrack_retired_t *self, uint64_t bytes)
+{
+    atomic_fetch_add(&self->refs, 1);
+    atomic_fetch_add(&self->bytes, bytes);
+
+    return;
+}
+
+/* Called from the cleanup handler of a store that's being freed. */
+void
+hatrack_retired_sub(hatrack_retired_t *self, uint64_t bytes)
+{
+    atomic_fetch_sub(&self->bytes, bytes);
+    hatrack_retired_release(self);
+
+    return;
+}
+
+void
+hatrack_retired_release(hatrack_retired_t *self)
+{
+    if (!self) {
+	return;
+    }
+
+    if (atomic_fetch_sub(&self->refs, 1) == 1) {
+	free(self);
+    }
+
+    return;
+}
+
+uint64_t
+hatrack_retired_bytes(_Atomic(hatrack_retired_t *) *slot)
+{
+    hatrack_retired_t *retired;
+
+    retired = atomic_load(slot);
+
+    if (!retired) {
+	return 0;
+    }
+
+    return atomic_load(&retired->bytes);
+}
+
+void
+hatrack_stats_add_probe(hatrack_stats_t *stats, uint64_t distance)
+{
+    if (distance > stats->max_probe) {
+	stats->max_probe = distance;
+    }
+
+    stats->mean_probe += distance;
+
+    if (distance >= HATRACK_STATS_PROBE_BUCKETS) {
+	distance = HATRACK_STATS_PROBE_BUCKETS - 1;
+    }
+
+    stats->probe_hist[distance]++;
+
+    return;
+}
+
+void
+hatrack_stats_add_chain(hatrack_stats_t *stats, uint64_t links)
+{
+    if (links > stats->max_chain) {
+	stats->max_chain = links;
+    }
+
+    stats->mean_chain += links;
+
+    return;
+}
+
+/* While we're collecting, mean_probe (and mean_chain) holds a sum, so that stats for
+ * multiple tables (e.g., the shards of a dictionary) can be added
+ * together before we divide. hatrack_stats_finish() turns it into an
+ * average, and fills in the derived fields.
+ */
+void
+hatrack_stats_merge(hatrack_stats_t *dst, hatrack_stats_t *src)
+{
+    uint64_t i;
+
+    dst->num_buckets            += src->num_buckets;
+    dst->used_buckets           += src->used_buckets;
+    dst->num_items              += src->num_items;
+    dst->mean_probe             += src->mean_probe;
+    dst->neighborhood_overflows += src->neighborhood_overflows;
+    dst->deleted_records        += src->deleted_records;
+    dst->mean_chain             += src->mean_chain;
+    dst->migrations             += src->migrations;
+    dst->store_bytes            += src->store_bytes;
+    dst->record_bytes           += src->record_bytes;
+    dst->retired_bytes          += src->retired_bytes;
+
+    for (i = 0; i < HATRACK_STATS_PROBE_BUCKETS; i++) {
+	dst->probe_hist[i] += src->probe_hist[i];
+    }
+
+    if (src->max_probe > dst->max_probe) {
+	dst->max_probe = src->max_probe;
+    }
+
+    if (src->max_neighborhood > dst->max_neighborhood) {
+	dst->max_neighborhood = src->max_neighborhood;
+    }
+
+    if (src->max_chain > dst->max_chain) {
+	dst->max_chain = src->max_chain;
+    }
+
+    return;
+}
+
+void
+hatrack_stats_finish(hatrack_stats_t *stats)
+{
+    if (stats->num_buckets) {
+	stats->load_factor = (double)stats->used_buckets / stats->num_buckets;
+    }
+
+    if (stats->used_buckets) {
+	stats->mean_probe /= stats->used_buckets;
+	stats->mean_chain /= stats->used_buckets;
+    }
+
+    stats->total_bytes = stats->store_bytes + stats->record_bytes
+	               + stats->retired_bytes;
+
+    return;
+}
@@ -34,6 +34,7 @@
 #define S_KEY_RANGE   "num-keys"
 #define S_SHUFFLE     "no-rand"
 #define S_SEED        "seed"
+#define S_BACKOFF     "backoff"
 #define S_HELP        "help"
 
 #define HATRACK_DEFAULT_READ     98
@@ -204,7 +205,11 @@ usage(void)
             " ops before.)\n");
     fprintf(stderr,
             "  --seed=<hex-digits> (Set a seed for the rng; "
-            "implies --no-rand)\n\n");
+            "implies --no-rand)\n");
+    fprintf(stderr,
+            "  --backoff=<none|pause|spin|yield|sleep> (How to back off "
+            "after a failed\nCAS; DEFAULT: %s)\n\n",
+            hatrack_backoff_name(&hatrack_backoff_default));
 
     fprintf(stderr, "When you pass --functional-tests or any of the flags ");
     fprintf(stderr, "for a custom\nperformance test, the default stress ");
@@ -454,6 +459,43 @@ try_parse_flag_arg(char *p, char *flag_name, bool *b)
     return false;
 }
 
+/* Unlike the other flags, this one doesn't go in the config; it sets
+ * hatrack_backoff_default, which every data structure picks up, so
+ * it applies to whatever tests end up running.
+ */
+static bool
+try_parse_backoff_arg(char *p, char *flag_name, bool *b)
+{
+    char              *s;
+    hatrack_backoff_t  config;
+
+    s = p;
+
+    if (!strncmp(s, flag_name, strlen(flag_name))) {
+        s += strlen(flag_name);
+        if (*s++ != '=') {
+            fprintf(stderr,
+                    "Unrecognized flag: %s. Did you mean '%s'?\n",
+                    p,
+                    flag_name);
+            usage();
+        }
+
+        ensure_unspecd(b, flag_name);
+
+        if (!hatrack_backoff_from_name(&config, s)) {
+            fprintf(stderr, "Unknown backoff strategy: %s\n", s);
+            usage();
+        }
+
+        hatrack_backoff_set_default(&config);
+
+        return true;
+    }
+
+    return false;
+}
+
 #define try_parse_int(p, flag_name, bool_name, var)                            \
     if (try_parse_int_arg(p, flag_name, &bool_name, var)) {                    \
         continue;                                                              \
@@ -464,6 +506,11 @@ try_parse_flag_arg(char *p, char *flag_name, bool *b)
         continue;                                                              \
     }
 
+#define try_parse_backoff(p, flag_name, bool_name)                             \
+    if (try_parse_backoff_arg(p, flag_name, &bool_name)) {                     \
+        continue;                                                              \
+    }
+
 #define try_parse_flag(p, flag_name, bool_name, var)                           \
     if (try_parse_flag_arg(p, flag_name, &bool_name)) {                        \
         *var = true;                                                           \
@@ -490,6 +537,7 @@ parse_args(int argc, char *argv[])
     bool           total_op_provided    = false;
     bool           shuffle_provided     = false;
     bool           seed_provided        = false;
+    bool           backoff_provided     = false;
     int            alloc_len;
     int            i, j;
     int            num_hats;
@@ -568,6 +616,7 @@ parse_args(int argc, char *argv[])
                            def_tests_provided,
                            &ret->run_default_tests);
             try_parse_seed(p, S_SEED, seed_provided, &ret->custom.seed);
+            try_parse_backoff(p, S_BACKOFF, backoff_provided);
             try_parse_int(p,
                           S_READ_PCT,
                           read_pct_provided,
@@ -13,6 +13,7 @@
  */
 
 #include "testhat.h"
+#include <string.h>
 
 #define basictest(name, g, p, a, r, d, v, o, sz, pf, range, num, ops)          \
     {                                                                          \
@@ -42,6 +43,23 @@
         basictest(name, g, p, a, r, d, v, o, 15, pf, 10000, num, 3000),        \
         basictest(name, g, p, a, r, d, v, o, 18, pf, 100000, num, 300)
 
+/* These are for comparing crown's two store layouts (see
+ * HATRACK_CROWN_SOA), which mostly differ in how they use the
+ * cache. So we go from a table that fits in L1 to one that doesn't
+ * come close to fitting in L3. The key range is twice the number of
+ * prefilled items, so about half of the reads are misses, which have
+ * to look at the whole neighborhood.
+ *
+ * The layout only matters to crown, so these live in their own list,
+ * below, and only ever run against crown.
+ */
+#define layoutset(name, g, p, a, r, d, v, o, num)                             \
+    basictest(name, g, p, a, r, d, v, o, 8, 75, 384, num, 20000000),           \
+        basictest(name, g, p, a, r, d, v, o, 12, 75, 6144, num, 20000000),     \
+        basictest(name, g, p, a, r, d, v, o, 16, 75, 98304, num, 10000000),    \
+        basictest(name, g, p, a, r, d, v, o, 20, 75, 1572864, num, 5000000),   \
+        basictest(name, g, p, a, r, d, v, o, 23, 75, 12582912, num, 5000000)
+
 /* Right now, I've picked all op counts so that most tests take around
  * a second (plus or minus a bit) w/ 1 thread, when compiled
  * w/ optimization and w/o debug.
@@ -73,6 +91,34 @@ benchmark_t default_tests[] = {
     }
 };
 
+benchmark_t layout_tests[] = {
+    layoutset("layout read", 100, 0, 0, 0, 0, 0, 0, 1),
+    layoutset("layout mix", 90, 5, 0, 0, 5, 0, 0, 4),
+    {
+        0,
+    }
+};
+
+static char *layout_hat_list[] = {"crown", NULL};
+
+/* The layout tests run if crown is one of the algorithms we're
+ * testing, but not against anything else.
+ */
+static bool
+testing_crown(config_info_t *config)
+{
+    int i = 0;
+
+    while (config->hat_list[i]) {
+        if (!strcmp(config->hat_list[i], "crown")) {
+            return true;
+        }
+        i++;
+    }
+
+    return false;
+}
+
 void
 run_default_tests(config_info_t *config)
 {
@@ -86,5 +132,19 @@ run_default_tests(config_info_t *config)
         i++;
     }
 
+    if (!testing_crown(config)) {
+        return;
+    }
+
+    i = 0;
+
+    while (layout_tests[i].total_ops) {
+        layout_tests[i].hat_list = layout_hat_list;
+
+        run_performance_test(&layout_tests[i]);
+        counters_output_delta();
+        i++;
+    }
+
     return;
 }
@@ -11,8 +11,22 @@
 
 #include "testhat.h"
 
+#include <hatrack/hq.h>
+#include <hatrack/capq.h>
+#include <hatrack/hq_spsc.h>
+#include <hatrack/hq_mpsc.h>
+#include <hatrack/skipq.h>
+#include <hatrack/wsdeque.h>
+#include <hatrack/pool.h>
+#include <hatrack/queue.h>
+#include <hatrack/q64.h>
+#include <hatrack/stack.h>
+#include <hatrack/hatring.h>
+#include <hatrack/logring.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 typedef struct {
     uint32_t   tid;
@@ -418,6 +432,5392 @@ test_parallel(func_test_info_t *info)
     return true;
 }
 
+/* [ backends ]
+ *
+ * Not a testhat test; this checks that hatrack_dict and hatrack_set
+ * behave the same on top of each backend we allow them to use. We
+ * do a handful of single-threaded operations, then compare views and
+ * set algebra against what we expect.
+ */
+static char *backend_names[] = {
+    [HATRACK_BACKEND_CROWN]             = "crown",
+    [HATRACK_BACKEND_WOOLHAT]           = "woolhat",
+    [HATRACK_BACKEND_WITCHHAT]          = "witchhat",
+    [HATRACK_BACKEND_HIHAT]             = "hihat",
+    [HATRACK_BACKEND_TOPHAT_FAST]       = "tophat-fwf",
+    [HATRACK_BACKEND_TOPHAT_CONSISTENT] = "tophat-cwf",
+    [HATRACK_BACKEND_CLOCHE]            = "cloche",
+};
+
+static bool
+test_backend(hatrack_backend_t backend, uint64_t range)
+{
+    hatrack_dict_t       *dict;
+    hatrack_set_t        *s1;
+    hatrack_set_t        *s2;
+    hatrack_set_t        *s3;
+    hatrack_dict_value_t *values;
+    void                **items;
+    uint64_t              i;
+    uint64_t              num;
+    uint64_t              sum;
+    bool                  found;
+    bool                  ret;
+
+    ret  = false;
+    dict = hatrack_dict_new_with_backend(HATRACK_DICT_KEY_TYPE_INT, backend);
+    s1   = hatrack_set_new_with_backend(HATRACK_DICT_KEY_TYPE_INT, backend);
+    s2   = hatrack_set_new_with_backend(HATRACK_DICT_KEY_TYPE_INT, backend);
+    s3   = NULL;
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+	hatrack_set_add(s1, (void *)i);
+	hatrack_set_add(s2, (void *)(i + range / 2));
+    }
+
+    for (i = 1; i <= range; i++) {
+	if ((uint64_t)hatrack_dict_get(dict, (void *)i, &found) != i || !found) {
+	    goto finished;
+	}
+    }
+
+    if (!hatrack_dict_replace(dict, (void *)1, (void *)(range + 1))) {
+	goto finished;
+    }
+
+    if (hatrack_dict_replace(dict, (void *)(range + 1), (void *)1)) {
+	goto finished;
+    }
+
+    if (hatrack_dict_add(dict, (void *)2, (void *)2)) {
+	goto finished;
+    }
+
+    if (!hatrack_dict_remove(dict, (void *)2)) {
+	goto finished;
+    }
+
+    hatrack_dict_get(dict, (void *)2, &found);
+
+    if (found) {
+	goto finished;
+    }
+
+    // Values are now 3 .. range, plus range + 1.
+    values = hatrack_dict_values_sort(dict, &num);
+    sum    = 0;
+
+    for (i = 0; i < num; i++) {
+	sum += (uint64_t)values[i];
+    }
+
+    free(values);
+
+    if (num != range - 1 || sum != ((range + 1) * (range + 2)) / 2 - 3) {
+	goto finished;
+    }
+
+    s3 = hatrack_set_intersection(s1, s2);
+    items = hatrack_set_items(s3, &num);
+    free(items);
+
+    if (num != range - range / 2) {
+	goto finished;
+    }
+
+    if (!hatrack_set_contains(s3, (void *)range)
+	|| hatrack_set_contains(s3, (void *)1)) {
+	goto finished;
+    }
+
+    if (!hatrack_set_is_subset(s3, s1, true)
+	|| hatrack_set_is_disjoint(s1, s2)) {
+	goto finished;
+    }
+
+    ret = true;
+
+finished:
+    hatrack_dict_delete(dict);
+    hatrack_set_delete(s1);
+    hatrack_set_delete(s2);
+
+    if (s3) {
+	hatrack_set_delete(s3);
+    }
+
+    return ret;
+}
+
+static void
+run_backend_tests(void)
+{
+    hatrack_backend_t backend;
+
+    fprintf(stderr, "[[ Test: backends ]]\n");
+
+    for (backend = HATRACK_BACKEND_CROWN; backend < HATRACK_BACKEND_NUM;
+	 backend++) {
+	fprintf(stderr, "%10s:\t", backend_names[backend]);
+
+	if (test_backend(backend, 1000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* [ changes ]
+ *
+ * Checks the change feed on hatrack_dict: we make a batch of changes,
+ * ask for everything since a midpoint, and make sure we get exactly
+ * the changes after the midpoint, in order, with the right kinds. Then
+ * we trim, and make sure asking for trimmed history says so.
+ */
+static bool
+test_change_feed(uint64_t range)
+{
+    hatrack_dict_t   *dict;
+    hatrack_change_t *changes;
+    uint64_t          i;
+    uint64_t          num;
+    uint64_t          mid;
+    uint64_t          high_water;
+    bool              ret;
+
+    ret     = false;
+    changes = NULL;
+    dict    = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    hatrack_dict_set_change_feed(dict, true);
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    mid = hatrack_dict_changes_epoch(dict);
+
+    for (i = 1; i <= range; i++) {
+	if (i & 1) {
+	    hatrack_dict_put(dict, (void *)i, (void *)(i + 1));
+	}
+	else {
+	    hatrack_dict_remove(dict, (void *)i);
+	}
+    }
+
+    // Neither of these is a change.
+    hatrack_dict_remove(dict, (void *)2);
+    hatrack_dict_add(dict, (void *)1, NULL);
+
+    changes = hatrack_dict_changes_since(dict, mid, &num, &high_water);
+
+    if (num != range || high_water != mid + range) {
+	goto finished;
+    }
+
+    for (i = 0; i < num; i++) {
+	if ((uint64_t)changes[i].key != i + 1
+	    || changes[i].epoch != mid + i + 1) {
+	    goto finished;
+	}
+	if (((i + 1) & 1) && (changes[i].kind != HATRACK_CHANGE_UPDATE
+			      || (uint64_t)changes[i].value != i + 2)) {
+	    goto finished;
+	}
+	if (!((i + 1) & 1) && changes[i].kind != HATRACK_CHANGE_DELETE) {
+	    goto finished;
+	}
+    }
+
+    free(changes);
+
+    changes = hatrack_dict_changes_since(dict, high_water, &num, &high_water);
+
+    if (changes || num || high_water != mid + range) {
+	goto finished;
+    }
+
+    hatrack_dict_changes_trim(dict, mid + 1);
+    changes = hatrack_dict_changes_since(dict, mid, &num, &high_water);
+
+    if (changes || high_water != HATRACK_CHANGES_TRIMMED) {
+	goto finished;
+    }
+
+    changes = hatrack_dict_changes_since(dict, mid + 1, &num, &high_water);
+
+    if (num != range - 1) {
+	goto finished;
+    }
+
+    ret = true;
+
+finished:
+    free(changes);
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+/* Several threads write to the same small set of keys at once, mixing
+ * puts, adds and removes, so that plenty of them race on the same
+ * key. Afterward, replaying the whole feed, in order, has to give us
+ * exactly what's in the table: the same keys, with the same values.
+ */
+typedef struct {
+    hatrack_dict_t *dict;
+    hatrack_set_t  *set;
+    uint64_t        id;
+    uint64_t        range;
+    uint64_t        ops;
+} feed_order_info_t;
+
+static void *
+feed_order_thread(void *arg)
+{
+    feed_order_info_t *info;
+    uint64_t           i;
+    uint64_t           key;
+    void              *value;
+
+    info = (feed_order_info_t *)arg;
+
+    for (i = 0; i < info->ops; i++) {
+	key   = ((i * 2654435761ULL + info->id * 40503) % info->range) + 1;
+	value = (void *)((info->id << 32) | (i + 1));
+
+	switch ((i + info->id) % 3) {
+	case 0:
+	    if (info->dict) {
+		hatrack_dict_put(info->dict, (void *)key, value);
+	    }
+	    else {
+		hatrack_set_put(info->set, (void *)key);
+	    }
+	    break;
+	case 1:
+	    if (info->dict) {
+		hatrack_dict_add(info->dict, (void *)key, value);
+	    }
+	    else {
+		hatrack_set_add(info->set, (void *)key);
+	    }
+	    break;
+	default:
+	    if (info->dict) {
+		hatrack_dict_remove(info->dict, (void *)key);
+	    }
+	    else {
+		hatrack_set_remove(info->set, (void *)key);
+	    }
+	    break;
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_change_feed_order(bool use_set, uint64_t num_threads, uint64_t range)
+{
+    feed_order_info_t *info;
+    pthread_t         *threads;
+    hatrack_change_t  *changes;
+    bool              *present;
+    void             **values;
+    uint64_t           num;
+    uint64_t           high_water;
+    uint64_t           key;
+    uint64_t           i;
+    void              *value;
+    bool               found;
+    bool               ret;
+
+    info    = (feed_order_info_t *)calloc(num_threads,
+					 sizeof(feed_order_info_t));
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    present = (bool *)calloc(range + 1, sizeof(bool));
+    values  = (void **)calloc(range + 1, sizeof(void *));
+    ret     = true;
+
+    for (i = 0; i < num_threads; i++) {
+	if (use_set) {
+	    if (!i) {
+		info[i].set = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+		hatrack_set_set_change_feed(info[i].set, true);
+	    }
+	    else {
+		info[i].set = info[0].set;
+	    }
+	}
+	else {
+	    if (!i) {
+		info[i].dict = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+		hatrack_dict_set_change_feed(info[i].dict, true);
+	    }
+	    else {
+		info[i].dict = info[0].dict;
+	    }
+	}
+
+	info[i].id    = i;
+	info[i].range = range;
+	info[i].ops   = range * 200;
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_create(&threads[i], NULL, feed_order_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    if (use_set) {
+	changes = hatrack_set_changes_since(info[0].set, 0, &num, &high_water);
+    }
+    else {
+	changes = hatrack_dict_changes_since(info[0].dict,
+					     0,
+					     &num,
+					     &high_water);
+    }
+
+    for (i = 0; i < num; i++) {
+	key = (uint64_t)changes[i].key;
+
+	if (changes[i].kind == HATRACK_CHANGE_DELETE) {
+	    present[key] = false;
+	}
+	else {
+	    present[key] = true;
+	    values[key]  = changes[i].value;
+	}
+    }
+
+    for (key = 1; key <= range; key++) {
+	if (use_set) {
+	    found = hatrack_set_contains(info[0].set, (void *)key);
+	    value = NULL;
+	}
+	else {
+	    value = hatrack_dict_get(info[0].dict, (void *)key, &found);
+	}
+
+	if (found != present[key] || (found && value != values[key])) {
+	    ret = false;
+	}
+    }
+
+    if (use_set) {
+	hatrack_set_delete(info[0].set);
+    }
+    else {
+	hatrack_dict_delete(info[0].dict);
+    }
+
+    free(changes);
+    free(values);
+    free(present);
+    free(threads);
+    free(info);
+
+    return ret;
+}
+
+/* With a free handler, the log has to keep each value it logged alive
+ * until the log lets go of it, even once the dictionary is done with
+ * it. The values here count their references: the dictionary holds
+ * one while a value is in it, and the return hook hands out more.
+ * After overwriting and removing everything, we make mmm free all the
+ * records it can, and the values in the feed still have to be intact.
+ * Once the dictionary (and with it, the log) is gone, every value has
+ * to get freed, exactly once. Run under ASan for the full effect.
+ */
+typedef struct {
+    _Atomic int64_t refs;
+    uint64_t        magic;
+} feed_value_t;
+
+static _Atomic uint64_t feed_values_freed;
+
+static void
+feed_value_ref(void *dict, void *value)
+{
+    atomic_fetch_add(&((feed_value_t *)value)->refs, 1);
+
+    return;
+}
+
+static void
+feed_value_unref(feed_value_t *value)
+{
+    if (atomic_fetch_sub(&value->refs, 1) == 1) {
+	value->magic = 0;
+	free(value);
+	atomic_fetch_add(&feed_values_freed, 1);
+    }
+
+    return;
+}
+
+static void
+feed_value_eject(void *dict, void *item)
+{
+    if (((hatrack_dict_item_t *)item)->value) {
+	feed_value_unref((feed_value_t *)((hatrack_dict_item_t *)item)->value);
+    }
+
+    return;
+}
+
+static feed_value_t *
+feed_value_new(void)
+{
+    feed_value_t *ret;
+
+    ret        = (feed_value_t *)malloc(sizeof(feed_value_t));
+    ret->magic = 0xfeedfeedfeedfeedULL;
+
+    atomic_store(&ret->refs, 1);
+
+    return ret;
+}
+
+static bool
+test_change_feed_refs(uint64_t range)
+{
+    hatrack_dict_t   *dict;
+    hatrack_change_t *changes;
+    uint64_t          num;
+    uint64_t          high_water;
+    uint64_t          i;
+    uint64_t         *p;
+    bool              ret;
+
+    ret  = true;
+    dict = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    atomic_store(&feed_values_freed, 0);
+
+    hatrack_dict_set_val_return_hook(dict, feed_value_ref);
+    hatrack_dict_set_free_handler(dict, feed_value_eject);
+    hatrack_dict_set_change_feed(dict, true);
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, feed_value_new());
+	hatrack_dict_put(dict, (void *)i, feed_value_new());
+	hatrack_dict_remove(dict, (void *)i);
+    }
+
+    for (i = 0; i < range * HATRACK_RETIRE_FREQ; i++) {
+	mmm_start_basic_op();
+	p  = mmm_alloc_committed(sizeof(uint64_t));
+	*p = i;
+	mmm_retire(p);
+	mmm_end_op();
+    }
+
+    changes = hatrack_dict_changes_since(dict, 0, &num, &high_water);
+
+    if (num != range * 3 || atomic_load(&feed_values_freed)) {
+	ret = false;
+    }
+
+    for (i = 0; i < num; i++) {
+	if (changes[i].kind == HATRACK_CHANGE_DELETE) {
+	    continue;
+	}
+
+	if (((feed_value_t *)changes[i].value)->magic
+	    != 0xfeedfeedfeedfeedULL) {
+	    ret = false;
+	}
+
+	feed_value_unref((feed_value_t *)changes[i].value);
+    }
+
+    free(changes);
+    hatrack_dict_delete(dict);
+
+    for (i = 0; i < range * HATRACK_RETIRE_FREQ; i++) {
+	if (atomic_load(&feed_values_freed) == range * 2) {
+	    break;
+	}
+
+	mmm_start_basic_op();
+	p  = mmm_alloc_committed(sizeof(uint64_t));
+	*p = i;
+	mmm_retire(p);
+	mmm_end_op();
+    }
+
+    return ret && atomic_load(&feed_values_freed) == range * 2;
+}
+
+static void
+run_change_feed_tests(void)
+{
+    uint64_t threads[] = {2, 4, 8, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: changes ]]\n");
+    fprintf(stderr, "%17s\t", "dict:");
+
+    if (test_change_feed(1000)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    for (i = 0; threads[i]; i++) {
+	fprintf(stderr, "%7lu dict order:\t", threads[i]);
+
+	if (test_change_feed_order(false, threads[i], 64)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+
+	fprintf(stderr, "%8lu set order:\t", threads[i]);
+
+	if (test_change_feed_order(true, threads[i], 64)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    fprintf(stderr, "%17s\t", "logged values:");
+
+    if (test_change_feed_refs(1000)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
+/* [ shards ]
+ *
+ * Checks sharded dictionaries. We fill one up far enough that every
+ * shard has to grow a few times, then check lookups, the length
+ * (which has to add up across shards), and that sorted views come
+ * back in write order, even though the items live in different
+ * shards, both with and without consistent views.
+ */
+static bool
+test_sharded_dict(uint32_t shard_bits, uint64_t range)
+{
+    hatrack_dict_t       *dict;
+    hatrack_dict_value_t *values;
+    uint64_t              i;
+    uint64_t              num;
+    bool                  found;
+    bool                  ret;
+
+    ret    = false;
+    values = NULL;
+    dict   = hatrack_dict_new_sharded(HATRACK_DICT_KEY_TYPE_INT, shard_bits);
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    for (i = 1; i <= range; i += 2) {
+	hatrack_dict_remove(dict, (void *)i);
+    }
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_get(dict, (void *)i, &found);
+
+	if (found != !(i & 1)) {
+	    goto finished;
+	}
+    }
+
+    if (hatrack_dict_len(dict) != range / 2) {
+	goto finished;
+    }
+
+    for (i = 0; i < 2; i++) {
+	hatrack_dict_set_consistent_views(dict, i);
+	values = hatrack_dict_values_sort(dict, &num);
+
+	if (num != range / 2) {
+	    goto finished;
+	}
+
+	for (num = 0; num < range / 2; num++) {
+	    if ((uint64_t)values[num] != (num + 1) * 2) {
+		goto finished;
+	    }
+	}
+
+	free(values);
+	values = NULL;
+    }
+
+    ret = true;
+
+finished:
+    free(values);
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+/* Checks that consistent views of a sharded dictionary really are
+ * consistent while writers are busy. Each writer owns a set of key
+ * pairs (k, k + range), and keeps moving each pair's entry back and
+ * forth between the two keys, always adding the new key before
+ * removing the old one. It also keeps overwriting key k + 2 * range.
+ *
+ * Any view that matches the dictionary at some point in time must
+ * have at least one key from every pair, and every overwritten key
+ * exactly once. Views that freeze the shards one at a time don't
+ * manage this when the two keys in a pair live in different shards.
+ */
+typedef struct {
+    hatrack_dict_t   *dict;
+    uint64_t          range;
+    uint64_t          id;
+    uint64_t          num_writers;
+    _Atomic uint64_t *writers_done;
+} shard_view_test_info_t;
+
+static void *
+shard_view_test_thread(void *arg)
+{
+    shard_view_test_info_t *info;
+    uint64_t                round;
+    uint64_t                key;
+    uint64_t                from;
+    uint64_t                to;
+
+    info = (shard_view_test_info_t *)arg;
+
+    mmm_register_thread();
+
+    for (round = 1; round <= 20; round++) {
+	for (key = info->id + 1; key <= info->range; key += info->num_writers) {
+	    from = (round & 1) ? key : key + info->range;
+	    to   = (round & 1) ? key + info->range : key;
+
+	    hatrack_dict_put(info->dict, (void *)to, (void *)round);
+	    hatrack_dict_remove(info->dict, (void *)from);
+	    hatrack_dict_put(info->dict,
+			     (void *)(key + 2 * info->range),
+			     (void *)round);
+	}
+    }
+
+    atomic_fetch_add(info->writers_done, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_sharded_views(uint32_t shard_bits, uint64_t num_writers, uint64_t range)
+{
+    hatrack_dict_t         *dict;
+    hatrack_dict_key_t     *keys;
+    shard_view_test_info_t *info;
+    pthread_t              *threads;
+    uint8_t                *seen;
+    _Atomic uint64_t        writers_done;
+    uint64_t                num;
+    uint64_t                key;
+    uint64_t                i;
+    bool                    ret;
+
+    dict    = hatrack_dict_new_sharded(HATRACK_DICT_KEY_TYPE_INT, shard_bits);
+    info    = (shard_view_test_info_t *)malloc(sizeof(shard_view_test_info_t)
+					       * num_writers);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_writers);
+    seen    = (uint8_t *)malloc(3 * range + 1);
+    ret     = true;
+
+    hatrack_dict_set_consistent_views(dict, true);
+    atomic_store(&writers_done, 0);
+
+    for (key = 1; key <= range; key++) {
+	hatrack_dict_put(dict, (void *)key, (void *)0);
+	hatrack_dict_put(dict, (void *)(key + 2 * range), (void *)0);
+    }
+
+    for (i = 0; i < num_writers; i++) {
+	info[i].dict         = dict;
+	info[i].range        = range;
+	info[i].id           = i;
+	info[i].num_writers  = num_writers;
+	info[i].writers_done = &writers_done;
+
+	pthread_create(&threads[i], NULL, shard_view_test_thread, &info[i]);
+    }
+
+    while (ret && atomic_load(&writers_done) != num_writers) {
+	keys = hatrack_dict_keys(dict, &num);
+
+	memset(seen, 0, 3 * range + 1);
+
+	for (i = 0; i < num; i++) {
+	    key = (uint64_t)keys[i];
+
+	    if (!key || key > 3 * range || seen[key]++) {
+		ret = false;
+	    }
+	}
+
+	for (key = 1; key <= range; key++) {
+	    if (!seen[key] && !seen[key + range]) {
+		ret = false;
+	    }
+
+	    if (!seen[key + 2 * range]) {
+		ret = false;
+	    }
+	}
+
+	free(keys);
+    }
+
+    for (i = 0; i < num_writers; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    if (hatrack_dict_len(dict) != 2 * range) {
+	ret = false;
+    }
+
+    hatrack_dict_delete(dict);
+    free(info);
+    free(threads);
+    free(seen);
+
+    return ret;
+}
+
+static void
+run_sharded_dict_tests(void)
+{
+    uint32_t bits[] = {1, 4, HATRACK_DICT_MAX_SHARD_BITS, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: shards ]]\n");
+
+    for (i = 0; bits[i]; i++) {
+	fprintf(stderr, "%7u bit:\t", bits[i]);
+
+	if (test_sharded_dict(bits[i], 20000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    for (i = 0; bits[i]; i++) {
+	fprintf(stderr, "%7u bit views:\t", bits[i]);
+
+	if (test_sharded_views(bits[i], 4, 2000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Checks the negative-lookup filter. The interesting cases are keys
+ * that were deleted (their filter bits stay set until the next
+ * migration, so lookups have to fall through to the table), and
+ * turning the filter on after the dictionary already has items in it,
+ * which only takes effect once the table migrates. We fill up far
+ * enough for the table to grow several times after that, so both the
+ * migrated items and the new ones have to get into the new filter.
+ */
+static bool
+test_miss_filter(uint32_t shard_bits, uint64_t range)
+{
+    hatrack_dict_t *dict;
+    uint64_t        i;
+    uint64_t        value;
+    bool            found;
+    bool            ret;
+
+    ret  = false;
+    dict = hatrack_dict_new_sharded(HATRACK_DICT_KEY_TYPE_INT, shard_bits);
+
+    for (i = 1; i <= range / 16; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    hatrack_dict_set_miss_filter(dict, true);
+
+    for (; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    for (i = 1; i <= range; i += 2) {
+	hatrack_dict_remove(dict, (void *)i);
+    }
+
+    for (i = 1; i <= range * 2; i++) {
+	value = (uint64_t)hatrack_dict_get(dict, (void *)i, &found);
+
+	if (found != (i <= range && !(i & 1))) {
+	    goto finished;
+	}
+
+	if (found && value != i) {
+	    goto finished;
+	}
+    }
+
+    for (i = 1; i <= range; i += 2) {
+	if (!hatrack_dict_add(dict, (void *)i, (void *)i)) {
+	    goto finished;
+	}
+    }
+
+    for (i = range + 1; i <= range * 2; i++) {
+	if (hatrack_dict_replace(dict, (void *)i, (void *)i)) {
+	    goto finished;
+	}
+    }
+
+    if (hatrack_dict_len(dict) != range) {
+	goto finished;
+    }
+
+    ret = true;
+
+finished:
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+static void
+run_miss_filter_tests(void)
+{
+    uint32_t bits[] = {0, 4};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: filter ]]\n");
+
+    for (i = 0; i < sizeof(bits) / sizeof(uint32_t); i++) {
+	fprintf(stderr, "%7u bit:\t", bits[i]);
+
+	if (test_miss_filter(bits[i], 20000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Sanity checks the numbers from the *_stats() calls, after filling a
+ * table far enough that it's had to migrate a few times, and then
+ * deleting some of what we put in.
+ */
+static bool
+stats_are_sane(hatrack_stats_t *stats, uint64_t expected_items)
+{
+    uint64_t i;
+    uint64_t total;
+
+    if (stats->num_items != expected_items) {
+	return false;
+    }
+
+    if (stats->used_buckets < expected_items
+	|| stats->used_buckets > stats->num_buckets) {
+	return false;
+    }
+
+    if (stats->load_factor > 0.75 || !stats->migrations) {
+	return false;
+    }
+
+    total = 0;
+
+    for (i = 0; i < HATRACK_STATS_PROBE_BUCKETS; i++) {
+	total += stats->probe_hist[i];
+    }
+
+    if (total != stats->used_buckets) {
+	return false;
+    }
+
+    if (stats->mean_probe > stats->max_probe) {
+	return false;
+    }
+
+    if (stats->mean_chain > stats->max_chain) {
+	return false;
+    }
+
+    if (!stats->store_bytes || stats->total_bytes != stats->store_bytes
+	+ stats->record_bytes + stats->retired_bytes) {
+	return false;
+    }
+
+    return true;
+}
+
+static bool
+test_dict_stats(hatrack_dict_t *dict, uint64_t range)
+{
+    hatrack_stats_t stats;
+    uint64_t        i;
+    bool            ret;
+
+    for (i = 1; i <= range; i++) {
+	hatrack_dict_put(dict, (void *)i, (void *)i);
+    }
+
+    for (i = 1; i <= range; i += 2) {
+	hatrack_dict_remove(dict, (void *)i);
+    }
+
+    hatrack_dict_stats(dict, &stats);
+
+    ret = stats_are_sane(&stats, range / 2);
+
+    if (stats.record_bytes < (range / 2) * sizeof(hatrack_dict_item_t)) {
+	ret = false;
+    }
+
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+static bool
+test_set_stats(uint64_t range)
+{
+    hatrack_set_t  *set;
+    hatrack_stats_t stats;
+    uint64_t        i;
+    bool            ret;
+
+    set = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    for (i = 1; i <= range; i++) {
+	hatrack_set_put(set, (void *)i);
+    }
+
+    for (i = 1; i <= range; i += 2) {
+	hatrack_set_remove(set, (void *)i);
+    }
+
+    hatrack_set_stats(set, &stats);
+
+    ret = stats_are_sane(&stats, range / 2);
+
+    // Every other bucket's current record is a deletion record.
+    if (stats.deleted_records != range - range / 2) {
+	ret = false;
+    }
+
+    hatrack_set_delete(set);
+
+    return ret;
+}
+
+static char *stats_test_names[] = {"crown", "shards", "woolhat", "set"};
+
+static bool
+test_stats(uint32_t which, uint64_t range)
+{
+    switch (which) {
+    case 0:
+	return test_dict_stats(hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT),
+			       range);
+    case 1:
+	return test_dict_stats(
+	    hatrack_dict_new_sharded(HATRACK_DICT_KEY_TYPE_INT, 4),
+	    range);
+    case 2:
+	return test_dict_stats(
+	    hatrack_dict_new_with_backend(HATRACK_DICT_KEY_TYPE_INT,
+					  HATRACK_BACKEND_WOOLHAT),
+	    range);
+    default:
+	return test_set_stats(range);
+    }
+}
+
+static void
+run_stats_tests(void)
+{
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: stats ]]\n");
+
+    for (i = 0; i < sizeof(stats_test_names) / sizeof(char *); i++) {
+	fprintf(stderr, "%10s:\t", stats_test_names[i]);
+
+	if (test_stats(i, 20000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Checks the set algebra operations, serial and parallel, against
+ * each other. Set 1 holds 1 .. range, and set 2 holds range / 2 + 1 ..
+ * range + range / 2, both inserted in increasing order, so for every
+ * operation, the result (sorted by insertion order) should be the
+ * right keys in increasing order, no matter how many threads built
+ * it.
+ *
+ * We run this with woolhat on both sides, with bitsets on both sides
+ * (where sorted views are in numeric order anyway), and with one of
+ * each. In the mixed case, the items from the bitset don't have an
+ * insertion time, so we only check the contents, not the order.
+ *
+ * If we're given a pool, we use the _pooled() versions instead, and
+ * ignore num_threads.
+ */
+enum {
+    SETOPS_WOOLHAT,
+    SETOPS_BITSET,
+    SETOPS_MIXED
+};
+
+static int
+item_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(uint64_t *)a;
+    uint64_t y = *(uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static bool
+test_set_algebra(uint32_t        op,
+		 uint32_t        mode,
+		 uint32_t        num_threads,
+		 uint64_t        range,
+		 hatrack_pool_t *pool)
+{
+    hatrack_set_t *s1;
+    hatrack_set_t *s2;
+    hatrack_set_t *s3;
+    void         **items;
+    uint64_t       num;
+    uint64_t       i;
+    uint64_t       n;
+    bool           in1;
+    bool           in2;
+    bool           want;
+    bool           ret;
+
+    ret = false;
+
+    if (mode == SETOPS_WOOLHAT) {
+	s1 = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+    }
+    else {
+	s1 = hatrack_set_new_bitset(range + 1);
+    }
+
+    if (mode == SETOPS_BITSET) {
+	s2 = hatrack_set_new_bitset(range + range / 2 + 1);
+    }
+    else {
+	s2 = hatrack_set_new(HATRACK_DICT_KEY_TYPE_INT);
+    }
+
+    for (i = 1; i <= range; i++) {
+	hatrack_set_put(s1, (void *)i);
+    }
+
+    for (i = range / 2 + 1; i <= range + range / 2; i++) {
+	hatrack_set_put(s2, (void *)i);
+    }
+
+    if (pool) {
+	switch (op) {
+	case 0:
+	    s3 = hatrack_set_difference_pooled(s1, s2, pool);
+	    break;
+	case 1:
+	    s3 = hatrack_set_union_pooled(s1, s2, pool);
+	    break;
+	case 2:
+	    s3 = hatrack_set_intersection_pooled(s1, s2, pool);
+	    break;
+	default:
+	    s3 = hatrack_set_disjunction_pooled(s1, s2, pool);
+	    break;
+	}
+    }
+    else {
+	switch (op) {
+	case 0:
+	    s3 = hatrack_set_difference_parallel(s1, s2, num_threads);
+	    break;
+	case 1:
+	    s3 = hatrack_set_union_parallel(s1, s2, num_threads);
+	    break;
+	case 2:
+	    s3 = hatrack_set_intersection_parallel(s1, s2, num_threads);
+	    break;
+	default:
+	    s3 = hatrack_set_disjunction_parallel(s1, s2, num_threads);
+	    break;
+	}
+    }
+
+    items = hatrack_set_items_sort(s3, &num);
+    n     = 0;
+
+    if (mode == SETOPS_MIXED) {
+	qsort(items, num, sizeof(void *), item_cmp);
+    }
+
+    for (i = 1; i <= range + range / 2; i++) {
+	in1 = i <= range;
+	in2 = i > range / 2;
+
+	switch (op) {
+	case 0:
+	    want = in1 && !in2;
+	    break;
+	case 1:
+	    want = true;
+	    break;
+	case 2:
+	    want = in1 && in2;
+	    break;
+	default:
+	    want = in1 != in2;
+	    break;
+	}
+
+	if (hatrack_set_contains(s3, (void *)i) != want) {
+	    goto finished;
+	}
+
+	if (!want) {
+	    continue;
+	}
+
+	if (n == num || (uint64_t)items[n] != i) {
+	    goto finished;
+	}
+
+	n++;
+    }
+
+    if (n != num) {
+	goto finished;
+    }
+
+    if (hatrack_set_is_subset(s3, s1, false) != (op == 0 || op == 2)) {
+	goto finished;
+    }
+
+    ret = true;
+
+finished:
+    free(items);
+    hatrack_set_delete(s1);
+    hatrack_set_delete(s2);
+    hatrack_set_delete(s3);
+
+    return ret;
+}
+
+static char *set_algebra_names[] = {"diff", "union", "intersect", "disjunct"};
+static char *set_algebra_modes[] = {"woolhat", "bitset", "mixed"};
+
+static void
+run_set_algebra_tests(void)
+{
+    uint32_t threads[] = {1, 2, 5, 8, 0};
+    uint32_t i;
+    uint32_t j;
+    uint32_t mode;
+
+    fprintf(stderr, "[[ Test: setops ]]\n");
+
+    for (mode = 0; mode < sizeof(set_algebra_modes) / sizeof(char *); mode++) {
+	for (i = 0; i < sizeof(set_algebra_names) / sizeof(char *); i++) {
+	    for (j = 0; threads[j]; j++) {
+		fprintf(stderr,
+			"%7s %9s, %u thread(s):\t",
+			set_algebra_modes[mode],
+			set_algebra_names[i],
+			threads[j]);
+
+		if (test_set_algebra(i, mode, threads[j], 20000, NULL)) {
+		    fprintf(stderr, "pass\n");
+		}
+		else {
+		    fprintf(stderr, "FAIL\n");
+		}
+	    }
+	}
+    }
+
+    return;
+}
+
+/* One thread adds 0 .. range - 1 to a bitset, in order, while the
+ * rest take snapshots. Since there's a single writer going in order,
+ * every consistent snapshot is some prefix of that range; anything
+ * else means a snapshot mixed words from two different moments.
+ *
+ * Then all the threads remove the odd items at once, each taking a
+ * different slice, to make sure concurrent writes to the same words
+ * don't lose each other's bits.
+ */
+typedef struct {
+    hatrack_bitset_t *bitset;
+    uint64_t          range;
+    uint64_t          id;
+    uint64_t          num_threads;
+    _Atomic bool     *writer_done;
+    bool              ok;
+} bitset_test_info_t;
+
+static void *
+bitset_test_thread(void *arg)
+{
+    bitset_test_info_t *info;
+    uint64_t           *items;
+    uint64_t            num;
+    uint64_t            i;
+
+    info     = (bitset_test_info_t *)arg;
+    info->ok = true;
+
+    if (!info->id) {
+	for (i = 0; i < info->range; i++) {
+	    hatrack_bitset_add(info->bitset, i);
+	}
+
+	atomic_store(info->writer_done, true);
+    }
+    else {
+	while (!atomic_load(info->writer_done)) {
+	    items = hatrack_bitset_items(info->bitset, &num);
+
+	    for (i = 0; i < num; i++) {
+		if (items[i] != i) {
+		    info->ok = false;
+		}
+	    }
+
+	    free(items);
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+bitset_remove_thread(void *arg)
+{
+    bitset_test_info_t *info;
+    uint64_t            i;
+
+    info = (bitset_test_info_t *)arg;
+
+    for (i = info->id * 2 + 1; i < info->range; i += info->num_threads * 2) {
+	if (!hatrack_bitset_remove(info->bitset, i)) {
+	    info->ok = false;
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_bitset(uint64_t num_threads, uint64_t range)
+{
+    hatrack_bitset_t   *bitset;
+    bitset_test_info_t *info;
+    pthread_t          *threads;
+    _Atomic bool        writer_done;
+    uint64_t            i;
+    bool                ret;
+
+    bitset  = hatrack_bitset_new(range);
+    info    = (bitset_test_info_t *)malloc(sizeof(bitset_test_info_t)
+					   * num_threads);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret     = true;
+
+    atomic_store(&writer_done, false);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].bitset      = bitset;
+	info[i].range       = range;
+	info[i].id          = i;
+	info[i].num_threads = num_threads;
+	info[i].writer_done = &writer_done;
+
+	pthread_create(&threads[i], NULL, bitset_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    if (hatrack_bitset_len(bitset) != range || hatrack_bitset_add(bitset, 0)) {
+	ret = false;
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_create(&threads[i], NULL, bitset_remove_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    for (i = 0; i < range; i++) {
+	if (hatrack_bitset_contains(bitset, i) != !(i & 1)) {
+	    ret = false;
+	}
+    }
+
+    if (hatrack_bitset_contains(bitset, range)
+	|| hatrack_bitset_remove(bitset, range)) {
+	ret = false;
+    }
+
+    hatrack_bitset_delete(bitset);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+/* Several writers at once, while we take snapshots, so that the
+ * optimistic copy keeps failing, and snapshots end up freezing the
+ * sets. Each writer owns some tokens, and keeps moving each one back
+ * and forth between item k in set 1 and item k + range in set 2
+ * (so the two items are in different words, and different sets),
+ * always adding the new one before removing the old one.
+ *
+ * So, in any consistent snapshot of both sets at once, every token
+ * is in at least one of the two places; the union always has every
+ * one of them.
+ */
+typedef struct {
+    hatrack_bitset_t *set1;
+    hatrack_bitset_t *set2;
+    uint64_t          range;
+    uint64_t          id;
+    uint64_t          num_writers;
+    _Atomic uint64_t *writers_done;
+} bitset_freeze_test_info_t;
+
+static void *
+bitset_freeze_test_thread(void *arg)
+{
+    bitset_freeze_test_info_t *info;
+    uint64_t                   round;
+    uint64_t                   k;
+
+    info = (bitset_freeze_test_info_t *)arg;
+
+    for (round = 0; round < 50; round++) {
+	for (k = info->id; k < info->range; k += info->num_writers) {
+	    if (round & 1) {
+		hatrack_bitset_add(info->set1, k);
+		hatrack_bitset_remove(info->set2, k + info->range);
+	    }
+	    else {
+		hatrack_bitset_add(info->set2, k + info->range);
+		hatrack_bitset_remove(info->set1, k);
+	    }
+	}
+    }
+
+    atomic_fetch_add(info->writers_done, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_bitset_freeze(uint64_t num_writers, uint64_t range)
+{
+    hatrack_bitset_t          *set1;
+    hatrack_bitset_t          *set2;
+    hatrack_bitset_t          *both;
+    bitset_freeze_test_info_t *info;
+    pthread_t                 *threads;
+    _Atomic uint64_t           writers_done;
+    uint64_t                  *items;
+    uint64_t                   num;
+    uint64_t                   k;
+    uint64_t                   i;
+    bool                       ret;
+
+    set1    = hatrack_bitset_new(range);
+    set2    = hatrack_bitset_new(range * 2);
+    info    = (bitset_freeze_test_info_t *)
+	malloc(sizeof(bitset_freeze_test_info_t) * num_writers);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_writers);
+    ret     = true;
+
+    atomic_store(&writers_done, 0);
+
+    for (k = 0; k < range; k++) {
+	hatrack_bitset_add(set1, k);
+    }
+
+    for (i = 0; i < num_writers; i++) {
+	info[i].set1         = set1;
+	info[i].set2         = set2;
+	info[i].range        = range;
+	info[i].id           = i;
+	info[i].num_writers  = num_writers;
+	info[i].writers_done = &writers_done;
+
+	pthread_create(&threads[i], NULL, bitset_freeze_test_thread, &info[i]);
+    }
+
+    while (ret && atomic_load(&writers_done) != num_writers) {
+	both  = hatrack_bitset_union(set1, set2);
+	items = hatrack_bitset_items(both, &num);
+
+	for (k = 0; k < range; k++) {
+	    if (!hatrack_bitset_contains(both, k)
+		&& !hatrack_bitset_contains(both, k + range)) {
+		ret = false;
+	    }
+	}
+
+	for (i = 1; i < num; i++) {
+	    if (items[i] <= items[i - 1]) {
+		ret = false;
+	    }
+	}
+
+	free(items);
+	hatrack_bitset_delete(both);
+    }
+
+    for (i = 0; i < num_writers; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    if (hatrack_bitset_len(set1) != range || hatrack_bitset_len(set2)) {
+	ret = false;
+    }
+
+    hatrack_bitset_delete(set1);
+    hatrack_bitset_delete(set2);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_bitset_tests(void)
+{
+    uint64_t threads[] = {2, 4, 8, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: bitset ]]\n");
+
+    for (i = 0; threads[i]; i++) {
+	fprintf(stderr, "%7lu thread(s):\t", threads[i]);
+
+	if (test_bitset(threads[i], 100000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    for (i = 0; threads[i]; i++) {
+	fprintf(stderr, "%7lu writer(s):\t", threads[i]);
+
+	if (test_bitset_freeze(threads[i], 4096)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Hammers a woolhat with overwrites and deletes, so that its records
+ * cycle through the mmm pool, while other threads take views. Each
+ * writer owns the keys congruent to its id, and every value it writes
+ * has the key in its low 32 bits, and the round in the high bits.
+ * On odd rounds, the writer deletes each key right after writing it.
+ *
+ * If a record got recycled while some view could still reach it, the
+ * view would see a value for some other key (so the same key twice),
+ * or the zeroed-out item of a fresh record. At the end, every key should hold
+ * its last value, and the writers should have gotten at least some
+ * of their records back out of the pool.
+ */
+typedef struct {
+    woolhat_t        *table;
+    uint64_t          range;
+    uint64_t          rounds;
+    uint64_t          id;
+    uint64_t          num_writers;
+    _Atomic uint64_t *writers_done;
+    uint64_t          pool_hits;
+    bool              ok;
+} woolpool_test_info_t;
+
+static void *
+woolpool_test_thread(void *arg)
+{
+    woolpool_test_info_t *info;
+    hatrack_view_t       *view;
+    uint8_t              *seen;
+    uint64_t              num;
+    uint64_t              misses;
+    uint64_t              key;
+    uint64_t              round;
+    uint64_t              i;
+
+    info     = (woolpool_test_info_t *)arg;
+    info->ok = true;
+
+    mmm_register_thread();
+
+    if (info->id < info->num_writers) {
+	for (round = 1; round <= info->rounds; round++) {
+	    for (key = info->id; key < info->range; key += info->num_writers) {
+		woolhat_put(info->table,
+			    precomputed_hashes[key],
+			    (void *)((round << 32) | key),
+			    NULL);
+
+		if (round & 1) {
+		    woolhat_remove(info->table, precomputed_hashes[key], NULL);
+		}
+	    }
+	}
+
+	mmm_pool_counts(&info->pool_hits, &misses);
+	atomic_fetch_add(info->writers_done, 1);
+    }
+    else {
+	seen = (uint8_t *)malloc(info->range);
+
+	while (atomic_load(info->writers_done) != info->num_writers) {
+	    view = woolhat_view(info->table, &num, false);
+
+	    memset(seen, 0, info->range);
+
+	    for (i = 0; i < num; i++) {
+		key   = ((uint64_t)view[i].item) & 0xffffffff;
+		round = ((uint64_t)view[i].item) >> 32;
+
+		if (key >= info->range || seen[key] || !round
+		    || round > info->rounds) {
+		    info->ok = false;
+		    continue;
+		}
+
+		seen[key] = 1;
+	    }
+
+	    free(view);
+	}
+
+	free(seen);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_woolhat_pool(uint64_t num_writers, uint64_t num_readers, uint64_t range)
+{
+    woolhat_t            *table;
+    woolpool_test_info_t *info;
+    pthread_t            *threads;
+    _Atomic uint64_t      writers_done;
+    uint64_t              num_threads;
+    uint64_t              pool_hits;
+    uint64_t              i;
+    bool                  found;
+    bool                  ret;
+    void                 *item;
+
+    num_threads = num_writers + num_readers;
+    table       = woolhat_new();
+    info        = (woolpool_test_info_t *)malloc(sizeof(woolpool_test_info_t)
+						 * num_threads);
+    threads     = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    pool_hits   = 0;
+    ret         = true;
+
+    atomic_store(&writers_done, 0);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].table        = table;
+	info[i].range        = range;
+	info[i].rounds       = 20;
+	info[i].id           = i;
+	info[i].num_writers  = num_writers;
+	info[i].writers_done = &writers_done;
+	info[i].pool_hits    = 0;
+
+	pthread_create(&threads[i], NULL, woolpool_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret        = ret && info[i].ok;
+	pool_hits += info[i].pool_hits;
+    }
+
+    for (i = 0; i < range; i++) {
+	item = woolhat_get(table, precomputed_hashes[i], &found);
+
+	if (!found || item != (void *)((20ULL << 32) | i)) {
+	    ret = false;
+	}
+    }
+
+    if (woolhat_len(table) != range) {
+	ret = false;
+    }
+
+    if (mmm_pool_limit && !pool_hits) {
+	ret = false;
+    }
+
+    woolhat_delete(table);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_woolhat_pool_tests(void)
+{
+    uint64_t writers[] = {1, 2, 4, 0};
+    uint64_t limit;
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: woolpool ]]\n");
+
+    limit = mmm_pool_limit;
+
+    for (i = 0; writers[i]; i++) {
+	fprintf(stderr, "%7lu writer(s):\t", writers[i]);
+
+	if (test_woolhat_pool(writers[i], 2, 10000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    fprintf(stderr, "%17s\t", "unpooled:");
+
+    mmm_pool_limit = 0;
+
+    if (test_woolhat_pool(2, 2, 10000)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    mmm_pool_limit = limit;
+
+    return;
+}
+
+/* First, single-threaded checks of the ordered lookups, against keys
+ * 10, 20, ... Then writer threads each own the keys congruent to
+ * their id, and repeatedly add, overwrite and remove them, while
+ * scanner threads check that every range scan comes back in strictly
+ * increasing order. At the end, every key should hold the value from
+ * its last round, and the free handler should have seen every record
+ * that was ever ejected, exactly once.
+ */
+static _Atomic uint64_t omap_ejections;
+
+static void
+omap_test_eject(void *omap, void *item)
+{
+    atomic_fetch_add(&omap_ejections, 1);
+
+    return;
+}
+
+typedef struct {
+    hatrack_omap_t   *omap;
+    uint64_t          range;
+    uint64_t          rounds;
+    uint64_t          id;
+    uint64_t          num_writers;
+    _Atomic uint64_t *writers_done;
+    bool              ok;
+} omap_test_info_t;
+
+static void *
+omap_test_thread(void *arg)
+{
+    omap_test_info_t    *info;
+    hatrack_dict_item_t *items;
+    uint64_t             num;
+    uint64_t             key;
+    uint64_t             round;
+    uint64_t             i;
+
+    info     = (omap_test_info_t *)arg;
+    info->ok = true;
+
+    mmm_register_thread();
+
+    if (info->id < info->num_writers) {
+	for (round = 1; round <= info->rounds; round++) {
+	    for (key = info->id; key < info->range; key += info->num_writers) {
+		hatrack_omap_put(info->omap, (void *)key, (void *)round);
+
+		if (round & 1) {
+		    hatrack_omap_replace(info->omap, (void *)key, (void *)round);
+		    if (!hatrack_omap_remove(info->omap, (void *)key)) {
+			info->ok = false;
+		    }
+		}
+	    }
+	}
+
+	atomic_fetch_add(info->writers_done, 1);
+    }
+    else {
+	while (atomic_load(info->writers_done) != info->num_writers) {
+	    items = hatrack_omap_range(info->omap,
+				       (void *)(info->range / 4),
+				       (void *)(info->range / 2),
+				       &num);
+
+	    for (i = 0; i < num; i++) {
+		if ((uint64_t)items[i].key < info->range / 4
+		    || (uint64_t)items[i].key >= info->range / 2
+		    || (i && items[i].key <= items[i - 1].key)) {
+		    info->ok = false;
+		}
+	    }
+
+	    free(items);
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_omap_ordered(void)
+{
+    hatrack_omap_t      *omap;
+    hatrack_dict_item_t  item;
+    hatrack_dict_item_t *items;
+    uint64_t             num;
+    uint64_t             i;
+    bool                 ret;
+
+    omap = hatrack_omap_new(HATRACK_DICT_KEY_TYPE_INT);
+    ret  = true;
+
+    for (i = 10; i > 0; i--) {
+	hatrack_omap_put(omap, (void *)(i * 10), (void *)i);
+    }
+
+    if (hatrack_omap_add(omap, (void *)50, (void *)0)
+	|| !hatrack_omap_add(omap, (void *)55, (void *)0)
+	|| !hatrack_omap_remove(omap, (void *)55)
+	|| hatrack_omap_remove(omap, (void *)55)
+	|| hatrack_omap_replace(omap, (void *)55, (void *)0)
+	|| hatrack_omap_get(omap, (void *)55, NULL)
+	|| hatrack_omap_len(omap) != 10) {
+	ret = false;
+    }
+
+    if (!hatrack_omap_floor(omap, (void *)55, &item) || item.key != (void *)50
+	|| !hatrack_omap_floor(omap, (void *)60, &item)
+	|| item.key != (void *)60
+	|| hatrack_omap_floor(omap, (void *)9, &item)
+	|| !hatrack_omap_ceiling(omap, (void *)55, &item)
+	|| item.key != (void *)60 || item.value != (void *)6
+	|| !hatrack_omap_ceiling(omap, (void *)0, &item)
+	|| item.key != (void *)10
+	|| hatrack_omap_ceiling(omap, (void *)101, &item)) {
+	ret = false;
+    }
+
+    items = hatrack_omap_range(omap, (void *)20, (void *)50, &num);
+
+    if (num != 3 || items[0].key != (void *)20 || items[2].key != (void *)40) {
+	ret = false;
+    }
+
+    free(items);
+
+    hatrack_omap_remove(omap, (void *)30);
+
+    items = hatrack_omap_items(omap, &num);
+
+    if (num != 9 || items[2].key != (void *)40) {
+	ret = false;
+    }
+
+    free(items);
+    hatrack_omap_delete(omap);
+
+    return ret;
+}
+
+static bool
+test_omap(uint64_t num_writers, uint64_t num_readers, uint64_t range)
+{
+    hatrack_omap_t   *omap;
+    omap_test_info_t *info;
+    pthread_t        *threads;
+    _Atomic uint64_t  writers_done;
+    uint64_t          num_threads;
+    uint64_t          i;
+    bool              found;
+    bool              ret;
+
+    num_threads = num_writers + num_readers;
+    omap        = hatrack_omap_new(HATRACK_DICT_KEY_TYPE_INT);
+    info        = (omap_test_info_t *)malloc(sizeof(omap_test_info_t)
+					     * num_threads);
+    threads     = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret         = true;
+
+    hatrack_omap_set_free_handler(omap, omap_test_eject);
+    atomic_store(&writers_done, 0);
+    atomic_store(&omap_ejections, 0);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].omap         = omap;
+	info[i].range        = range;
+	info[i].rounds       = 10;
+	info[i].id           = i;
+	info[i].num_writers  = num_writers;
+	info[i].writers_done = &writers_done;
+
+	pthread_create(&threads[i], NULL, omap_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    for (i = 0; i < range; i++) {
+	if (hatrack_omap_get(omap, (void *)i, &found) != (void *)10 || !found) {
+	    ret = false;
+	}
+    }
+
+    if (hatrack_omap_len(omap) != range) {
+	ret = false;
+    }
+
+    /* Each key got 15 records over 10 rounds (three on each odd
+     * round), and the last one is still in the map until we delete
+     * it. Everything else got ejected by the time the writers exited,
+     * since exiting threads flush their retirement lists.
+     */
+    hatrack_omap_delete(omap);
+
+    if (atomic_load(&omap_ejections) != range * 15) {
+	ret = false;
+    }
+
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+/* Records that get replaced or removed sit on mmm's retirement list
+ * until it gets around to them, which can be after the map's been
+ * deleted. Here, we delete the map with plenty still on the list,
+ * then churn through mmm until it's all been freed. Every record
+ * should reach the free handler exactly once: the ones mmm frees with
+ * NULL for the map, and the ones still in the map at delete time with
+ * the map. Run this under ASan to catch anything that reaches back
+ * into the deleted map.
+ */
+static _Atomic uint64_t omap_late_with_map;
+static _Atomic uint64_t omap_late_without_map;
+static hatrack_omap_t  *omap_late_map;
+
+static void
+omap_test_late_eject(void *omap, void *item)
+{
+    if (!omap) {
+	atomic_fetch_add(&omap_late_without_map, 1);
+    }
+    else if (omap == omap_late_map) {
+	atomic_fetch_add(&omap_late_with_map, 1);
+    }
+
+    return;
+}
+
+static bool
+test_omap_late_eject(uint64_t range)
+{
+    uint64_t  i;
+    uint64_t *p;
+
+    omap_late_map = hatrack_omap_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    hatrack_omap_set_free_handler(omap_late_map, omap_test_late_eject);
+    atomic_store(&omap_late_with_map, 0);
+    atomic_store(&omap_late_without_map, 0);
+
+    for (i = 0; i < range; i++) {
+	hatrack_omap_put(omap_late_map, (void *)i, (void *)1);
+	hatrack_omap_put(omap_late_map, (void *)i, (void *)2);
+    }
+
+    for (i = 0; i < range; i += 2) {
+	hatrack_omap_remove(omap_late_map, (void *)i);
+    }
+
+    hatrack_omap_delete(omap_late_map);
+
+    for (i = 0; i < range * HATRACK_RETIRE_FREQ; i++) {
+	if (atomic_load(&omap_late_without_map) == range + range / 2) {
+	    break;
+	}
+
+	mmm_start_basic_op();
+	p  = mmm_alloc_committed(sizeof(uint64_t));
+	*p = i;
+	mmm_retire(p);
+	mmm_end_op();
+    }
+
+    return atomic_load(&omap_late_without_map) == range + range / 2
+	&& atomic_load(&omap_late_with_map) == range / 2;
+}
+
+static void
+run_omap_tests(void)
+{
+    uint64_t writers[] = {1, 2, 4, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: omap ]]\n");
+    fprintf(stderr, "%17s\t", "ordered ops:");
+
+    if (test_omap_ordered()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr, "%17s\t", "late ejections:");
+
+    if (test_omap_late_eject(1000)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    for (i = 0; writers[i]; i++) {
+	fprintf(stderr, "%7lu writer(s):\t", writers[i]);
+
+	if (test_omap(writers[i], 2, 5000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Single-threaded checks of the u64map operations, including the
+ * edge cases: key 0 (which tiara can't store), the largest key and
+ * value, and fetch_add wrapping around at 2^60. Then enough keys to
+ * force a few migrations.
+ */
+static bool
+test_u64map_ops(void)
+{
+    hatrack_u64map_t      *map;
+    hatrack_u64map_item_t *items;
+    uint64_t               num;
+    uint64_t               sum;
+    uint64_t               i;
+    bool                   found;
+    bool                   ret;
+
+    map = hatrack_u64map_new();
+    ret = true;
+
+    hatrack_u64map_get(map, 0, &found);
+    ret = ret && !found;
+
+    hatrack_u64map_put(map, 0, 5, &found);
+    ret = ret && !found && hatrack_u64map_get(map, 0, &found) == 5 && found;
+    ret = ret && hatrack_u64map_put(map, 0, 7, &found) == 5 && found;
+    ret = ret && !hatrack_u64map_add(map, 0, 1);
+    ret = ret && hatrack_u64map_remove(map, 0, &found) == 7 && found;
+    hatrack_u64map_remove(map, 0, &found);
+    ret = ret && !found && hatrack_u64map_add(map, 0, 1);
+
+    ret = ret
+       && hatrack_u64map_add(map, 0xffffffffffffffffULL,
+			     HATRACK_U64MAP_VALUE_MAX);
+    ret = ret
+       && hatrack_u64map_fetch_add(map, 0xffffffffffffffffULL, 1)
+	      == HATRACK_U64MAP_VALUE_MAX;
+    ret = ret && hatrack_u64map_get(map, 0xffffffffffffffffULL, NULL) == 0;
+    ret = ret && hatrack_u64map_fetch_add(map, 42, 3) == 0;
+    ret = ret && hatrack_u64map_fetch_add(map, 42, (uint64_t)-1) == 3;
+    ret = ret && hatrack_u64map_get(map, 42, NULL) == 2;
+    ret = ret && hatrack_u64map_len(map) == 3;
+
+    for (i = 0; i < 10000; i++) {
+	hatrack_u64map_put(map, i << 20, i, NULL);
+    }
+
+    items = hatrack_u64map_items(map, &num);
+    sum   = 0;
+
+    for (i = 0; i < num; i++) {
+	sum += items[i].value;
+    }
+
+    // Key 0 got overwritten with 0; 42 holds 2.
+    ret = ret && num == 10002 && hatrack_u64map_len(map) == 10002;
+    ret = ret && sum == (9999ULL * 10000) / 2 + 2;
+
+    free(items);
+    hatrack_u64map_delete(map);
+
+    return ret;
+}
+
+/* Every thread bumps every shared key once per round, so at the end,
+ * each one should hold num_threads * rounds, no matter how the
+ * increments raced with each other or with migrations. To keep the
+ * migrations coming (in both directions), each thread also adds and
+ * then removes a batch of private keys every round.
+ */
+typedef struct {
+    hatrack_u64map_t *map;
+    uint64_t          range;
+    uint64_t          rounds;
+    uint64_t          id;
+    bool              ok;
+} u64map_test_info_t;
+
+static void *
+u64map_test_thread(void *arg)
+{
+    u64map_test_info_t *info;
+    uint64_t            private;
+    uint64_t            round;
+    uint64_t            i;
+    bool                found;
+
+    info     = (u64map_test_info_t *)arg;
+    info->ok = true;
+    private  = (info->id + 1) * info->range;
+
+    mmm_register_thread();
+
+    for (round = 0; round < info->rounds; round++) {
+	for (i = 0; i < info->range; i++) {
+	    hatrack_u64map_fetch_add(info->map, i, 1);
+
+	    if (!hatrack_u64map_add(info->map, private + i, round)) {
+		info->ok = false;
+	    }
+	}
+
+	for (i = 0; i < info->range; i++) {
+	    if (hatrack_u64map_remove(info->map, private + i, &found) != round
+		|| !found) {
+		info->ok = false;
+	    }
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_u64map(uint64_t num_threads, uint64_t range)
+{
+    hatrack_u64map_t   *map;
+    u64map_test_info_t *info;
+    pthread_t          *threads;
+    uint64_t            i;
+    bool                found;
+    bool                ret;
+
+    map     = hatrack_u64map_new();
+    info    = (u64map_test_info_t *)malloc(sizeof(u64map_test_info_t)
+					   * num_threads);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret     = true;
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].map    = map;
+	info[i].range  = range;
+	info[i].rounds = 10;
+	info[i].id     = i;
+
+	pthread_create(&threads[i], NULL, u64map_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    for (i = 0; i < range; i++) {
+	if (hatrack_u64map_get(map, i, &found) != num_threads * 10 || !found) {
+	    ret = false;
+	}
+    }
+
+    if (hatrack_u64map_len(map) != range) {
+	ret = false;
+    }
+
+    hatrack_u64map_delete(map);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_u64map_tests(void)
+{
+    uint64_t threads[] = {1, 2, 4, 8, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: u64map ]]\n");
+    fprintf(stderr, "%17s\t", "single ops:");
+
+    if (test_u64map_ops()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    for (i = 0; threads[i]; i++) {
+	fprintf(stderr, "%7lu thread(s):\t", threads[i]);
+
+	if (test_u64map(threads[i], 10000)) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* Checks that tophat migrates to its multi-threaded table when
+ * writers contend, and back again once only one thread is writing.
+ *
+ * We set the contention threshold to 1 for the parallel phase, since,
+ * on a machine with few cores, a writer only fails its trylock when
+ * another thread gets preempted while holding the lock, and we don't
+ * want to wait around for a whole window's worth of that. We also
+ * turn off migrating back until the parallel phase is over, so that
+ * a thread that happens to get the CPU to itself for a while doesn't
+ * send us back early.
+ *
+ * Each thread keeps writing its own keys until it sees the table go
+ * multi-threaded, and then keeps going for a while longer. The main
+ * thread then rewrites a third of the keys, and removes another third,
+ * until the table migrates back. Either way, we give up after a few
+ * seconds. The writes are idempotent, so the final contents don't
+ * depend on how many times anyone went around.
+ */
+#define TOPHAT_TEST_RANGE   1000
+#define TOPHAT_TEST_TIMEOUT 5000000000ULL
+
+typedef struct {
+    tophat_t *table;
+    uint64_t  id;
+} tophat_test_info_t;
+
+static uint64_t
+tophat_test_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *
+tophat_test_thread(void *arg)
+{
+    tophat_test_info_t *info;
+    uint64_t            start;
+    uint64_t            extra;
+    uint64_t            i;
+    uint64_t            key;
+
+    info  = (tophat_test_info_t *)arg;
+    start = tophat_test_now();
+    extra = 0;
+
+    mmm_register_thread();
+
+    while (extra < 20) {
+	for (i = 0; i < TOPHAT_TEST_RANGE; i++) {
+	    key = info->id * TOPHAT_TEST_RANGE + i;
+	    tophat_put(info->table, precomputed_hashes[key], (void *)(key + 1), NULL);
+	}
+
+	if (tophat_is_multi_threaded(info->table)
+	    || tophat_test_now() - start > TOPHAT_TEST_TIMEOUT) {
+	    extra++;
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_tophat_adaptive(void (*init)(tophat_t *), uint64_t num_threads)
+{
+    tophat_t           *table;
+    tophat_test_info_t *info;
+    pthread_t          *threads;
+    hatrack_view_t     *view;
+    uint64_t            start;
+    uint64_t            i;
+    uint64_t            key;
+    uint64_t            num;
+    uint64_t            expected;
+    void               *item;
+    bool                found;
+    bool                ret;
+
+    table   = (tophat_t *)malloc(sizeof(tophat_t));
+    info    = (tophat_test_info_t *)malloc(sizeof(tophat_test_info_t)
+					   * num_threads);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+
+    precompute_hashes(num_threads * TOPHAT_TEST_RANGE);
+    (*init)(table);
+    tophat_set_contention_threshold(table, 1);
+    tophat_set_quiet_period(table, 0);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].table = table;
+	info[i].id    = i;
+
+	pthread_create(&threads[i], NULL, tophat_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    ret = tophat_is_multi_threaded(table);
+
+    tophat_set_quiet_period(table, 10);
+
+    start = tophat_test_now();
+
+    do {
+	for (key = 0; key < num_threads * TOPHAT_TEST_RANGE; key++) {
+	    switch (key % 3) {
+	    case 0:
+		tophat_remove(table, precomputed_hashes[key], NULL);
+		break;
+	    case 1:
+		tophat_put(table, precomputed_hashes[key], (void *)(key + 2), NULL);
+		break;
+	    default:
+		break;
+	    }
+	}
+    } while (tophat_is_multi_threaded(table)
+	     && tophat_test_now() - start < TOPHAT_TEST_TIMEOUT);
+
+    ret = ret && !tophat_is_multi_threaded(table);
+
+    // Make sure we can keep writing after migrating back.
+    tophat_add(table, precomputed_hashes[0], (void *)1);
+
+    expected = 0;
+
+    for (key = 0; key < num_threads * TOPHAT_TEST_RANGE; key++) {
+	item = tophat_get(table, precomputed_hashes[key], &found);
+
+	switch (key % 3) {
+	case 0:
+	    if (key ? found : (!found || item != (void *)1)) {
+		ret = false;
+	    }
+	    break;
+	case 1:
+	    if (!found || item != (void *)(key + 2)) {
+		ret = false;
+	    }
+	    break;
+	default:
+	    if (!found || item != (void *)(key + 1)) {
+		ret = false;
+	    }
+	    break;
+	}
+
+	expected += found ? 1 : 0;
+    }
+
+    view = tophat_view(table, &num, true);
+    ret  = ret && num == expected && tophat_len(table) == expected;
+
+    free(view);
+    tophat_delete(table);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_tophat_adaptive_tests(void)
+{
+    uint64_t threads[] = {2, 4, 8, 0};
+    uint32_t i;
+    uint32_t j;
+
+    struct {
+	char  *name;
+	void (*init)(tophat_t *);
+    } types[] = {
+	{"tophat-fmx", tophat_init_fast_mx},
+	{"tophat-fwf", tophat_init_fast_wf},
+	{"tophat-cmx", tophat_init_cst_mx},
+	{"tophat-cwf", tophat_init_cst_wf},
+	{"tophat-flf", tophat_init_fast_lf},
+	{"tophat-fhs", tophat_init_fast_hs},
+	{NULL, NULL}
+    };
+
+    fprintf(stderr, "[[ Test: tophat-adaptive ]]\n");
+
+    for (j = 0; types[j].name; j++) {
+	for (i = 0; threads[i]; i++) {
+	    fprintf(stderr, "%10s, %lu threads:\t", types[j].name, threads[i]);
+
+	    if (test_tophat_adaptive(types[j].init, threads[i])) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ cloche ]
+ *
+ * Cloche views are supposed to come back in insertion order, without
+ * sorting, with Python's semantics: overwriting a key keeps its
+ * position, and removing a key and then adding it back moves it to
+ * the end. We go through the dict, so that we're also checking that
+ * hatrack_dict_items_nosort() gives us that order, and we use enough
+ * keys that the table migrates a number of times along the way.
+ */
+static bool
+test_cloche_order(uint64_t range)
+{
+    hatrack_dict_t      *dict;
+    hatrack_dict_item_t *items;
+    uint64_t             key;
+    uint64_t             num;
+    uint64_t             i;
+    uint64_t             n;
+    bool                 ret;
+
+    dict = hatrack_dict_new_with_backend(HATRACK_DICT_KEY_TYPE_INT,
+					 HATRACK_BACKEND_CLOCHE);
+    ret  = true;
+
+    // 7919 is prime, so this visits every key from 1 to range.
+    for (i = 0; i < range; i++) {
+	key = (i * 7919) % range + 1;
+	hatrack_dict_put(dict, (void *)key, (void *)key);
+    }
+
+    for (key = 3; key <= range; key += 3) {
+	hatrack_dict_put(dict, (void *)key, (void *)(key * 2));
+    }
+
+    for (key = 5; key <= range; key += 5) {
+	hatrack_dict_remove(dict, (void *)key);
+    }
+
+    for (i = 0; i < range; i++) {
+	key = (i * 7919) % range + 1;
+
+	if (!(key % 10)) {
+	    hatrack_dict_add(dict, (void *)key, (void *)key);
+	}
+    }
+
+    items = hatrack_dict_items_nosort(dict, &num);
+    n     = 0;
+
+    if (num != range - range / 5 + range / 10) {
+	ret = false;
+	goto finished;
+    }
+
+    for (i = 0; i < range; i++) {
+	key = (i * 7919) % range + 1;
+
+	if (!(key % 5)) {
+	    continue;
+	}
+
+	if (items[n].key != (void *)key
+	    || items[n].value != (void *)(key % 3 ? key : key * 2)) {
+	    ret = false;
+	}
+	n++;
+    }
+
+    for (i = 0; i < range; i++) {
+	key = (i * 7919) % range + 1;
+
+	if (key % 10) {
+	    continue;
+	}
+
+	if (items[n].key != (void *)key || items[n].value != (void *)key) {
+	    ret = false;
+	}
+	n++;
+    }
+
+finished:
+    free(items);
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+static void
+run_cloche_tests(void)
+{
+    uint64_t sizes[] = {10, 1000, 50000, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: cloche ]]\n");
+
+    for (i = 0; sizes[i]; i++) {
+	fprintf(stderr, "%7lu items:\t", sizes[i]);
+
+	if (test_cloche_order(sizes[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* [ hq-batch ]
+ *
+ * Producers push runs of sequence numbers with hq_enqueue_many(),
+ * tagged with the producer's id, and consumers drain with
+ * hq_dequeue_many(). We start with the smallest store, so that ranges
+ * regularly span migrations. Every item has to come out exactly once,
+ * and since each producer enqueues in order, each consumer has to see
+ * any one producer's items in increasing order.
+ */
+typedef struct {
+    hq_t             *q;
+    uint64_t          id;
+    uint64_t          num_producers;
+    uint64_t          per_producer;
+    uint64_t          batch;
+    _Atomic uint64_t *remaining;
+    _Atomic uint64_t *sum;
+    bool              ok;
+} hq_batch_info_t;
+
+static void *
+hq_batch_producer(void *arg)
+{
+    hq_batch_info_t *info;
+    void           **items;
+    uint64_t         seq;
+    uint64_t         n;
+    uint64_t         i;
+
+    info  = (hq_batch_info_t *)arg;
+    items = (void **)malloc(sizeof(void *) * info->batch);
+    seq   = 1;
+
+    mmm_register_thread();
+
+    while (seq <= info->per_producer) {
+	n = info->per_producer - seq + 1;
+	n = n < info->batch ? n : info->batch;
+
+	for (i = 0; i < n; i++) {
+	    items[i] = (void *)((info->id << 32) | seq++);
+	}
+
+	hq_enqueue_many(info->q, items, n);
+    }
+
+    free(items);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+hq_batch_consumer(void *arg)
+{
+    hq_batch_info_t *info;
+    void           **items;
+    uint64_t        *last;
+    uint64_t         producer;
+    uint64_t         seq;
+    uint64_t         sum;
+    uint64_t         n;
+    uint64_t         i;
+
+    info     = (hq_batch_info_t *)arg;
+    items    = (void **)malloc(sizeof(void *) * info->batch);
+    last     = (uint64_t *)calloc(info->num_producers, sizeof(uint64_t));
+    sum      = 0;
+    info->ok = true;
+
+    mmm_register_thread();
+
+    while (atomic_read(info->remaining)) {
+	n = hq_dequeue_many(info->q, items, info->batch);
+
+	for (i = 0; i < n; i++) {
+	    producer = (uint64_t)items[i] >> 32;
+	    seq      = (uint64_t)items[i] & 0xffffffff;
+
+	    if (producer >= info->num_producers || seq <= last[producer]) {
+		info->ok = false;
+		continue;
+	    }
+
+	    last[producer] = seq;
+	    sum           += seq;
+	}
+
+	atomic_fetch_sub(info->remaining, n);
+    }
+
+    atomic_fetch_add(info->sum, sum);
+
+    free(items);
+    free(last);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_hq_batch(uint64_t num_producers, uint64_t num_consumers, uint64_t batch)
+{
+    hq_t            *q;
+    hq_batch_info_t *info;
+    pthread_t       *threads;
+    _Atomic uint64_t remaining;
+    _Atomic uint64_t sum;
+    uint64_t         per_producer;
+    uint64_t         num_threads;
+    uint64_t         i;
+    bool             ret;
+
+    q            = hq_new_size(0);
+    per_producer = 20000;
+    num_threads  = num_producers + num_consumers;
+    info         = (hq_batch_info_t *)malloc(sizeof(hq_batch_info_t)
+					     * num_threads);
+    threads      = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret          = true;
+
+    atomic_store(&remaining, num_producers * per_producer);
+    atomic_store(&sum, 0);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].q             = q;
+	info[i].id            = i;
+	info[i].num_producers = num_producers;
+	info[i].per_producer  = per_producer;
+	info[i].batch         = batch;
+	info[i].remaining     = &remaining;
+	info[i].sum           = &sum;
+	info[i].ok            = true;
+
+	pthread_create(&threads[i],
+		       NULL,
+		       i < num_producers ? hq_batch_producer : hq_batch_consumer,
+		       &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    if (atomic_read(&sum)
+	!= num_producers * (per_producer * (per_producer + 1) / 2)) {
+	ret = false;
+    }
+
+    if (hq_len(q) != 0) {
+	ret = false;
+    }
+
+    hq_delete(q);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_hq_batch_tests(void)
+{
+    uint64_t batches[] = {1, 7, 64, 1000, 0};
+    uint64_t threads[] = {1, 1, 2, 2, 4, 4, 1, 4, 0, 0};
+    uint32_t i;
+    uint32_t j;
+
+    fprintf(stderr, "[[ Test: hq-batch ]]\n");
+
+    for (i = 0; batches[i]; i++) {
+	for (j = 0; threads[j]; j += 2) {
+	    fprintf(stderr,
+		    "batch %4lu, %lu enqueuers, %lu dequeuers:\t",
+		    batches[i],
+		    threads[j],
+		    threads[j + 1]);
+
+	    if (test_hq_batch(threads[j], threads[j + 1], batches[i])) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ hq-bounded ]
+ *
+ * First, single-threaded: a bounded queue holds exactly its
+ * (rounded-up) capacity, hq_try_enqueue() fails once it's full,
+ * hq_enqueue_wait() times out, and a dequeue makes room again. Items
+ * have to come out in order, and the store must never get replaced.
+ *
+ * Then, producers push through a tiny bounded queue with the blocking
+ * hq_enqueue(), so that they spend most of their time parked, waiting
+ * on consumers. Every item has to come out exactly once, in
+ * per-producer order, and the store still can't have changed.
+ */
+static bool
+test_hq_bounded_basic(void)
+{
+    hq_t       *q;
+    hq_store_t *store;
+    uint64_t    i;
+    void       *item;
+    bool        found;
+    bool        ret;
+
+    q     = hq_new_bounded(100);
+    store = atomic_read(&q->store);
+    ret   = true;
+
+    if (q->capacity != 128) {
+	ret = false;
+    }
+
+    for (i = 1; i <= 128; i++) {
+	if (!hq_try_enqueue(q, (void *)i)) {
+	    ret = false;
+	}
+    }
+
+    if (hq_try_enqueue(q, (void *)129) || hq_enqueue_wait(q, (void *)129, 20)) {
+	ret = false;
+    }
+
+    if (hq_len(q) != 128) {
+	ret = false;
+    }
+
+    item = hq_dequeue(q, &found);
+
+    if (!found || item != (void *)1) {
+	ret = false;
+    }
+
+    if (!hq_try_enqueue(q, (void *)129)) {
+	ret = false;
+    }
+
+    for (i = 2; i <= 129; i++) {
+	item = hq_dequeue(q, &found);
+
+	if (!found || item != (void *)i) {
+	    ret = false;
+	}
+    }
+
+    hq_dequeue(q, &found);
+
+    if (found || hq_len(q) != 0 || atomic_read(&q->store) != store) {
+	ret = false;
+    }
+
+    hq_delete(q);
+
+    return ret;
+}
+
+static void *
+hq_bounded_producer(void *arg)
+{
+    hq_batch_info_t *info;
+    uint64_t         seq;
+
+    info = (hq_batch_info_t *)arg;
+
+    mmm_register_thread();
+
+    for (seq = 1; seq <= info->per_producer; seq++) {
+	hq_enqueue(info->q, (void *)((info->id << 32) | seq));
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+hq_bounded_consumer(void *arg)
+{
+    hq_batch_info_t *info;
+    uint64_t        *last;
+    uint64_t         producer;
+    uint64_t         seq;
+    uint64_t         sum;
+    void            *item;
+    bool             found;
+
+    info     = (hq_batch_info_t *)arg;
+    last     = (uint64_t *)calloc(info->num_producers, sizeof(uint64_t));
+    sum      = 0;
+    info->ok = true;
+
+    mmm_register_thread();
+
+    while (atomic_read(info->remaining)) {
+	item = hq_dequeue_wait(info->q, &found, 10);
+
+	if (!found) {
+	    continue;
+	}
+
+	producer = (uint64_t)item >> 32;
+	seq      = (uint64_t)item & 0xffffffff;
+
+	if (producer >= info->num_producers || seq <= last[producer]) {
+	    info->ok = false;
+	}
+	else {
+	    last[producer] = seq;
+	    sum           += seq;
+	}
+
+	atomic_fetch_sub(info->remaining, 1);
+    }
+
+    atomic_fetch_add(info->sum, sum);
+
+    free(last);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_hq_bounded(uint64_t capacity,
+		uint64_t num_producers,
+		uint64_t num_consumers)
+{
+    hq_t            *q;
+    hq_store_t      *store;
+    hq_batch_info_t *info;
+    pthread_t       *threads;
+    _Atomic uint64_t remaining;
+    _Atomic uint64_t sum;
+    uint64_t         per_producer;
+    uint64_t         num_threads;
+    uint64_t         i;
+    bool             ret;
+
+    q            = hq_new_bounded(capacity);
+    store        = atomic_read(&q->store);
+    per_producer = 20000;
+    num_threads  = num_producers + num_consumers;
+    info         = (hq_batch_info_t *)malloc(sizeof(hq_batch_info_t)
+					     * num_threads);
+    threads      = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret          = true;
+
+    atomic_store(&remaining, num_producers * per_producer);
+    atomic_store(&sum, 0);
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].q             = q;
+	info[i].id            = i;
+	info[i].num_producers = num_producers;
+	info[i].per_producer  = per_producer;
+	info[i].batch         = 1;
+	info[i].remaining     = &remaining;
+	info[i].sum           = &sum;
+	info[i].ok            = true;
+
+	pthread_create(&threads[i],
+		       NULL,
+		       i < num_producers ? hq_bounded_producer
+		                         : hq_bounded_consumer,
+		       &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    if (atomic_read(&sum)
+	!= num_producers * (per_producer * (per_producer + 1) / 2)) {
+	ret = false;
+    }
+
+    if (hq_len(q) != 0 || atomic_read(&q->store) != store) {
+	ret = false;
+    }
+
+    hq_delete(q);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_hq_bounded_tests(void)
+{
+    uint64_t threads[] = {1, 1, 2, 2, 4, 1, 1, 4, 0, 0};
+    uint64_t sizes[]   = {2, 16, 256, 0};
+    uint32_t i;
+    uint32_t j;
+
+    fprintf(stderr, "[[ Test: hq-bounded ]]\n");
+    fprintf(stderr, "full queue rejects and times out:\t");
+
+    if (test_hq_bounded_basic()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    for (i = 0; sizes[i]; i++) {
+	for (j = 0; threads[j]; j += 2) {
+	    fprintf(stderr,
+		    "capacity %3lu, %lu enqueuers, %lu dequeuers:\t",
+		    sizes[i],
+		    threads[j],
+		    threads[j + 1]);
+
+	    if (test_hq_bounded(sizes[i], threads[j], threads[j + 1])) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ hq-sc ]
+ *
+ * The single-consumer queues. For hq_spsc, one producer and one
+ * consumer, starting with the smallest ring so that we grow a bunch
+ * of times mid-stream; items must come out in exactly the order they
+ * went in. For hq_mpsc, several producers and one consumer, with
+ * small segments; each producer's items must come out in order, and
+ * every item must come out exactly once.
+ *
+ * Both are run with batch size 1 (hq_*_enqueue() / hq_*_dequeue())
+ * and with larger batches (the _many() variants).
+ */
+#define SC_TEST_ITEMS ((uint64_t)100000)
+
+typedef struct {
+    void    *q;
+    uint64_t id;
+    uint64_t num_producers;
+    uint64_t batch;
+    uint64_t sum;
+    bool     ok;
+} sc_test_info_t;
+
+static void *
+spsc_test_producer(void *arg)
+{
+    sc_test_info_t *info;
+    void          **items;
+    uint64_t        seq;
+    uint64_t        n;
+    uint64_t        i;
+
+    info  = (sc_test_info_t *)arg;
+    items = (void **)malloc(sizeof(void *) * info->batch);
+    seq   = 1;
+
+    while (seq <= SC_TEST_ITEMS) {
+	if (info->batch == 1) {
+	    hq_spsc_enqueue(info->q, (void *)seq++);
+	    continue;
+	}
+
+	n = SC_TEST_ITEMS - seq + 1;
+	n = n < info->batch ? n : info->batch;
+
+	for (i = 0; i < n; i++) {
+	    items[i] = (void *)seq++;
+	}
+
+	hq_spsc_enqueue_many(info->q, items, n);
+    }
+
+    free(items);
+
+    return NULL;
+}
+
+static void *
+spsc_test_consumer(void *arg)
+{
+    sc_test_info_t *info;
+    void          **items;
+    uint64_t        expected;
+    uint64_t        n;
+    uint64_t        i;
+    bool            found;
+
+    info     = (sc_test_info_t *)arg;
+    items    = (void **)malloc(sizeof(void *) * info->batch);
+    expected = 1;
+    info->ok = true;
+
+    while (expected <= SC_TEST_ITEMS) {
+	if (info->batch == 1) {
+	    items[0] = hq_spsc_dequeue(info->q, &found);
+	    n        = found ? 1 : 0;
+	}
+	else {
+	    n = hq_spsc_dequeue_many(info->q, items, info->batch);
+	}
+
+	for (i = 0; i < n; i++) {
+	    if (items[i] != (void *)expected++) {
+		info->ok = false;
+	    }
+	}
+    }
+
+    free(items);
+
+    return NULL;
+}
+
+static bool
+test_hq_spsc(uint64_t batch)
+{
+    hq_spsc_t     *q;
+    sc_test_info_t info[2];
+    pthread_t      threads[2];
+    bool           ret;
+
+    q = hq_spsc_new_size(0);
+
+    info[0].q     = q;
+    info[0].batch = batch;
+    info[0].ok    = true;
+    info[1]       = info[0];
+
+    pthread_create(&threads[0], NULL, spsc_test_producer, &info[0]);
+    pthread_create(&threads[1], NULL, spsc_test_consumer, &info[1]);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    ret = info[1].ok && hq_spsc_len(q) == 0;
+
+    hq_spsc_delete(q);
+
+    return ret;
+}
+
+static void *
+mpsc_test_producer(void *arg)
+{
+    sc_test_info_t *info;
+    void          **items;
+    uint64_t        seq;
+    uint64_t        n;
+    uint64_t        i;
+
+    info  = (sc_test_info_t *)arg;
+    items = (void **)malloc(sizeof(void *) * info->batch);
+    seq   = 1;
+
+    mmm_register_thread();
+
+    while (seq <= SC_TEST_ITEMS) {
+	if (info->batch == 1) {
+	    hq_mpsc_enqueue(info->q, (void *)((info->id << 32) | seq++));
+	    continue;
+	}
+
+	n = SC_TEST_ITEMS - seq + 1;
+	n = n < info->batch ? n : info->batch;
+
+	for (i = 0; i < n; i++) {
+	    items[i] = (void *)((info->id << 32) | seq++);
+	}
+
+	hq_mpsc_enqueue_many(info->q, items, n);
+    }
+
+    free(items);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+mpsc_test_consumer(void *arg)
+{
+    sc_test_info_t *info;
+    void          **items;
+    uint64_t       *last;
+    uint64_t        remaining;
+    uint64_t        producer;
+    uint64_t        seq;
+    uint64_t        n;
+    uint64_t        i;
+    bool            found;
+
+    info      = (sc_test_info_t *)arg;
+    items     = (void **)malloc(sizeof(void *) * info->batch);
+    last      = (uint64_t *)calloc(info->num_producers, sizeof(uint64_t));
+    remaining = info->num_producers * SC_TEST_ITEMS;
+    info->sum = 0;
+    info->ok  = true;
+
+    mmm_register_thread();
+
+    while (remaining) {
+	if (info->batch == 1) {
+	    items[0] = hq_mpsc_dequeue(info->q, &found);
+	    n        = found ? 1 : 0;
+	}
+	else {
+	    n = hq_mpsc_dequeue_many(info->q, items, info->batch);
+	}
+
+	for (i = 0; i < n; i++) {
+	    producer = (uint64_t)items[i] >> 32;
+	    seq      = (uint64_t)items[i] & 0xffffffff;
+
+	    if (producer >= info->num_producers || seq <= last[producer]) {
+		info->ok = false;
+		continue;
+	    }
+
+	    last[producer] = seq;
+	    info->sum     += seq;
+	}
+
+	remaining = n > remaining ? 0 : remaining - n;
+    }
+
+    free(items);
+    free(last);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_hq_mpsc(uint64_t num_producers, uint64_t batch)
+{
+    hq_mpsc_t      *q;
+    sc_test_info_t *info;
+    pthread_t      *threads;
+    uint64_t        i;
+    bool            ret;
+
+    q       = hq_mpsc_new_size(0);
+    info    = (sc_test_info_t *)malloc(sizeof(sc_test_info_t)
+				       * (num_producers + 1));
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * (num_producers + 1));
+
+    for (i = 0; i <= num_producers; i++) {
+	info[i].q             = q;
+	info[i].id            = i;
+	info[i].num_producers = num_producers;
+	info[i].batch         = batch;
+	info[i].ok            = true;
+
+	pthread_create(&threads[i],
+		       NULL,
+		       i < num_producers ? mpsc_test_producer
+		                         : mpsc_test_consumer,
+		       &info[i]);
+    }
+
+    for (i = 0; i <= num_producers; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    ret = info[num_producers].ok
+	&& info[num_producers].sum
+	== num_producers * (SC_TEST_ITEMS * (SC_TEST_ITEMS + 1) / 2)
+	&& hq_mpsc_len(q) == 0;
+
+    hq_mpsc_delete(q);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_hq_sc_tests(void)
+{
+    uint64_t batches[]   = {1, 7, 100, 0};
+    uint64_t producers[] = {1, 2, 4, 0};
+    uint32_t i;
+    uint32_t j;
+
+    fprintf(stderr, "[[ Test: hq-sc ]]\n");
+
+    for (i = 0; batches[i]; i++) {
+	fprintf(stderr, "hq_spsc, batch %3lu:\t", batches[i]);
+
+	if (test_hq_spsc(batches[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    for (i = 0; batches[i]; i++) {
+	for (j = 0; producers[j]; j++) {
+	    fprintf(stderr,
+		    "hq_mpsc, batch %3lu, %lu enqueuers:\t",
+		    batches[i],
+		    producers[j]);
+
+	    if (test_hq_mpsc(producers[j], batches[i])) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ skipq ]
+ *
+ * First, single-threaded: items have to come out of a strict skipq in
+ * priority order (duplicates included), and everything has to come
+ * out of a relaxed one.
+ *
+ * Then, threads insert distinct priorities all at once, and then
+ * dequeue all at once. With no inserts running, every dequeue out of
+ * a strict queue gets the current minimum, so each thread has to see
+ * increasing priorities. Either way, every item has to come out
+ * exactly once.
+ *
+ * Finally, threads insert and dequeue at the same time; we only check
+ * that every item comes out exactly once.
+ */
+#define SKIPQ_TEST_ITEMS ((uint64_t)20000)
+
+typedef struct {
+    skipq_t          *q;
+    uint64_t          id;
+    uint64_t          num_threads;
+    _Atomic uint8_t  *seen;
+    _Atomic uint64_t *remaining;
+    bool              insert;
+    bool              dequeue;
+    bool              check_order;
+    bool              ok;
+} skipq_test_info_t;
+
+static bool
+test_skipq_basic(uint64_t num_lists)
+{
+    skipq_t  *q;
+    uint64_t  i;
+    uint64_t  prio;
+    uint64_t  last;
+    uint64_t  sum;
+    void     *item;
+    bool      found;
+    bool      ret;
+
+    q   = num_lists ? skipq_new_relaxed(num_lists) : skipq_new();
+    ret = true;
+    sum = 0;
+
+    for (i = 0; i < SKIPQ_TEST_ITEMS; i++) {
+	prio = (i * 7919) % (SKIPQ_TEST_ITEMS / 2);
+	skipq_insert(q, prio, (void *)(prio + 1));
+	sum += prio;
+    }
+
+    if (skipq_len(q) != (int64_t)SKIPQ_TEST_ITEMS) {
+	ret = false;
+    }
+
+    last = 0;
+
+    for (i = 0; i < SKIPQ_TEST_ITEMS; i++) {
+	item = skipq_dequeue_min(q, &prio, &found);
+
+	if (!found || item != (void *)(prio + 1)) {
+	    ret = false;
+	    break;
+	}
+
+	if (!num_lists && prio < last) {
+	    ret = false;
+	}
+
+	last = prio;
+	sum -= prio;
+    }
+
+    skipq_dequeue_min(q, NULL, &found);
+
+    if (found || sum || skipq_len(q) != 0) {
+	ret = false;
+    }
+
+    skipq_delete(q);
+
+    return ret;
+}
+
+static void *
+skipq_test_thread(void *arg)
+{
+    skipq_test_info_t *info;
+    uint64_t           i;
+    uint64_t           prio;
+    uint64_t           last;
+    void              *item;
+    bool               found;
+
+    info     = (skipq_test_info_t *)arg;
+    info->ok = true;
+    last     = 0;
+
+    mmm_register_thread();
+
+    for (i = info->id; info->insert && i < SKIPQ_TEST_ITEMS;
+	 i += info->num_threads) {
+	skipq_insert(info->q, i, (void *)(i + 1));
+    }
+
+    while (info->dequeue && atomic_read(info->remaining)) {
+	item = skipq_dequeue_min(info->q, &prio, &found);
+
+	if (!found) {
+	    continue;
+	}
+
+	if (item != (void *)(prio + 1) || prio >= SKIPQ_TEST_ITEMS
+	    || atomic_fetch_add(&info->seen[prio], 1)) {
+	    info->ok = false;
+	}
+
+	if (info->check_order && prio < last) {
+	    info->ok = false;
+	}
+
+	last = prio;
+
+	atomic_fetch_sub(info->remaining, 1);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+run_skipq_threads(skipq_t          *q,
+		  uint64_t          num_threads,
+		  _Atomic uint8_t  *seen,
+		  _Atomic uint64_t *remaining,
+		  bool              insert,
+		  bool              dequeue,
+		  bool              check_order)
+{
+    skipq_test_info_t *info;
+    pthread_t         *threads;
+    uint64_t           i;
+    bool               ret;
+
+    info    = (skipq_test_info_t *)malloc(sizeof(skipq_test_info_t)
+					  * num_threads);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    ret     = true;
+
+    for (i = 0; i < num_threads; i++) {
+	info[i].q           = q;
+	info[i].id          = i;
+	info[i].num_threads = num_threads;
+	info[i].seen        = seen;
+	info[i].remaining   = remaining;
+	info[i].insert      = insert;
+	info[i].dequeue     = dequeue;
+	info[i].check_order = check_order;
+
+	pthread_create(&threads[i], NULL, skipq_test_thread, &info[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static bool
+test_skipq_parallel(uint64_t num_lists, uint64_t num_threads, bool phased)
+{
+    skipq_t          *q;
+    _Atomic uint8_t  *seen;
+    _Atomic uint64_t  remaining;
+    uint64_t          i;
+    bool              ret;
+
+    q    = num_lists ? skipq_new_relaxed(num_lists) : skipq_new();
+    seen = (_Atomic uint8_t *)calloc(SKIPQ_TEST_ITEMS, sizeof(uint8_t));
+    ret  = true;
+
+    atomic_store(&remaining, SKIPQ_TEST_ITEMS);
+
+    if (phased) {
+	ret = run_skipq_threads(q, num_threads, seen, &remaining,
+				true, false, false)
+	    && run_skipq_threads(q, num_threads, seen, &remaining,
+				 false, true, !num_lists);
+    }
+    else {
+	ret = run_skipq_threads(q, num_threads, seen, &remaining,
+				true, true, false);
+    }
+
+    for (i = 0; i < SKIPQ_TEST_ITEMS; i++) {
+	if (atomic_read(&seen[i]) != 1) {
+	    ret = false;
+	}
+    }
+
+    if (skipq_len(q) != 0) {
+	ret = false;
+    }
+
+    skipq_delete(q);
+    free(seen);
+
+    return ret;
+}
+
+static void
+run_skipq_tests(void)
+{
+    uint64_t lists[]   = {0, 4, 16};
+    uint64_t threads[] = {1, 2, 4, 8, 0};
+    uint32_t i;
+    uint32_t j;
+
+    fprintf(stderr, "[[ Test: skipq ]]\n");
+
+    for (i = 0; i < sizeof(lists) / sizeof(uint64_t); i++) {
+	fprintf(stderr, "%2lu lists, single-threaded:\t", lists[i]);
+
+	if (test_skipq_basic(lists[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+
+	for (j = 0; threads[j]; j++) {
+	    fprintf(stderr,
+		    "%2lu lists, %lu threads, phased:\t",
+		    lists[i],
+		    threads[j]);
+
+	    if (test_skipq_parallel(lists[i], threads[j], true)) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+
+	    fprintf(stderr,
+		    "%2lu lists, %lu threads, mixed:\t",
+		    lists[i],
+		    threads[j]);
+
+	    if (test_skipq_parallel(lists[i], threads[j], false)) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ queue-wait ]
+ *
+ * Checks hq_dequeue_wait() and capq_dequeue_wait(). First, that
+ * waiting on an empty queue times out, and doesn't return early.
+ * Then we run consumers that never time out against a producer that
+ * keeps pausing, so the consumers are regularly asleep when items
+ * show up. Every item has to get through, and, at the end, one
+ * 'stop' item per consumer has to wake everyone up.
+ */
+typedef struct {
+    char  *name;
+    void  *(*new)(void);
+    void   (*enqueue)(void *, void *);
+    void  *(*dequeue_wait)(void *, bool *, int64_t);
+    void   (*delete)(void *);
+} wait_queue_impl_t;
+
+typedef struct {
+    wait_queue_impl_t *impl;
+    void              *q;
+    uint64_t           sum;
+} wait_queue_info_t;
+
+#define WAIT_TEST_ITEMS 20000
+#define WAIT_TEST_STOP  ((void *)0xffffffff)
+
+static void *
+wait_hq_new(void)
+{
+    return hq_new();
+}
+
+static void
+wait_hq_enqueue(void *q, void *item)
+{
+    hq_enqueue((hq_t *)q, item);
+}
+
+static void *
+wait_hq_dequeue_wait(void *q, bool *found, int64_t timeout_ms)
+{
+    return hq_dequeue_wait((hq_t *)q, found, timeout_ms);
+}
+
+static void
+wait_hq_delete(void *q)
+{
+    hq_delete((hq_t *)q);
+}
+
+static void *
+wait_capq_new(void)
+{
+    return capq_new();
+}
+
+static void
+wait_capq_enqueue(void *q, void *item)
+{
+    capq_enqueue((capq_t *)q, item);
+}
+
+static void *
+wait_capq_dequeue_wait(void *q, bool *found, int64_t timeout_ms)
+{
+    return capq_dequeue_wait((capq_t *)q, found, timeout_ms);
+}
+
+static void
+wait_capq_delete(void *q)
+{
+    capq_delete((capq_t *)q);
+}
+
+static void *
+wait_queue_consumer(void *arg)
+{
+    wait_queue_info_t *info;
+    void              *item;
+    bool               found;
+
+    info      = (wait_queue_info_t *)arg;
+    info->sum = 0;
+
+    mmm_register_thread();
+
+    while (true) {
+	item = (*info->impl->dequeue_wait)(info->q, &found, -1);
+
+	if (!found || item == WAIT_TEST_STOP) {
+	    break;
+	}
+
+	info->sum += (uint64_t)item;
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_queue_wait(wait_queue_impl_t *impl, uint64_t num_consumers)
+{
+    wait_queue_info_t *info;
+    pthread_t         *threads;
+    struct timespec    start;
+    struct timespec    end;
+    struct timespec    pause;
+    void              *q;
+    uint64_t           sum;
+    uint64_t           elapsed_ms;
+    uint64_t           i;
+    bool               found;
+    bool               ret;
+
+    q   = (*impl->new)();
+    ret = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    (*impl->dequeue_wait)(q, &found, 50);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+	       + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    if (found || elapsed_ms < 45) {
+	ret = false;
+    }
+
+    info    = (wait_queue_info_t *)malloc(sizeof(wait_queue_info_t)
+					  * num_consumers);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_consumers);
+
+    for (i = 0; i < num_consumers; i++) {
+	info[i].impl = impl;
+	info[i].q    = q;
+
+	pthread_create(&threads[i], NULL, wait_queue_consumer, &info[i]);
+    }
+
+    pause.tv_sec  = 0;
+    pause.tv_nsec = 200000;
+
+    for (i = 1; i <= WAIT_TEST_ITEMS; i++) {
+	(*impl->enqueue)(q, (void *)i);
+
+	if (!(i % 500)) {
+	    nanosleep(&pause, NULL);
+	}
+    }
+
+    for (i = 0; i < num_consumers; i++) {
+	(*impl->enqueue)(q, WAIT_TEST_STOP);
+    }
+
+    sum = 0;
+
+    for (i = 0; i < num_consumers; i++) {
+	pthread_join(threads[i], NULL);
+	sum += info[i].sum;
+    }
+
+    if (sum != (WAIT_TEST_ITEMS * (WAIT_TEST_ITEMS + 1)) / 2) {
+	ret = false;
+    }
+
+    (*impl->delete)(q);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_queue_wait_tests(void)
+{
+    uint64_t threads[] = {1, 2, 4, 0};
+    uint32_t i;
+    uint32_t j;
+
+    wait_queue_impl_t impls[] = {
+	{"hq", wait_hq_new, wait_hq_enqueue, wait_hq_dequeue_wait,
+	 wait_hq_delete},
+	{"capq", wait_capq_new, wait_capq_enqueue, wait_capq_dequeue_wait,
+	 wait_capq_delete},
+	{NULL, NULL, NULL, NULL, NULL}
+    };
+
+    fprintf(stderr, "[[ Test: queue-wait ]]\n");
+
+    for (j = 0; impls[j].name; j++) {
+	for (i = 0; threads[i]; i++) {
+	    fprintf(stderr,
+		    "%4s, %lu dequeuers:\t",
+		    impls[j].name,
+		    threads[i]);
+
+	    if (test_queue_wait(&impls[j], threads[i])) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+    }
+
+    return;
+}
+
+/* [ wsdeque ]
+ *
+ * The owner (the calling thread) pushes WSDEQUE_TEST_ITEMS items,
+ * popping one back off after every third push, while the thieves
+ * steal as fast as they can. The deque starts small, so it grows
+ * several times along the way, with thieves in the middle of reading
+ * from it. Once the owner has pushed everything, it pops until the
+ * deque is empty. Every item has to come out exactly once.
+ */
+#define WSDEQUE_TEST_ITEMS ((uint64_t)100000)
+
+typedef struct {
+    wsdeque_t        *deque;
+    _Atomic uint8_t  *seen;
+    _Atomic bool     *done;
+    bool              ok;
+} wsdeque_test_info_t;
+
+static bool
+wsdeque_test_take(_Atomic uint8_t *seen, void *item)
+{
+    uint64_t n;
+
+    n = (uint64_t)item;
+
+    if (!n || n > WSDEQUE_TEST_ITEMS) {
+	return false;
+    }
+
+    return !atomic_fetch_add(&seen[n - 1], 1);
+}
+
+static void *
+wsdeque_test_thief(void *arg)
+{
+    wsdeque_test_info_t *info;
+    void                *item;
+    bool                 found;
+
+    info = (wsdeque_test_info_t *)arg;
+
+    mmm_register_thread();
+
+    while (true) {
+	item = wsdeque_steal(info->deque, &found);
+
+	if (found) {
+	    if (!wsdeque_test_take(info->seen, item)) {
+		info->ok = false;
+	    }
+	    continue;
+	}
+
+	if (atomic_load(info->done) && !wsdeque_len(info->deque)) {
+	    break;
+	}
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_wsdeque(uint64_t num_thieves)
+{
+    wsdeque_t           *deque;
+    wsdeque_test_info_t *info;
+    pthread_t           *threads;
+    _Atomic uint8_t     *seen;
+    _Atomic bool         done;
+    void                *item;
+    uint64_t             i;
+    bool                 found;
+    bool                 ret;
+
+    deque   = wsdeque_new_size(16);
+    seen    = (_Atomic uint8_t *)calloc(WSDEQUE_TEST_ITEMS, sizeof(uint8_t));
+    info    = (wsdeque_test_info_t *)malloc(sizeof(wsdeque_test_info_t)
+					    * num_thieves);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * num_thieves);
+    ret     = true;
+
+    atomic_store(&done, false);
+
+    for (i = 0; i < num_thieves; i++) {
+	info[i].deque = deque;
+	info[i].seen  = seen;
+	info[i].done  = &done;
+	info[i].ok    = true;
+
+	pthread_create(&threads[i], NULL, wsdeque_test_thief, &info[i]);
+    }
+
+    for (i = 1; i <= WSDEQUE_TEST_ITEMS; i++) {
+	wsdeque_push(deque, (void *)i);
+
+	if (i % 3) {
+	    continue;
+	}
+
+	item = wsdeque_pop(deque, &found);
+
+	if (found && !wsdeque_test_take(seen, item)) {
+	    ret = false;
+	}
+    }
+
+    while (true) {
+	item = wsdeque_pop(deque, &found);
+
+	if (!found) {
+	    break;
+	}
+
+	if (!wsdeque_test_take(seen, item)) {
+	    ret = false;
+	}
+    }
+
+    atomic_store(&done, true);
+
+    for (i = 0; i < num_thieves; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    for (i = 0; i < WSDEQUE_TEST_ITEMS; i++) {
+	if (atomic_read(&seen[i]) != 1) {
+	    ret = false;
+	}
+    }
+
+    if (wsdeque_len(deque)) {
+	ret = false;
+    }
+
+    wsdeque_delete(deque);
+    free(seen);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void
+run_wsdeque_tests(void)
+{
+    uint64_t thieves[] = {0, 1, 2, 4, 8};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: wsdeque ]]\n");
+
+    for (i = 0; i < sizeof(thieves) / sizeof(uint64_t); i++) {
+	fprintf(stderr, "%lu thieves:\t", thieves[i]);
+
+	if (test_wsdeque(thieves[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* [ pool ]
+ *
+ * Three checks on hatrack_pool:
+ *
+ * 1) Fork-join: a single task spawns a full binary tree of tasks,
+ *    each of which spawns its children from inside the pool, so
+ *    nearly everything goes through the workers' deques. We do it a
+ *    few times, with a pause in between, so the workers have to park
+ *    and get woken back up.
+ *
+ * 2) Submissions from outside: several threads that aren't workers
+ *    submit tasks at once, which all go through the shared queue.
+ *
+ * 3) Set algebra through the pool, including from inside a task on a
+ *    pool with a single worker, which would deadlock if the calling
+ *    thread waited for helpers that can't start until it's done.
+ */
+#define POOL_TEST_DEPTH       14
+#define POOL_TEST_SUBMITTERS  4
+#define POOL_TEST_SUBMISSIONS 10000
+
+typedef struct {
+    hatrack_pool_t   *pool;
+    _Atomic uint64_t  count;
+    uint64_t          depth;
+} pool_test_tree_t;
+
+typedef struct {
+    pool_test_tree_t *tree;
+    uint64_t          depth;
+} pool_test_node_t;
+
+static void
+pool_test_node(void *arg)
+{
+    pool_test_node_t *node;
+    pool_test_node_t *child;
+    uint64_t          i;
+
+    node = (pool_test_node_t *)arg;
+
+    atomic_fetch_add(&node->tree->count, 1);
+
+    if (node->depth) {
+	for (i = 0; i < 2; i++) {
+	    child        = (pool_test_node_t *)malloc(sizeof(pool_test_node_t));
+	    child->tree  = node->tree;
+	    child->depth = node->depth - 1;
+
+	    hatrack_pool_submit(node->tree->pool, pool_test_node, child);
+	}
+    }
+
+    free(node);
+
+    return;
+}
+
+static bool
+test_pool_fork_join(uint64_t num_workers)
+{
+    pool_test_tree_t  tree;
+    pool_test_node_t *root;
+    uint64_t          round;
+    bool              ret;
+
+    tree.pool = hatrack_pool_new(num_workers);
+    ret       = true;
+
+    for (round = 0; round < 3; round++) {
+	atomic_store(&tree.count, 0);
+
+	root        = (pool_test_node_t *)malloc(sizeof(pool_test_node_t));
+	root->tree  = &tree;
+	root->depth = POOL_TEST_DEPTH;
+
+	hatrack_pool_submit(tree.pool, pool_test_node, root);
+	hatrack_pool_wait(tree.pool);
+
+	if (atomic_load(&tree.count) != (1ULL << (POOL_TEST_DEPTH + 1)) - 1) {
+	    ret = false;
+	}
+
+	if (hatrack_pool_pending(tree.pool)) {
+	    ret = false;
+	}
+
+	usleep(5000);
+    }
+
+    hatrack_pool_delete(tree.pool);
+
+    return ret;
+}
+
+typedef struct {
+    hatrack_pool_t   *pool;
+    _Atomic uint64_t *sum;
+    uint64_t          id;
+} pool_test_submitter_t;
+
+static void
+pool_test_add(void *arg)
+{
+    pool_test_submitter_t *info;
+
+    info = (pool_test_submitter_t *)arg;
+
+    atomic_fetch_add(info->sum, info->id + 1);
+
+    return;
+}
+
+static void *
+pool_test_submitter(void *arg)
+{
+    pool_test_submitter_t *info;
+    uint64_t               i;
+
+    info = (pool_test_submitter_t *)arg;
+
+    mmm_register_thread();
+
+    for (i = 0; i < POOL_TEST_SUBMISSIONS; i++) {
+	hatrack_pool_submit(info->pool, pool_test_add, info);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_pool_submitters(uint64_t num_workers)
+{
+    hatrack_pool_t        *pool;
+    pool_test_submitter_t  info[POOL_TEST_SUBMITTERS];
+    pthread_t              threads[POOL_TEST_SUBMITTERS];
+    _Atomic uint64_t       sum;
+    uint64_t               expected;
+    uint64_t               i;
+
+    pool     = hatrack_pool_new(num_workers);
+    expected = 0;
+
+    atomic_store(&sum, 0);
+
+    for (i = 0; i < POOL_TEST_SUBMITTERS; i++) {
+	info[i].pool = pool;
+	info[i].sum  = &sum;
+	info[i].id   = i;
+	expected    += (i + 1) * POOL_TEST_SUBMISSIONS;
+
+	pthread_create(&threads[i], NULL, pool_test_submitter, &info[i]);
+    }
+
+    for (i = 0; i < POOL_TEST_SUBMITTERS; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    hatrack_pool_wait(pool);
+    hatrack_pool_delete(pool);
+
+    return atomic_load(&sum) == expected;
+}
+
+typedef struct {
+    hatrack_pool_t *pool;
+    bool            ok;
+} pool_test_setops_t;
+
+static void
+pool_test_setops_task(void *arg)
+{
+    pool_test_setops_t *info;
+    uint32_t            op;
+
+    info     = (pool_test_setops_t *)arg;
+    info->ok = true;
+
+    for (op = 0; op < 4; op++) {
+	if (!test_set_algebra(op, SETOPS_WOOLHAT, 0, 20000, info->pool)) {
+	    info->ok = false;
+	}
+    }
+
+    return;
+}
+
+static bool
+test_pool_setops(uint64_t num_workers)
+{
+    pool_test_setops_t info;
+    uint32_t           op;
+    bool               ret;
+
+    info.pool = hatrack_pool_new(num_workers);
+    info.ok   = false;
+    ret       = true;
+
+    for (op = 0; op < 4; op++) {
+	if (!test_set_algebra(op, SETOPS_WOOLHAT, 0, 20000, info.pool)) {
+	    ret = false;
+	}
+    }
+
+    hatrack_pool_submit(info.pool, pool_test_setops_task, &info);
+    hatrack_pool_wait(info.pool);
+    hatrack_pool_delete(info.pool);
+
+    return ret && info.ok;
+}
+
+static void
+run_pool_tests(void)
+{
+    uint64_t workers[] = {1, 2, 4, 8, 0};
+    uint32_t i;
+
+    fprintf(stderr, "[[ Test: pool ]]\n");
+
+    for (i = 0; workers[i]; i++) {
+	fprintf(stderr, "%lu workers, fork-join:\t", workers[i]);
+
+	if (test_pool_fork_join(workers[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+
+	fprintf(stderr, "%lu workers, outside submitters:\t", workers[i]);
+
+	if (test_pool_submitters(workers[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+
+	fprintf(stderr, "%lu workers, set algebra:\t", workers[i]);
+
+	if (test_pool_setops(workers[i])) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    return;
+}
+
+/* [ store-cache ]
+ *
+ * First, the cache on its own: an allocation that's been retired
+ * should come back for the next request of the same size, but not
+ * for one twice the size, and once the cache is released, anything
+ * that comes back to it should just get freed (which ASan will
+ * complain about, if we get it wrong).
+ *
+ * Then, single-threaded bursts through the segmented queues, with
+ * small segments, so that every burst goes through several of
+ * them. The items have to come out in the right order, and, after
+ * the first few bursts, new stores should be coming out of the cache.
+ */
+#define STORE_CACHE_ROUNDS 50
+#define STORE_CACHE_BURST  5000
+
+static bool
+test_store_cache_basic(void)
+{
+    mmm_cache_t *cache;
+    void        *p1;
+    void        *p2;
+    void        *p3;
+    uint64_t     hits;
+    uint64_t     misses;
+    bool         ret;
+
+    cache = mmm_cache_new();
+    ret   = true;
+
+    p1 = mmm_cache_alloc_committed(cache, 4096);
+    memset(p1, 0xff, 4096);
+    mmm_retire_unused(p1);
+
+    p2 = mmm_cache_alloc_committed(cache, 8192);
+    p3 = mmm_cache_alloc_committed(cache, 4096);
+
+    if (p3 != p1 || ((uint8_t *)p3)[100]) {
+	ret = false;
+    }
+
+    mmm_cache_counts(cache, &hits, &misses);
+
+    if (hits != 1 || misses != 2) {
+	ret = false;
+    }
+
+    mmm_retire_unused(p3);
+    mmm_cache_release(cache);
+
+    // The cache is closed; this one gets freed, along with the cache.
+    mmm_retire_unused(p2);
+
+    return ret;
+}
+
+static bool
+test_store_cache_queue(bool use_q64)
+{
+    queue_t  *q;
+    q64_t    *q64;
+    void     *item;
+    uint64_t  round;
+    uint64_t  i;
+    uint64_t  hits;
+    uint64_t  misses;
+    bool      found;
+    bool      ret;
+
+    q   = NULL;
+    q64 = NULL;
+    ret = true;
+
+    if (use_q64) {
+	q64 = q64_new_size(QSIZE_LOG_MIN);
+    }
+    else {
+	q = queue_new_size(QSIZE_LOG_MIN);
+    }
+
+    for (round = 0; round < STORE_CACHE_ROUNDS; round++) {
+	for (i = 1; i <= STORE_CACHE_BURST; i++) {
+	    if (use_q64) {
+		q64_enqueue(q64, (void *)(i << 3));
+	    }
+	    else {
+		queue_enqueue(q, (void *)i);
+	    }
+	}
+
+	for (i = 1; i <= STORE_CACHE_BURST; i++) {
+	    if (use_q64) {
+		item = q64_dequeue(q64, &found);
+		item = (void *)((uint64_t)item >> 3);
+	    }
+	    else {
+		item = queue_dequeue(q, &found);
+	    }
+
+	    if (!found || (uint64_t)item != i) {
+		ret = false;
+	    }
+	}
+    }
+
+    if (use_q64) {
+	mmm_cache_counts(q64->segment_cache, &hits, &misses);
+	q64_delete(q64);
+    }
+    else {
+	mmm_cache_counts(q->segment_cache, &hits, &misses);
+	queue_delete(q);
+    }
+
+    return ret && hits;
+}
+
+static void
+run_store_cache_tests(void)
+{
+    fprintf(stderr, "[[ Test: store-cache ]]\n");
+
+    fprintf(stderr, "basic:\t");
+
+    if (test_store_cache_basic()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr, "queue bursts:\t");
+
+    if (test_store_cache_queue(false)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr, "q64 bursts:\t");
+
+    if (test_store_cache_queue(true)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
+/* [ ring-epochs ]
+ *
+ * hatring and logring used to keep 32-bit epochs, which a busy ring
+ * would wrap in a couple of minutes. We start the rings' epochs just
+ * short of 2^32, and then push items through until we're well past
+ * it, checking that everything comes out in order, with the epoch we
+ * expect. We also overfill a hatring past that point, to make sure
+ * the oldest items get dropped (not the newest), and take a logring
+ * view across it.
+ */
+#define RING_EPOCHS_SIZE   64
+#define RING_EPOCHS_BURST  40
+#define RING_EPOCHS_ROUNDS 100
+#define RING_EPOCHS_START  ((1ULL << 32) - 1000)
+
+static uint64_t ring_epochs_drops;
+
+static void
+ring_epochs_count_drop(void *item)
+{
+    ring_epochs_drops++;
+
+    return;
+}
+
+static bool
+test_ring_epochs_hatring(void)
+{
+    hatring_t *ring;
+    uint64_t   next;
+    uint64_t   epoch;
+    uint64_t   i;
+    uint64_t   j;
+    uint64_t   item;
+    bool       found;
+    bool       ret;
+
+    ring = hatring_new(RING_EPOCHS_SIZE);
+    next = RING_EPOCHS_START;
+    ret  = true;
+
+    hatring_set_epochs(ring, RING_EPOCHS_START);
+
+    for (i = 0; i < RING_EPOCHS_ROUNDS; i++) {
+	for (j = 0; j < RING_EPOCHS_BURST; j++) {
+	    if (hatring_enqueue(ring, (void *)(next + j)) != next + j) {
+		ret = false;
+	    }
+	}
+
+	for (j = 0; j < RING_EPOCHS_BURST; j++) {
+	    item = (uint64_t)hatring_dequeue_w_epoch(ring, &found, &epoch);
+
+	    if (!found || item != next + j || epoch != next + j) {
+		ret = false;
+	    }
+	}
+
+	hatring_dequeue(ring, &found);
+
+	if (found) {
+	    ret = false;
+	}
+
+	next += RING_EPOCHS_BURST;
+    }
+
+    if (next <= (1ULL << 32)) {
+	ret = false;
+    }
+
+    ring_epochs_drops = 0;
+    hatring_set_drop_handler(ring, ring_epochs_count_drop);
+
+    for (j = 0; j < RING_EPOCHS_SIZE + RING_EPOCHS_BURST; j++) {
+	hatring_enqueue(ring, (void *)j);
+    }
+
+    for (j = RING_EPOCHS_BURST; j < RING_EPOCHS_SIZE + RING_EPOCHS_BURST; j++) {
+	item = (uint64_t)hatring_dequeue(ring, &found);
+
+	if (!found || item != j) {
+	    ret = false;
+	}
+    }
+
+    if (ring_epochs_drops != RING_EPOCHS_BURST) {
+	ret = false;
+    }
+
+    hatring_delete(ring);
+
+    return ret;
+}
+
+static bool
+test_ring_epochs_logring(void)
+{
+    logring_t      *ring;
+    logring_view_t *view;
+    uint64_t        next;
+    uint64_t        i;
+    uint64_t        j;
+    uint64_t        msg[2];
+    uint64_t       *viewed;
+    uint64_t        len;
+    bool            ret;
+
+    ring = logring_new(RING_EPOCHS_SIZE, sizeof(msg));
+    next = 0;
+    ret  = true;
+
+    hatring_set_epochs(ring->ring, RING_EPOCHS_START);
+
+    for (i = 0; i < RING_EPOCHS_ROUNDS; i++) {
+	for (j = 0; j < RING_EPOCHS_BURST; j++) {
+	    msg[0] = next + j;
+	    msg[1] = ~(next + j);
+	    logring_enqueue(ring, msg, sizeof(msg));
+	}
+
+	// Every tenth round, look at everything before dequeuing it.
+	if (!(i % 10)) {
+	    view = logring_view(ring, false);
+	    j    = 0;
+
+	    while ((viewed = (uint64_t *)logring_view_next(view, &len))) {
+		if (len != sizeof(msg) || viewed[0] != next + j ||
+		    viewed[1] != ~(next + j)) {
+		    ret = false;
+		}
+		free(viewed);
+		j++;
+	    }
+
+	    if (j != RING_EPOCHS_BURST) {
+		ret = false;
+	    }
+
+	    logring_view_delete(view);
+	}
+
+	for (j = 0; j < RING_EPOCHS_BURST; j++) {
+	    if (!logring_dequeue(ring, msg, &len) || len != sizeof(msg) ||
+		msg[0] != next + j || msg[1] != ~(next + j)) {
+		ret = false;
+	    }
+	}
+
+	if (logring_dequeue(ring, msg, &len)) {
+	    ret = false;
+	}
+
+	next += RING_EPOCHS_BURST;
+    }
+
+    if (atomic_read(&ring->ring->write_epoch) <= (1ULL << 32)) {
+	ret = false;
+    }
+
+    logring_delete(ring);
+
+    return ret;
+}
+
+static void
+run_ring_epochs_tests(void)
+{
+    fprintf(stderr, "[[ Test: ring-epochs ]]\n");
+
+    fprintf(stderr, "hatring past 2^32:\t");
+
+    if (test_ring_epochs_hatring()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr, "logring past 2^32:\t");
+
+    if (test_ring_epochs_logring()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
+/* [ backoff ]
+ *
+ * Runs hq, capq, hatstack and hatring under each backoff strategy,
+ * with more threads than the other queue tests use, so that some
+ * CAS loops actually fail, and checks that every item comes out
+ * exactly once. Then it does the same for u64map's fetch_add, which
+ * takes its strategy from hatrack_backoff_default, like all the hash
+ * tables do.
+ *
+ * The ring is big enough to hold every item, so nothing gets dropped.
+ */
+typedef struct {
+    char  *name;
+    void  *(*new)(const hatrack_backoff_t *);
+    void   (*enqueue)(void *, void *);
+    void  *(*dequeue)(void *, bool *);
+    void   (*delete)(void *);
+} backoff_queue_impl_t;
+
+typedef struct {
+    backoff_queue_impl_t *impl;
+    void                 *q;
+    uint64_t              id;
+    uint64_t              num_threads;
+    _Atomic uint8_t      *seen;
+    _Atomic uint64_t     *remaining;
+    bool                  ok;
+} backoff_test_info_t;
+
+#define BACKOFF_TEST_ITEMS   ((uint64_t)20000)
+#define BACKOFF_TEST_THREADS 16
+#define BACKOFF_TEST_KEYS    16
+
+static void *
+backoff_hq_new(const hatrack_backoff_t *config)
+{
+    hq_t *ret;
+
+    ret = hq_new();
+    hq_set_backoff(ret, config);
+
+    return ret;
+}
+
+static void
+backoff_hq_enqueue(void *q, void *item)
+{
+    hq_enqueue((hq_t *)q, item);
+}
+
+static void *
+backoff_hq_dequeue(void *q, bool *found)
+{
+    return hq_dequeue((hq_t *)q, found);
+}
+
+static void
+backoff_hq_delete(void *q)
+{
+    hq_delete((hq_t *)q);
+}
+
+static void *
+backoff_capq_new(const hatrack_backoff_t *config)
+{
+    capq_t *ret;
+
+    ret = capq_new();
+    capq_set_backoff(ret, config);
+
+    return ret;
+}
+
+static void
+backoff_capq_enqueue(void *q, void *item)
+{
+    capq_enqueue((capq_t *)q, item);
+}
+
+static void *
+backoff_capq_dequeue(void *q, bool *found)
+{
+    return capq_dequeue((capq_t *)q, found);
+}
+
+static void
+backoff_capq_delete(void *q)
+{
+    capq_delete((capq_t *)q);
+}
+
+static void *
+backoff_hatstack_new(const hatrack_backoff_t *config)
+{
+    hatstack_t *ret;
+
+    ret = hatstack_new(128);
+    hatstack_set_backoff(ret, config);
+
+    return ret;
+}
+
+static void
+backoff_hatstack_enqueue(void *q, void *item)
+{
+    hatstack_push((hatstack_t *)q, item);
+}
+
+static void *
+backoff_hatstack_dequeue(void *q, bool *found)
+{
+    return hatstack_pop((hatstack_t *)q, found);
+}
+
+static void
+backoff_hatstack_delete(void *q)
+{
+    hatstack_delete((hatstack_t *)q);
+}
+
+static void *
+backoff_hatring_new(const hatrack_backoff_t *config)
+{
+    hatring_t *ret;
+
+    ret = hatring_new(BACKOFF_TEST_ITEMS);
+    hatring_set_backoff(ret, config);
+
+    return ret;
+}
+
+static void
+backoff_hatring_enqueue(void *q, void *item)
+{
+    hatring_enqueue((hatring_t *)q, item);
+}
+
+static void *
+backoff_hatring_dequeue(void *q, bool *found)
+{
+    return hatring_dequeue((hatring_t *)q, found);
+}
+
+static void
+backoff_hatring_delete(void *q)
+{
+    hatring_delete((hatring_t *)q);
+}
+
+static backoff_queue_impl_t backoff_queues[] = {
+    {"hq", backoff_hq_new, backoff_hq_enqueue, backoff_hq_dequeue,
+     backoff_hq_delete},
+    {"capq", backoff_capq_new, backoff_capq_enqueue, backoff_capq_dequeue,
+     backoff_capq_delete},
+    {"hatstack", backoff_hatstack_new, backoff_hatstack_enqueue,
+     backoff_hatstack_dequeue, backoff_hatstack_delete},
+    {"hatring", backoff_hatring_new, backoff_hatring_enqueue,
+     backoff_hatring_dequeue, backoff_hatring_delete},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static const char *backoff_names[] = {
+    "none", "pause", "spin", "yield", "sleep", NULL
+};
+
+/* Each thread alternates between enqueuing one of its own items and
+ * trying a dequeue, and once it's out of items, keeps dequeuing until
+ * every item has been seen.
+ */
+static void *
+backoff_queue_thread(void *arg)
+{
+    backoff_test_info_t *info;
+    uint64_t             next;
+    uint64_t             item;
+    bool                 found;
+
+    info     = (backoff_test_info_t *)arg;
+    info->ok = true;
+    next     = info->id;
+
+    mmm_register_thread();
+
+    while (atomic_read(info->remaining)) {
+	if (next < BACKOFF_TEST_ITEMS) {
+	    (*info->impl->enqueue)(info->q, (void *)(next + 1));
+	    next += info->num_threads;
+	}
+
+	item = (uint64_t)(*info->impl->dequeue)(info->q, &found);
+
+	if (!found) {
+	    continue;
+	}
+
+	if (!item || item > BACKOFF_TEST_ITEMS
+	    || atomic_fetch_add(&info->seen[item - 1], 1)) {
+	    info->ok = false;
+	}
+
+	atomic_fetch_sub(info->remaining, 1);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_backoff_queue(backoff_queue_impl_t *impl, const hatrack_backoff_t *config)
+{
+    backoff_test_info_t *info;
+    pthread_t           *threads;
+    _Atomic uint8_t     *seen;
+    _Atomic uint64_t     remaining;
+    void                *q;
+    uint64_t             i;
+    bool                 ret;
+
+    q       = (*impl->new)(config);
+    seen    = (_Atomic uint8_t *)calloc(BACKOFF_TEST_ITEMS, sizeof(uint8_t));
+    info    = (backoff_test_info_t *)malloc(sizeof(backoff_test_info_t)
+					    * BACKOFF_TEST_THREADS);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * BACKOFF_TEST_THREADS);
+    ret     = true;
+
+    atomic_store(&remaining, BACKOFF_TEST_ITEMS);
+
+    for (i = 0; i < BACKOFF_TEST_THREADS; i++) {
+	info[i].impl        = impl;
+	info[i].q           = q;
+	info[i].id          = i;
+	info[i].num_threads = BACKOFF_TEST_THREADS;
+	info[i].seen        = seen;
+	info[i].remaining   = &remaining;
+
+	pthread_create(&threads[i], NULL, backoff_queue_thread, &info[i]);
+    }
+
+    for (i = 0; i < BACKOFF_TEST_THREADS; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    for (i = 0; i < BACKOFF_TEST_ITEMS; i++) {
+	if (atomic_read(&seen[i]) != 1) {
+	    ret = false;
+	}
+    }
+
+    (*impl->delete)(q);
+    free(seen);
+    free(info);
+    free(threads);
+
+    return ret;
+}
+
+static void *
+backoff_u64map_thread(void *arg)
+{
+    hatrack_u64map_t *map;
+    uint64_t          i;
+
+    map = (hatrack_u64map_t *)arg;
+
+    mmm_register_thread();
+
+    for (i = 0; i < BACKOFF_TEST_ITEMS; i++) {
+	hatrack_u64map_fetch_add(map, i % BACKOFF_TEST_KEYS, 1);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_backoff_u64map(void)
+{
+    hatrack_u64map_t *map;
+    pthread_t         threads[BACKOFF_TEST_THREADS];
+    uint64_t          i;
+    uint64_t          expected;
+    bool              found;
+    bool              ret;
+
+    map      = hatrack_u64map_new();
+    expected = BACKOFF_TEST_THREADS * BACKOFF_TEST_ITEMS / BACKOFF_TEST_KEYS;
+    ret      = true;
+
+    for (i = 0; i < BACKOFF_TEST_THREADS; i++) {
+	pthread_create(&threads[i], NULL, backoff_u64map_thread, map);
+    }
+
+    for (i = 0; i < BACKOFF_TEST_THREADS; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < BACKOFF_TEST_KEYS; i++) {
+	if (hatrack_u64map_get(map, i, &found) != expected || !found) {
+	    ret = false;
+	}
+    }
+
+    hatrack_u64map_delete(map);
+
+    return ret;
+}
+
+static void
+run_backoff_tests(void)
+{
+    hatrack_backoff_t saved;
+    hatrack_backoff_t config;
+    uint32_t          i;
+    uint32_t          j;
+    bool              ok;
+
+    fprintf(stderr, "[[ Test: backoff ]]\n");
+
+    saved = hatrack_backoff_default;
+
+    for (i = 0; backoff_names[i]; i++) {
+	ok = hatrack_backoff_from_name(&config, backoff_names[i])
+	  && !strcmp(hatrack_backoff_name(&config), backoff_names[i]);
+
+	fprintf(stderr, "%s: name lookup:\t", backoff_names[i]);
+	fprintf(stderr, ok ? "pass\n" : "FAIL\n");
+
+	for (j = 0; backoff_queues[j].name; j++) {
+	    fprintf(stderr,
+		    "%s: %s, %d threads:\t",
+		    backoff_names[i],
+		    backoff_queues[j].name,
+		    BACKOFF_TEST_THREADS);
+
+	    if (test_backoff_queue(&backoff_queues[j], &config)) {
+		fprintf(stderr, "pass\n");
+	    }
+	    else {
+		fprintf(stderr, "FAIL\n");
+	    }
+	}
+
+	hatrack_backoff_set_default(&config);
+
+	fprintf(stderr,
+		"%s: u64map, %d threads:\t",
+		backoff_names[i],
+		BACKOFF_TEST_THREADS);
+
+	if (test_backoff_u64map()) {
+	    fprintf(stderr, "pass\n");
+	}
+	else {
+	    fprintf(stderr, "FAIL\n");
+	}
+    }
+
+    hatrack_backoff_set_default(&saved);
+
+    fprintf(stderr, "unknown name rejected:\t");
+
+    if (!hatrack_backoff_from_name(&config, "bogus")) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
+/* [ logring-inplace ]
+ *
+ * Checks logring_reserve() / logring_commit() and
+ * logring_dequeue_inplace() / logring_release(). Single-threaded, we
+ * mix them with the copying calls, and make sure order and lengths
+ * survive, including a commit that uses less than it reserved, and
+ * that a view sees committed entries. Then producers write in place
+ * while consumers read in place, and every message has to come out
+ * once, intact.
+ */
+#define INPLACE_RING_SIZE   1024
+#define INPLACE_ITEMS       ((uint64_t)40000)
+#define INPLACE_PRODUCERS   4
+#define INPLACE_CONSUMERS   4
+
+typedef struct {
+    logring_t        *ring;
+    uint64_t          id;
+    _Atomic uint8_t  *seen;
+    _Atomic uint64_t *remaining;
+    bool              ok;
+} inplace_test_info_t;
+
+static bool
+test_logring_inplace_basic(void)
+{
+    logring_t      *ring;
+    logring_view_t *view;
+    uint64_t       *msg;
+    uint64_t       *viewed;
+    uint64_t        copy[2];
+    uint64_t        len;
+    uint64_t        i;
+    bool            ret;
+
+    ring = logring_new(LOGRING_MIN_SIZE, sizeof(copy));
+    ret  = true;
+
+    for (i = 0; i < 10; i++) {
+	if (i & 1) {
+	    copy[0] = i;
+	    copy[1] = ~i;
+	    logring_enqueue(ring, copy, sizeof(copy));
+	    continue;
+	}
+
+	msg    = (uint64_t *)logring_reserve(ring, sizeof(copy));
+	msg[0] = i;
+	msg[1] = ~i;
+
+	// Every fourth one only uses half of what it reserved.
+	logring_commit(ring, msg, (i % 4) ? sizeof(copy) : sizeof(uint64_t));
+    }
+
+    view = logring_view(ring, false);
+    i    = 0;
+
+    while ((viewed = (uint64_t *)logring_view_next(view, &len))) {
+	if (viewed[0] != i) {
+	    ret = false;
+	}
+	free(viewed);
+	i++;
+    }
+
+    logring_view_delete(view);
+
+    if (i != 10) {
+	ret = false;
+    }
+
+    for (i = 0; i < 10; i++) {
+	if (i & 1) {
+	    if (!logring_dequeue(ring, copy, &len) || len != sizeof(copy)
+		|| copy[0] != i || copy[1] != ~i) {
+		ret = false;
+	    }
+	    continue;
+	}
+
+	msg = (uint64_t *)logring_dequeue_inplace(ring, &len);
+
+	if (!msg || msg[0] != i) {
+	    ret = false;
+	}
+
+	if ((i % 4) && (len != sizeof(copy) || msg[1] != ~i)) {
+	    ret = false;
+	}
+
+	if (!(i % 4) && len != sizeof(uint64_t)) {
+	    ret = false;
+	}
+
+	if (msg) {
+	    logring_release(ring, msg);
+	}
+    }
+
+    if (logring_dequeue_inplace(ring, &len)) {
+	ret = false;
+    }
+
+    // Every slot should be reusable, now that everything's released.
+    for (i = 0; i < INPLACE_RING_SIZE; i++) {
+	msg    = (uint64_t *)logring_reserve(ring, sizeof(copy));
+	msg[0] = i;
+	logring_commit(ring, msg, sizeof(uint64_t));
+
+	msg = (uint64_t *)logring_dequeue_inplace(ring, &len);
+
+	if (!msg || msg[0] != i) {
+	    ret = false;
+	}
+
+	if (msg) {
+	    logring_release(ring, msg);
+	}
+    }
+
+    logring_delete(ring);
+
+    return ret;
+}
+
+static void *
+inplace_producer(void *arg)
+{
+    inplace_test_info_t *info;
+    uint64_t            *msg;
+    uint64_t             i;
+
+    info = (inplace_test_info_t *)arg;
+
+    mmm_register_thread();
+
+    for (i = info->id; i < INPLACE_ITEMS; i += INPLACE_PRODUCERS) {
+	msg    = (uint64_t *)logring_reserve(info->ring, 2 * sizeof(uint64_t));
+	msg[0] = i;
+	msg[1] = ~i;
+
+	logring_commit(info->ring, msg, 2 * sizeof(uint64_t));
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* The ring is much smaller than the number of messages, so the
+ * producers will overwrite messages the consumers haven't gotten to;
+ * those just never show up. What we check is that nothing shows up
+ * twice, or torn.
+ */
+static void *
+inplace_consumer(void *arg)
+{
+    inplace_test_info_t *info;
+    uint64_t            *msg;
+    uint64_t             len;
+
+    info     = (inplace_test_info_t *)arg;
+    info->ok = true;
+
+    mmm_register_thread();
+
+    while (atomic_read(info->remaining)) {
+	msg = (uint64_t *)logring_dequeue_inplace(info->ring, &len);
+
+	if (!msg) {
+	    continue;
+	}
+
+	if (len != 2 * sizeof(uint64_t) || msg[0] >= INPLACE_ITEMS
+	    || msg[1] != ~msg[0]
+	    || atomic_fetch_add(&info->seen[msg[0]], 1)) {
+	    info->ok = false;
+	}
+
+	logring_release(info->ring, msg);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+test_logring_inplace_parallel(void)
+{
+    logring_t           *ring;
+    inplace_test_info_t  info[INPLACE_PRODUCERS + INPLACE_CONSUMERS];
+    pthread_t            threads[INPLACE_PRODUCERS + INPLACE_CONSUMERS];
+    _Atomic uint8_t     *seen;
+    _Atomic uint64_t     remaining;
+    uint64_t            *msg;
+    uint64_t             len;
+    uint64_t             i;
+    bool                 ret;
+
+    ring = logring_new(INPLACE_RING_SIZE, 2 * sizeof(uint64_t));
+    seen = (_Atomic uint8_t *)calloc(INPLACE_ITEMS, sizeof(uint8_t));
+    ret  = true;
+
+    atomic_store(&remaining, 1);
+
+    for (i = 0; i < INPLACE_PRODUCERS + INPLACE_CONSUMERS; i++) {
+	info[i].ring      = ring;
+	info[i].id        = i;
+	info[i].seen      = seen;
+	info[i].remaining = &remaining;
+	info[i].ok        = true;
+
+	pthread_create(&threads[i],
+		       NULL,
+		       i < INPLACE_PRODUCERS ? inplace_producer
+					     : inplace_consumer,
+		       &info[i]);
+    }
+
+    for (i = 0; i < INPLACE_PRODUCERS; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    atomic_store(&remaining, 0);
+
+    for (; i < INPLACE_PRODUCERS + INPLACE_CONSUMERS; i++) {
+	pthread_join(threads[i], NULL);
+	ret = ret && info[i].ok;
+    }
+
+    // Whatever's left over should still be intact, and unseen.
+    while ((msg = (uint64_t *)logring_dequeue_inplace(ring, &len))) {
+	if (msg[0] >= INPLACE_ITEMS || msg[1] != ~msg[0]
+	    || atomic_fetch_add(&seen[msg[0]], 1)) {
+	    ret = false;
+	}
+
+	logring_release(ring, msg);
+    }
+
+    logring_delete(ring);
+    free(seen);
+
+    return ret;
+}
+
+static void
+run_logring_inplace_tests(void)
+{
+    fprintf(stderr, "[[ Test: logring-inplace ]]\n");
+
+    fprintf(stderr, "single-threaded:\t");
+
+    if (test_logring_inplace_basic()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr,
+	    "%d producers, %d consumers:\t",
+	    INPLACE_PRODUCERS,
+	    INPLACE_CONSUMERS);
+
+    if (test_logring_inplace_parallel()) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
+/* [ counters ]
+ *
+ * Checks hatrack_counters_export(). With counters compiled in, we
+ * export in each format, bump one counter, export again, and check
+ * that the output is well-formed, lists every counter, and that the
+ * one we bumped went up by exactly one (nothing else in the test
+ * touches "stores shrunk"). With counters compiled out, the export
+ * has to fail, instead of quietly writing nothing.
+ */
+#ifdef HATRACK_COUNTERS
+static char *
+counters_export_text(hatrack_counters_format_t format)
+{
+    FILE *f;
+    char *buf;
+    long  len;
+
+    f = tmpfile();
+
+    if (!f) {
+	return NULL;
+    }
+
+    if (hatrack_counters_export(fileno(f), format)) {
+	fclose(f);
+	return NULL;
+    }
+
+    len = lseek(fileno(f), 0, SEEK_END);
+    buf = (char *)calloc(1, len + 1);
+
+    if (pread(fileno(f), buf, len, 0) != len) {
+	free(buf);
+	buf = NULL;
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+/* Returns the value exported for the given counter name, or -1 if
+ * it isn't there.
+ */
+static int64_t
+counters_export_value(char *text, char *name, hatrack_counters_format_t format)
+{
+    char  key[128];
+    char *p;
+
+    if (format == HATRACK_COUNTERS_JSON) {
+	snprintf(key, sizeof(key), "\"%s\": ", name);
+    }
+    else {
+	snprintf(key, sizeof(key), "{counter=\"%s\"} ", name);
+    }
+
+    p = strstr(text, key);
+
+    if (!p) {
+	return -1;
+    }
+
+    return strtoll(p + strlen(key), NULL, 10);
+}
+
+static bool
+counters_export_wellformed(char *text, hatrack_counters_format_t format)
+{
+    uint64_t i;
+    uint64_t lines;
+    int64_t  depth;
+    char    *p;
+
+    if (format == HATRACK_COUNTERS_JSON) {
+	if (strncmp(text, "{\n  \"counters\": {", 17)
+	    || !strstr(text, "\n  \"yn_counters\": {")) {
+	    return false;
+	}
+
+	depth = 0;
+
+	for (p = text; *p; p++) {
+	    if (*p == '{') {
+		depth++;
+	    }
+	    if (*p == '}' && --depth < 0) {
+		return false;
+	    }
+	}
+
+	if (depth || strcmp(p - 2, "}\n")) {
+	    return false;
+	}
+    }
+    else {
+	if (strncmp(text, "# TYPE hatrack_events_total counter\n", 36)
+	    || !strstr(text, "\n# TYPE hatrack_cas_total counter\n")) {
+	    return false;
+	}
+
+	lines = 0;
+
+	for (p = text; *p; p++) {
+	    if (*p == '\n') {
+		lines++;
+	    }
+	}
+
+	if (lines != 2 + HATRACK_COUNTERS_NUM + 2 * HATRACK_YN_COUNTERS_NUM) {
+	    return false;
+	}
+    }
+
+    for (i = 0; i < HATRACK_COUNTERS_NUM; i++) {
+	if (counters_export_value(text, hatrack_counter_names[i], format) < 0) {
+	    return false;
+	}
+    }
+
+    for (i = 0; i < HATRACK_YN_COUNTERS_NUM; i++) {
+	if (!strstr(text, hatrack_yn_counter_names[i])) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+static bool
+test_counters_export(hatrack_counters_format_t format)
+{
+    char   *before;
+    char   *after;
+    int64_t old_value;
+    int64_t new_value;
+    bool    ret;
+
+    before = counters_export_text(format);
+
+    HATRACK_CTR(HATRACK_CTR_STORE_SHRINK);
+
+    after = counters_export_text(format);
+    ret   = false;
+
+    if (!before || !after) {
+	goto finished;
+    }
+
+    if (!counters_export_wellformed(before, format)
+	|| !counters_export_wellformed(after, format)) {
+	goto finished;
+    }
+
+    old_value = counters_export_value(before, "stores shrunk", format);
+    new_value = counters_export_value(after, "stores shrunk", format);
+    ret       = (old_value >= 0 && new_value == old_value + 1);
+
+finished:
+    free(before);
+    free(after);
+
+    return ret;
+}
+#else
+static bool
+test_counters_export(hatrack_counters_format_t format)
+{
+    errno = 0;
+
+    return hatrack_counters_export(STDERR_FILENO, format) == -1
+	&& errno == ENOTSUP;
+}
+#endif
+
+static void
+run_counters_export_tests(void)
+{
+    fprintf(stderr, "[[ Test: counters ]]\n");
+    fprintf(stderr, "%10s:\t", "prometheus");
+
+    if (test_counters_export(HATRACK_COUNTERS_PROMETHEUS)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    fprintf(stderr, "%10s:\t", "json");
+
+    if (test_counters_export(HATRACK_COUNTERS_JSON)) {
+	fprintf(stderr, "pass\n");
+    }
+    else {
+	fprintf(stderr, "FAIL\n");
+    }
+
+    return;
+}
+
 void
 run_functional_tests(config_info_t *config)
 {
@@ -467,6 +5867,54 @@ run_functional_tests(config_info_t *config)
 		  basic_sizes,
                   multiple_threads);
     counters_output_delta();
+    run_backend_tests();
+    counters_output_delta();
+    run_change_feed_tests();
+    counters_output_delta();
+    run_sharded_dict_tests();
+    counters_output_delta();
+    run_miss_filter_tests();
+    counters_output_delta();
+    run_stats_tests();
+    counters_output_delta();
+    run_set_algebra_tests();
+    counters_output_delta();
+    run_bitset_tests();
+    counters_output_delta();
+    run_woolhat_pool_tests();
+    counters_output_delta();
+    run_omap_tests();
+    counters_output_delta();
+    run_u64map_tests();
+    counters_output_delta();
+    run_tophat_adaptive_tests();
+    counters_output_delta();
+    run_cloche_tests();
+    counters_output_delta();
+    run_hq_batch_tests();
+    counters_output_delta();
+    run_queue_wait_tests();
+    counters_output_delta();
+    run_hq_bounded_tests();
+    counters_output_delta();
+    run_hq_sc_tests();
+    counters_output_delta();
+    run_skipq_tests();
+    counters_output_delta();
+    run_wsdeque_tests();
+    counters_output_delta();
+    run_pool_tests();
+    counters_output_delta();
+    run_store_cache_tests();
+    counters_output_delta();
+    run_ring_epochs_tests();
+    counters_output_delta();
+    run_backoff_tests();
+    counters_output_delta();
+    run_logring_inplace_tests();
+    counters_output_delta();
+    run_counters_export_tests();
+    counters_output_delta();
     
     return;
 }
@@ -78,6 +78,18 @@ static struct timespec stop_times[HATRACK_THREADS_MAX];
 
 #define calculate_num_test_keys(n) hatrack_round_up_to_power_of_2(n)
 
+/* Crown's bucket layout is picked at compile time (see
+ * HATRACK_CROWN_SOA), so we can't run both layouts side by side.
+ * Instead, we print which one we've got next to crown's results;
+ * build once each way, and compare the numbers from the "layout"
+ * tests in default.c.
+ */
+#ifdef HATRACK_CROWN_SOA
+#define CROWN_LAYOUT_NAME "arrays"
+#else
+#define CROWN_LAYOUT_NAME "buckets"
+#endif
+
 // Internal enumeration used for the op distribution.
 enum
 {
@@ -583,13 +595,19 @@ performance_report(char *hat, benchmark_t *config, struct timespec *start)
     }
 
     fprintf(stderr,
-            "%10s time: %.4f sec (fastest: %.4f, avg: %.4f); MOps/sec: %.3f\n",
+            "%10s time: %.4f sec (fastest: %.4f, avg: %.4f); MOps/sec: %.3f",
             hat,
             max,
             min,
             max / config->num_threads,
             (((double)config->total_ops) / (max * 1000000)));
 
+    if (!strcmp(hat, "crown")) {
+        fprintf(stderr, " (layout: %s)", CROWN_LAYOUT_NAME);
+    }
+
+    fputc('\n', stderr);
+
     return;
 }
 
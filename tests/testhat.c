@@ -363,6 +363,32 @@ hatrack_vtable_t thcwf_vtable = {
     .view    = (hatrack_view_func)tophat_view
 };
 
+hatrack_vtable_t thflf_vtable = {
+    .init    = (hatrack_init_func)tophat_init_fast_lf,
+    .init_sz = (hatrack_init_sz_func)tophat_init_fast_lf_size,    
+    .get     = (hatrack_get_func)tophat_get,
+    .put     = (hatrack_put_func)tophat_put,
+    .replace = (hatrack_replace_func)tophat_replace,    
+    .add     = (hatrack_add_func)tophat_add,
+    .remove  = (hatrack_remove_func)tophat_remove,
+    .delete  = (hatrack_delete_func)tophat_delete,
+    .len     = (hatrack_len_func)tophat_len,
+    .view    = (hatrack_view_func)tophat_view
+};
+
+hatrack_vtable_t thfhs_vtable = {
+    .init    = (hatrack_init_func)tophat_init_fast_hs,
+    .init_sz = (hatrack_init_sz_func)tophat_init_fast_hs_size,    
+    .get     = (hatrack_get_func)tophat_get,
+    .put     = (hatrack_put_func)tophat_put,
+    .replace = (hatrack_replace_func)tophat_replace,    
+    .add     = (hatrack_add_func)tophat_add,
+    .remove  = (hatrack_remove_func)tophat_remove,
+    .delete  = (hatrack_delete_func)tophat_delete,
+    .len     = (hatrack_len_func)tophat_len,
+    .view    = (hatrack_view_func)tophat_view
+};
+
 hatrack_vtable_t crown_vtable = {
     .init    = (hatrack_init_func)crown_init,
     .init_sz = (hatrack_init_sz_func)crown_init_size,    
@@ -389,6 +415,168 @@ hatrack_vtable_t tiara_vtable = {
     .view    = (hatrack_view_func)tiara_view
 };
 
+/* hatrack_omap isn't a hash table, and has a dict-style interface,
+ * so it needs a bit of glue. Like tiara, it takes 64-bit keys, which
+ * the harness takes from the first 8 bytes of the hash value, and it
+ * treats the harness's items as values. The write operations return
+ * nothing useful, which the harness doesn't mind.
+ */
+static void
+omap_th_init(hatrack_omap_t *self)
+{
+    hatrack_omap_init(self, HATRACK_DICT_KEY_TYPE_INT);
+}
+
+static void
+omap_th_init_size(hatrack_omap_t *self, char size)
+{
+    hatrack_omap_init(self, HATRACK_DICT_KEY_TYPE_INT);
+}
+
+static void *
+omap_th_get(hatrack_omap_t *self, uint64_t key)
+{
+    return hatrack_omap_get(self, (void *)key, NULL);
+}
+
+static void *
+omap_th_put(hatrack_omap_t *self, uint64_t key, void *item)
+{
+    hatrack_omap_put(self, (void *)key, item);
+
+    return NULL;
+}
+
+static void *
+omap_th_replace(hatrack_omap_t *self, uint64_t key, void *item)
+{
+    hatrack_omap_replace(self, (void *)key, item);
+
+    return NULL;
+}
+
+static bool
+omap_th_add(hatrack_omap_t *self, uint64_t key, void *item)
+{
+    return hatrack_omap_add(self, (void *)key, item);
+}
+
+static void *
+omap_th_remove(hatrack_omap_t *self, uint64_t key)
+{
+    hatrack_omap_remove(self, (void *)key);
+
+    return NULL;
+}
+
+hatrack_vtable_t omap_vtable = {
+    .init    = (hatrack_init_func)omap_th_init,
+    .init_sz = (hatrack_init_sz_func)omap_th_init_size,
+    .get     = (hatrack_get_func)omap_th_get,
+    .put     = (hatrack_put_func)omap_th_put,
+    .replace = (hatrack_replace_func)omap_th_replace,
+    .add     = (hatrack_add_func)omap_th_add,
+    .remove  = (hatrack_remove_func)omap_th_remove,
+    .delete  = (hatrack_delete_func)hatrack_omap_delete,
+    .len     = (hatrack_len_func)hatrack_omap_len,
+    .view    = (hatrack_view_func)hatrack_omap_view
+};
+
+/* hatrack_u64map stores integers, not pointers, but the harness's
+ * items fit in its 60-bit values. It has no replace operation, so we
+ * fake one with a get and a put, which is fine for timing, but isn't
+ * atomic. And its items come back as key / value pairs, so we convert
+ * them to the harness's view format.
+ */
+static void *
+u64map_th_get(hatrack_u64map_t *self, uint64_t key)
+{
+    return (void *)hatrack_u64map_get(self, key, NULL);
+}
+
+static void *
+u64map_th_put(hatrack_u64map_t *self, uint64_t key, void *item)
+{
+    return (void *)hatrack_u64map_put(self, key, (uint64_t)item, NULL);
+}
+
+static void *
+u64map_th_replace(hatrack_u64map_t *self, uint64_t key, void *item)
+{
+    bool found;
+
+    hatrack_u64map_get(self, key, &found);
+
+    if (!found) {
+	return NULL;
+    }
+
+    return (void *)hatrack_u64map_put(self, key, (uint64_t)item, NULL);
+}
+
+static bool
+u64map_th_add(hatrack_u64map_t *self, uint64_t key, void *item)
+{
+    return hatrack_u64map_add(self, key, (uint64_t)item);
+}
+
+static void *
+u64map_th_remove(hatrack_u64map_t *self, uint64_t key)
+{
+    return (void *)hatrack_u64map_remove(self, key, NULL);
+}
+
+static hatrack_view_t *
+u64map_th_view(hatrack_u64map_t *self, uint64_t *num, bool sort)
+{
+    hatrack_u64map_item_t *items;
+    hatrack_view_t        *view;
+    uint64_t               i;
+
+    items = hatrack_u64map_items(self, num);
+
+    if (!items) {
+	return NULL;
+    }
+
+    view = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * *num);
+
+    for (i = 0; i < *num; i++) {
+	view[i].item       = (void *)items[i].value;
+	view[i].sort_epoch = 0;
+    }
+
+    free(items);
+
+    return view;
+}
+
+hatrack_vtable_t cloche_vtable = {
+    .init    = (hatrack_init_func)cloche_init,
+    .init_sz = (hatrack_init_sz_func)cloche_init_size,
+    .get     = (hatrack_get_func)cloche_get,
+    .put     = (hatrack_put_func)cloche_put,
+    .replace = (hatrack_replace_func)cloche_replace,
+    .add     = (hatrack_add_func)cloche_add,
+    .remove  = (hatrack_remove_func)cloche_remove,
+    .delete  = (hatrack_delete_func)cloche_delete,
+    .len     = (hatrack_len_func)cloche_len,
+    .view    = (hatrack_view_func)cloche_view
+};
+
+hatrack_vtable_t u64map_vtable = {
+    .init    = (hatrack_init_func)hatrack_u64map_init,
+    .init_sz = (hatrack_init_sz_func)hatrack_u64map_init_size,
+    .get     = (hatrack_get_func)u64map_th_get,
+    .put     = (hatrack_put_func)u64map_th_put,
+    .replace = (hatrack_replace_func)u64map_th_replace,
+    .add     = (hatrack_add_func)u64map_th_add,
+    .remove  = (hatrack_remove_func)u64map_th_remove,
+    .delete  = (hatrack_delete_func)hatrack_u64map_delete,
+    .len     = (hatrack_len_func)hatrack_u64map_len,
+    .view    = (hatrack_view_func)u64map_th_view
+};
+
 // clang-format on
 
 static void
@@ -411,6 +599,11 @@ testhat_init_default_algorithms(void)
     algorithm_register("tophat-fwf", &thfwf_vtable, sizeof(tophat_t), 16, true);
     algorithm_register("tophat-cmx", &thcmx_vtable, sizeof(tophat_t), 16, true);
     algorithm_register("tophat-cwf", &thcwf_vtable, sizeof(tophat_t), 16, true);
+    algorithm_register("tophat-flf", &thflf_vtable, sizeof(tophat_t), 16, true);
+    algorithm_register("tophat-fhs", &thfhs_vtable, sizeof(tophat_t), 16, true);
+    algorithm_register("cloche", &cloche_vtable, sizeof(cloche_t), 16, true);
     algorithm_register("tiara", &tiara_vtable, sizeof(tiara_t), 8, true);
+    algorithm_register("omap", &omap_vtable, sizeof(hatrack_omap_t), 8, true);
+    algorithm_register("u64map", &u64map_vtable, sizeof(hatrack_u64map_t), 8, true);
     return;
 }